@@ -0,0 +1,598 @@
+/*
+ *  kernelbench.cpp
+ *  BEAGLE
+ *
+ *  Times individual likelihood kernels in isolation on every CPU
+ *  implementation that can be instantiated (generic/SSE/AVX, 4-state and
+ *  general state count, single and double precision, with and without
+ *  C++ threading), swept over state, pattern and category counts.
+ *  Results are written as CSV or JSON for regression tracking.
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "libhmsbeagle/beagle.h"
+
+#define GT_RAND_MAX 0x7fffffff
+
+// Buffer layout shared by every benchmark instance
+#define KB_TIP_COUNT            4   // tips 0,1 are compact states, tips 2,3 are partials
+#define KB_COMPACT_COUNT        2
+#define KB_PARTIALS_COUNT       14  // 2 tip partials + 8 post-order + 4 pre-order buffers
+#define KB_MATRIX_COUNT         6   // 4 transition matrices + first and second derivatives
+#define KB_SCALE_COUNT          3   // 2 written by operations + 1 cumulative
+#define KB_FIRST_DERIV_MATRIX   4
+#define KB_SECOND_DERIV_MATRIX  5
+#define KB_PRE_ROOT_BUFFER      12
+#define KB_CUMULATIVE_SCALE     2
+#define KB_MISSING_RUN_LENGTH   32  // patterns per run of missing data with --missing
+
+struct BenchConfig {
+    std::vector<int> stateCounts;
+    std::vector<int> patternCounts;
+    std::vector<int> categoryCounts;
+    int reps;
+    int threadCount;
+    int resource;
+    int missingPercent;
+    bool genericStates;
+    bool json;
+    bool threaded;
+    bool unthreaded;
+    std::string outFile;
+};
+
+struct BenchVariant {
+    const char* label;
+    long vectorFlag;
+    long precisionFlag;
+    bool threaded;
+};
+
+struct BenchResult {
+    std::string implName;
+    std::string variant;
+    std::string kernel;
+    int stateCount;
+    int patternCount;
+    int categoryCount;
+    int threads;
+    double bestMs;
+    double meanMs;
+    double gflops;
+};
+
+static unsigned int rand_state = 1;
+
+int gt_rand() {
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state % ((unsigned int)GT_RAND_MAX + 1));
+}
+
+double gt_rand_unit() {
+    return (double) gt_rand() / (double) GT_RAND_MAX;
+}
+
+/*
+ * Eigen decomposition of the equal-rates (Jukes-Cantor type) generator for an arbitrary
+ * state count. The eigenvectors are the rows of the orthonormal Helmert matrix, so the
+ * inverse is simply the transpose.
+ */
+void makeEqualRatesEigenSystem(int stateCount,
+                               std::vector<double>& evec,
+                               std::vector<double>& ivec,
+                               std::vector<double>& eval) {
+    const int n = stateCount;
+    std::vector<double> helmert(n * n, 0.0);
+    for (int j = 0; j < n; j++)
+        helmert[j] = 1.0 / sqrt((double) n);
+    for (int k = 1; k < n; k++) {
+        double norm = 1.0 / sqrt((double) k * (k + 1));
+        for (int j = 0; j < k; j++)
+            helmert[k * n + j] = norm;
+        helmert[k * n + k] = -k * norm;
+    }
+
+    evec.assign(n * n, 0.0);
+    ivec.assign(n * n, 0.0);
+    eval.assign(n, -((double) n) / (n - 1));
+    eval[0] = 0.0;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            evec[i * n + j] = helmert[j * n + i];
+            ivec[i * n + j] = helmert[i * n + j];
+        }
+    }
+}
+
+double getTimeDiff(std::chrono::steady_clock::time_point t1,
+                   std::chrono::steady_clock::time_point t2) {
+    return std::chrono::duration<double, std::milli>(t2 - t1).count();
+}
+
+/*
+ * Floating-point operation estimates per call, used for the GFLOPS column. These
+ * count the dominant inner products only and ignore scaling and log evaluations.
+ */
+double kernelFlops(const std::string& kernel, int s, int p, int c) {
+    double spc = (double) s * p * c;
+    if (kernel == "states_states")
+        return spc;
+    if (kernel == "states_partials")
+        return spc * (2.0 * s + 1.0);
+    if (kernel == "partials_partials" || kernel == "partials_partials_rescale" ||
+        kernel == "pre_partials")
+        return spc * (4.0 * s + 1.0);
+    if (kernel == "rescale" || kernel == "accumulate_scale")
+        return spc;
+    if (kernel == "matrix_update")
+        return 4.0 * 2.0 * s * s * s * c;
+    if (kernel == "matrix_update_derivatives")
+        return 4.0 * 2.0 * s * s * s * c * 3.0;
+    if (kernel == "root")
+        return spc * 2.0;
+    if (kernel == "edge")
+        return spc * (2.0 * s + 2.0);
+    if (kernel == "edge_derivatives")
+        return spc * (6.0 * s + 6.0);
+    if (kernel == "edge_gradient" || kernel == "cross_products")
+        return spc * (2.0 * s * s + 2.0 * s);
+    return 0.0;
+}
+
+template <typename F>
+void timeKernel(F kernel,
+                int reps,
+                double* bestMs,
+                double* meanMs) {
+    kernel(); // warm-up
+    double total = 0.0;
+    double best = 0.0;
+    for (int r = 0; r < reps; r++) {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        kernel();
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        double elapsed = getTimeDiff(t0, t1);
+        total += elapsed;
+        if (r == 0 || elapsed < best)
+            best = elapsed;
+    }
+    *bestMs = best;
+    *meanMs = total / reps;
+}
+
+int createBenchInstance(const BenchConfig& config,
+                        const BenchVariant& variant,
+                        int stateCount,
+                        int patternCount,
+                        int categoryCount,
+                        BeagleInstanceDetails* instDetails) {
+    long preferenceFlags = BEAGLE_FLAG_SCALERS_RAW;
+    long requirementFlags = BEAGLE_FLAG_PROCESSOR_CPU |
+                            BEAGLE_FLAG_EIGEN_REAL |
+                            variant.vectorFlag |
+                            variant.precisionFlag;
+    if (variant.threaded)
+        preferenceFlags |= BEAGLE_FLAG_THREADING_CPP;
+    else
+        requirementFlags |= BEAGLE_FLAG_THREADING_NONE;
+
+    int resource = config.resource;
+    return beagleCreateInstance(KB_TIP_COUNT,
+                                KB_PARTIALS_COUNT,
+                                KB_COMPACT_COUNT,
+                                stateCount,
+                                patternCount,
+                                1,
+                                KB_MATRIX_COUNT,
+                                categoryCount,
+                                KB_SCALE_COUNT,
+                                (resource >= 0 ? &resource : NULL),
+                                (resource >= 0 ? 1 : 0),
+                                preferenceFlags,
+                                requirementFlags,
+                                instDetails);
+}
+
+/*
+ * Random tips; with missingPercent, that share of runs of KB_MISSING_RUN_LENGTH patterns is
+ * missing from every tip, as in concatenated loci not sequenced for some taxa.
+ */
+void setupInstance(int instance,
+                   int stateCount,
+                   int patternCount,
+                   int categoryCount,
+                   int missingPercent) {
+    std::vector<bool> missing(patternCount, false);
+    if (missingPercent > 0) {
+        for (int k = 0; k < patternCount; k += KB_MISSING_RUN_LENGTH) {
+            bool run = (gt_rand() % 100 < missingPercent);
+            for (int j = k; j < std::min(k + KB_MISSING_RUN_LENGTH, patternCount); j++)
+                missing[j] = run;
+        }
+    }
+
+    std::vector<int> states(patternCount);
+    for (int t = 0; t < KB_COMPACT_COUNT; t++) {
+        for (int k = 0; k < patternCount; k++)
+            states[k] = (missing[k] ? stateCount : gt_rand() % stateCount);
+        beagleSetTipStates(instance, t, states.data());
+    }
+
+    std::vector<double> partials(patternCount * stateCount);
+    for (int t = KB_COMPACT_COUNT; t < KB_TIP_COUNT; t++) {
+        for (int k = 0; k < patternCount * stateCount; k++)
+            partials[k] = (missing[k / stateCount] ? 1.0 : gt_rand_unit());
+        beagleSetTipPartials(instance, t, partials.data());
+    }
+
+    std::vector<double> rates(categoryCount);
+    std::vector<double> weights(categoryCount);
+    for (int c = 0; c < categoryCount; c++) {
+        rates[c] = 2.0 * (c + 1) / (categoryCount + 1);
+        weights[c] = 1.0 / categoryCount;
+    }
+    beagleSetCategoryRates(instance, rates.data());
+    beagleSetCategoryWeights(instance, 0, weights.data());
+
+    std::vector<double> freqs(stateCount, 1.0 / stateCount);
+    beagleSetStateFrequencies(instance, 0, freqs.data());
+
+    std::vector<double> patternWeights(patternCount, 1.0);
+    beagleSetPatternWeights(instance, patternWeights.data());
+
+    std::vector<double> evec, ivec, eval;
+    makeEqualRatesEigenSystem(stateCount, evec, ivec, eval);
+    beagleSetEigenDecomposition(instance, 0, evec.data(), ivec.data(), eval.data());
+
+    std::vector<double> preRoot(patternCount * stateCount * categoryCount, 1.0 / stateCount);
+    beagleSetPartials(instance, KB_PRE_ROOT_BUFFER, preRoot.data());
+}
+
+void benchmarkShape(const BenchConfig& config,
+                    const BenchVariant& variant,
+                    int stateCount,
+                    int patternCount,
+                    int categoryCount,
+                    std::vector<BenchResult>& results) {
+    BeagleInstanceDetails instDetails;
+    int instance = createBenchInstance(config, variant, stateCount, patternCount,
+                                       categoryCount, &instDetails);
+    if (instance < 0)
+        return;
+
+    // Requested vector or threading flags may be silently downgraded by the factory;
+    // only report variants that were honoured.
+    if ((variant.vectorFlag & ~instDetails.flags) ||
+        (variant.threaded && !(instDetails.flags & BEAGLE_FLAG_THREADING_CPP))) {
+        beagleFinalizeInstance(instance);
+        return;
+    }
+
+    int threads = 1;
+    if (variant.threaded) {
+        threads = config.threadCount;
+        beagleSetCPUThreadCount(instance, threads);
+    }
+
+    setupInstance(instance, stateCount, patternCount, categoryCount, config.missingPercent);
+
+    std::string variantLabel = variant.label;
+    if (config.missingPercent > 0)
+        variantLabel += "-missing" + std::to_string(config.missingPercent);
+
+    int probIndices[4] = { 0, 1, 2, 3 };
+    double edgeLengths[4] = { 0.05, 0.1, 0.2, 0.4 };
+    int firstDerivIndex = KB_FIRST_DERIV_MATRIX;
+    int secondDerivIndex = KB_SECOND_DERIV_MATRIX;
+
+    // [dest, destScaleWrite, destScaleRead, child1, matrix1, child2, matrix2]
+    BeagleOperation opStatesStates        = { 4, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 0, 0, 1, 1 };
+    BeagleOperation opStatesPartials      = { 5, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 0, 0, 2, 1 };
+    BeagleOperation opPartialsPartials    = { 6, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 2, 2, 3, 3 };
+    BeagleOperation opPartialsRescale     = { 7, 0,              BEAGLE_OP_NONE, 5, 0, 6, 1 };
+    BeagleOperation opPrePartials         = { 13, BEAGLE_OP_NONE, BEAGLE_OP_NONE,
+                                              KB_PRE_ROOT_BUFFER, 0, 5, 1 };
+
+    beagleUpdateTransitionMatrices(instance, 0, probIndices, NULL, NULL, edgeLengths, 4);
+    beagleUpdateTransitionMatrices(instance, 0, probIndices, &firstDerivIndex, &secondDerivIndex,
+                                   edgeLengths, 1);
+    BeagleOperation setup[4] = { opStatesStates, opStatesPartials, opPartialsPartials,
+                                 opPartialsRescale };
+    beagleUpdatePartials(instance, setup, 4, BEAGLE_OP_NONE);
+    beagleUpdatePrePartials(instance, &opPrePartials, 1, BEAGLE_OP_NONE);
+
+    int rootIndex = 6;
+    int parentIndex = 6;
+    int childIndex = 5;
+    int postIndex = 6;
+    int preIndex = 13;
+    int weightsIndex = 0;
+    int freqsIndex = 0;
+    int noScale = BEAGLE_OP_NONE;
+    int scaleIndex = 0;
+    double logL = 0.0, d1 = 0.0, d2 = 0.0;
+    std::vector<double> siteDerivatives(patternCount);
+    std::vector<double> crossProducts(stateCount * stateCount * categoryCount);
+
+    struct KernelEntry {
+        const char* name;
+        std::function<void()> run;
+    };
+
+    std::vector<KernelEntry> kernels = {
+        { "states_states", [&]() {
+            beagleUpdatePartials(instance, &opStatesStates, 1, BEAGLE_OP_NONE); } },
+        { "states_partials", [&]() {
+            beagleUpdatePartials(instance, &opStatesPartials, 1, BEAGLE_OP_NONE); } },
+        { "partials_partials", [&]() {
+            beagleUpdatePartials(instance, &opPartialsPartials, 1, BEAGLE_OP_NONE); } },
+        { "partials_partials_rescale", [&]() {
+            beagleUpdatePartials(instance, &opPartialsRescale, 1, BEAGLE_OP_NONE); } },
+        { "accumulate_scale", [&]() {
+            beagleResetScaleFactors(instance, KB_CUMULATIVE_SCALE);
+            beagleAccumulateScaleFactors(instance, &scaleIndex, 1, KB_CUMULATIVE_SCALE); } },
+        { "matrix_update", [&]() {
+            beagleUpdateTransitionMatrices(instance, 0, probIndices, NULL, NULL, edgeLengths, 4); } },
+        { "matrix_update_derivatives", [&]() {
+            beagleUpdateTransitionMatrices(instance, 0, probIndices, &firstDerivIndex,
+                                           &secondDerivIndex, edgeLengths, 1); } },
+        { "root", [&]() {
+            beagleCalculateRootLogLikelihoods(instance, &rootIndex, &weightsIndex, &freqsIndex,
+                                              &noScale, 1, &logL); } },
+        { "edge", [&]() {
+            beagleCalculateEdgeLogLikelihoods(instance, &parentIndex, &childIndex, probIndices,
+                                              NULL, NULL, &weightsIndex, &freqsIndex, &noScale, 1,
+                                              &logL, NULL, NULL); } },
+        { "edge_derivatives", [&]() {
+            beagleCalculateEdgeLogLikelihoods(instance, &parentIndex, &childIndex, probIndices,
+                                              &firstDerivIndex, &secondDerivIndex, &weightsIndex,
+                                              &freqsIndex, &noScale, 1, &logL, &d1, &d2); } },
+        { "pre_partials", [&]() {
+            beagleUpdatePrePartials(instance, &opPrePartials, 1, BEAGLE_OP_NONE); } },
+        { "edge_gradient", [&]() {
+            beagleCalculateEdgeDerivatives(instance, &postIndex, &preIndex, &firstDerivIndex,
+                                           &weightsIndex, 1, siteDerivatives.data(), &d1, NULL); } },
+        { "cross_products", [&]() {
+            std::fill(crossProducts.begin(), crossProducts.end(), 0.0);
+            beagleCalculateCrossProductDerivative(instance, &postIndex, &preIndex, &weightsIndex,
+                                                  &weightsIndex, edgeLengths, 1,
+                                                  crossProducts.data(), NULL); } },
+    };
+
+    double unscaledBest = 0.0, unscaledMean = 0.0;
+    for (size_t i = 0; i < kernels.size(); i++) {
+        BenchResult result;
+        result.implName = instDetails.implName;
+        result.variant = variantLabel;
+        result.kernel = kernels[i].name;
+        result.stateCount = stateCount;
+        result.patternCount = patternCount;
+        result.categoryCount = categoryCount;
+        result.threads = threads;
+        timeKernel(kernels[i].run, config.reps, &result.bestMs, &result.meanMs);
+        result.gflops = (result.bestMs > 0.0) ?
+                kernelFlops(result.kernel, stateCount, patternCount, categoryCount) /
+                (result.bestMs * 1.0e6) : 0.0;
+        results.push_back(result);
+
+        if (result.kernel == "partials_partials") {
+            unscaledBest = result.bestMs;
+            unscaledMean = result.meanMs;
+        } else if (result.kernel == "partials_partials_rescale") {
+            // rescaling cost is reported as the overhead over the unscaled kernel
+            BenchResult rescale = result;
+            rescale.kernel = "rescale";
+            rescale.bestMs = std::max(0.0, result.bestMs - unscaledBest);
+            rescale.meanMs = std::max(0.0, result.meanMs - unscaledMean);
+            rescale.gflops = (rescale.bestMs > 0.0) ?
+                    kernelFlops(rescale.kernel, stateCount, patternCount, categoryCount) /
+                    (rescale.bestMs * 1.0e6) : 0.0;
+            results.push_back(rescale);
+        }
+    }
+
+    beagleFinalizeInstance(instance);
+}
+
+void writeCSV(std::ostream& out,
+              const std::vector<BenchResult>& results) {
+    out << "impl,variant,kernel,states,patterns,categories,threads,best_ms,mean_ms,gflops\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << r.implName << "," << r.variant << "," << r.kernel << ","
+            << r.stateCount << "," << r.patternCount << "," << r.categoryCount << ","
+            << r.threads << "," << r.bestMs << "," << r.meanMs << "," << r.gflops << "\n";
+    }
+}
+
+void writeJSON(std::ostream& out,
+               const std::vector<BenchResult>& results) {
+    out << "{\n  \"version\": \"" << beagleGetVersion() << "\",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << "    {\"impl\": \"" << r.implName << "\", \"variant\": \"" << r.variant
+            << "\", \"kernel\": \"" << r.kernel << "\", \"states\": " << r.stateCount
+            << ", \"patterns\": " << r.patternCount << ", \"categories\": " << r.categoryCount
+            << ", \"threads\": " << r.threads << ", \"best_ms\": " << r.bestMs
+            << ", \"mean_ms\": " << r.meanMs << ", \"gflops\": " << r.gflops << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+void helpMessage() {
+    std::cerr << "Usage:\n\n";
+    std::cerr << "kernelbench [--states s1,s2,...] [--patterns p1,p2,...] [--categories c1,c2,...]"
+              << " [--reps r] [--threads t] [--rsrc r] [--missing percent] [--genericstates]"
+              << " [--nothreading] [--threadingonly] [--json] [--out file]\n\n";
+    std::cerr << "Defaults: --states 4,20,61 --patterns 1000,10000 --categories 4 --reps 10\n";
+    std::cerr << "--missing codes that percentage of runs of " << KB_MISSING_RUN_LENGTH
+              << " patterns as missing from every tip\n";
+    std::cerr << "--genericstates runs 16, 20, 61 and 64 states on the generic CPU kernels\n";
+    std::exit(0);
+}
+
+std::vector<int> parseList(const std::string& option) {
+    std::vector<int> values;
+    std::stringstream ss(option);
+    int j;
+    while (ss >> j) {
+        values.push_back(j);
+        if (ss.peek() == ',')
+            ss.ignore();
+    }
+    return values;
+}
+
+void interpretCommandLineParameters(int argc,
+                                    const char* argv[],
+                                    BenchConfig* config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string option = argv[i];
+        std::string value = (i + 1 < argc ? argv[i + 1] : "");
+
+        if (option == "--help") {
+            helpMessage();
+        } else if (option == "--states") {
+            config->stateCounts = parseList(value); i++;
+        } else if (option == "--patterns") {
+            config->patternCounts = parseList(value); i++;
+        } else if (option == "--categories") {
+            config->categoryCounts = parseList(value); i++;
+        } else if (option == "--reps") {
+            config->reps = atoi(value.c_str()); i++;
+        } else if (option == "--threads") {
+            config->threadCount = atoi(value.c_str()); i++;
+        } else if (option == "--rsrc") {
+            config->resource = atoi(value.c_str()); i++;
+        } else if (option == "--missing") {
+            config->missingPercent = atoi(value.c_str()); i++;
+        } else if (option == "--out") {
+            config->outFile = value; i++;
+        } else if (option == "--genericstates") {
+            config->genericStates = true;
+        } else if (option == "--json") {
+            config->json = true;
+        } else if (option == "--nothreading") {
+            config->threaded = false;
+        } else if (option == "--threadingonly") {
+            config->unthreaded = false;
+        } else {
+            std::cerr << "Unknown option: " << option << std::endl;
+            helpMessage();
+        }
+    }
+
+    if (config->reps < 1 || config->threadCount < 1 || config->stateCounts.empty() ||
+        config->missingPercent < 0 || config->missingPercent > 100 ||
+        config->patternCounts.empty() || config->categoryCounts.empty()) {
+        std::cerr << "Invalid benchmark configuration" << std::endl;
+        std::exit(1);
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    BenchConfig config;
+    config.stateCounts = { 4, 20, 61 };
+    config.patternCounts = { 1000, 10000 };
+    config.categoryCounts = { 4 };
+    config.reps = 10;
+    config.threadCount = std::max(1u, std::thread::hardware_concurrency());
+    config.resource = 0;
+    config.missingPercent = 0;
+    config.genericStates = false;
+    config.json = false;
+    config.threaded = true;
+    config.unthreaded = true;
+
+    interpretCommandLineParameters(argc, argv, &config);
+
+    // read by the CPU plugin's fixed-state factory whenever an instance is created
+    if (config.genericStates) {
+#ifdef _WIN32
+        _putenv_s("BEAGLE_CPU_FIXED_STATES", "0");
+#else
+        setenv("BEAGLE_CPU_FIXED_STATES", "0", 1);
+#endif
+    }
+
+    const BenchVariant variants[] = {
+        { "none-double",       BEAGLE_FLAG_VECTOR_NONE, BEAGLE_FLAG_PRECISION_DOUBLE, false },
+        { "none-single",       BEAGLE_FLAG_VECTOR_NONE, BEAGLE_FLAG_PRECISION_SINGLE, false },
+        { "sse-double",        BEAGLE_FLAG_VECTOR_SSE,  BEAGLE_FLAG_PRECISION_DOUBLE, false },
+        { "sse-single",        BEAGLE_FLAG_VECTOR_SSE,  BEAGLE_FLAG_PRECISION_SINGLE, false },
+        { "avx-double",        BEAGLE_FLAG_VECTOR_AVX,  BEAGLE_FLAG_PRECISION_DOUBLE, false },
+        { "avx-single",        BEAGLE_FLAG_VECTOR_AVX,  BEAGLE_FLAG_PRECISION_SINGLE, false },
+        { "none-double-cpp",   BEAGLE_FLAG_VECTOR_NONE, BEAGLE_FLAG_PRECISION_DOUBLE, true  },
+        { "none-single-cpp",   BEAGLE_FLAG_VECTOR_NONE, BEAGLE_FLAG_PRECISION_SINGLE, true  },
+        { "sse-double-cpp",    BEAGLE_FLAG_VECTOR_SSE,  BEAGLE_FLAG_PRECISION_DOUBLE, true  },
+        { "sse-single-cpp",    BEAGLE_FLAG_VECTOR_SSE,  BEAGLE_FLAG_PRECISION_SINGLE, true  },
+        { "avx-double-cpp",    BEAGLE_FLAG_VECTOR_AVX,  BEAGLE_FLAG_PRECISION_DOUBLE, true  },
+        { "avx-single-cpp",    BEAGLE_FLAG_VECTOR_AVX,  BEAGLE_FLAG_PRECISION_SINGLE, true  },
+    };
+    const int variantCount = sizeof(variants) / sizeof(variants[0]);
+
+    std::vector<BenchResult> results;
+    for (int v = 0; v < variantCount; v++) {
+        if ((variants[v].threaded && !config.threaded) ||
+            (!variants[v].threaded && !config.unthreaded))
+            continue;
+        for (size_t s = 0; s < config.stateCounts.size(); s++) {
+            for (size_t p = 0; p < config.patternCounts.size(); p++) {
+                for (size_t c = 0; c < config.categoryCounts.size(); c++) {
+                    rand_state = 1;
+                    size_t before = results.size();
+                    benchmarkShape(config, variants[v], config.stateCounts[s],
+                                   config.patternCounts[p], config.categoryCounts[c], results);
+                    if (results.size() != before) {
+                        std::cerr << "benchmarked " << results[before].implName << " ("
+                                  << variants[v].label << ") states=" << config.stateCounts[s]
+                                  << " patterns=" << config.patternCounts[p]
+                                  << " categories=" << config.categoryCounts[c] << std::endl;
+                    }
+                }
+            }
+        }
+    }
+
+    if (config.outFile.empty()) {
+        if (config.json)
+            writeJSON(std::cout, results);
+        else
+            writeCSV(std::cout, results);
+    } else {
+        std::ofstream out(config.outFile.c_str());
+        if (!out.is_open()) {
+            std::cerr << "Unable to open " << config.outFile << std::endl;
+            return 1;
+        }
+        if (config.json)
+            writeJSON(out, results);
+        else
+            writeCSV(out, results);
+    }
+
+    beagleFinalize();
+
+    return 0;
+}
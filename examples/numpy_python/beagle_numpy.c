@@ -0,0 +1,761 @@
+/*
+ *  beagle_numpy.c
+ *  BEAGLE
+ *
+ *  Python bindings for libhmsbeagle that pass NumPy arrays (or any object
+ *  exporting a C-contiguous buffer) straight through to the library with no
+ *  copies. Inputs are read in place; outputs are written into arrays supplied
+ *  by the caller. The GIL is released while the library computes, so Python
+ *  threads can drive several instances at once.
+ *
+ *  Arrays must be float64 for doubles and int32 for indices and states.
+ *  Operations are an int32 array of shape (count, 7) in BeagleOperation order.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <string.h>
+
+#include "libhmsbeagle/beagle.h"
+
+/* Sizes of each instance, kept to check array lengths before the library sees them. */
+typedef struct {
+    int active;
+    int tipCount;
+    int partialsBufferCount;
+    int stateCount;
+    int patternCount;
+    int eigenBufferCount;
+    int matrixBufferCount;
+    int categoryCount;
+    int scaleBufferCount;
+} InstanceSizes;
+
+static InstanceSizes* instanceSizes = NULL;
+static int instanceSizesCount = 0;
+
+static PyObject* BeagleError;
+
+static PyObject* raiseBeagleError(int code) {
+    PyObject* value = Py_BuildValue("(is)", code, "BEAGLE call failed");
+    if (value != NULL) {
+        PyErr_SetObject(BeagleError, value);
+        Py_DECREF(value);
+    }
+    return NULL;
+}
+
+static PyObject* checkResult(int code) {
+    if (code < 0)
+        return raiseBeagleError(code);
+    Py_RETURN_NONE;
+}
+
+static InstanceSizes* getSizes(int instance) {
+    if (instance < 0 || instance >= instanceSizesCount || !instanceSizes[instance].active) {
+        raiseBeagleError(BEAGLE_ERROR_UNINITIALIZED_INSTANCE);
+        return NULL;
+    }
+    return &instanceSizes[instance];
+}
+
+/*
+ * Acquires a C-contiguous buffer of the given struct format ('d' or 'i') holding
+ * at least minLength items. obj may be None when allowNone is set, leaving
+ * view->buf NULL.
+ */
+static int getBuffer(PyObject* obj,
+                     Py_buffer* view,
+                     char format,
+                     Py_ssize_t minLength,
+                     int writable,
+                     int allowNone,
+                     const char* name) {
+    memset(view, 0, sizeof(Py_buffer));
+    if (obj == Py_None && allowNone)
+        return 0;
+
+    int flags = PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0);
+    if (PyObject_GetBuffer(obj, view, flags) != 0)
+        return -1;
+
+    const char* f = view->format;
+    if (f[0] == '@' || f[0] == '=' || f[0] == '<')
+        f++;
+    int formatOk = 0;
+    if (format == 'd')
+        formatOk = (strcmp(f, "d") == 0);
+    else
+        formatOk = (view->itemsize == sizeof(int) && (strcmp(f, "i") == 0 || strcmp(f, "l") == 0));
+    if (!formatOk) {
+        PyErr_Format(PyExc_TypeError, "%s must be a %s array", name,
+                     (format == 'd' ? "float64" : "int32"));
+        PyBuffer_Release(view);
+        return -1;
+    }
+
+    Py_ssize_t length = view->len / view->itemsize;
+    if (length < minLength) {
+        PyErr_Format(PyExc_ValueError, "%s has %zd elements, %zd required", name, length, minLength);
+        PyBuffer_Release(view);
+        return -1;
+    }
+    return 0;
+}
+
+static void releaseBuffer(Py_buffer* view) {
+    if (view->obj != NULL)
+        PyBuffer_Release(view);
+}
+
+static Py_ssize_t bufferLength(const Py_buffer* view) {
+    return (view->obj != NULL ? view->len / view->itemsize : 0);
+}
+
+/* create_instance(tip_count, partials_buffer_count, compact_buffer_count, state_count,
+ *                 pattern_count, eigen_buffer_count, matrix_buffer_count, category_count,
+ *                 scale_buffer_count, resource=None, preference_flags=0,
+ *                 requirement_flags=0) -> (instance, implementation name, flags) */
+static PyObject* create_instance(PyObject* self, PyObject* args, PyObject* kwds) {
+    static char* keywords[] = { "tip_count", "partials_buffer_count", "compact_buffer_count",
+                                "state_count", "pattern_count", "eigen_buffer_count",
+                                "matrix_buffer_count", "category_count", "scale_buffer_count",
+                                "resource", "preference_flags", "requirement_flags", NULL };
+    int tipCount, partialsBufferCount, compactBufferCount, stateCount, patternCount;
+    int eigenBufferCount, matrixBufferCount, categoryCount, scaleBufferCount;
+    PyObject* resourceObj = Py_None;
+    long preferenceFlags = 0, requirementFlags = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "iiiiiiiii|Oll", keywords,
+                                     &tipCount, &partialsBufferCount, &compactBufferCount,
+                                     &stateCount, &patternCount, &eigenBufferCount,
+                                     &matrixBufferCount, &categoryCount, &scaleBufferCount,
+                                     &resourceObj, &preferenceFlags, &requirementFlags))
+        return NULL;
+
+    int resource = 0;
+    int* resourceList = NULL;
+    if (resourceObj != Py_None) {
+        resource = (int) PyLong_AsLong(resourceObj);
+        if (PyErr_Occurred())
+            return NULL;
+        resourceList = &resource;
+    }
+
+    BeagleInstanceDetails details;
+    int instance;
+    Py_BEGIN_ALLOW_THREADS
+    instance = beagleCreateInstance(tipCount, partialsBufferCount, compactBufferCount,
+                                    stateCount, patternCount, eigenBufferCount,
+                                    matrixBufferCount, categoryCount, scaleBufferCount,
+                                    resourceList, (resourceList ? 1 : 0),
+                                    preferenceFlags, requirementFlags, &details);
+    Py_END_ALLOW_THREADS
+    if (instance < 0)
+        return raiseBeagleError(instance);
+
+    if (instance >= instanceSizesCount) {
+        int newCount = instance + 16;
+        InstanceSizes* sizes = (InstanceSizes*) PyMem_Realloc(instanceSizes,
+                                                              sizeof(InstanceSizes) * newCount);
+        if (sizes == NULL) {
+            beagleFinalizeInstance(instance);
+            return PyErr_NoMemory();
+        }
+        memset(sizes + instanceSizesCount, 0, sizeof(InstanceSizes) * (newCount - instanceSizesCount));
+        instanceSizes = sizes;
+        instanceSizesCount = newCount;
+    }
+    InstanceSizes* sizes = &instanceSizes[instance];
+    sizes->active = 1;
+    sizes->tipCount = tipCount;
+    sizes->partialsBufferCount = partialsBufferCount;
+    sizes->stateCount = stateCount;
+    sizes->patternCount = patternCount;
+    sizes->eigenBufferCount = eigenBufferCount;
+    sizes->matrixBufferCount = matrixBufferCount;
+    sizes->categoryCount = categoryCount;
+    sizes->scaleBufferCount = scaleBufferCount;
+
+    return Py_BuildValue("(isl)", instance, (details.implName ? details.implName : ""), details.flags);
+}
+
+static PyObject* finalize_instance(PyObject* self, PyObject* args) {
+    int instance;
+    if (!PyArg_ParseTuple(args, "i", &instance))
+        return NULL;
+    if (getSizes(instance) == NULL)
+        return NULL;
+    instanceSizes[instance].active = 0;
+    return checkResult(beagleFinalizeInstance(instance));
+}
+
+static PyObject* set_tip_states(PyObject* self, PyObject* args) {
+    int instance, tipIndex;
+    PyObject* statesObj;
+    if (!PyArg_ParseTuple(args, "iiO", &instance, &tipIndex, &statesObj))
+        return NULL;
+    InstanceSizes* sizes = getSizes(instance);
+    if (sizes == NULL)
+        return NULL;
+
+    Py_buffer states;
+    if (getBuffer(statesObj, &states, 'i', sizes->patternCount, 0, 0, "states") != 0)
+        return NULL;
+    int code = beagleSetTipStates(instance, tipIndex, (const int*) states.buf);
+    releaseBuffer(&states);
+    return checkResult(code);
+}
+
+static PyObject* set_tip_partials(PyObject* self, PyObject* args) {
+    int instance, tipIndex;
+    PyObject* partialsObj;
+    if (!PyArg_ParseTuple(args, "iiO", &instance, &tipIndex, &partialsObj))
+        return NULL;
+    InstanceSizes* sizes = getSizes(instance);
+    if (sizes == NULL)
+        return NULL;
+
+    Py_buffer partials;
+    if (getBuffer(partialsObj, &partials, 'd', (Py_ssize_t) sizes->stateCount * sizes->patternCount,
+                  0, 0, "partials") != 0)
+        return NULL;
+    int code = beagleSetTipPartials(instance, tipIndex, (const double*) partials.buf);
+    releaseBuffer(&partials);
+    return checkResult(code);
+}
+
+static PyObject* set_partials(PyObject* self, PyObject* args) {
+    int instance, bufferIndex;
+    PyObject* partialsObj;
+    if (!PyArg_ParseTuple(args, "iiO", &instance, &bufferIndex, &partialsObj))
+        return NULL;
+    InstanceSizes* sizes = getSizes(instance);
+    if (sizes == NULL)
+        return NULL;
+
+    Py_buffer partials;
+    if (getBuffer(partialsObj, &partials, 'd',
+                  (Py_ssize_t) sizes->stateCount * sizes->patternCount * sizes->categoryCount,
+                  0, 0, "partials") != 0)
+        return NULL;
+    int code = beagleSetPartials(instance, bufferIndex, (const double*) partials.buf);
+    releaseBuffer(&partials);
+    return checkResult(code);
+}
+
+/* get_partials(instance, buffer_index, scale_index, out) */
+static PyObject* get_partials(PyObject* self, PyObject* args) {
+    int instance, bufferIndex, scaleIndex;
+    PyObject* outObj;
+    if (!PyArg_ParseTuple(args, "iiiO", &instance, &bufferIndex, &scaleIndex, &outObj))
+        return NULL;
+    InstanceSizes* sizes = getSizes(instance);
+    if (sizes == NULL)
+        return NULL;
+
+    Py_buffer out;
+    if (getBuffer(outObj, &out, 'd',
+                  (Py_ssize_t) sizes->stateCount * sizes->patternCount * sizes->categoryCount,
+                  1, 0, "out") != 0)
+        return NULL;
+    int code;
+    Py_BEGIN_ALLOW_THREADS
+    code = beagleGetPartials(instance, bufferIndex, scaleIndex, (double*) out.buf);
+    Py_END_ALLOW_THREADS
+    releaseBuffer(&out);
+    return checkResult(code);
+}
+
+static PyObject* set_pattern_weights(PyObject* self, PyObject* args) {
+    int instance;
+    PyObject* weightsObj;
+    if (!PyArg_ParseTuple(args, "iO", &instance, &weightsObj))
+        return NULL;
+    InstanceSizes* sizes = getSizes(instance);
+    if (sizes == NULL)
+        return NULL;
+
+    Py_buffer weights;
+    if (getBuffer(weightsObj, &weights, 'd', sizes->patternCount, 0, 0, "weights") != 0)
+        return NULL;
+    int code = beagleSetPatternWeights(instance, (const double*) weights.buf);
+    releaseBuffer(&weights);
+    return checkResult(code);
+}
+
+static PyObject* set_state_frequencies(PyObject* self, PyObject* args) {
+    int instance, frequenciesIndex;
+    PyObject* frequenciesObj;
+    if (!PyArg_ParseTuple(args, "iiO", &instance, &frequenciesIndex, &frequenciesObj))
+        return NULL;
+    InstanceSizes* sizes = getSizes(instance);
+    if (sizes == NULL)
+        return NULL;
+
+    Py_buffer frequencies;
+    if (getBuffer(frequenciesObj, &frequencies, 'd', sizes->stateCount, 0, 0, "frequencies") != 0)
+        return NULL;
+    int code = beagleSetStateFrequencies(instance, frequenciesIndex, (const double*) frequencies.buf);
+    releaseBuffer(&frequencies);
+    return checkResult(code);
+}
+
+static PyObject* set_category_weights(PyObject* self, PyObject* args) {
+    int instance, weightsIndex;
+    PyObject* weightsObj;
+    if (!PyArg_ParseTuple(args, "iiO", &instance, &weightsIndex, &weightsObj))
+        return NULL;
+    InstanceSizes* sizes = getSizes(instance);
+    if (sizes == NULL)
+        return NULL;
+
+    Py_buffer weights;
+    if (getBuffer(weightsObj, &weights, 'd', sizes->categoryCount, 0, 0, "weights") != 0)
+        return NULL;
+    int code = beagleSetCategoryWeights(instance, weightsIndex, (const double*) weights.buf);
+    releaseBuffer(&weights);
+    return checkResult(code);
+}
+
+static PyObject* set_category_rates(PyObject* self, PyObject* args) {
+    int instance;
+    PyObject* ratesObj;
+    if (!PyArg_ParseTuple(args, "iO", &instance, &ratesObj))
+        return NULL;
+    InstanceSizes* sizes = getSizes(instance);
+    if (sizes == NULL)
+        return NULL;
+
+    Py_buffer rates;
+    if (getBuffer(ratesObj, &rates, 'd', sizes->categoryCount, 0, 0, "rates") != 0)
+        return NULL;
+    int code = beagleSetCategoryRates(instance, (const double*) rates.buf);
+    releaseBuffer(&rates);
+    return checkResult(code);
+}
+
+/* set_eigen_decomposition(instance, eigen_index, eigenvectors, inverse_eigenvectors, eigenvalues) */
+static PyObject* set_eigen_decomposition(PyObject* self, PyObject* args) {
+    int instance, eigenIndex;
+    PyObject *vectorsObj, *inverseObj, *valuesObj;
+    if (!PyArg_ParseTuple(args, "iiOOO", &instance, &eigenIndex, &vectorsObj, &inverseObj, &valuesObj))
+        return NULL;
+    InstanceSizes* sizes = getSizes(instance);
+    if (sizes == NULL)
+        return NULL;
+
+    const Py_ssize_t matrixSize = (Py_ssize_t) sizes->stateCount * sizes->stateCount;
+    Py_buffer vectors, inverse, values;
+    if (getBuffer(vectorsObj, &vectors, 'd', matrixSize, 0, 0, "eigenvectors") != 0)
+        return NULL;
+    if (getBuffer(inverseObj, &inverse, 'd', matrixSize, 0, 0, "inverse_eigenvectors") != 0) {
+        releaseBuffer(&vectors);
+        return NULL;
+    }
+    if (getBuffer(valuesObj, &values, 'd', sizes->stateCount, 0, 0, "eigenvalues") != 0) {
+        releaseBuffer(&vectors);
+        releaseBuffer(&inverse);
+        return NULL;
+    }
+    int code = beagleSetEigenDecomposition(instance, eigenIndex, (const double*) vectors.buf,
+                                           (const double*) inverse.buf, (const double*) values.buf);
+    releaseBuffer(&vectors);
+    releaseBuffer(&inverse);
+    releaseBuffer(&values);
+    return checkResult(code);
+}
+
+/* set_transition_matrix(instance, matrix_index, matrix, padded_value=1.0) */
+static PyObject* set_transition_matrix(PyObject* self, PyObject* args) {
+    int instance, matrixIndex;
+    PyObject* matrixObj;
+    double paddedValue = 1.0;
+    if (!PyArg_ParseTuple(args, "iiO|d", &instance, &matrixIndex, &matrixObj, &paddedValue))
+        return NULL;
+    InstanceSizes* sizes = getSizes(instance);
+    if (sizes == NULL)
+        return NULL;
+
+    Py_buffer matrix;
+    if (getBuffer(matrixObj, &matrix, 'd',
+                  (Py_ssize_t) sizes->stateCount * sizes->stateCount * sizes->categoryCount,
+                  0, 0, "matrix") != 0)
+        return NULL;
+    int code = beagleSetTransitionMatrix(instance, matrixIndex, (const double*) matrix.buf, paddedValue);
+    releaseBuffer(&matrix);
+    return checkResult(code);
+}
+
+/* get_transition_matrix(instance, matrix_index, out) */
+static PyObject* get_transition_matrix(PyObject* self, PyObject* args) {
+    int instance, matrixIndex;
+    PyObject* outObj;
+    if (!PyArg_ParseTuple(args, "iiO", &instance, &matrixIndex, &outObj))
+        return NULL;
+    InstanceSizes* sizes = getSizes(instance);
+    if (sizes == NULL)
+        return NULL;
+
+    Py_buffer out;
+    if (getBuffer(outObj, &out, 'd',
+                  (Py_ssize_t) sizes->stateCount * sizes->stateCount * sizes->categoryCount,
+                  1, 0, "out") != 0)
+        return NULL;
+    int code = beagleGetTransitionMatrix(instance, matrixIndex, (double*) out.buf);
+    releaseBuffer(&out);
+    return checkResult(code);
+}
+
+/* update_transition_matrices(instance, eigen_index, probability_indices,
+ *                            first_derivative_indices, second_derivative_indices, edge_lengths) */
+static PyObject* update_transition_matrices(PyObject* self, PyObject* args) {
+    int instance, eigenIndex;
+    PyObject *probabilityObj, *firstObj, *secondObj, *lengthsObj;
+    if (!PyArg_ParseTuple(args, "iiOOOO", &instance, &eigenIndex, &probabilityObj,
+                          &firstObj, &secondObj, &lengthsObj))
+        return NULL;
+    if (getSizes(instance) == NULL)
+        return NULL;
+
+    Py_buffer probability, first, second, lengths;
+    if (getBuffer(probabilityObj, &probability, 'i', 0, 0, 0, "probability_indices") != 0)
+        return NULL;
+    const Py_ssize_t count = bufferLength(&probability);
+    if (getBuffer(firstObj, &first, 'i', count, 0, 1, "first_derivative_indices") != 0) {
+        releaseBuffer(&probability);
+        return NULL;
+    }
+    if (getBuffer(secondObj, &second, 'i', count, 0, 1, "second_derivative_indices") != 0) {
+        releaseBuffer(&probability);
+        releaseBuffer(&first);
+        return NULL;
+    }
+    if (getBuffer(lengthsObj, &lengths, 'd', count, 0, 0, "edge_lengths") != 0) {
+        releaseBuffer(&probability);
+        releaseBuffer(&first);
+        releaseBuffer(&second);
+        return NULL;
+    }
+
+    int code;
+    Py_BEGIN_ALLOW_THREADS
+    code = beagleUpdateTransitionMatrices(instance, eigenIndex, (const int*) probability.buf,
+                                          (const int*) first.buf, (const int*) second.buf,
+                                          (const double*) lengths.buf, (int) count);
+    Py_END_ALLOW_THREADS
+    releaseBuffer(&probability);
+    releaseBuffer(&first);
+    releaseBuffer(&second);
+    releaseBuffer(&lengths);
+    return checkResult(code);
+}
+
+/* update_partials(instance, operations, cumulative_scale_index=BEAGLE_OP_NONE) */
+static PyObject* update_partials(PyObject* self, PyObject* args) {
+    int instance, cumulativeScaleIndex = BEAGLE_OP_NONE;
+    PyObject* operationsObj;
+    if (!PyArg_ParseTuple(args, "iO|i", &instance, &operationsObj, &cumulativeScaleIndex))
+        return NULL;
+    if (getSizes(instance) == NULL)
+        return NULL;
+
+    Py_buffer operations;
+    if (getBuffer(operationsObj, &operations, 'i', 0, 0, 0, "operations") != 0)
+        return NULL;
+    const Py_ssize_t length = bufferLength(&operations);
+    if (length % BEAGLE_OP_COUNT != 0) {
+        PyErr_Format(PyExc_ValueError, "operations must hold %d indices per operation", BEAGLE_OP_COUNT);
+        releaseBuffer(&operations);
+        return NULL;
+    }
+
+    int code;
+    Py_BEGIN_ALLOW_THREADS
+    code = beagleUpdatePartials(instance, (const BeagleOperation*) operations.buf,
+                                (int) (length / BEAGLE_OP_COUNT), cumulativeScaleIndex);
+    Py_END_ALLOW_THREADS
+    releaseBuffer(&operations);
+    return checkResult(code);
+}
+
+/* accumulate_scale_factors(instance, scale_indices, cumulative_scale_index) */
+static PyObject* accumulate_scale_factors(PyObject* self, PyObject* args) {
+    int instance, cumulativeScaleIndex;
+    PyObject* indicesObj;
+    if (!PyArg_ParseTuple(args, "iOi", &instance, &indicesObj, &cumulativeScaleIndex))
+        return NULL;
+    if (getSizes(instance) == NULL)
+        return NULL;
+
+    Py_buffer indices;
+    if (getBuffer(indicesObj, &indices, 'i', 0, 0, 0, "scale_indices") != 0)
+        return NULL;
+    int code;
+    Py_BEGIN_ALLOW_THREADS
+    code = beagleAccumulateScaleFactors(instance, (const int*) indices.buf,
+                                        (int) bufferLength(&indices), cumulativeScaleIndex);
+    Py_END_ALLOW_THREADS
+    releaseBuffer(&indices);
+    return checkResult(code);
+}
+
+static PyObject* reset_scale_factors(PyObject* self, PyObject* args) {
+    int instance, cumulativeScaleIndex;
+    if (!PyArg_ParseTuple(args, "ii", &instance, &cumulativeScaleIndex))
+        return NULL;
+    if (getSizes(instance) == NULL)
+        return NULL;
+    return checkResult(beagleResetScaleFactors(instance, cumulativeScaleIndex));
+}
+
+/* calculate_root_log_likelihoods(instance, buffer_indices, category_weights_indices,
+ *                                state_frequencies_indices, cumulative_scale_indices) -> float */
+static PyObject* calculate_root_log_likelihoods(PyObject* self, PyObject* args) {
+    int instance;
+    PyObject *buffersObj, *weightsObj, *frequenciesObj, *scalesObj;
+    if (!PyArg_ParseTuple(args, "iOOOO", &instance, &buffersObj, &weightsObj, &frequenciesObj, &scalesObj))
+        return NULL;
+    if (getSizes(instance) == NULL)
+        return NULL;
+
+    Py_buffer buffers, weights, frequencies, scales;
+    if (getBuffer(buffersObj, &buffers, 'i', 1, 0, 0, "buffer_indices") != 0)
+        return NULL;
+    const Py_ssize_t count = bufferLength(&buffers);
+    if (getBuffer(weightsObj, &weights, 'i', count, 0, 0, "category_weights_indices") != 0) {
+        releaseBuffer(&buffers);
+        return NULL;
+    }
+    if (getBuffer(frequenciesObj, &frequencies, 'i', count, 0, 0, "state_frequencies_indices") != 0) {
+        releaseBuffer(&buffers);
+        releaseBuffer(&weights);
+        return NULL;
+    }
+    if (getBuffer(scalesObj, &scales, 'i', count, 0, 0, "cumulative_scale_indices") != 0) {
+        releaseBuffer(&buffers);
+        releaseBuffer(&weights);
+        releaseBuffer(&frequencies);
+        return NULL;
+    }
+
+    double logL = 0.0;
+    int code;
+    Py_BEGIN_ALLOW_THREADS
+    code = beagleCalculateRootLogLikelihoods(instance, (const int*) buffers.buf, (const int*) weights.buf,
+                                             (const int*) frequencies.buf, (const int*) scales.buf,
+                                             (int) count, &logL);
+    Py_END_ALLOW_THREADS
+    releaseBuffer(&buffers);
+    releaseBuffer(&weights);
+    releaseBuffer(&frequencies);
+    releaseBuffer(&scales);
+    if (code < 0)
+        return raiseBeagleError(code);
+    return PyFloat_FromDouble(logL);
+}
+
+/* calculate_edge_log_likelihoods(instance, parent_indices, child_indices, probability_indices,
+ *                                first_derivative_indices, second_derivative_indices,
+ *                                category_weights_indices, state_frequencies_indices,
+ *                                cumulative_scale_indices) -> (logL, first, second) */
+static PyObject* calculate_edge_log_likelihoods(PyObject* self, PyObject* args) {
+    int instance;
+    PyObject* objs[8];
+    static const char* names[8] = { "parent_indices", "child_indices", "probability_indices",
+                                    "first_derivative_indices", "second_derivative_indices",
+                                    "category_weights_indices", "state_frequencies_indices",
+                                    "cumulative_scale_indices" };
+    if (!PyArg_ParseTuple(args, "iOOOOOOOO", &instance, &objs[0], &objs[1], &objs[2], &objs[3],
+                          &objs[4], &objs[5], &objs[6], &objs[7]))
+        return NULL;
+    if (getSizes(instance) == NULL)
+        return NULL;
+
+    Py_buffer views[8];
+    Py_ssize_t count = 1;
+    int acquired = 0;
+    for (; acquired < 8; acquired++) {
+        const int allowNone = (acquired == 3 || acquired == 4);
+        if (getBuffer(objs[acquired], &views[acquired], 'i', count, 0, allowNone, names[acquired]) != 0)
+            break;
+        if (acquired == 0)
+            count = bufferLength(&views[0]);
+    }
+    if (acquired < 8) {
+        for (int i = 0; i < acquired; i++)
+            releaseBuffer(&views[i]);
+        return NULL;
+    }
+
+    double logL = 0.0, first = 0.0, second = 0.0;
+    int code;
+    Py_BEGIN_ALLOW_THREADS
+    code = beagleCalculateEdgeLogLikelihoods(instance, (const int*) views[0].buf, (const int*) views[1].buf,
+                                             (const int*) views[2].buf, (const int*) views[3].buf,
+                                             (const int*) views[4].buf, (const int*) views[5].buf,
+                                             (const int*) views[6].buf, (const int*) views[7].buf,
+                                             (int) count, &logL,
+                                             (views[3].buf ? &first : NULL),
+                                             (views[4].buf ? &second : NULL));
+    Py_END_ALLOW_THREADS
+    for (int i = 0; i < 8; i++)
+        releaseBuffer(&views[i]);
+    if (code < 0)
+        return raiseBeagleError(code);
+    return Py_BuildValue("(ddd)", logL, first, second);
+}
+
+/* evaluate(instance, commands, values=None) -> (logL, first, second); derivatives are
+ * None unless the stream ends with an edge command that requests them */
+static PyObject* evaluate(PyObject* self, PyObject* args) {
+    int instance;
+    PyObject *commandsObj, *valuesObj = Py_None;
+    if (!PyArg_ParseTuple(args, "iO|O", &instance, &commandsObj, &valuesObj))
+        return NULL;
+    if (getSizes(instance) == NULL)
+        return NULL;
+
+    Py_buffer commands, values;
+    if (getBuffer(commandsObj, &commands, 'i', 0, 0, 0, "commands") != 0)
+        return NULL;
+    if (getBuffer(valuesObj, &values, 'd', 0, 0, 1, "values") != 0) {
+        releaseBuffer(&commands);
+        return NULL;
+    }
+
+    const double unset = -HUGE_VAL;
+    double logL = unset, first = unset, second = unset;
+    int code;
+    Py_BEGIN_ALLOW_THREADS
+    code = beagleEvaluate(instance, (const int*) commands.buf, (int) bufferLength(&commands),
+                          (const double*) values.buf, (int) bufferLength(&values),
+                          &logL, &first, &second);
+    Py_END_ALLOW_THREADS
+    releaseBuffer(&commands);
+    releaseBuffer(&values);
+    if (code < 0)
+        return raiseBeagleError(code);
+    return Py_BuildValue("(NNN)",
+                         (logL == unset ? Py_BuildValue("") : PyFloat_FromDouble(logL)),
+                         (first == unset ? Py_BuildValue("") : PyFloat_FromDouble(first)),
+                         (second == unset ? Py_BuildValue("") : PyFloat_FromDouble(second)));
+}
+
+/* get_site_log_likelihoods(instance, out) */
+static PyObject* get_site_log_likelihoods(PyObject* self, PyObject* args) {
+    int instance;
+    PyObject* outObj;
+    if (!PyArg_ParseTuple(args, "iO", &instance, &outObj))
+        return NULL;
+    InstanceSizes* sizes = getSizes(instance);
+    if (sizes == NULL)
+        return NULL;
+
+    Py_buffer out;
+    if (getBuffer(outObj, &out, 'd', sizes->patternCount, 1, 0, "out") != 0)
+        return NULL;
+    int code = beagleGetSiteLogLikelihoods(instance, (double*) out.buf);
+    releaseBuffer(&out);
+    return checkResult(code);
+}
+
+/* get_site_derivatives(instance, out_first, out_second=None) */
+static PyObject* get_site_derivatives(PyObject* self, PyObject* args) {
+    int instance;
+    PyObject *firstObj, *secondObj = Py_None;
+    if (!PyArg_ParseTuple(args, "iO|O", &instance, &firstObj, &secondObj))
+        return NULL;
+    InstanceSizes* sizes = getSizes(instance);
+    if (sizes == NULL)
+        return NULL;
+
+    Py_buffer first, second;
+    if (getBuffer(firstObj, &first, 'd', sizes->patternCount, 1, 0, "out_first") != 0)
+        return NULL;
+    if (getBuffer(secondObj, &second, 'd', sizes->patternCount, 1, 1, "out_second") != 0) {
+        releaseBuffer(&first);
+        return NULL;
+    }
+    int code = beagleGetSiteDerivatives(instance, (double*) first.buf, (double*) second.buf);
+    releaseBuffer(&first);
+    releaseBuffer(&second);
+    return checkResult(code);
+}
+
+static PyMethodDef BeagleNumpyMethods[] = {
+    { "create_instance", (PyCFunction) (void(*)(void)) create_instance, METH_VARARGS | METH_KEYWORDS,
+      "Creates an instance; returns (instance, implementation name, flags)." },
+    { "finalize_instance", finalize_instance, METH_VARARGS, "Finalizes an instance." },
+    { "set_tip_states", set_tip_states, METH_VARARGS, "Sets compact states (int32) of a tip." },
+    { "set_tip_partials", set_tip_partials, METH_VARARGS, "Sets partials (float64) of a tip." },
+    { "set_partials", set_partials, METH_VARARGS, "Sets a partials buffer." },
+    { "get_partials", get_partials, METH_VARARGS, "Copies a partials buffer into out." },
+    { "set_pattern_weights", set_pattern_weights, METH_VARARGS, "Sets pattern weights." },
+    { "set_state_frequencies", set_state_frequencies, METH_VARARGS, "Sets state frequencies." },
+    { "set_category_weights", set_category_weights, METH_VARARGS, "Sets category weights." },
+    { "set_category_rates", set_category_rates, METH_VARARGS, "Sets category rates." },
+    { "set_eigen_decomposition", set_eigen_decomposition, METH_VARARGS, "Sets an eigen decomposition." },
+    { "set_transition_matrix", set_transition_matrix, METH_VARARGS, "Sets a transition matrix." },
+    { "get_transition_matrix", get_transition_matrix, METH_VARARGS, "Copies a transition matrix into out." },
+    { "update_transition_matrices", update_transition_matrices, METH_VARARGS,
+      "Computes transition matrices and optional derivatives." },
+    { "update_partials", update_partials, METH_VARARGS,
+      "Computes partials for an int32 (count, 7) array of operations." },
+    { "accumulate_scale_factors", accumulate_scale_factors, METH_VARARGS, "Accumulates scale factors." },
+    { "reset_scale_factors", reset_scale_factors, METH_VARARGS, "Resets a cumulative scale buffer." },
+    { "calculate_root_log_likelihoods", calculate_root_log_likelihoods, METH_VARARGS,
+      "Returns the summed root log likelihood." },
+    { "calculate_edge_log_likelihoods", calculate_edge_log_likelihoods, METH_VARARGS,
+      "Returns (log likelihood, first derivative, second derivative) across an edge." },
+    { "evaluate", evaluate, METH_VARARGS,
+      "Runs a command stream; returns (logL, first, second)." },
+    { "get_site_log_likelihoods", get_site_log_likelihoods, METH_VARARGS,
+      "Copies site log likelihoods into out." },
+    { "get_site_derivatives", get_site_derivatives, METH_VARARGS,
+      "Copies site derivatives into out_first and out_second." },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef beagleNumpyModule = {
+    PyModuleDef_HEAD_INIT, "beagle_numpy",
+    "Zero-copy bindings for libhmsbeagle using the buffer protocol.",
+    -1, BeagleNumpyMethods
+};
+
+PyMODINIT_FUNC PyInit_beagle_numpy(void) {
+    PyObject* module = PyModule_Create(&beagleNumpyModule);
+    if (module == NULL)
+        return NULL;
+
+    BeagleError = PyErr_NewException("beagle_numpy.BeagleError", PyExc_RuntimeError, NULL);
+    Py_INCREF(BeagleError);
+    PyModule_AddObject(module, "BeagleError", BeagleError);
+
+    PyModule_AddIntConstant(module, "OP_NONE", BEAGLE_OP_NONE);
+    PyModule_AddIntConstant(module, "OP_COUNT", BEAGLE_OP_COUNT);
+    PyModule_AddIntConstant(module, "COMMAND_UPDATE_TRANSITION_MATRICES", BEAGLE_COMMAND_UPDATE_TRANSITION_MATRICES);
+    PyModule_AddIntConstant(module, "COMMAND_UPDATE_PARTIALS", BEAGLE_COMMAND_UPDATE_PARTIALS);
+    PyModule_AddIntConstant(module, "COMMAND_RESET_SCALE_FACTORS", BEAGLE_COMMAND_RESET_SCALE_FACTORS);
+    PyModule_AddIntConstant(module, "COMMAND_ACCUMULATE_SCALE_FACTORS", BEAGLE_COMMAND_ACCUMULATE_SCALE_FACTORS);
+    PyModule_AddIntConstant(module, "COMMAND_ROOT_LOG_LIKELIHOODS", BEAGLE_COMMAND_ROOT_LOG_LIKELIHOODS);
+    PyModule_AddIntConstant(module, "COMMAND_EDGE_LOG_LIKELIHOODS", BEAGLE_COMMAND_EDGE_LOG_LIKELIHOODS);
+    PyModule_AddIntConstant(module, "FLAG_PRECISION_SINGLE", BEAGLE_FLAG_PRECISION_SINGLE);
+    PyModule_AddIntConstant(module, "FLAG_PRECISION_DOUBLE", BEAGLE_FLAG_PRECISION_DOUBLE);
+    PyModule_AddIntConstant(module, "FLAG_PROCESSOR_CPU", BEAGLE_FLAG_PROCESSOR_CPU);
+    PyModule_AddIntConstant(module, "FLAG_PROCESSOR_GPU", BEAGLE_FLAG_PROCESSOR_GPU);
+    PyModule_AddIntConstant(module, "FLAG_SCALING_MANUAL", BEAGLE_FLAG_SCALING_MANUAL);
+    PyModule_AddIntConstant(module, "FLAG_SCALERS_RAW", BEAGLE_FLAG_SCALERS_RAW);
+    PyModule_AddIntConstant(module, "FLAG_SCALERS_LOG", BEAGLE_FLAG_SCALERS_LOG);
+    PyModule_AddIntConstant(module, "FLAG_THREADING_CPP", BEAGLE_FLAG_THREADING_CPP);
+    PyModule_AddIntConstant(module, "FLAG_THREADING_NONE", BEAGLE_FLAG_THREADING_NONE);
+    PyModule_AddIntConstant(module, "FLAG_VECTOR_SSE", BEAGLE_FLAG_VECTOR_SSE);
+    PyModule_AddIntConstant(module, "FLAG_VECTOR_NONE", BEAGLE_FLAG_VECTOR_NONE);
+
+    return module;
+}
@@ -0,0 +1,124 @@
+"""
+Times a Python-driven likelihood loop through the zero-copy bindings and,
+when the SWIG module from ../swig_python has been built, through SWIG.
+
+Each iteration sets new tip partials, updates transition matrices and
+partials, computes the root log likelihood and reads back the site log
+likelihoods, which is the data movement of a typical Python sampler.
+
+    python benchmark.py [taxa] [patterns] [iterations]
+"""
+import os
+import sys
+import time
+import numpy as np
+import beagle_numpy as bn
+
+taxa = int(sys.argv[1]) if len(sys.argv) > 1 else 16
+patterns = int(sys.argv[2]) if len(sys.argv) > 2 else 10000
+iterations = int(sys.argv[3]) if len(sys.argv) > 3 else 20
+states = 4
+
+rng = np.random.default_rng(1)
+tip_partials = [rng.random(states * patterns) for _ in range(taxa)]
+edge_lengths = rng.random(2 * taxa - 2) * 0.1
+
+evec = np.array([1.0,  2.0,  0.0,  0.5,  1.0, -2.0,  0.5,  0.0,
+                 1.0,  2.0,  0.0, -0.5,  1.0, -2.0, -0.5,  0.0])
+ivec = np.array([0.25, 0.25, 0.25, 0.25,  0.125, -0.125, 0.125, -0.125,
+                 0.0,  1.0,  0.0, -1.0,   1.0,    0.0, -1.0,    0.0])
+evals = np.array([0.0, -4.0 / 3.0, -4.0 / 3.0, -4.0 / 3.0])
+
+# a caterpillar tree: node taxa + i joins the previous node and tip i + 1
+operations = []
+previous = 0
+for i in range(taxa - 1):
+    operations.append([taxa + i, i, bn.OP_NONE, previous, previous, i + 1, i + 1])
+    previous = taxa + i
+root = previous
+scale_indices = list(range(taxa - 1))
+cumulative_index = taxa - 1
+
+def run_numpy():
+    instance, impl_name, flags = bn.create_instance(taxa, 2 * taxa - 1, 0, states, patterns, 1,
+                                                    2 * taxa - 2, 1, taxa)
+    bn.set_pattern_weights(instance, np.ones(patterns))
+    bn.set_state_frequencies(instance, 0, np.full(states, 0.25))
+    bn.set_category_weights(instance, 0, np.ones(1))
+    bn.set_category_rates(instance, np.ones(1))
+    bn.set_eigen_decomposition(instance, 0, evec, ivec, evals)
+
+    ops = np.array(operations, dtype=np.int32)
+    matrix_indices = np.arange(2 * taxa - 2, dtype=np.int32)
+    scales = np.array(scale_indices, dtype=np.int32)
+    root_args = [np.array([v], dtype=np.int32) for v in (root, 0, 0, cumulative_index)]
+    site_logL = np.empty(patterns)
+
+    start = time.perf_counter()
+    for it in range(iterations):
+        for tip in range(taxa):
+            bn.set_tip_partials(instance, tip, tip_partials[tip])
+        bn.update_transition_matrices(instance, 0, matrix_indices, None, None, edge_lengths)
+        bn.update_partials(instance, ops)
+        bn.reset_scale_factors(instance, cumulative_index)
+        bn.accumulate_scale_factors(instance, scales, cumulative_index)
+        logL = bn.calculate_root_log_likelihoods(instance, *root_args)
+        bn.get_site_log_likelihoods(instance, site_logL)
+    elapsed = time.perf_counter() - start
+    bn.finalize_instance(instance)
+    return logL, elapsed
+
+def run_swig(beagle):
+    details = beagle.BeagleInstanceDetails()
+    instance = beagle.beagleCreateInstance(taxa, 2 * taxa - 1, 0, states, patterns, 1,
+                                           2 * taxa - 2, 1, taxa, None, 0, 0, 0, details)
+    beagle.beagleSetPatternWeights(instance, beagle.make_doublearray([1.0] * patterns))
+    beagle.beagleSetStateFrequencies(instance, 0, beagle.make_doublearray([0.25] * states))
+    beagle.beagleSetCategoryWeights(instance, 0, beagle.make_doublearray([1.0]))
+    beagle.beagleSetCategoryRates(instance, beagle.make_doublearray([1.0]))
+    beagle.beagleSetEigenDecomposition(instance, 0, beagle.make_doublearray(list(evec)),
+                                       beagle.make_doublearray(list(ivec)),
+                                       beagle.make_doublearray(list(evals)))
+
+    ops = beagle.new_BeagleOperationArray(len(operations))
+    for i, op in enumerate(operations):
+        beagle.BeagleOperationArray_setitem(ops, i, beagle.make_operation(op))
+    matrix_indices = beagle.make_intarray(list(range(2 * taxa - 2)))
+    scales = beagle.make_intarray(scale_indices)
+    root_args = [beagle.make_intarray([v]) for v in (root, 0, 0, cumulative_index)]
+    logLp = beagle.new_doublep()
+    site_array = beagle.new_doubleArray(patterns)
+
+    start = time.perf_counter()
+    for it in range(iterations):
+        for tip in range(taxa):
+            partials = beagle.make_doublearray(tip_partials[tip].tolist())
+            beagle.beagleSetTipPartials(instance, tip, partials)
+            beagle.delete_doubleArray(partials)
+        lengths = beagle.make_doublearray(edge_lengths.tolist())
+        beagle.beagleUpdateTransitionMatrices(instance, 0, matrix_indices, None, None, lengths,
+                                              2 * taxa - 2)
+        beagle.delete_doubleArray(lengths)
+        beagle.beagleUpdatePartials(instance, ops, len(operations), beagle.BEAGLE_OP_NONE)
+        beagle.beagleResetScaleFactors(instance, cumulative_index)
+        beagle.beagleAccumulateScaleFactors(instance, scales, len(scale_indices), cumulative_index)
+        beagle.beagleCalculateRootLogLikelihoods(instance, *(root_args + [1, logLp]))
+        beagle.beagleGetSiteLogLikelihoods(instance, site_array)
+        site_logL = [beagle.doubleArray_getitem(site_array, k) for k in range(patterns)]
+    elapsed = time.perf_counter() - start
+    beagle.beagleFinalizeInstance(instance)
+    return beagle.doublep_value(logLp), elapsed
+
+print("taxa %d, patterns %d, iterations %d" % (taxa, patterns, iterations))
+logL, elapsed = run_numpy()
+print("numpy: logL %.6f, %.2f ms per iteration" % (logL, 1000.0 * elapsed / iterations))
+
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "swig_python"))
+try:
+    import beagle
+except ImportError as error:
+    print("swig: unavailable (%s), see README" % error)
+    sys.exit(0)
+swig_logL, swig_elapsed = run_swig(beagle)
+print("swig:  logL %.6f, %.2f ms per iteration (%.1fx)" %
+      (swig_logL, 1000.0 * swig_elapsed / iterations, swig_elapsed / elapsed))
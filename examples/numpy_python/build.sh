@@ -0,0 +1,5 @@
+export LD_LIBRARY_PATH=$HOME/lib:$LD_LIBRARY_PATH
+export PKG_CONFIG_PATH=$HOME/lib/pkgconfig:$PKG_CONFIG_PATH
+
+gcc -O2 -fPIC -shared beagle_numpy.c -o beagle_numpy`python3-config --extension-suffix` \
+    `python3-config --includes` `pkg-config --cflags --libs hmsbeagle-1`
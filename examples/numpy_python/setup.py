@@ -0,0 +1,19 @@
+import subprocess
+from setuptools import setup, Extension
+
+def pkgconfig(*packages, **kw):
+    flag_map = {'-I': 'include_dirs', '-L': 'library_dirs', '-l': 'libraries'}
+    output = subprocess.check_output(["pkg-config", "--libs", "--cflags"] + list(packages))
+    for token in output.decode().split():
+        kw.setdefault(flag_map.get(token[:2]), []).append(token[2:])
+    return kw
+
+beagle_numpy_module = Extension("beagle_numpy",
+                                sources=['beagle_numpy.c'],
+                                **pkgconfig('hmsbeagle-1'))
+
+setup(name='beagle_numpy',
+    version='0.1',
+    description="""Zero-copy NumPy bindings for BEAGLE""",
+    ext_modules = [beagle_numpy_module],
+    )
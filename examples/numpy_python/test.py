@@ -0,0 +1,118 @@
+import sys
+import threading
+import numpy as np
+import beagle_numpy as bn
+
+mars    = "CCGAG-AGCAGCAATGGAT-GAGGCATGGCG"
+saturn  = "GCGCGCAGCTGCTGTAGATGGAGGCATGACG"
+jupiter = "GCGCGCAGCAGCTGTGGATGGAAGGATGACG"
+
+def create_states(sequence):
+    table = {'A': 0, 'C': 1, 'G': 2, 'T': 3, '-': 4}
+    return np.array([table[c] for c in sequence.upper()], dtype=np.int32)
+
+evec = np.array([1.0,  2.0,  0.0,  0.5,
+                 1.0, -2.0,  0.5,  0.0,
+                 1.0,  2.0,  0.0, -0.5,
+                 1.0, -2.0, -0.5,  0.0])
+ivec = np.array([0.25,   0.25,  0.25,   0.25,
+                 0.125, -0.125, 0.125, -0.125,
+                 0.0,    1.0,   0.0,   -1.0,
+                 1.0,    0.0,  -1.0,    0.0])
+evals = np.array([0.0, -4.0 / 3.0, -4.0 / 3.0, -4.0 / 3.0])
+
+def hello_beagle():
+    """Translation of hellobeagle; returns (instance, root log likelihood)."""
+    n_patterns = len(mars)
+    instance, impl_name, flags = bn.create_instance(3, 2, 3, 4, n_patterns, 1, 6, 1, 0)
+
+    for tip, sequence in enumerate((mars, saturn, jupiter)):
+        bn.set_tip_states(instance, tip, create_states(sequence))
+    bn.set_pattern_weights(instance, np.ones(n_patterns))
+    bn.set_state_frequencies(instance, 0, np.full(4, 0.25))
+    bn.set_category_weights(instance, 0, np.ones(1))
+    bn.set_category_rates(instance, np.ones(1))
+    bn.set_eigen_decomposition(instance, 0, evec, ivec, evals)
+
+    bn.update_transition_matrices(instance, 0,
+                                  np.array([0, 1, 2, 3], dtype=np.int32), None, None,
+                                  np.array([0.1, 0.1, 0.2, 0.1]))
+
+    operations = np.array([[3, bn.OP_NONE, bn.OP_NONE, 0, 0, 1, 1],
+                           [4, bn.OP_NONE, bn.OP_NONE, 2, 2, 3, 3]], dtype=np.int32)
+    bn.update_partials(instance, operations)
+
+    zero = np.zeros(1, dtype=np.int32)
+    logL = bn.calculate_root_log_likelihoods(instance, np.array([4], dtype=np.int32), zero, zero,
+                                             np.array([bn.OP_NONE], dtype=np.int32))
+    return instance, logL
+
+failures = 0
+expected = -84.8523582328
+
+instance, logL = hello_beagle()
+print("%.10f" % logL)
+if abs(logL - expected) > 1e-8:
+    failures += 1
+
+# site log likelihoods are written in place and sum to the root log likelihood
+site_logL = np.empty(len(mars))
+bn.get_site_log_likelihoods(instance, site_logL)
+if abs(site_logL.sum() - logL) > 1e-8:
+    print("site log likelihoods do not sum to the root log likelihood")
+    failures += 1
+
+# derivatives across the edge between 3 and 2; by the pulley principle its length is 0.2 + 0.1
+bn.update_transition_matrices(instance, 0, np.array([2], dtype=np.int32),
+                              np.array([4], dtype=np.int32), np.array([5], dtype=np.int32),
+                              np.array([0.3]))
+one = lambda i: np.array([i], dtype=np.int32)
+edge_logL, first, second = bn.calculate_edge_log_likelihoods(instance, one(3), one(2), one(2), one(4),
+                                                             one(5), one(0), one(0), one(bn.OP_NONE))
+site_first = np.empty(len(mars))
+site_second = np.empty(len(mars))
+bn.get_site_derivatives(instance, site_first, site_second)
+print("edge logL %.10f, d1 %.10f, d2 %.10f" % (edge_logL, first, second))
+if abs(edge_logL - expected) > 1e-8 or abs(site_first.sum() - first) > 1e-8 or \
+   abs(site_second.sum() - second) > 1e-8:
+    failures += 1
+
+# the same matrices, partials and edge integration as a single command stream
+commands = np.array([bn.COMMAND_UPDATE_TRANSITION_MATRICES, 0, 4, 0, 0, 1, 2, 3,
+                     bn.COMMAND_UPDATE_PARTIALS, 2, bn.OP_NONE,
+                     3, bn.OP_NONE, bn.OP_NONE, 0, 0, 1, 1,
+                     4, bn.OP_NONE, bn.OP_NONE, 2, 2, 3, 3,
+                     bn.COMMAND_UPDATE_TRANSITION_MATRICES, 0, 1, 2, 2, 4, 5,
+                     bn.COMMAND_EDGE_LOG_LIKELIHOODS, 1, 2, 3, 2, 2, 4, 5, 0, 0, bn.OP_NONE],
+                    dtype=np.int32)
+stream_result = bn.evaluate(instance, commands, np.array([0.1, 0.1, 0.2, 0.1, 0.3]))
+print("evaluate logL %.10f, d1 %.10f, d2 %.10f" % stream_result)
+if max(abs(a - b) for a, b in zip(stream_result, (edge_logL, first, second))) > 1e-8:
+    failures += 1
+
+# wrong dtype and short arrays are rejected before reaching the library
+for bad in (np.ones(len(mars)), np.zeros(3, dtype=np.int32)):
+    try:
+        bn.set_tip_states(instance, 0, bad)
+        failures += 1
+    except (TypeError, ValueError):
+        pass
+
+bn.finalize_instance(instance)
+
+# several instances driven from Python threads
+results = [None] * 4
+def worker(i):
+    inst, results[i] = hello_beagle()
+    bn.finalize_instance(inst)
+threads = [threading.Thread(target=worker, args=(i,)) for i in range(4)]
+for t in threads:
+    t.start()
+for t in threads:
+    t.join()
+if any(abs(r - expected) > 1e-8 for r in results):
+    print("threaded results differ")
+    failures += 1
+
+print("Woof!" if failures == 0 else "%d failures" % failures)
+sys.exit(1 if failures else 0)
@@ -6,7 +6,18 @@
 # This file is compatible with both classic and new-style classes.
 
 from sys import version_info
-if version_info >= (2,6,0):
+if version_info >= (2,7,0):
+    def swig_import_helper():
+        import importlib
+        pkg = __name__.rpartition('.')[0]
+        mname = '.'.join((pkg, '_beagle')).lstrip('.')
+        try:
+            return importlib.import_module(mname)
+        except ImportError:
+            return importlib.import_module('_beagle')
+    _beagle = swig_import_helper()
+    del swig_import_helper
+elif version_info >= (2,6,0):
     def swig_import_helper():
         from os.path import dirname
         import imp
@@ -1,9 +1,10 @@
-from distutils.core import setup, Extension
-import commands
+import subprocess
+from setuptools import setup, Extension
 
 def pkgconfig(*packages, **kw):
     flag_map = {'-I': 'include_dirs', '-L': 'library_dirs', '-l': 'libraries'}
-    for token in commands.getoutput("pkg-config --libs --cflags %s" % ' '.join(packages)).split():
+    output = subprocess.check_output(["pkg-config", "--libs", "--cflags"] + list(packages))
+    for token in output.decode().split():
         kw.setdefault(flag_map.get(token[:2]), []).append(token[2:])
     return kw
 
@@ -16,4 +17,3 @@ setup(name='beagle',
     ext_modules = [beagle_module],
     py_modules = ["beagle"],
     )
-
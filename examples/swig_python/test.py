@@ -39,7 +39,7 @@ instance = beagleCreateInstance(3,
                                 returnInfo)
 
 if instance<0:
-    print "Failed to obtain BEAGLE instance"
+    print("Failed to obtain BEAGLE instance")
     sys.exit()
 
 table = getTable()
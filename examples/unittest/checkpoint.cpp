@@ -0,0 +1,182 @@
+/*
+ *  checkpoint.cpp
+ *  BEAGLE
+ *
+ *  Checks that an instance restored with beagleRestoreInstanceState reports the
+ *  saved site log likelihoods, gives the same root log likelihood from its restored
+ *  partials and scale factors without recomputation, and continues like the saved
+ *  instance after new edge lengths, in double and mixed precision; and that
+ *  mismatched instances are rejected.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "unittest.h"
+
+namespace {
+
+const int stateCount = 4;
+const int patternCount = 37;
+const int categoryCount = 3;
+const int tipCount = 4;
+const char* stateFile = "unittest-checkpoint.state";
+
+int createInstance(int patterns, long precisionFlags) {
+    long flags;
+    int instance = createCPUInstance(tipCount, 2 * tipCount - 1, 0, stateCount, patterns, 1, 2 * tipCount - 2,
+                                     categoryCount, 3, BEAGLE_FLAG_SCALING_MANUAL, precisionFlags, &flags);
+    if (instance >= 0 && (flags & precisionFlags) != precisionFlags) {
+        beagleFinalizeInstance(instance);
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+    return instance;
+}
+
+/* Tree ((0,1)4,(2,3)5)6 with matrix c for child c and scale buffer i for node 4 + i. */
+double computeRoot(int instance, const double* edgeLengths) {
+    int probabilityIndices[6] = { 0, 1, 2, 3, 4, 5 };
+    beagleUpdateTransitionMatrices(instance, 0, probabilityIndices, NULL, NULL, edgeLengths, 6);
+    int operations[3 * BEAGLE_OP_COUNT] = {
+        4, 0, BEAGLE_OP_NONE, 0, 0, 1, 1,
+        5, 1, BEAGLE_OP_NONE, 2, 2, 3, 3,
+        6, 2, BEAGLE_OP_NONE, 4, 4, 5, 5 };
+    beagleUpdatePartials(instance, (BeagleOperation*) operations, 3, BEAGLE_OP_NONE);
+
+    int scaleIndices[3] = { 0, 1, 2 };
+    int cumulativeIndex = 2;
+    beagleAccumulateScaleFactors(instance, scaleIndices, 2, cumulativeIndex);
+    int rootIndex = 6, zero = 0;
+    double logL;
+    beagleCalculateRootLogLikelihoods(instance, &rootIndex, &zero, &zero, &cumulativeIndex, 1, &logL);
+    return logL;
+}
+
+/*
+ * Saves an instance after a likelihood calculation and restores it into a new one, which
+ * must report the same site and root log likelihoods and continue with new edge lengths.
+ */
+int checkSaveRestore(const char* label, long precisionFlags) {
+
+    int failures = 0;
+    char text[128];
+
+    int saved = createInstance(patternCount, precisionFlags);
+    if (saved < 0) {
+        fprintf(stderr, "%s: failed to create instance\n", label);
+        return 1;
+    }
+
+    // two tips with states and two with partials
+    srand(11);
+    std::vector<int> states(patternCount);
+    std::vector<double> partials(stateCount * patternCount);
+    for (int t = 0; t < tipCount; t++) {
+        if (t % 2 == 0) {
+            for (int i = 0; i < patternCount; i++)
+                states[i] = rand() % (stateCount + 1);
+            beagleSetTipStates(saved, t, &states[0]);
+        } else {
+            for (int i = 0; i < stateCount * patternCount; i++)
+                partials[i] = rand() / (double) RAND_MAX;
+            beagleSetTipPartials(saved, t, &partials[0]);
+        }
+    }
+
+    double q[stateCount * stateCount] = {
+        -1.0,  0.2,  0.6,  0.2,
+         0.3, -1.1,  0.3,  0.5,
+         0.6,  0.2, -1.0,  0.2,
+         0.3,  0.5,  0.3, -1.1 };
+    double freqs[stateCount] = { 0.3, 0.2, 0.3, 0.2 };
+    beagleSetRateMatrix(saved, 0, q, freqs);
+    beagleSetStateFrequencies(saved, 0, freqs);
+
+    std::vector<double> weights(patternCount);
+    for (int i = 0; i < patternCount; i++)
+        weights[i] = 1 + i % 3;
+    beagleSetPatternWeights(saved, &weights[0]);
+
+    double rates[categoryCount] = { 0.3, 1.0, 1.7 };
+    double categoryWeights[categoryCount] = { 0.25, 0.5, 0.25 };
+    beagleSetCategoryRates(saved, rates);
+    beagleSetCategoryWeights(saved, 0, categoryWeights);
+
+    double edgeLengths[6] = { 0.1, 0.2, 0.15, 0.3, 0.05, 0.12 };
+    double logL = computeRoot(saved, edgeLengths);
+
+    int returnCode = beagleSaveInstanceState(saved, stateFile);
+    if (returnCode != BEAGLE_SUCCESS) {
+        fprintf(stderr, "%s: save failed with error %d\n", label, returnCode);
+        beagleFinalizeInstance(saved);
+        return 1;
+    }
+
+    int restored = createInstance(patternCount, precisionFlags);
+    returnCode = beagleRestoreInstanceState(restored, stateFile);
+    if (returnCode != BEAGLE_SUCCESS) {
+        fprintf(stderr, "%s: restore failed with error %d\n", label, returnCode);
+        failures++;
+    }
+
+    std::vector<double> savedSites(patternCount), restoredSites(patternCount);
+    beagleGetSiteLogLikelihoods(saved, &savedSites[0]);
+    beagleGetSiteLogLikelihoods(restored, &restoredSites[0]);
+    for (int i = 0; i < patternCount; i++) {
+        if (restoredSites[i] != savedSites[i]) {
+            fprintf(stderr, "%s: site %d log likelihood not restored\n", label, i);
+            failures++;
+            break;
+        }
+    }
+
+    // the root from the restored partials and scale factors alone
+    int rootIndex = 6, zero = 0, cumulativeIndex = 2;
+    double restoredLogL;
+    beagleCalculateRootLogLikelihoods(restored, &rootIndex, &zero, &zero, &cumulativeIndex, 1,
+                                      &restoredLogL);
+    snprintf(text, sizeof(text), "%s, restored logL", label);
+    failures += checkRelative(text, restoredLogL, logL, 1e-12);
+
+    // new edge lengths go through the restored eigen decomposition and category rates
+    for (int i = 0; i < 6; i++)
+        edgeLengths[i] *= 1.5;
+    beagleResetScaleFactors(saved, cumulativeIndex);
+    beagleResetScaleFactors(restored, cumulativeIndex);
+    snprintf(text, sizeof(text), "%s, continued logL", label);
+    failures += checkRelative(text, computeRoot(restored, edgeLengths), computeRoot(saved, edgeLengths), 1e-12);
+
+    beagleFinalizeInstance(saved);
+    beagleFinalizeInstance(restored);
+
+    return failures;
+}
+
+} // namespace
+
+int runCheckpointTests() {
+
+    int failures = 0;
+
+    failures += checkSaveRestore("double", BEAGLE_FLAG_PRECISION_DOUBLE);
+    // scale factors, weights and frequencies of mixed precision are held in double
+    failures += checkSaveRestore("mixed", BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_DOUBLE);
+
+    // a state of another shape
+    int other = createInstance(patternCount + 1, BEAGLE_FLAG_PRECISION_DOUBLE);
+    int returnCode = beagleRestoreInstanceState(other, stateFile);
+    if (returnCode != BEAGLE_ERROR_OUT_OF_RANGE) {
+        fprintf(stderr, "mismatched restore not rejected (%d)\n", returnCode);
+        failures++;
+    }
+
+    remove(stateFile);
+    beagleFinalizeInstance(other);
+
+    return failures;
+}
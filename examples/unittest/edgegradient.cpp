@@ -0,0 +1,327 @@
+/*
+ *  edgegradient.cpp
+ *  BEAGLE
+ *
+ *  Checks that beagleCalculateEdgeGradients gives the branch-length gradient and diagonal
+ *  Hessian of the root log likelihood by finite differences with per-edge category weights and
+ *  rates, agrees with beagleCalculateEdgeDerivatives, and is unchanged by threading; and that
+ *  beagleCalculateParameterGradients gives the derivatives with respect to rate multipliers of
+ *  Q in all categories and in one category.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <vector>
+
+#include "unittest.h"
+
+namespace {
+
+const int stateCount = 4;
+const int patternCount = 1400;
+const int categoryCount = 2;
+const int tipCount = 4;
+const int edgeCount = 6;
+const int rootPre = 7;
+
+/*
+ * Tree ((0,1)4,(2,3)5)6 with matrix c for the edge above node c. Pre-order partials of node c
+ * are in buffer 8 + c, with buffer 7 at the root; differential matrices are 6 (Q), 7 (Q Q),
+ * 8 (Q scaled by the rates of categoryRates 1) and 9 (Q in the second category only).
+ */
+BeagleOperation postorder[3] = {
+    { 4, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 0, 0, 1, 1 },
+    { 5, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 2, 2, 3, 3 },
+    { 6, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 4, 4, 5, 5 } };
+BeagleOperation preorder[6] = {
+    { 12, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 7, 4, 5, 5 },
+    { 13, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 7, 5, 4, 4 },
+    {  8, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 12, 0, 1, 1 },
+    {  9, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 12, 1, 0, 0 },
+    { 10, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 13, 2, 3, 3 },
+    { 11, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 13, 3, 2, 2 } };
+int postBuffers[edgeCount] = { 0, 1, 2, 3, 4, 5 };
+int preBuffers[edgeCount] = { 8, 9, 10, 11, 12, 13 };
+int edgeMatrices[edgeCount] = { 0, 1, 2, 3, 4, 5 };
+
+double freqs[stateCount] = { 0.3, 0.2, 0.15, 0.35 };
+
+int createInstance(long preferenceFlags) {
+    int instance = createCPUInstance(tipCount, 14, 2, stateCount, patternCount, 2, 10, categoryCount, 0,
+                                     preferenceFlags);
+    if (instance < 0)
+        return instance;
+
+    // tips 0 and 2 have states, some missing, and tips 1 and 3 partials
+    srand(7);
+    std::vector<int> states(patternCount);
+    std::vector<double> partials(stateCount * patternCount);
+    for (int t = 0; t < tipCount; t++) {
+        if (t % 2 == 0) {
+            for (int i = 0; i < patternCount; i++)
+                states[i] = rand() % (stateCount + 1);
+            beagleSetTipStates(instance, t, &states[0]);
+        } else {
+            for (int i = 0; i < stateCount * patternCount; i++)
+                partials[i] = 0.05 + rand() / (double) RAND_MAX;
+            beagleSetTipPartials(instance, t, &partials[0]);
+        }
+    }
+
+    std::vector<double> patternWeights(patternCount);
+    for (int i = 0; i < patternCount; i++)
+        patternWeights[i] = 1 + i % 3;
+    beagleSetPatternWeights(instance, &patternWeights[0]);
+
+    // reversible Q = S diag(freqs), with unit diagonal of S
+    const int n = stateCount;
+    double q[stateCount * stateCount], qq[stateCount * stateCount];
+    double s[stateCount * stateCount] = {
+        0.0, 1.2, 3.1, 0.7,
+        1.2, 0.0, 0.9, 2.6,
+        3.1, 0.9, 0.0, 1.1,
+        0.7, 2.6, 1.1, 0.0 };
+    for (int i = 0; i < n; i++) {
+        double sum = 0.0;
+        for (int j = 0; j < n; j++) {
+            q[i * n + j] = s[i * n + j] * freqs[j];
+            sum += q[i * n + j];
+        }
+        q[i * n + i] = -sum;
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            qq[i * n + j] = 0.0;
+            for (int k = 0; k < n; k++)
+                qq[i * n + j] += q[i * n + k] * q[k * n + j];
+        }
+    }
+    beagleSetRateMatrix(instance, 0, q, freqs);
+    beagleSetStateFrequencies(instance, 0, freqs);
+
+    double rates[categoryCount] = { 1.0, 1.0 };
+    double gammaRates[categoryCount] = { 0.4, 1.6 };
+    double weights[categoryCount] = { 0.5, 0.5 };
+    double gammaWeights[categoryCount] = { 0.7, 0.3 };
+    beagleSetCategoryRatesWithIndex(instance, 0, rates);
+    beagleSetCategoryRatesWithIndex(instance, 1, gammaRates);
+    beagleSetCategoryWeights(instance, 0, weights);
+    beagleSetCategoryWeights(instance, 1, gammaWeights);
+
+    std::vector<double> matrices(n * n * categoryCount);
+    for (int c = 0; c < categoryCount; c++) {
+        for (int i = 0; i < n * n; i++)
+            matrices[c * n * n + i] = q[i];
+    }
+    beagleSetTransitionMatrix(instance, 6, &matrices[0], 0.0);
+    for (int c = 0; c < categoryCount; c++) {
+        for (int i = 0; i < n * n; i++)
+            matrices[c * n * n + i] = qq[i];
+    }
+    beagleSetTransitionMatrix(instance, 7, &matrices[0], 0.0);
+    for (int c = 0; c < categoryCount; c++) {
+        for (int i = 0; i < n * n; i++)
+            matrices[c * n * n + i] = q[i] * gammaRates[c];
+    }
+    beagleSetTransitionMatrix(instance, 8, &matrices[0], 0.0);
+    for (int i = 0; i < n * n; i++) {
+        matrices[i] = 0.0;
+        matrices[n * n + i] = q[i];
+    }
+    beagleSetDifferentialMatrix(instance, 9, &matrices[0]);
+
+    // the root prior of the pre-order traversal
+    std::vector<double> root(stateCount * patternCount * categoryCount);
+    for (size_t i = 0; i < root.size(); i++)
+        root[i] = freqs[i % stateCount];
+    beagleSetPartials(instance, rootPre, &root[0]);
+
+    return instance;
+}
+
+// edge matrices under categoryRates 1
+void updateMatrices(int instance, const double* edgeLengths) {
+    int eigenIndices[edgeCount] = { 0, 0, 0, 0, 0, 0 };
+    int rateIndices[edgeCount] = { 1, 1, 1, 1, 1, 1 };
+    beagleUpdateTransitionMatricesWithMultipleModels(instance, eigenIndices, rateIndices, edgeMatrices,
+                                                     NULL, NULL, edgeLengths, edgeCount);
+}
+
+// root log likelihood under categoryWeights 1
+double logLikelihood(int instance, const double* edgeLengths) {
+    updateMatrices(instance, edgeLengths);
+    beagleUpdatePartials(instance, postorder, 3, BEAGLE_OP_NONE);
+    int rootIndex = 6, weightsIndex = 1, frequenciesIndex = 0, scaleIndex = BEAGLE_OP_NONE;
+    double logL;
+    beagleCalculateRootLogLikelihoods(instance, &rootIndex, &weightsIndex, &frequenciesIndex,
+                                      &scaleIndex, 1, &logL);
+    return logL;
+}
+
+} // namespace
+
+int runEdgeGradientTests() {
+
+    int failures = 0;
+
+    int instance = createInstance(0);
+    if (instance < 0) {
+        fprintf(stderr, "failed to create instance\n");
+        return 1;
+    }
+
+    double edgeLengths[edgeCount] = { 0.12, 0.3, 0.05, 0.22, 0.17, 0.09 };
+    int differential[edgeCount] = { 6, 6, 6, 6, 6, 6 };
+    int secondDifferential[edgeCount] = { 7, 7, 7, 7, 7, 7 };
+    int weightsIndices[edgeCount] = { 1, 1, 1, 1, 1, 1 };
+    int ratesIndices[edgeCount] = { 1, 1, 1, 1, 1, 1 };
+
+    updateMatrices(instance, edgeLengths);
+    double gradient[edgeCount], hessian[edgeCount];
+    int returnCode = beagleCalculateEdgeGradients(instance, postorder, 3, preorder, 6,
+                                                  postBuffers, preBuffers, differential,
+                                                  secondDifferential, weightsIndices, ratesIndices,
+                                                  edgeCount, gradient, hessian);
+    if (returnCode != BEAGLE_SUCCESS) {
+        fprintf(stderr, "gradient failed with error %d\n", returnCode);
+        return 1;
+    }
+
+    // multipliers of Q in both categories and in the second, from the same partials
+    int parameterMatrices[2] = { 6, 9 };
+    double parameterGradient[2];
+    returnCode = beagleCalculateParameterGradients(instance, postBuffers, preBuffers, ratesIndices,
+                                                   weightsIndices, edgeLengths, edgeCount,
+                                                   parameterMatrices, 2, parameterGradient);
+    if (returnCode != BEAGLE_SUCCESS) {
+        fprintf(stderr, "parameter gradient failed with error %d\n", returnCode);
+        return 1;
+    }
+
+    // central differences of the root log likelihood
+    const double h = 1e-4;
+    const double centre = logLikelihood(instance, edgeLengths);
+    double gradientError = 0.0, hessianError = 0.0;
+    for (int e = 0; e < edgeCount; e++) {
+        double shifted[edgeCount];
+        for (int i = 0; i < edgeCount; i++)
+            shifted[i] = edgeLengths[i];
+        shifted[e] = edgeLengths[e] + h;
+        const double plus = logLikelihood(instance, shifted);
+        shifted[e] = edgeLengths[e] - h;
+        const double minus = logLikelihood(instance, shifted);
+        gradientError = std::max(gradientError,
+                                 fabs((plus - minus) / (2 * h) - gradient[e]) / (1.0 + fabs(gradient[e])));
+        hessianError = std::max(hessianError,
+                                fabs((plus - 2 * centre + minus) / (h * h) - hessian[e]) / (1.0 + fabs(hessian[e])));
+    }
+    failures += check("gradient", gradientError, 1e-6);
+    failures += check("diagonal Hessian", hessianError, 1e-3);
+
+    // an overall rate scales every edge length
+    double rateSum = 0.0;
+    for (int e = 0; e < edgeCount; e++)
+        rateSum += edgeLengths[e] * gradient[e];
+    double scaledLengths[2][edgeCount];
+    for (int e = 0; e < edgeCount; e++) {
+        scaledLengths[0][e] = edgeLengths[e] * (1.0 + h);
+        scaledLengths[1][e] = edgeLengths[e] * (1.0 - h);
+    }
+    const double rateDifference = (logLikelihood(instance, scaledLengths[0]) -
+                                   logLikelihood(instance, scaledLengths[1])) / (2 * h);
+    failures += check("overall rate", std::max(fabs(parameterGradient[0] - rateSum),
+                                               fabs(parameterGradient[0] - rateDifference)) /
+                                      (1.0 + fabs(rateSum)), 1e-6);
+
+    double shiftedRates[2][categoryCount] = { { 0.4, 1.6 + h }, { 0.4, 1.6 - h } };
+    double shiftedLogL[2];
+    for (int i = 0; i < 2; i++) {
+        beagleSetCategoryRatesWithIndex(instance, 1, shiftedRates[i]);
+        shiftedLogL[i] = logLikelihood(instance, edgeLengths);
+    }
+    double gammaRates[categoryCount] = { 0.4, 1.6 };
+    beagleSetCategoryRatesWithIndex(instance, 1, gammaRates);
+    // a multiplier of Q in the second category moves its rate r by r times as much
+    const double categoryDifference = gammaRates[1] * (shiftedLogL[0] - shiftedLogL[1]) / (2 * h);
+    failures += check("category rate", fabs(parameterGradient[1] - categoryDifference) /
+                                       (1.0 + fabs(parameterGradient[1])), 1e-6);
+
+    // beagleCalculateEdgeDerivatives with rate-scaled matrices and weights 1 moved to buffer 0
+    double gammaWeights[categoryCount] = { 0.7, 0.3 };
+    beagleSetCategoryWeights(instance, 0, gammaWeights);
+    updateMatrices(instance, edgeLengths);
+    beagleUpdatePartials(instance, postorder, 3, BEAGLE_OP_NONE);
+    beagleUpdatePrePartials(instance, preorder, 6, BEAGLE_OP_NONE);
+    int scaled[edgeCount] = { 8, 8, 8, 8, 8, 8 };
+    int zero = 0;
+    double sums[edgeCount], scaledGradient[edgeCount];
+    beagleCalculateEdgeDerivatives(instance, postBuffers, preBuffers, scaled, &zero, edgeCount,
+                                   NULL, sums, NULL);
+    beagleCalculateEdgeGradients(instance, NULL, 0, NULL, 0, postBuffers, preBuffers, scaled, NULL,
+                                 weightsIndices, NULL, edgeCount, scaledGradient, NULL);
+    double edgeDerivativesError = 0.0, scaledError = 0.0;
+    for (int e = 0; e < edgeCount; e++) {
+        edgeDerivativesError = std::max(edgeDerivativesError, fabs(sums[e] - gradient[e]));
+        scaledError = std::max(scaledError, fabs(scaledGradient[e] - gradient[e]));
+    }
+    failures += check("edge derivatives", edgeDerivativesError, 1e-9);
+    failures += check("scaled matrices", scaledError, 1e-9);
+
+    // bad arguments
+    int badMatrix[edgeCount] = { 6, 6, 6, 6, 6, 10 };
+    if (beagleCalculateEdgeGradients(instance, NULL, 0, NULL, 0, postBuffers, preBuffers, badMatrix, NULL,
+                                     weightsIndices, NULL, edgeCount, gradient, NULL) != BEAGLE_ERROR_OUT_OF_RANGE ||
+        beagleCalculateEdgeGradients(instance, NULL, 0, NULL, 0, postBuffers, preBuffers, differential,
+                                     secondDifferential, weightsIndices, NULL, edgeCount, gradient,
+                                     NULL) != BEAGLE_ERROR_OUT_OF_RANGE ||
+        beagleCalculateParameterGradients(instance, postBuffers, preBuffers, NULL, weightsIndices,
+                                          edgeLengths, edgeCount, &badMatrix[5], 1,
+                                          gradient) != BEAGLE_ERROR_OUT_OF_RANGE) {
+        fprintf(stderr, "bad arguments not rejected\n");
+        failures++;
+    }
+    beagleFinalizeInstance(instance);
+
+    // blocks of patterns split across threads are summed in the same order
+    int serial = createInstance(0);
+    int threaded = createInstance(BEAGLE_FLAG_THREADING_CPP);
+    // pattern partitions start one worker thread each, whatever the hardware
+    std::vector<int> partitions(patternCount);
+    for (int i = 0; i < patternCount; i++)
+        partitions[i] = i * 4 / patternCount;
+    beagleSetPatternPartitions(threaded, 4, &partitions[0]);
+    double threadedGradient[2][edgeCount], threadedHessian[2][edgeCount];
+    double threadedParameters[2][2];
+    for (int i = 0; i < 2; i++) {
+        int target = (i == 0 ? serial : threaded);
+        updateMatrices(target, edgeLengths);
+        beagleCalculateEdgeGradients(target, postorder, 3, preorder, 6, postBuffers, preBuffers,
+                                     differential, secondDifferential, weightsIndices, ratesIndices,
+                                     edgeCount, threadedGradient[i], threadedHessian[i]);
+        beagleCalculateParameterGradients(target, postBuffers, preBuffers, ratesIndices, weightsIndices,
+                                          edgeLengths, edgeCount, parameterMatrices, 2,
+                                          threadedParameters[i]);
+    }
+    double threadedError = 0.0;
+    for (int e = 0; e < edgeCount; e++) {
+        threadedError = std::max(threadedError, fabs(threadedGradient[1][e] - threadedGradient[0][e]));
+        threadedError = std::max(threadedError, fabs(threadedHessian[1][e] - threadedHessian[0][e]));
+    }
+    failures += check("threaded", threadedError, 0.0);
+    // cross products of each thread are summed in the order of the threads
+    double threadedParameterError = 0.0;
+    for (int d = 0; d < 2; d++)
+        threadedParameterError = std::max(threadedParameterError,
+                                          fabs(threadedParameters[1][d] - threadedParameters[0][d]) /
+                                          fabs(threadedParameters[0][d]));
+    failures += check("threaded parameters", threadedParameterError, 1e-12);
+    beagleFinalizeInstance(serial);
+    beagleFinalizeInstance(threaded);
+
+    return failures;
+}
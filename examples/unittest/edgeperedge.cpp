@@ -0,0 +1,177 @@
+/*
+ *  edgeperedge.cpp
+ *  BEAGLE
+ *
+ *  Compares beagleCalculateEdgeLogLikelihoodsPerEdge against one
+ *  beagleCalculateEdgeLogLikelihoods call per edge, for log likelihoods
+ *  and first and second derivatives with manual rescaling, unthreaded
+ *  and with OpenMP pattern blocks.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <stdio.h>
+#include <cmath>
+#include <vector>
+
+#include "unittest.h"
+
+namespace {
+
+const int edgeCount = 12;
+
+struct Results {
+    std::vector<double> logL;
+    std::vector<double> firstDerivatives;
+    std::vector<double> secondDerivatives;
+
+    void resize(int count) {
+        logL.resize(count);
+        firstDerivatives.resize(count);
+        secondDerivatives.resize(count);
+    }
+};
+
+int runInstance(const BalancedTree& tree, long requirementFlags, int threadCount,
+                Results* perEdge, Results* reference) {
+    const int nodeCount = 2 * tree.tipCount - 1;
+    const int internalCount = tree.tipCount - 1;
+
+    int instance = createTreeInstance(tree, 0, 3 * nodeCount, 0, requirementFlags);
+    if (instance < 0)
+        return instance;
+
+    if (threadCount > 1)
+        beagleSetCPUThreadCount(instance, threadCount);
+
+    setJCTransitionMatrices(instance, tree, true);
+
+    int cumulativeIndex = internalCount;
+    beagleResetScaleFactors(instance, cumulativeIndex);
+    beagleUpdatePartials(instance, &tree.operations[0], (int) tree.operations.size(), cumulativeIndex);
+
+    // Edges need not be consistent with the tree; parents are internal partials, children mix tips and partials
+    int parents[edgeCount], children[edgeCount];
+    int matrices[edgeCount], firstDerivs[edgeCount], secondDerivs[edgeCount];
+    int weightIndices[edgeCount], freqIndices[edgeCount], scaleIndices[edgeCount];
+    for (int e = 0; e < edgeCount; e++) {
+        parents[e] = tree.tipCount + (e * 5) % internalCount;
+        children[e] = (e * 7 + 3) % (nodeCount - 1);
+        if (children[e] == parents[e])
+            children[e] = (children[e] + 1) % (nodeCount - 1);
+        matrices[e] = children[e];
+        firstDerivs[e] = nodeCount + children[e];
+        secondDerivs[e] = 2 * nodeCount + children[e];
+        weightIndices[e] = 0;
+        freqIndices[e] = 0;
+        scaleIndices[e] = cumulativeIndex;
+    }
+
+    perEdge->resize(edgeCount);
+    int returnCode = beagleCalculateEdgeLogLikelihoodsPerEdge(instance, parents, children, matrices,
+                                                              firstDerivs, secondDerivs,
+                                                              weightIndices, freqIndices, scaleIndices,
+                                                              edgeCount, &perEdge->logL[0],
+                                                              &perEdge->firstDerivatives[0],
+                                                              &perEdge->secondDerivatives[0]);
+
+    // Log likelihoods alone must not depend on whether derivatives were requested
+    std::vector<double> logLOnly(edgeCount);
+    if (returnCode == BEAGLE_SUCCESS)
+        returnCode = beagleCalculateEdgeLogLikelihoodsPerEdge(instance, parents, children, matrices,
+                                                              NULL, NULL, weightIndices, freqIndices,
+                                                              scaleIndices, edgeCount, &logLOnly[0],
+                                                              NULL, NULL);
+    if (returnCode == BEAGLE_SUCCESS && logLOnly != perEdge->logL)
+        returnCode = BEAGLE_ERROR_GENERAL;
+
+    reference->resize(edgeCount);
+    for (int e = 0; e < edgeCount && returnCode == BEAGLE_SUCCESS; e++) {
+        returnCode = beagleCalculateEdgeLogLikelihoods(instance, &parents[e], &children[e], &matrices[e],
+                                                       &firstDerivs[e], &secondDerivs[e],
+                                                       &weightIndices[e], &freqIndices[e], &scaleIndices[e],
+                                                       1, &reference->logL[e],
+                                                       &reference->firstDerivatives[e],
+                                                       &reference->secondDerivatives[e]);
+    }
+
+    beagleFinalizeInstance(instance);
+
+    return returnCode;
+}
+
+bool differs(double expected, double actual, double tolerance) {
+    return fabs(expected - actual) > tolerance * (1.0 + fabs(expected));
+}
+
+int compare(const char* label, const Results& perEdge, const Results& reference, double tolerance) {
+    int failures = 0;
+
+    printf("%s: edge 0 = %.10f / %.10f\td1 = %.10f / %.10f\td2 = %.10f / %.10f\n", label,
+           reference.logL[0], perEdge.logL[0],
+           reference.firstDerivatives[0], perEdge.firstDerivatives[0],
+           reference.secondDerivatives[0], perEdge.secondDerivatives[0]);
+
+    for (int e = 0; e < edgeCount; e++) {
+        if (differs(reference.logL[e], perEdge.logL[e], tolerance) ||
+            differs(reference.firstDerivatives[e], perEdge.firstDerivatives[e], tolerance) ||
+            differs(reference.secondDerivatives[e], perEdge.secondDerivatives[e], tolerance)) {
+            fprintf(stderr, "%s: edge %d differs from single-edge evaluation\n", label, e);
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+} // namespace
+
+int runEdgePerEdgeTests() {
+
+    int stateCounts[2] = { 4, 20 };
+    long precisions[2] = { BEAGLE_FLAG_PRECISION_DOUBLE, BEAGLE_FLAG_PRECISION_SINGLE };
+    long vectors[2] = { BEAGLE_FLAG_VECTOR_NONE, BEAGLE_FLAG_VECTOR_SSE };
+    long threadings[2] = { BEAGLE_FLAG_THREADING_NONE, BEAGLE_FLAG_THREADING_OPENMP };
+    const char* labels[2][2] = { { "double", "double-sse" }, { "single", "single-sse" } };
+
+    int failures = 0;
+    int comparisons = 0;
+
+    for (int s = 0; s < 2; s++) {
+        BalancedTree tree = makeBalancedTree(16, 601, stateCounts[s], 13, 70, 3);
+        for (int p = 0; p < 2; p++) {
+            for (int v = 0; v < 2; v++) {
+                for (int t = 0; t < 2; t++) {
+                    Results perEdge, reference;
+                    long flags = precisions[p] | vectors[v] | threadings[t];
+
+                    int returnCode = runInstance(tree, flags, (t == 0 ? 1 : 4), &perEdge, &reference);
+                    if (returnCode == BEAGLE_ERROR_NO_RESOURCE || returnCode == BEAGLE_ERROR_NO_IMPLEMENTATION)
+                        continue;
+
+                    char label[64];
+                    snprintf(label, sizeof(label), "%d-state %s%s", stateCounts[s], labels[p][v],
+                             (t == 0 ? "" : " openmp"));
+
+                    if (returnCode != BEAGLE_SUCCESS) {
+                        fprintf(stderr, "%s: failed with error %d\n", label, returnCode);
+                        failures++;
+                        continue;
+                    }
+
+                    failures += compare(label, perEdge, reference, (p == 0 ? 1e-10 : 1e-3));
+                    comparisons++;
+                }
+            }
+        }
+    }
+
+    if (comparisons == 0) {
+        fprintf(stderr, "failed to create any instances\n");
+        return 1;
+    }
+
+    return failures;
+}
@@ -0,0 +1,176 @@
+/*
+ *  epochmatrix.cpp
+ *  BEAGLE
+ *
+ *  Checks that beagleUpdateEpochTransitionMatrices gives the same matrices as
+ *  per-segment beagleUpdateTransitionMatrices calls followed by
+ *  beagleConvolveTransitionMatrices, that its derivatives match finite
+ *  differences in the branch length, and that threaded products agree.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <vector>
+
+#include "unittest.h"
+
+namespace {
+
+const int categoryCount = 2;
+const int matrixCount = 12;
+
+int createInstance(int stateCount, int patternCount, long preferenceFlags) {
+    int instance = createCPUInstance(2, 3, 0, stateCount, patternCount, 2, matrixCount, categoryCount, 0,
+                                     preferenceFlags);
+    if (instance < 0)
+        return instance;
+
+    // two epochs with different random reversible rate matrices
+    const int n = stateCount;
+    srand(5);
+    std::vector<double> q(n * n), freqs(n, 1.0 / n);
+    for (int e = 0; e < 2; e++) {
+        for (int i = 0; i < n; i++) {
+            for (int j = i + 1; j < n; j++)
+                q[i * n + j] = q[j * n + i] = (e + 1) * (0.2 + rand() / (double) RAND_MAX);
+        }
+        for (int i = 0; i < n; i++) {
+            double sum = 0.0;
+            for (int j = 0; j < n; j++) {
+                if (j != i)
+                    sum += q[i * n + j];
+            }
+            q[i * n + i] = -sum;
+        }
+        beagleSetRateMatrix(instance, e, &q[0], &freqs[0]);
+    }
+
+    double rates[categoryCount] = { 0.4, 1.6 };
+    double slowRates[categoryCount] = { 0.2, 0.8 };
+    beagleSetCategoryRatesWithIndex(instance, 0, rates);
+    beagleSetCategoryRatesWithIndex(instance, 1, slowRates);
+
+    return instance;
+}
+
+} // namespace
+
+int runEpochMatrixTests() {
+
+    int failures = 0;
+    const int n = 4;
+
+    int instance = createInstance(n, 10, 0);
+    if (instance < 0) {
+        fprintf(stderr, "failed to create instance\n");
+        return 1;
+    }
+
+    // branch 0: segments (eigen 0, 0.1) (eigen 1, 0.25) (eigen 0 with rates 1, 0.05)
+    // branch 1: one segment (eigen 1, 0.3)
+    int segmentCounts[2] = { 3, 1 };
+    int eigenIndices[4] = { 0, 1, 0, 1 };
+    int rateIndices[4] = { 0, 0, 1, 0 };
+    double lengths[4] = { 0.1, 0.25, 0.05, 0.3 };
+    int probabilityIndices[2] = { 0, 1 };
+    int firstDerivativeIndices[2] = { 2, 3 };
+    int secondDerivativeIndices[2] = { 4, 5 };
+
+    int returnCode = beagleUpdateEpochTransitionMatrices(instance, segmentCounts, eigenIndices, rateIndices,
+                                                         lengths, probabilityIndices,
+                                                         firstDerivativeIndices, secondDerivativeIndices, 2);
+    if (returnCode != BEAGLE_SUCCESS) {
+        fprintf(stderr, "epoch update failed with error %d\n", returnCode);
+        return 1;
+    }
+
+    // the same matrices segment by segment
+    int segmentMatrices[4] = { 6, 7, 8, 11 };
+    beagleUpdateTransitionMatricesWithMultipleModels(instance, eigenIndices, rateIndices, segmentMatrices,
+                                                     NULL, NULL, lengths, 4);
+    int first[2] = { 6, 9 }, second[2] = { 7, 8 }, result[2] = { 9, 10 };
+    beagleConvolveTransitionMatrices(instance, &first[0], &second[0], &result[0], 1);
+    beagleConvolveTransitionMatrices(instance, &first[1], &second[1], &result[1], 1);
+    const int size = n * n * categoryCount;
+    failures += check("three segments", maxMatrixDifference(instance, 0, instance, 10, size), 1e-14);
+
+    // one segment is an ordinary matrix with its derivatives
+    int single[3] = { 9, 10, 11 };
+    beagleUpdateTransitionMatrices(instance, 1, &single[0], &single[1], &single[2], &lengths[3], 1);
+    for (int d = 0; d < 3; d++)
+        failures += check("one segment", maxMatrixDifference(instance, 1 + 2 * d, instance, single[d], size), 1e-14);
+
+    // derivatives of branch 0 by central differences, scaling all of its segments
+    const double h = 1e-4;
+    for (int sign = -1; sign <= 1; sign += 2) {
+        double scaled[3];
+        for (int s = 0; s < 3; s++)
+            scaled[s] = lengths[s] * (1.0 + sign * h / 0.4);
+        int target = (sign < 0 ? 9 : 10);
+        beagleUpdateEpochTransitionMatrices(instance, segmentCounts, eigenIndices, rateIndices, scaled,
+                                            &target, NULL, NULL, 1);
+    }
+    std::vector<double> minus(size), plus(size), centre(size), d1(size), d2(size);
+    beagleGetTransitionMatrix(instance, 9, &minus[0]);
+    beagleGetTransitionMatrix(instance, 10, &plus[0]);
+    beagleGetTransitionMatrix(instance, 0, &centre[0]);
+    beagleGetTransitionMatrix(instance, 2, &d1[0]);
+    beagleGetTransitionMatrix(instance, 4, &d2[0]);
+    double firstError = 0.0, secondError = 0.0;
+    for (int i = 0; i < size; i++) {
+        firstError = std::max(firstError, fabs((plus[i] - minus[i]) / (2 * h) - d1[i]));
+        secondError = std::max(secondError, fabs((plus[i] - 2 * centre[i] + minus[i]) / (h * h) - d2[i]));
+    }
+    failures += check("first derivative", firstError, 1e-6);
+    failures += check("second derivative", secondError, 1e-4);
+
+    // bad arguments
+    int noSegments[2] = { 0, 1 };
+    if (beagleUpdateEpochTransitionMatrices(instance, noSegments, eigenIndices, NULL, lengths,
+                                            probabilityIndices, NULL, NULL, 2) != BEAGLE_ERROR_OUT_OF_RANGE ||
+        beagleUpdateEpochTransitionMatrices(instance, segmentCounts, eigenIndices, NULL, lengths,
+                                            probabilityIndices, NULL, secondDerivativeIndices, 2) != BEAGLE_ERROR_OUT_OF_RANGE) {
+        fprintf(stderr, "bad arguments not rejected\n");
+        failures++;
+    }
+    beagleFinalizeInstance(instance);
+
+    // threaded products over many branches with many states
+    const int states = 48, branches = 4;
+    int serial = createInstance(states, 64, 0);
+    int threaded = createInstance(states, 64, BEAGLE_FLAG_THREADING_CPP);
+    // pattern partitions start one worker thread each, whatever the hardware
+    std::vector<int> partitions(64);
+    for (int i = 0; i < 64; i++)
+        partitions[i] = i / 16;
+    beagleSetPatternPartitions(threaded, 4, &partitions[0]);
+    std::vector<int> counts(branches, 3), eigens(3 * branches), outputs(branches), derivatives(branches);
+    std::vector<double> segmentLengths(3 * branches);
+    for (int s = 0; s < 3 * branches; s++) {
+        eigens[s] = s % 2;
+        segmentLengths[s] = 0.02 * (1 + s);
+    }
+    for (int b = 0; b < branches; b++) {
+        outputs[b] = b;
+        derivatives[b] = branches + b;
+    }
+    for (int i = 0; i < 2; i++) {
+        int target = (i == 0 ? serial : threaded);
+        beagleUpdateEpochTransitionMatrices(target, &counts[0], &eigens[0], NULL, &segmentLengths[0],
+                                            &outputs[0], &derivatives[0], NULL, branches);
+    }
+    double threadedError = 0.0;
+    for (int m = 0; m < 2 * branches; m++)
+        threadedError = std::max(threadedError, maxMatrixDifference(threaded, m, serial, m,
+                                                                    states * states * categoryCount));
+    failures += check("threaded", threadedError, 0.0);
+    beagleFinalizeInstance(serial);
+    beagleFinalizeInstance(threaded);
+
+    return failures;
+}
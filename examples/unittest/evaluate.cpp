@@ -0,0 +1,168 @@
+/*
+ *  evaluate.cpp
+ *  BEAGLE
+ *
+ *  Checks that beagleEvaluate command streams give the same root and edge
+ *  log likelihoods and edge derivatives as the equivalent separate calls,
+ *  with merged matrix and partials commands and scale accumulation, and
+ *  that malformed streams are rejected.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "unittest.h"
+
+namespace {
+
+const int stateCount = 4;
+const int patternCount = 53;
+const int categoryCount = 2;
+const int tipCount = 5;
+
+/* Tree (((0,1)5,(2,3)6)7,4), matrix c for child c, derivatives of matrix 4 in 8 and 9. */
+int createInstance() {
+    const int n = stateCount;
+    int instance = createCPUInstance(tipCount, 2 * tipCount - 2, 0, n, patternCount, 1, 10,
+                                     categoryCount, 4, BEAGLE_FLAG_SCALING_MANUAL);
+    if (instance < 0)
+        return instance;
+
+    srand(7);
+    std::vector<double> partials(n * patternCount);
+    for (int t = 0; t < tipCount; t++) {
+        for (int i = 0; i < n * patternCount; i++)
+            partials[i] = rand() / (double) RAND_MAX;
+        beagleSetTipPartials(instance, t, &partials[0]);
+    }
+
+    std::vector<double> q(n * n, 1.0 / (n - 1)), freqs(n, 1.0 / n), weights(patternCount, 1.0);
+    for (int i = 0; i < n; i++)
+        q[i * n + i] = -1.0;
+    beagleSetRateMatrix(instance, 0, &q[0], &freqs[0]);
+    beagleSetStateFrequencies(instance, 0, &freqs[0]);
+    beagleSetPatternWeights(instance, &weights[0]);
+
+    double rates[categoryCount] = { 0.5, 1.5 };
+    double categoryWeights[categoryCount] = { 0.5, 0.5 };
+    beagleSetCategoryRates(instance, rates);
+    beagleSetCategoryWeights(instance, 0, categoryWeights);
+
+    return instance;
+}
+
+} // namespace
+
+int runEvaluateTests() {
+
+    int failures = 0;
+
+    int reference = createInstance();
+    int instance = createInstance();
+    if (reference < 0 || instance < 0) {
+        fprintf(stderr, "failed to create instance\n");
+        return 1;
+    }
+
+    double edgeLengths[7] = { 0.1, 0.2, 0.15, 0.3, 0.05, 0.12, 0.25 };
+    int probabilityIndices[6] = { 0, 1, 2, 3, 5, 6 };
+    int edgeIndices[3] = { 4, 8, 9 };
+    int operations[3 * BEAGLE_OP_COUNT] = {
+        5, 0, BEAGLE_OP_NONE, 0, 0, 1, 1,
+        6, 1, BEAGLE_OP_NONE, 2, 2, 3, 3,
+        7, 2, BEAGLE_OP_NONE, 5, 5, 6, 6 };
+    int scaleIndices[3] = { 0, 1, 2 };
+    int cumulativeIndex = 3;
+    int rootIndex = 7, tipIndex = 4, zero = 0;
+
+    // separate calls
+    double rootLogL, edgeLogL, firstDerivative, secondDerivative;
+    beagleUpdateTransitionMatrices(reference, 0, probabilityIndices, NULL, NULL, edgeLengths, 6);
+    beagleUpdateTransitionMatrices(reference, 0, &edgeIndices[0], &edgeIndices[1], &edgeIndices[2],
+                                   &edgeLengths[6], 1);
+    beagleUpdatePartials(reference, (BeagleOperation*) operations, 3, BEAGLE_OP_NONE);
+    beagleResetScaleFactors(reference, cumulativeIndex);
+    beagleAccumulateScaleFactors(reference, scaleIndices, 3, cumulativeIndex);
+    beagleCalculateRootLogLikelihoods(reference, &rootIndex, &zero, &zero, &cumulativeIndex, 1, &rootLogL);
+    beagleCalculateEdgeLogLikelihoods(reference, &rootIndex, &tipIndex, &edgeIndices[0], &edgeIndices[1],
+                                      &edgeIndices[2], &zero, &zero, &cumulativeIndex, 1,
+                                      &edgeLogL, &firstDerivative, &secondDerivative);
+
+    // the same sequence as one stream; the first two matrix commands and the two partials
+    // commands are merged
+    std::vector<int> commands;
+    int matrices[] = {
+        BEAGLE_COMMAND_UPDATE_TRANSITION_MATRICES, 0, 3, 0, 0, 1, 2,
+        BEAGLE_COMMAND_UPDATE_TRANSITION_MATRICES, 0, 3, 0, 3, 5, 6,
+        BEAGLE_COMMAND_UPDATE_TRANSITION_MATRICES, 0, 1, 2, 4, 8, 9 };
+    commands.insert(commands.end(), matrices, matrices + sizeof(matrices) / sizeof(int));
+    int partials[] = { BEAGLE_COMMAND_UPDATE_PARTIALS, 2, BEAGLE_OP_NONE };
+    commands.insert(commands.end(), partials, partials + 3);
+    commands.insert(commands.end(), operations, operations + 2 * BEAGLE_OP_COUNT);
+    partials[1] = 1;
+    commands.insert(commands.end(), partials, partials + 3);
+    commands.insert(commands.end(), operations + 2 * BEAGLE_OP_COUNT, operations + 3 * BEAGLE_OP_COUNT);
+    int scaling[] = {
+        BEAGLE_COMMAND_RESET_SCALE_FACTORS, 3,
+        BEAGLE_COMMAND_ACCUMULATE_SCALE_FACTORS, 3, 3, 0, 1, 2 };
+    commands.insert(commands.end(), scaling, scaling + sizeof(scaling) / sizeof(int));
+    const int prefixLength = (int) commands.size();
+
+    int root[] = { BEAGLE_COMMAND_ROOT_LOG_LIKELIHOODS, 1, 7, 0, 0, 3 };
+    commands.insert(commands.end(), root, root + sizeof(root) / sizeof(int));
+
+    double logL = 0.0, d1 = 0.0, d2 = 0.0;
+    int returnCode = beagleEvaluate(instance, &commands[0], (int) commands.size(), edgeLengths, 7,
+                                    &logL, &d1, &d2);
+    if (returnCode != BEAGLE_SUCCESS) {
+        fprintf(stderr, "root stream failed with error %d\n", returnCode);
+        failures++;
+    }
+    failures += checkRelative("root logL", logL, rootLogL, 1e-10);
+    if (d1 != 0.0 || d2 != 0.0) {
+        fprintf(stderr, "root stream wrote derivatives\n");
+        failures++;
+    }
+
+    commands.resize(prefixLength);
+    int edge[] = { BEAGLE_COMMAND_EDGE_LOG_LIKELIHOODS, 1, 2, 7, 4, 4, 8, 9, 0, 0, 3 };
+    commands.insert(commands.end(), edge, edge + sizeof(edge) / sizeof(int));
+
+    returnCode = beagleEvaluate(instance, &commands[0], (int) commands.size(), edgeLengths, 7,
+                                &logL, &d1, &d2);
+    if (returnCode != BEAGLE_SUCCESS) {
+        fprintf(stderr, "edge stream failed with error %d\n", returnCode);
+        failures++;
+    }
+    failures += checkRelative("edge logL", logL, edgeLogL, 1e-10);
+    failures += checkRelative("edge first derivative", d1, firstDerivative, 1e-10);
+    failures += checkRelative("edge second derivative", d2, secondDerivative, 1e-10);
+
+    // truncated stream, too few edge lengths, unknown command, bad derivative order
+    int badOrder[] = { BEAGLE_COMMAND_UPDATE_TRANSITION_MATRICES, 0, 1, 3, 0, 0, 0, 0 };
+    int unknown[] = { 99 };
+    struct { const int* commands; int length; int valueCount; } bad[4] = {
+        { &commands[0], (int) commands.size() - 1, 7 },
+        { &commands[0], (int) commands.size(), 6 },
+        { unknown, 1, 0 },
+        { badOrder, 8, 1 } };
+    for (int b = 0; b < 4; b++) {
+        logL = 1.0;
+        returnCode = beagleEvaluate(instance, bad[b].commands, bad[b].length, edgeLengths,
+                                    bad[b].valueCount, &logL, NULL, NULL);
+        if (returnCode != BEAGLE_ERROR_OUT_OF_RANGE || logL != 1.0) {
+            fprintf(stderr, "malformed stream %d not rejected (%d)\n", b, returnCode);
+            failures++;
+        }
+    }
+
+    beagleFinalizeInstance(reference);
+    beagleFinalizeInstance(instance);
+
+    return failures;
+}
@@ -0,0 +1,260 @@
+/*
+ *  fixedstate.cpp
+ *  BEAGLE
+ *
+ *  Compares the compile-time state count kernels (16, 20, 61 and 64 states) against
+ *  the generic CPU kernels, selected by setting BEAGLE_CPU_FIXED_STATES to 0, for
+ *  root and site log likelihoods and edge and site derivatives. Covers a pattern
+ *  count that fills no register block, gaps, tips set as states, partials or both,
+ *  rescaling and fixed scaling, and threaded pattern partitions.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "unittest.h"
+
+namespace {
+
+const int tipCount = 8;
+const int patternCount = 101;
+const int partitionCount = 4;
+const int nodeCount = 2 * tipCount - 1;
+const int edgeCount = 2;
+const double tolerance = 1e-10;
+
+struct Results {
+    double rootLogL;
+    std::vector<double> siteLogLs;
+    double edgeLogL[edgeCount];
+    double firstDerivatives[edgeCount];
+    double secondDerivatives[edgeCount];
+    std::vector<double> siteFirstDerivatives;   // of the last edge
+    std::vector<double> siteSecondDerivatives;
+};
+
+void setGenericKernels(bool generic) {
+#ifdef _WIN32
+    _putenv_s("BEAGLE_CPU_FIXED_STATES", (generic ? "0" : ""));
+#else
+    if (generic)
+        setenv("BEAGLE_CPU_FIXED_STATES", "0", 1);
+    else
+        unsetenv("BEAGLE_CPU_FIXED_STATES");
+#endif
+}
+
+/* The implementation chosen for a double-precision CPU instance, or an empty string if none. */
+std::string implementationName(int stateCount, bool generic, long vectorFlags = BEAGLE_FLAG_VECTOR_NONE) {
+    setGenericKernels(generic);
+    BeagleInstanceDetails instDetails;
+    int instance = beagleCreateInstance(2, 1, 2, stateCount, 1, 1, 2, 1, 0, NULL, 0, 0,
+                                        BEAGLE_FLAG_PRECISION_DOUBLE | vectorFlags |
+                                        BEAGLE_FLAG_PROCESSOR_CPU, &instDetails);
+    setGenericKernels(false);
+    if (instance < 0)
+        return std::string();
+    std::string name = instDetails.implName;
+    beagleFinalizeInstance(instance);
+    return name;
+}
+
+/* Post-order pass writing scale factors, or reading those of the previous pass. */
+void updatePartials(int instance, const BalancedTree& tree, bool partitioned, bool readScaling) {
+    const int cumulativeIndex = tipCount - 1;
+    const int writeCumulative = (readScaling ? BEAGLE_OP_NONE : cumulativeIndex);
+    if (!readScaling)
+        beagleResetScaleFactors(instance, cumulativeIndex);
+
+    std::vector<BeagleOperation> operations = tree.operations;
+    if (readScaling) {
+        for (size_t i = 0; i < operations.size(); i++) {
+            operations[i].destinationScaleRead = operations[i].destinationScaleWrite;
+            operations[i].destinationScaleWrite = BEAGLE_OP_NONE;
+        }
+    }
+
+    if (partitioned) {
+        std::vector<BeagleOperationByPartition> partitionOperations;
+        for (size_t i = 0; i < operations.size(); i++) {
+            for (int p = 0; p < partitionCount; p++) {
+                BeagleOperationByPartition operation = { operations[i].destinationPartials,
+                                                         operations[i].destinationScaleWrite,
+                                                         operations[i].destinationScaleRead,
+                                                         operations[i].child1Partials,
+                                                         operations[i].child1TransitionMatrix,
+                                                         operations[i].child2Partials,
+                                                         operations[i].child2TransitionMatrix,
+                                                         p, writeCumulative };
+                partitionOperations.push_back(operation);
+            }
+        }
+        beagleUpdatePartialsByPartition(instance, &partitionOperations[0], (int) partitionOperations.size());
+    } else {
+        beagleUpdatePartials(instance, &operations[0], (int) operations.size(), writeCumulative);
+    }
+}
+
+/*
+ * Root and site log likelihoods, then derivatives across the root edge and across the edge
+ * above tip 2, whose parent is taken to be the first internal node.
+ */
+int runInstance(const BalancedTree& tree, int partialsTipCount, bool generic, long preferenceFlags,
+                bool partitioned, bool fixedScaling, Results* results) {
+    setGenericKernels(generic);
+    int instance = createTreeInstance(tree, partialsTipCount, 3 * nodeCount, preferenceFlags,
+                                      BEAGLE_FLAG_PRECISION_DOUBLE | BEAGLE_FLAG_VECTOR_NONE);
+    setGenericKernels(false);
+    if (instance < 0)
+        return instance;
+
+    setJCTransitionMatrices(instance, tree, true);
+    if (partitioned)
+        setPatternPartitions(instance, tree.patternCount, partitionCount);
+
+    updatePartials(instance, tree, partitioned, false);
+    if (fixedScaling)
+        updatePartials(instance, tree, partitioned, true);
+
+    int cumulativeIndex = tipCount - 1;
+    int zero = 0;
+    int root = tree.root;
+    int returnCode = beagleCalculateRootLogLikelihoods(instance, &root, &zero, &zero, &cumulativeIndex, 1,
+                                                       &results->rootLogL);
+    results->siteLogLs.resize(tree.patternCount);
+    beagleGetSiteLogLikelihoods(instance, &results->siteLogLs[0]);
+
+    int parents[edgeCount] = { tree.rootChild1, tipCount };
+    int children[edgeCount] = { tree.rootChild2, 2 };
+    for (int e = 0; e < edgeCount && returnCode == BEAGLE_SUCCESS; e++) {
+        int firstDerivativeIndex = nodeCount + children[e];
+        int secondDerivativeIndex = 2 * nodeCount + children[e];
+        returnCode = beagleCalculateEdgeLogLikelihoods(instance, &parents[e], &children[e], &children[e],
+                                                       &firstDerivativeIndex, &secondDerivativeIndex,
+                                                       &zero, &zero, &cumulativeIndex, 1,
+                                                       &results->edgeLogL[e], &results->firstDerivatives[e],
+                                                       &results->secondDerivatives[e]);
+    }
+    results->siteFirstDerivatives.resize(tree.patternCount);
+    results->siteSecondDerivatives.resize(tree.patternCount);
+    beagleGetSiteDerivatives(instance, &results->siteFirstDerivatives[0], &results->siteSecondDerivatives[0]);
+
+    beagleFinalizeInstance(instance);
+    return returnCode;
+}
+
+double relativeDifference(double expected, double actual) {
+    return fabs(expected - actual) / (1.0 + fabs(expected));
+}
+
+double maxDifference(const Results& reference, const Results& results) {
+    double difference = relativeDifference(reference.rootLogL, results.rootLogL);
+    for (int e = 0; e < edgeCount; e++) {
+        difference = std::max(difference, relativeDifference(reference.edgeLogL[e], results.edgeLogL[e]));
+        difference = std::max(difference, relativeDifference(reference.firstDerivatives[e],
+                                                             results.firstDerivatives[e]));
+        difference = std::max(difference, relativeDifference(reference.secondDerivatives[e],
+                                                             results.secondDerivatives[e]));
+    }
+    for (size_t k = 0; k < reference.siteLogLs.size(); k++) {
+        difference = std::max(difference, relativeDifference(reference.siteLogLs[k], results.siteLogLs[k]));
+        difference = std::max(difference, relativeDifference(reference.siteFirstDerivatives[k],
+                                                             results.siteFirstDerivatives[k]));
+        difference = std::max(difference, relativeDifference(reference.siteSecondDerivatives[k],
+                                                             results.siteSecondDerivatives[k]));
+    }
+    return difference;
+}
+
+} // namespace
+
+int runFixedStateTests() {
+
+    const int stateCounts[4] = { 16, 20, 61, 64 };
+    const int partialsTipCounts[3] = { 0, 3, tipCount };    // tips 0-2 as partials mix all three kernels
+    const char* tipLabels[3] = { "states", "mixed tips", "partials" };
+
+    int failures = 0;
+
+    // without vector flags the generic SSE kernels, tried first, would take every state count
+    std::string otherName = implementationName(32, false, 0);
+    printf("32 states, default: %s\n", otherName.c_str());
+    if (otherName.empty() || otherName == "CPU-FixedState-Double") {
+        fprintf(stderr, "32 states, default: unexpected implementation\n");
+        failures++;
+    }
+
+    for (int s = 0; s < 4; s++) {
+        const int n = stateCounts[s];
+
+        std::string defaultName = implementationName(n, false, 0);
+        std::string sseName = implementationName(n, false, BEAGLE_FLAG_VECTOR_SSE);
+        printf("%d states, default: %s, SSE required: %s\n", n, defaultName.c_str(),
+               (sseName.empty() ? "none" : sseName.c_str()));
+        if (defaultName != "CPU-FixedState-Double" || (!sseName.empty() && sseName != "CPU-SSE-Double")) {
+            fprintf(stderr, "%d states: unexpected default implementations\n", n);
+            failures++;
+        }
+
+        std::string fixedName = implementationName(n, false);
+        std::string genericName = implementationName(n, true);
+        printf("%d states: %s / %s\n", n, fixedName.c_str(), genericName.c_str());
+        if (fixedName != "CPU-FixedState-Double" || genericName != "CPU-Double") {
+            fprintf(stderr, "%d states: unexpected implementations\n", n);
+            failures++;
+            continue;
+        }
+
+        // 10% gaps, set as missing states or as partials of ones
+        BalancedTree tree = makeBalancedTree(tipCount, patternCount, n, 41 + n, 40, 10);
+
+        for (int t = 0; t < 3; t++) {
+            for (int mode = 0; mode < 4; mode++) {
+                const bool partitioned = (mode >= 2);
+                const bool fixedScaling = (mode % 2 == 1);
+                // fixed scale factors are divided out as they are stored, so they must be raw
+                const long preferenceFlags = (partitioned ? BEAGLE_FLAG_THREADING_CPP : 0) |
+                                             (fixedScaling ? BEAGLE_FLAG_SCALERS_RAW : 0);
+
+                char label[128];
+                snprintf(label, sizeof(label), "%d states, %s%s%s", n, tipLabels[t],
+                         (fixedScaling ? ", fixed scaling" : ", rescaled"),
+                         (partitioned ? ", threaded partitions" : ""));
+
+                Results fixed, generic;
+                if (runInstance(tree, partialsTipCounts[t], false, preferenceFlags, partitioned, fixedScaling,
+                                &fixed) != BEAGLE_SUCCESS ||
+                    runInstance(tree, partialsTipCounts[t], true, preferenceFlags, partitioned, fixedScaling,
+                                &generic) != BEAGLE_SUCCESS) {
+                    fprintf(stderr, "%s: failed to evaluate\n", label);
+                    failures++;
+                    continue;
+                }
+                failures += check(label, maxDifference(generic, fixed), tolerance);
+            }
+        }
+
+        // gaps read from tip states and from partials of ones agree within the fixed-state kernels
+        Results states, partials;
+        char label[128];
+        snprintf(label, sizeof(label), "%d states, tip states against tip partials", n);
+        if (runInstance(tree, 0, false, 0, false, false, &states) != BEAGLE_SUCCESS ||
+            runInstance(tree, tipCount, false, 0, false, false, &partials) != BEAGLE_SUCCESS) {
+            fprintf(stderr, "%s: failed to evaluate\n", label);
+            failures++;
+            continue;
+        }
+        failures += check(label, maxDifference(states, partials), tolerance);
+    }
+
+    return failures;
+}
@@ -0,0 +1,139 @@
+/*
+ *  matrixmemo.cpp
+ *  BEAGLE
+ *
+ *  Checks that transition matrices met from the memo of beagleSetTransitionMatrixMemo
+ *  equal those of an instance without it, with the hit and miss counts expected as
+ *  buffers are overwritten and category rates and eigen decompositions are set.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <vector>
+
+#include "unittest.h"
+
+namespace {
+
+const int stateCount = 4;
+const int categoryCount = 3;
+const int edgeCount = 6;
+const int matrixCount = 3 * edgeCount + 2;
+
+int createInstance() {
+    return createCPUInstance(2, 3, 0, stateCount, 5, 2, matrixCount, categoryCount, 0, 0);
+}
+
+void setModel(int instance, int eigenIndex, double kappa, const double* rates) {
+    double freqs[stateCount] = { 0.3, 0.2, 0.3, 0.2 };
+    setHKYRateMatrix(instance, eigenIndex, kappa, freqs);
+    if (rates != NULL)
+        beagleSetCategoryRates(instance, rates);
+}
+
+/* Edge e into matrices e, 6 + e and 12 + e. */
+void update(int instance, int eigenIndex, const double* lengths, bool derivatives) {
+    int indices[3 * edgeCount];
+    for (int i = 0; i < 3 * edgeCount; i++)
+        indices[i] = i;
+    beagleUpdateTransitionMatrices(instance, eigenIndex, &indices[0],
+                                   (derivatives ? &indices[edgeCount] : NULL),
+                                   (derivatives ? &indices[2 * edgeCount] : NULL),
+                                   lengths, edgeCount);
+}
+
+int checkMemo(const char* label, int memoised, int reference, int count,
+              long expectedHits, long expectedMisses) {
+    long hits, misses;
+    beagleGetTransitionMatrixMemoCounts(memoised, &hits, &misses);
+    double difference = 0.0;
+    for (int m = 0; m < count; m++)
+        difference = std::max(difference, maxMatrixDifference(memoised, m, reference, m,
+                                                              stateCount * stateCount * categoryCount));
+    printf("%s: %ld hits, %ld misses, max difference %.3e\n", label, hits, misses, difference);
+    // matrices computed with derivatives may differ from those without in the last place
+    if (!(difference <= 1e-15) || hits != expectedHits || misses != expectedMisses) {
+        fprintf(stderr, "%s: expected %ld hits and %ld misses with equal matrices\n", label,
+                expectedHits, expectedMisses);
+        return 1;
+    }
+    return 0;
+}
+
+} // namespace
+
+int runMatrixMemoTests() {
+
+    int failures = 0;
+
+    int memoised = createInstance();
+    int reference = createInstance();
+    if (memoised < 0 || reference < 0) {
+        fprintf(stderr, "failed to create instance\n");
+        return 1;
+    }
+    if (beagleSetTransitionMatrixMemo(memoised, 1) != BEAGLE_SUCCESS) {
+        fprintf(stderr, "failed to enable memoisation\n");
+        return 1;
+    }
+
+    double rates[categoryCount] = { 0.3, 1.0, 1.7 };
+    for (int i = 0; i < 2; i++) {
+        int instance = (i == 0 ? memoised : reference);
+        setModel(instance, 0, 0.6, rates);
+        setModel(instance, 1, 1.4, NULL);
+    }
+
+    // strict-clock edges: three distinct lengths
+    double lengths[edgeCount] = { 0.1, 0.2, 0.1, 0.1, 0.3, 0.2 };
+    update(memoised, 0, lengths, true);
+    update(reference, 0, lengths, true);
+    failures += checkMemo("shared lengths", memoised, reference, 3 * edgeCount, 3, 3);
+
+    // the same request again is met in place, with or without derivatives
+    update(memoised, 0, lengths, true);
+    update(memoised, 0, lengths, false);
+    failures += checkMemo("repeated", memoised, reference, 3 * edgeCount, 15, 3);
+
+    // overwriting the buffer of a memoised length
+    std::vector<double> arbitrary(stateCount * stateCount * categoryCount, 0.25);
+    beagleSetTransitionMatrix(memoised, 0, &arbitrary[0], 1.0);
+    beagleSetTransitionMatrix(reference, 0, &arbitrary[0], 1.0);
+    int target[2] = { 3 * edgeCount, 3 * edgeCount + 1 };
+    double again[2] = { 0.1, 0.2 };
+    beagleUpdateTransitionMatrices(memoised, 0, target, NULL, NULL, again, 2);
+    beagleUpdateTransitionMatrices(reference, 0, target, NULL, NULL, again, 2);
+    failures += checkMemo("overwritten buffer", memoised, reference, matrixCount, 16, 4);
+
+    // another eigen decomposition keeps its own entries
+    update(memoised, 1, lengths, false);
+    update(reference, 1, lengths, false);
+    failures += checkMemo("second eigen", memoised, reference, matrixCount, 19, 7);
+
+    // new category rates and a new decomposition invalidate entries
+    double newRates[categoryCount] = { 0.5, 1.0, 1.5 };
+    for (int i = 0; i < 2; i++) {
+        int instance = (i == 0 ? memoised : reference);
+        beagleSetCategoryRates(instance, newRates);
+        setModel(instance, 1, 2.0, NULL);
+    }
+    update(memoised, 1, lengths, true);
+    update(reference, 1, lengths, true);
+    failures += checkMemo("new rates", memoised, reference, matrixCount, 22, 10);
+
+    // disabling clears the counts
+    beagleSetTransitionMatrixMemo(memoised, 0);
+    update(memoised, 0, lengths, true);
+    update(reference, 0, lengths, true);
+    failures += checkMemo("disabled", memoised, reference, matrixCount, 0, 0);
+
+    beagleFinalizeInstance(memoised);
+    beagleFinalizeInstance(reference);
+
+    return failures;
+}
@@ -0,0 +1,209 @@
+/*
+ *  missingdata.cpp
+ *  BEAGLE
+ *
+ *  Checks that site log likelihoods with long runs of missing data, where patterns
+ *  missing from whole subtrees are copied rather than computed, match those of an
+ *  instance whose gaps are coded as constant partials of 1/stateCount, with and
+ *  without rescaling, with threaded pattern partitions and at state counts taking the
+ *  blocked partials kernel.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <vector>
+
+#include "unittest.h"
+
+namespace {
+
+const int tipCount = 8;
+const int patternCount = 200;
+const int categoryCount = 2;
+const int nodeCount = 2 * tipCount - 1;
+
+enum Coding { CODING_STATES, CODING_PARTIALS, CODING_REFERENCE };
+
+/* Locus-like blocks: tips 0-3 lack patterns 40-119, tips 4-5 lack 100-179, tip 6 lacks 150-159. */
+bool isGap(int tip, int pattern) {
+    return (tip < 4 && pattern >= 40 && pattern < 120) ||
+           ((tip == 4 || tip == 5) && pattern >= 100 && pattern < 180) ||
+           (tip == 6 && pattern >= 150 && pattern < 160);
+}
+
+int createInstance(Coding coding, int stateCount, long preferenceFlags) {
+    int instance = createCPUInstance(tipCount, nodeCount, tipCount, stateCount, patternCount, 1, nodeCount,
+                                     categoryCount, tipCount, preferenceFlags);
+    if (instance < 0)
+        return instance;
+
+    srand(29);
+    std::vector<int> states(patternCount);
+    std::vector<double> partials(patternCount * stateCount);
+    for (int t = 0; t < tipCount; t++) {
+        for (int k = 0; k < patternCount; k++) {
+            int state = rand() % stateCount;
+            states[k] = (isGap(t, k) ? stateCount : state);
+            for (int i = 0; i < stateCount; i++) {
+                double gap = (coding == CODING_REFERENCE ? 1.0 / stateCount : 1.0);
+                partials[k * stateCount + i] = (isGap(t, k) ? gap : (i == state ? 1.0 : 0.0));
+            }
+        }
+        if (coding == CODING_STATES)
+            beagleSetTipStates(instance, t, &states[0]);
+        else
+            beagleSetTipPartials(instance, t, &partials[0]);
+    }
+
+    // HKY-like rate matrix with transition/transversion ratio 2, random beyond 4 states
+    std::vector<double> freqs;
+    if (stateCount == 4) {
+        freqs = { 0.3, 0.2, 0.3, 0.2 };
+        setHKYRateMatrix(instance, 0, 2.0, &freqs[0]);
+    } else {
+        std::vector<double> q = makeReversibleRateMatrix(stateCount, 37, &freqs);
+        beagleSetRateMatrix(instance, 0, &q[0], &freqs[0]);
+    }
+
+    double rates[categoryCount] = { 0.4, 1.6 };
+    double weights[categoryCount] = { 0.5, 0.5 };
+    std::vector<double> patternWeights(patternCount, 1.0);
+    beagleSetCategoryRates(instance, rates);
+    beagleSetCategoryWeights(instance, 0, weights);
+    beagleSetStateFrequencies(instance, 0, &freqs[0]);
+    beagleSetPatternWeights(instance, &patternWeights[0]);
+
+    int nodes[nodeCount - 1];
+    double lengths[nodeCount - 1];
+    for (int n = 0; n < nodeCount - 1; n++) {
+        nodes[n] = n;
+        lengths[n] = 0.05 + 0.03 * (n % 5);
+    }
+    beagleUpdateTransitionMatrices(instance, 0, nodes, NULL, NULL, lengths, nodeCount - 1);
+
+    return instance;
+}
+
+/*
+ * Balanced tree, with node n's scale buffer at n - tipCount when scaled and
+ * buffer tipCount - 1 accumulating them.
+ */
+void siteLogLikelihoods(int instance, int partitionCount, bool scaled, bool readScaling,
+                        double* outSiteLogL) {
+    const int cumulativeIndex = tipCount - 1;
+    const int writeCumulative = (scaled && !readScaling ? cumulativeIndex : BEAGLE_OP_NONE);
+    std::vector<BeagleOperation> operations;
+    std::vector<BeagleOperationByPartition> partitionOperations;
+    for (int n = tipCount; n < nodeCount; n++) {
+        int child = 2 * (n - tipCount);
+        BeagleOperation operation = { n,
+                                      (scaled && !readScaling ? n - tipCount : BEAGLE_OP_NONE),
+                                      (scaled && readScaling ? n - tipCount : BEAGLE_OP_NONE),
+                                      child, child, child + 1, child + 1 };
+        operations.push_back(operation);
+        for (int p = 0; p < partitionCount; p++) {
+            BeagleOperationByPartition partitionOperation = { operation.destinationPartials,
+                                                              operation.destinationScaleWrite,
+                                                              operation.destinationScaleRead,
+                                                              child, child, child + 1, child + 1,
+                                                              p, writeCumulative };
+            partitionOperations.push_back(partitionOperation);
+        }
+    }
+    if (writeCumulative != BEAGLE_OP_NONE)
+        beagleResetScaleFactors(instance, cumulativeIndex);
+    if (partitionCount > 1)
+        beagleUpdatePartialsByPartition(instance, &partitionOperations[0], (int) partitionOperations.size());
+    else
+        beagleUpdatePartials(instance, &operations[0], (int) operations.size(), writeCumulative);
+
+    int root = nodeCount - 1;
+    int zero = 0;
+    int cumulative = (scaled ? cumulativeIndex : BEAGLE_OP_NONE);
+    double logL;
+    beagleCalculateRootLogLikelihoods(instance, &root, &zero, &zero, &cumulative, 1, &logL);
+    beagleGetSiteLogLikelihoods(instance, outSiteLogL);
+}
+
+int checkCoding(const char* label, Coding coding, int stateCount, long preferenceFlags, bool partitioned,
+                bool scaled, bool readScaling) {
+    int instance = createInstance(coding, stateCount, preferenceFlags);
+    int reference = createInstance(CODING_REFERENCE, stateCount, preferenceFlags);
+    if (instance < 0 || reference < 0) {
+        fprintf(stderr, "%s: failed to create instance\n", label);
+        return 1;
+    }
+    int partitionCount = 1;
+    if (partitioned) {
+        // pattern partitions start one worker thread each, whatever the hardware;
+        // the second gap block straddles a partition boundary
+        partitionCount = 4;
+        std::vector<int> partitions(patternCount);
+        for (int k = 0; k < patternCount; k++)
+            partitions[k] = (k < 110 ? k / 55 : 2 + (k >= 160));
+        beagleSetPatternPartitions(instance, partitionCount, &partitions[0]);
+    }
+
+    std::vector<double> siteLogL(patternCount), referenceSiteLogL(patternCount);
+    if (readScaling) {
+        siteLogLikelihoods(instance, partitionCount, scaled, false, &siteLogL[0]);
+        siteLogLikelihoods(reference, 1, scaled, false, &referenceSiteLogL[0]);
+    }
+    siteLogLikelihoods(instance, partitionCount, scaled, readScaling, &siteLogL[0]);
+    siteLogLikelihoods(reference, 1, scaled, readScaling, &referenceSiteLogL[0]);
+
+    // each gap coded as 1/stateCount scales the site likelihood by 1/stateCount
+    double difference = 0.0;
+    for (int k = 0; k < patternCount; k++) {
+        int gaps = 0;
+        for (int t = 0; t < tipCount; t++)
+            gaps += isGap(t, k);
+        double expected = referenceSiteLogL[k] + gaps * log((double) stateCount);
+        difference = std::max(difference, fabs(siteLogL[k] - expected));
+    }
+    beagleFinalizeInstance(instance);
+    beagleFinalizeInstance(reference);
+
+    printf("%s: max difference %.3e\n", label, difference);
+    if (!(difference <= 1e-10)) {
+        fprintf(stderr, "%s: exceeds 1e-10\n", label);
+        return 1;
+    }
+    return 0;
+}
+
+} // namespace
+
+int runMissingDataTests() {
+
+    int failures = 0;
+
+    failures += checkCoding("states", CODING_STATES, 4, 0, false, false, false);
+    failures += checkCoding("partials", CODING_PARTIALS, 4, 0, false, false, false);
+    failures += checkCoding("states, no vectorization", CODING_STATES, 4, BEAGLE_FLAG_VECTOR_NONE,
+                            false, false, false);
+    failures += checkCoding("states, rescaled", CODING_STATES, 4, BEAGLE_FLAG_SCALING_MANUAL,
+                            false, true, false);
+    failures += checkCoding("partials, fixed scaling", CODING_PARTIALS, 4, BEAGLE_FLAG_SCALING_MANUAL,
+                            false, true, true);
+    failures += checkCoding("threaded states, rescaled", CODING_STATES, 4,
+                            BEAGLE_FLAG_THREADING_CPP | BEAGLE_FLAG_SCALING_MANUAL, true, true, false);
+    failures += checkCoding("threaded partials, fixed scaling", CODING_PARTIALS, 4,
+                            BEAGLE_FLAG_THREADING_CPP | BEAGLE_FLAG_SCALING_MANUAL, true, true, true);
+
+    // blocked kernel, whose transposes are kept across the ranges of one operation
+    failures += checkCoding("32 states, partials", CODING_PARTIALS, 32, BEAGLE_FLAG_VECTOR_NONE,
+                            false, false, false);
+    failures += checkCoding("32 states, partials, rescaled", CODING_PARTIALS, 32,
+                            BEAGLE_FLAG_VECTOR_NONE | BEAGLE_FLAG_SCALING_MANUAL, false, true, false);
+    failures += checkCoding("32 states, threaded partials, fixed scaling", CODING_PARTIALS, 32,
+                            BEAGLE_FLAG_VECTOR_NONE | BEAGLE_FLAG_THREADING_CPP | BEAGLE_FLAG_SCALING_MANUAL,
+                            true, true, true);
+
+    return failures;
+}
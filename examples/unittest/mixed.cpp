@@ -0,0 +1,83 @@
+/*
+ *  mixed.cpp
+ *  BEAGLE
+ *
+ *  Compares the mixed-precision CPU implementation against single and double
+ *  precision on a large tree with rescaling at every internal node.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <stdio.h>
+#include <cmath>
+#include <vector>
+
+#include "unittest.h"
+
+namespace {
+
+int runInstance(const BalancedTree& tree, long requirementFlags, TreeResults* results, long* outFlags) {
+    int instance = createTreeInstance(tree, 0, 2 * tree.tipCount - 1, 0, requirementFlags, outFlags);
+    if (instance < 0)
+        return instance;
+
+    // unit weights, so that site log likelihoods sum to the total
+    std::vector<double> patternWeights(tree.patternCount, 1.0);
+    beagleSetPatternWeights(instance, &patternWeights[0]);
+
+    updateJC69TransitionMatrices(instance, tree);
+    calculateTreeLikelihoods(instance, tree, results);
+
+    beagleFinalizeInstance(instance);
+    return BEAGLE_SUCCESS;
+}
+
+} // namespace
+
+int runMixedTests() {
+
+    BalancedTree tree = makeBalancedTree(128, 2000, 4, 42, 60, 2);
+
+    TreeResults d, s, m;
+    long flagsD, flagsS, flagsM;
+
+    if (runInstance(tree, BEAGLE_FLAG_PRECISION_DOUBLE, &d, &flagsD) != BEAGLE_SUCCESS ||
+        runInstance(tree, BEAGLE_FLAG_PRECISION_SINGLE, &s, &flagsS) != BEAGLE_SUCCESS) {
+        fprintf(stderr, "failed to create reference instances\n");
+        return 1;
+    }
+
+    if (runInstance(tree, BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_DOUBLE, &m, &flagsM) != BEAGLE_SUCCESS) {
+        fprintf(stderr, "failed to create mixed-precision instance\n");
+        return 1;
+    }
+
+    printf("double: root = %.10f\tedge = %.10f\n", d.rootLogL, d.edgeLogL);
+    printf("single: root = %.10f\tedge = %.10f\t(error %.3e)\n", s.rootLogL, s.edgeLogL, fabs(s.rootLogL - d.rootLogL));
+    printf("mixed : root = %.10f\tedge = %.10f\t(error %.3e)\n", m.rootLogL, m.edgeLogL, fabs(m.rootLogL - d.rootLogL));
+
+    int failures = 0;
+
+    if (!(flagsM & BEAGLE_FLAG_PRECISION_SINGLE) || !(flagsM & BEAGLE_FLAG_PRECISION_DOUBLE)) {
+        fprintf(stderr, "mixed instance does not report both precision flags\n");
+        failures++;
+    }
+
+    const double tolerance = 1e-7 * fabs(d.rootLogL);
+    if (fabs(m.rootLogL - d.rootLogL) > tolerance || fabs(m.edgeLogL - d.edgeLogL) > tolerance) {
+        fprintf(stderr, "mixed-precision log likelihood outside tolerance\n");
+        failures++;
+    }
+
+    double siteSum = 0.0;
+    for (int k = 0; k < tree.patternCount; k++)
+        siteSum += m.siteLogLs[k];
+    if (fabs(siteSum - m.edgeLogL) > 1e-8 * fabs(m.edgeLogL)) {
+        fprintf(stderr, "mixed-precision site log likelihoods do not sum to total\n");
+        failures++;
+    }
+
+    return failures;
+}
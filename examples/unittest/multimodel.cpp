@@ -0,0 +1,153 @@
+/*
+ *  multimodel.cpp
+ *  BEAGLE
+ *
+ *  Checks that batched beagleUpdateTransitionMatricesWithMultipleModels gives the
+ *  same matrices and derivatives as one beagleUpdateTransitionMatrices call per
+ *  edge, for cube, complex and large-state eigen systems, and that threaded
+ *  updates agree with serial ones.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <vector>
+
+#include "unittest.h"
+
+namespace {
+
+const int categoryCount = 3;
+const int eigenCount = 3;
+const int rateSetCount = 2;
+
+const double rateSets[rateSetCount][categoryCount] = { { 0.3, 1.0, 1.7 },
+                                                      { 0.1, 0.5, 2.4 } };
+
+int createInstance(int stateCount, int edgeCount, long preferenceFlags) {
+    int instance = createCPUInstance(2, 3, 0, stateCount, 8, eigenCount, 6 * edgeCount, categoryCount, 0,
+                                     preferenceFlags);
+    if (instance < 0)
+        return instance;
+
+    // random reversible rate matrices with unequal frequencies
+    const int n = stateCount;
+    srand(17);
+    std::vector<double> q(n * n), freqs(n);
+    double total = 0.0;
+    for (int i = 0; i < n; i++)
+        total += (freqs[i] = 1.0 + i % 3);
+    for (int i = 0; i < n; i++)
+        freqs[i] /= total;
+    for (int e = 0; e < eigenCount; e++) {
+        for (int i = 0; i < n; i++) {
+            for (int j = i + 1; j < n; j++) {
+                double s = (e + 1) * (0.2 + rand() / (double) RAND_MAX);
+                q[i * n + j] = s * freqs[j];
+                q[j * n + i] = s * freqs[i];
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            double sum = 0.0;
+            for (int j = 0; j < n; j++) {
+                if (j != i)
+                    sum += q[i * n + j];
+            }
+            q[i * n + i] = -sum;
+        }
+        beagleSetRateMatrix(instance, e, &q[0], &freqs[0]);
+    }
+
+    for (int r = 0; r < rateSetCount; r++)
+        beagleSetCategoryRatesWithIndex(instance, r, rateSets[r]);
+
+    return instance;
+}
+
+/* Edge e uses eigen system (2e + 1) % 3 and rate set e % 2, matrices e, edgeCount + e, ... */
+void updateBatched(int instance, int edgeCount, bool derivatives) {
+    std::vector<int> eigens(edgeCount), rates(edgeCount), indices(3 * edgeCount);
+    std::vector<double> lengths(edgeCount);
+    for (int e = 0; e < edgeCount; e++) {
+        eigens[e] = (2 * e + 1) % eigenCount;
+        rates[e] = e % rateSetCount;
+        lengths[e] = 0.01 * (1 + e);
+        for (int d = 0; d < 3; d++)
+            indices[d * edgeCount + e] = d * edgeCount + e;
+    }
+    beagleUpdateTransitionMatricesWithMultipleModels(instance, &eigens[0], &rates[0], &indices[0],
+                                                     (derivatives ? &indices[edgeCount] : NULL),
+                                                     (derivatives ? &indices[2 * edgeCount] : NULL),
+                                                     &lengths[0], edgeCount);
+}
+
+/* The same matrices one edge at a time into matrices 3 edgeCount + ... */
+void updateSingly(int instance, int edgeCount, bool derivatives) {
+    for (int e = 0; e < edgeCount; e++) {
+        int indices[3] = { 3 * edgeCount + e, 4 * edgeCount + e, 5 * edgeCount + e };
+        double length = 0.01 * (1 + e);
+        beagleSetCategoryRates(instance, rateSets[e % rateSetCount]);
+        beagleUpdateTransitionMatrices(instance, (2 * e + 1) % eigenCount, &indices[0],
+                                       (derivatives ? &indices[1] : NULL),
+                                       (derivatives ? &indices[2] : NULL), &length, 1);
+    }
+}
+
+int checkAgainstSingle(const char* label, int stateCount, int edgeCount, long flags, bool derivatives) {
+    int instance = createInstance(stateCount, edgeCount, flags);
+    if (instance < 0) {
+        fprintf(stderr, "%s: failed to create instance\n", label);
+        return 1;
+    }
+    updateBatched(instance, edgeCount, derivatives);
+    updateSingly(instance, edgeCount, derivatives);
+    const int size = stateCount * stateCount * categoryCount;
+    double difference = 0.0;
+    for (int d = 0; d < (derivatives ? 3 : 1); d++) {
+        for (int e = 0; e < edgeCount; e++) {
+            difference = std::max(difference, maxMatrixDifference(instance, d * edgeCount + e, instance,
+                                                                  (3 + d) * edgeCount + e, size));
+        }
+    }
+    beagleFinalizeInstance(instance);
+    return check(label, difference, 1e-15);
+}
+
+int checkThreaded(const char* label, int stateCount, int edgeCount, bool derivatives) {
+    int serial = createInstance(stateCount, edgeCount, 0);
+    int threaded = createInstance(stateCount, edgeCount, BEAGLE_FLAG_THREADING_CPP);
+    // pattern partitions start one worker thread each, whatever the hardware
+    int partitions[8] = { 0, 0, 1, 1, 2, 2, 3, 3 };
+    beagleSetPatternPartitions(threaded, 4, partitions);
+    updateBatched(serial, edgeCount, derivatives);
+    updateBatched(threaded, edgeCount, derivatives);
+    double difference = 0.0;
+    for (int m = 0; m < (derivatives ? 3 : 1) * edgeCount; m++)
+        difference = std::max(difference, maxMatrixDifference(threaded, m, serial, m,
+                                                              stateCount * stateCount * categoryCount));
+    beagleFinalizeInstance(serial);
+    beagleFinalizeInstance(threaded);
+    return check(label, difference, 0.0);
+}
+
+} // namespace
+
+int runMultiModelTests() {
+
+    int failures = 0;
+
+    // more edges than fit in one batch, with eigen systems interleaved
+    failures += checkAgainstSingle("cube", 4, 40, 0, true);
+    failures += checkAgainstSingle("cube, 64 states", 64, 12, 0, true);
+    failures += checkAgainstSingle("complex", 4, 40, BEAGLE_FLAG_EIGEN_COMPLEX, false);
+    failures += checkAgainstSingle("square, 130 states", 130, 12, 0, false);
+
+    failures += checkThreaded("threaded cube", 64, 12, true);
+    failures += checkThreaded("threaded square", 130, 12, false);
+
+    return failures;
+}
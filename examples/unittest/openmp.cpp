@@ -0,0 +1,129 @@
+/*
+ *  openmp.cpp
+ *  BEAGLE
+ *
+ *  Compares OpenMP pattern-block threading against the unthreaded CPU
+ *  implementations for partials, root and edge log likelihoods with
+ *  manual, always and dynamic rescaling and after the thread count is
+ *  lowered and raised again; and checks that auto-scaling instances,
+ *  which cannot be split into blocks, do not report OpenMP threading.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <stdio.h>
+#include <vector>
+
+#include "unittest.h"
+
+namespace {
+
+int runInstance(const BalancedTree& tree, long preferenceFlags, long requirementFlags,
+                const std::vector<int>& threadCounts, TreeResults* results, long* outFlags) {
+    int instance = createTreeInstance(tree, 0, 2 * tree.tipCount - 1, preferenceFlags, requirementFlags,
+                                      outFlags);
+    if (instance < 0)
+        return instance;
+
+    for (size_t i = 0; i < threadCounts.size(); i++)
+        beagleSetCPUThreadCount(instance, threadCounts[i]);
+
+    updateJC69TransitionMatrices(instance, tree);
+    calculateTreeLikelihoods(instance, tree, results);
+
+    beagleFinalizeInstance(instance);
+    return BEAGLE_SUCCESS;
+}
+
+} // namespace
+
+int runOpenMPTests() {
+
+    BalancedTree tree = makeBalancedTree(32, 1001, 4, 7, 70, 3);
+
+    long precisions[2] = { BEAGLE_FLAG_PRECISION_DOUBLE, BEAGLE_FLAG_PRECISION_SINGLE };
+    long vectors[2] = { BEAGLE_FLAG_VECTOR_NONE, BEAGLE_FLAG_VECTOR_SSE };
+    const char* labels[2][2] = { { "double", "double-sse" }, { "single", "single-sse" } };
+    const std::vector<int> fourThreads(1, 4);
+
+    int failures = 0;
+    int comparisons = 0;
+
+    for (int p = 0; p < 2; p++) {
+        for (int v = 0; v < 2; v++) {
+            TreeResults reference, threaded;
+            long flags = precisions[p] | vectors[v];
+            long threadedFlags;
+
+            if (runInstance(tree, 0, flags | BEAGLE_FLAG_THREADING_NONE, std::vector<int>(),
+                            &reference, NULL) != BEAGLE_SUCCESS)
+                continue;
+
+            if (runInstance(tree, 0, flags | BEAGLE_FLAG_THREADING_OPENMP, fourThreads,
+                            &threaded, &threadedFlags) != BEAGLE_SUCCESS) {
+                if (v == 0) {
+                    printf("OpenMP threading not available, skipping\n");
+                    return 0;
+                }
+                continue;
+            }
+
+            if (!(threadedFlags & BEAGLE_FLAG_THREADING_OPENMP)) {
+                fprintf(stderr, "%s: instance does not report OpenMP threading\n", labels[p][v]);
+                failures++;
+            }
+            failures += compareTreeResults(labels[p][v], reference, threaded, (p == 0 ? 1e-12 : 1e-5));
+            comparisons++;
+        }
+    }
+
+    if (comparisons == 0) {
+        fprintf(stderr, "failed to create any instances\n");
+        return 1;
+    }
+
+    // scaling modes that rescale pattern by pattern run in blocks
+    long scalingModes[2] = { BEAGLE_FLAG_SCALING_ALWAYS, BEAGLE_FLAG_SCALING_DYNAMIC };
+    const char* scalingLabels[2] = { "always scaling", "dynamic scaling" };
+    for (int m = 0; m < 2; m++) {
+        TreeResults reference, threaded;
+        long threadedFlags;
+        runInstance(tree, scalingModes[m], BEAGLE_FLAG_PRECISION_DOUBLE | BEAGLE_FLAG_THREADING_NONE,
+                    std::vector<int>(), &reference, NULL);
+        runInstance(tree, scalingModes[m], BEAGLE_FLAG_PRECISION_DOUBLE | BEAGLE_FLAG_THREADING_OPENMP,
+                    fourThreads, &threaded, &threadedFlags);
+        if (!(threadedFlags & BEAGLE_FLAG_THREADING_OPENMP) || !(threadedFlags & scalingModes[m])) {
+            fprintf(stderr, "%s: instance does not report OpenMP threading\n", scalingLabels[m]);
+            failures++;
+        }
+        failures += compareTreeResults(scalingLabels[m], reference, threaded, 1e-12);
+    }
+
+    // blocks of a higher thread count are dropped when lowered to one thread, and rebuilt when raised
+    int counts[3] = { 4, 1, 3 };
+    for (int c = 2; c <= 3; c++) {
+        TreeResults reference, threaded;
+        runInstance(tree, 0, BEAGLE_FLAG_PRECISION_DOUBLE | BEAGLE_FLAG_THREADING_NONE,
+                    std::vector<int>(), &reference, NULL);
+        runInstance(tree, 0, BEAGLE_FLAG_PRECISION_DOUBLE | BEAGLE_FLAG_THREADING_OPENMP,
+                    std::vector<int>(counts, counts + c), &threaded, NULL);
+        failures += compareTreeResults(c == 2 ? "lowered to one thread" : "raised again",
+                                       reference, threaded, 1e-12);
+    }
+
+    // auto scaling cannot be split into blocks and the instance says so
+    long autoFlags = 0;
+    int instance = createCPUInstance(4, 4, 0, 4, 64, 1, 4, 1, 0, BEAGLE_FLAG_SCALING_AUTO,
+                                     BEAGLE_FLAG_PRECISION_DOUBLE | BEAGLE_FLAG_THREADING_OPENMP, &autoFlags);
+    if (instance >= 0) {
+        if ((autoFlags & BEAGLE_FLAG_THREADING_OPENMP) || !(autoFlags & BEAGLE_FLAG_SCALING_AUTO)) {
+            fprintf(stderr, "auto scaling: instance reports OpenMP threading\n");
+            failures++;
+        }
+        beagleFinalizeInstance(instance);
+    }
+
+    return failures;
+}
@@ -0,0 +1,110 @@
+/*
+ *  partialslayout.cpp
+ *  BEAGLE
+ *
+ *  Compares the pattern-major partials layout against the default
+ *  category-major layout for root, edge and site log likelihoods with
+ *  manual rescaling, and checks that partials read back unchanged.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <stdio.h>
+#include <cmath>
+#include <vector>
+
+#include "unittest.h"
+
+namespace {
+
+const int partialsTipCount = 4;     // tips given as partials rather than states
+
+int runInstance(const BalancedTree& tree, long requirementFlags, int layout,
+                TreeResults* results, std::vector<double>* outPartials) {
+    int instance = createTreeInstance(tree, partialsTipCount, 2 * tree.tipCount - 1, 0, requirementFlags);
+    if (instance < 0)
+        return instance;
+
+    // Convert the tip partials already stored
+    int returnCode = beagleSetPartialsLayout(instance, layout);
+    if (returnCode != BEAGLE_SUCCESS) {
+        beagleFinalizeInstance(instance);
+        return returnCode;
+    }
+
+    setJCTransitionMatrices(instance, tree, false);
+    calculateTreeLikelihoods(instance, tree, results);
+
+    // partials of the first internal node
+    outPartials->resize(UT_CATEGORY_COUNT * tree.patternCount * tree.stateCount);
+    beagleGetPartials(instance, tree.tipCount, BEAGLE_OP_NONE, &(*outPartials)[0]);
+
+    // Converting back must leave the partials unchanged
+    std::vector<double> converted(outPartials->size());
+    beagleSetPartialsLayout(instance, BEAGLE_PARTIALS_LAYOUT_CATEGORY_MAJOR);
+    beagleGetPartials(instance, tree.tipCount, BEAGLE_OP_NONE, &converted[0]);
+    if (converted != *outPartials)
+        returnCode = BEAGLE_ERROR_GENERAL;
+
+    beagleFinalizeInstance(instance);
+
+    return returnCode;
+}
+
+} // namespace
+
+int runPartialsLayoutTests() {
+
+    int stateCounts[2] = { 4, 20 };
+    long precisions[2] = { BEAGLE_FLAG_PRECISION_DOUBLE, BEAGLE_FLAG_PRECISION_SINGLE };
+    long vectors[2] = { BEAGLE_FLAG_VECTOR_NONE, BEAGLE_FLAG_VECTOR_SSE };
+    const char* labels[2][2] = { { "double", "double-sse" }, { "single", "single-sse" } };
+
+    int failures = 0;
+    int comparisons = 0;
+
+    for (int s = 0; s < 2; s++) {
+        BalancedTree tree = makeBalancedTree(16, 257, stateCounts[s], 11, 70, 3);
+        for (int p = 0; p < 2; p++) {
+            for (int v = 0; v < 2; v++) {
+                TreeResults reference, patternMajor;
+                std::vector<double> referencePartials, patternMajorPartials;
+                long flags = precisions[p] | vectors[v];
+                const double tolerance = (p == 0 ? 1e-12 : 1e-5);
+
+                if (runInstance(tree, flags, BEAGLE_PARTIALS_LAYOUT_CATEGORY_MAJOR, &reference,
+                                &referencePartials) != BEAGLE_SUCCESS)
+                    continue;
+
+                char label[64];
+                snprintf(label, sizeof(label), "%d-state %s", stateCounts[s], labels[p][v]);
+
+                if (runInstance(tree, flags, BEAGLE_PARTIALS_LAYOUT_PATTERN_MAJOR, &patternMajor,
+                                &patternMajorPartials) != BEAGLE_SUCCESS) {
+                    fprintf(stderr, "%s: pattern-major instance failed\n", label);
+                    failures++;
+                    continue;
+                }
+
+                failures += compareTreeResults(label, reference, patternMajor, tolerance);
+                for (size_t i = 0; i < referencePartials.size(); i++) {
+                    if (fabs(referencePartials[i] - patternMajorPartials[i]) > tolerance * fabs(referencePartials[i])) {
+                        fprintf(stderr, "%s: partials differ from category-major\n", label);
+                        failures++;
+                        break;
+                    }
+                }
+                comparisons++;
+            }
+        }
+    }
+
+    if (comparisons == 0) {
+        fprintf(stderr, "failed to create any instances\n");
+        return 1;
+    }
+
+    return failures;
+}
@@ -0,0 +1,339 @@
+/*
+ *  plugins.cpp
+ *  BEAGLE
+ *
+ *  Checks the plugin manifest, the BEAGLE_PLUGINS variable and beagleSelectPlugins.
+ *  Plugins are loaded once per process, so each case runs this driver again as a
+ *  child process (--plugin-child) with its own environment and reads its report:
+ *  the manifest is only used when asked for, a fresh one is written without GPU
+ *  plugins, a current one defers loading to instance creation, one written for
+ *  another library path is ignored, an entry whose library is no longer the one
+ *  found by name is dropped, and a missing plugin is probed again once its library
+ *  appears.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "unittest.h"
+#include "libhmsbeagle/plugin/Plugin.h"
+
+namespace {
+
+const char* manifestFile = "unittest-plugins.manifest";
+const char* cacheDirectory = "unittest-plugins.cache";
+const char* staleLibraryFile = "unittest-plugins.stale";
+const char* missingLibraryFile = "unittest-plugins-missing.so";
+
+int isLoaded(const char* pluginName) {
+    return !beagle::plugin::PluginManager::instance().findPluginPath(pluginName).empty();
+}
+
+#ifndef _WIN32
+
+std::string absolutePath(const char* file) {
+    char directory[4096];
+    if (getcwd(directory, sizeof(directory)) == NULL)
+        return file;
+    return std::string(directory) + "/" + file;
+}
+
+bool readFile(const char* path, std::string* outText) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return false;
+    outText->clear();
+    char buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        outText->append(buffer, count);
+    fclose(file);
+    return true;
+}
+
+void writeFile(const char* path, const std::string& text) {
+    FILE* file = fopen(path, "w");
+    if (file != NULL) {
+        fputs(text.c_str(), file);
+        fclose(file);
+    }
+}
+
+void removeDirectory(const char* path) {
+    std::string command = std::string("rm -rf '") + path + "'";
+    if (system(command.c_str()) != 0)
+        fprintf(stderr, "failed to remove %s\n", path);
+}
+
+long long fileInode(const char* path) {
+    struct stat info;
+    return (stat(path, &info) == 0 ? (long long) info.st_ino : -1);
+}
+
+long long fileTime(const char* path) {
+    struct stat info;
+    return (stat(path, &info) == 0 ? (long long) info.st_mtime : -1);
+}
+
+/* The manifest line of a plugin, or an empty string. */
+std::string pluginLine(const std::string& manifest, const char* pluginName) {
+    std::string prefix = std::string("plugin\t") + pluginName + "\t";
+    size_t start = (manifest.compare(0, prefix.size(), prefix) == 0 ? 0 : manifest.find("\n" + prefix));
+    if (start == std::string::npos)
+        return std::string();
+    if (start > 0)
+        start++;
+    return manifest.substr(start, manifest.find('\n', start) - start);
+}
+
+/* Replaces the manifest line of a plugin; returns false if it has none. */
+bool setPluginLine(const char* pluginName, int available, long long libraryTime, const std::string& libraryPath) {
+    std::string manifest;
+    if (!readFile(manifestFile, &manifest))
+        return false;
+    std::string line = pluginLine(manifest, pluginName);
+    if (line.empty())
+        return false;
+    char replacement[4096];
+    snprintf(replacement, sizeof(replacement), "plugin\t%s\t%d\t%lld\t%s", pluginName, available, libraryTime,
+             libraryPath.c_str());
+    manifest.replace(manifest.find(line), line.size(), replacement);
+    writeFile(manifestFile, manifest);
+    return true;
+}
+
+/* Shell assignments using the given manifest, or no manifest setting if manifest is NULL. */
+std::string manifestEnvironment(const char* manifest) {
+    if (manifest == NULL)
+        return "unset BEAGLE_PLUGIN_MANIFEST; ";
+    return std::string("BEAGLE_PLUGIN_MANIFEST='") + manifest + "' ";
+}
+
+/*
+ * Runs this driver as a child after the given shell assignments and with BEAGLE_PLUGINS,
+ * selecting plugins first unless selectedPlugins is NULL and requiring the vector flag
+ * "none" or "sse", or none for "any".
+ */
+std::string runChild(const std::string& environment, const char* environmentPlugins, const char* selectedPlugins,
+                     const char* vector) {
+    std::string command = environment + "BEAGLE_PLUGINS='" + environmentPlugins + "' '" + unittestProgram +
+                          "' --plugin-child " + (selectedPlugins != NULL ? selectedPlugins : "-") + " " + vector;
+    std::string output;
+    FILE* pipe = popen(command.c_str(), "r");
+    if (pipe == NULL)
+        return output;
+    char buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+        output.append(buffer, count);
+    pclose(pipe);
+    return output;
+}
+
+std::string runChild(const char* manifest) {
+    return runChild(manifestEnvironment(manifest), "", NULL, "none");
+}
+
+int expect(const char* label, const std::string& text, const std::string& expected, bool present) {
+    if ((text.find(expected) != std::string::npos) == present)
+        return 0;
+    fprintf(stderr, "%s: %s \"%s\" in\n%s\n", label, (present ? "missing" : "unexpected"), expected.c_str(),
+            text.c_str());
+    return 1;
+}
+
+int expectRewritten(const char* label, long long inode, bool rewritten) {
+    if ((fileInode(manifestFile) != inode) == rewritten)
+        return 0;
+    fprintf(stderr, "%s: manifest %s\n", label, (rewritten ? "not rewritten" : "rewritten"));
+    return 1;
+}
+
+#endif // _WIN32
+
+} // namespace
+
+/* The child half of the plugin tests: reports loaded plugins and the implementation created. */
+int runPluginChild(const char* selectedPlugins, const char* vector) {
+    if (strcmp(selectedPlugins, "-") != 0)
+        printf("select %d\n", beagleSelectPlugins(selectedPlugins));
+
+    beagleGetResourceList();
+    printf("loaded before creation: cpu %d cpu-sse %d\n", isLoaded("hmsbeagle-cpu"), isLoaded("hmsbeagle-cpu-sse"));
+
+    BeagleInstanceDetails instDetails;
+    long requirementFlags = BEAGLE_FLAG_PRECISION_DOUBLE | BEAGLE_FLAG_PROCESSOR_CPU;
+    if (strcmp(vector, "sse") == 0)
+        requirementFlags |= BEAGLE_FLAG_VECTOR_SSE;
+    else if (strcmp(vector, "none") == 0)
+        requirementFlags |= BEAGLE_FLAG_VECTOR_NONE;
+    int instance = beagleCreateInstance(2, 1, 2, 4, 1, 1, 2, 1, 0, NULL, 0, 0, requirementFlags, &instDetails);
+    printf("impl %s\n", (instance >= 0 ? instDetails.implName : "-"));
+    printf("loaded after creation: cpu %d cpu-sse %d\n", isLoaded("hmsbeagle-cpu"), isLoaded("hmsbeagle-cpu-sse"));
+    if (instance >= 0)
+        beagleFinalizeInstance(instance);
+
+    printf("select after loading %d\n", beagleSelectPlugins("cpu"));
+    return 0;
+}
+
+int runPluginTests() {
+
+#ifdef _WIN32
+    printf("plugin tests need a POSIX shell, skipped\n");
+    return 0;
+#else
+    int failures = 0;
+    std::string output, manifest, line;
+    char expected[64];
+    snprintf(expected, sizeof(expected), "select after loading %d", BEAGLE_ERROR_GENERAL);
+    const std::string cacheEnvironment = std::string("XDG_CACHE_HOME='") + absolutePath(cacheDirectory) + "' ";
+    const std::string cacheManifests = std::string(cacheDirectory) + "/beagle";
+    struct stat info;
+
+    // without a manifest every plugin is loaded before any instance is created, and nothing is cached
+    removeDirectory(cacheDirectory);
+    output = runChild(cacheEnvironment + manifestEnvironment(NULL), "", NULL, "none");
+    failures += expect("no manifest", output, "loaded before creation: cpu 1", true);
+    failures += expect("no manifest", output, "impl CPU-4State-Double", true);
+    failures += expect("no manifest", output, expected, true);
+    const bool haveSSE = (output.find("cpu-sse 1") != std::string::npos);
+    if (stat(cacheManifests.c_str(), &info) == 0) {
+        fprintf(stderr, "no manifest: %s written\n", cacheManifests.c_str());
+        failures++;
+    }
+
+    // the default manifest lies in the cache directory
+    output = runChild(cacheEnvironment + manifestEnvironment("default"), "", NULL, "none");
+    failures += expect("default manifest", output, "impl CPU-4State-Double", true);
+    if (stat(cacheManifests.c_str(), &info) != 0) {
+        fprintf(stderr, "default manifest: %s not written\n", cacheManifests.c_str());
+        failures++;
+    }
+    removeDirectory(cacheDirectory);
+
+    // a fresh manifest describes the CPU plugins loaded, but not the GPU plugins
+    remove(manifestFile);
+    output = runChild(manifestFile);
+    failures += expect("fresh manifest", output, "impl CPU-4State-Double", true);
+    if (!readFile(manifestFile, &manifest)) {
+        fprintf(stderr, "fresh manifest: %s not written\n", manifestFile);
+        return failures + 1;
+    }
+    line = pluginLine(manifest, "hmsbeagle-cpu");
+    failures += expect("fresh manifest", line, "plugin\thmsbeagle-cpu\t1\t", true);
+    failures += expect("fresh manifest", manifest, "plugin\thmsbeagle-cuda\t", false);
+    failures += expect("fresh manifest", manifest, "plugin\thmsbeagle-opencl\t", false);
+    const std::string cpuLine = line;
+
+    // a current manifest is left as is and loads only the plugin of the instance, when it is created
+    long long inode = fileInode(manifestFile);
+    output = runChild(manifestEnvironment(manifestFile), "", NULL, "any");
+    failures += expect("current manifest", output, "loaded before creation: cpu 0 cpu-sse 0", true);
+    failures += expect("current manifest", output, (haveSSE ? "impl CPU-4State-SSE-Double" : "impl CPU-4State-Double"),
+                       true);
+    failures += expect("current manifest", output, (haveSSE ? "loaded after creation: cpu 0 cpu-sse 1" :
+                                                              "loaded after creation: cpu 1 cpu-sse 0"), true);
+    failures += expect("current manifest", output, expected, true);
+    failures += expectRewritten("current manifest", inode, false);
+
+    // a manifest written for another library path is ignored and replaced
+    output = runChild(manifestEnvironment(manifestFile) +
+                      "LD_LIBRARY_PATH=\"$LD_LIBRARY_PATH:/unittest-plugins\" ", "", NULL, "none");
+    failures += expect("other library path", output, "loaded before creation: cpu 1", true);
+    failures += expectRewritten("other library path", inode, true);
+    output = runChild(manifestFile);
+    failures += expect("other library path, back", output, "loaded before creation: cpu 1", true);
+    inode = fileInode(manifestFile);
+    output = runChild(manifestFile);
+    failures += expect("other library path, back", output, "loaded before creation: cpu 0", true);
+    failures += expectRewritten("other library path, back", inode, false);
+
+    // an entry for a library other than the one found by name is used for ranking only, then dropped
+    writeFile(staleLibraryFile, "not a library\n");
+    const std::string stalePath = absolutePath(staleLibraryFile);
+    setPluginLine("hmsbeagle-cpu", 1, fileTime(staleLibraryFile), stalePath);
+    output = runChild(manifestFile);
+    failures += expect("stale manifest", output, "loaded before creation: cpu 0", true);
+    failures += expect("stale manifest", output, "impl CPU-4State-Double", true);
+    readFile(manifestFile, &manifest);
+    failures += expect("stale manifest", manifest, stalePath, false);
+    failures += expect("stale manifest", manifest, "plugin\thmsbeagle-cpu\t", false);
+    output = runChild(manifestFile);
+    failures += expect("stale manifest, next run", output, "impl CPU-4State-Double", true);
+    readFile(manifestFile, &manifest);
+    failures += expect("stale manifest, next run", pluginLine(manifest, "hmsbeagle-cpu"), cpuLine, true);
+    remove(staleLibraryFile);
+
+    // a plugin whose library is missing is probed again once it appears
+    const char* missingPlugin = NULL;
+    const char* candidates[2] = { "hmsbeagle-cpu-avx", "hmsbeagle-cpu-openmp" };
+    for (int c = 0; c < 2 && missingPlugin == NULL; c++) {
+        if (pluginLine(manifest, candidates[c]).find("\t0\t-1\t") != std::string::npos)
+            missingPlugin = candidates[c];
+    }
+    if (missingPlugin != NULL) {
+        const std::string missingPath = absolutePath(missingLibraryFile);
+        remove(missingLibraryFile);
+        setPluginLine(missingPlugin, 0, -1, missingPath);
+        inode = fileInode(manifestFile);
+        runChild(manifestFile);
+        failures += expectRewritten("missing plugin", inode, false);
+        writeFile(missingLibraryFile, "not a library\n");
+        runChild(manifestFile);
+        failures += expectRewritten("missing plugin, library added", inode, true);
+        readFile(manifestFile, &manifest);
+        failures += expect("missing plugin, library added", pluginLine(manifest, missingPlugin), missingPath, false);
+        inode = fileInode(manifestFile);
+        runChild(manifestFile);
+        failures += expectRewritten("missing plugin, probed", inode, false);
+        remove(missingLibraryFile);
+    } else {
+        printf("no missing CPU plugin, re-probing not tested\n");
+    }
+
+    if (haveSSE) {
+        output = runChild(manifestEnvironment(manifestFile), "", NULL, "sse");
+        failures += expect("all plugins", output, "impl CPU-4State-SSE-Double", true);
+
+        // BEAGLE_PLUGINS restricts the plugins, with or without the manifest
+        const char* manifests[2] = { "none", manifestFile };
+        for (int m = 0; m < 2; m++) {
+            const std::string environment = manifestEnvironment(manifests[m]);
+            output = runChild(environment, "cpu", NULL, "sse");
+            failures += expect("BEAGLE_PLUGINS=cpu", output, "impl -", true);
+            failures += expect("BEAGLE_PLUGINS=cpu", output, "cpu-sse 1", false);
+            output = runChild(environment, "cpu", NULL, "none");
+            failures += expect("BEAGLE_PLUGINS=cpu", output, "impl CPU-4State-Double", true);
+            output = runChild(environment, "cpu-sse", NULL, "sse");
+            failures += expect("BEAGLE_PLUGINS=cpu-sse", output, "impl CPU-4State-SSE-Double", true);
+        }
+
+        // beagleSelectPlugins takes precedence over BEAGLE_PLUGINS
+        output = runChild(manifestEnvironment(manifestFile), "cpu-sse", "cpu", "sse");
+        snprintf(expected, sizeof(expected), "select %d", BEAGLE_SUCCESS);
+        failures += expect("beagleSelectPlugins(cpu)", output, expected, true);
+        failures += expect("beagleSelectPlugins(cpu)", output, "impl -", true);
+        failures += expect("beagleSelectPlugins(cpu)", output, "cpu-sse 1", false);
+        output = runChild(manifestEnvironment(manifestFile), "cpu", "cpu-sse", "sse");
+        failures += expect("beagleSelectPlugins(cpu-sse)", output, "impl CPU-4State-SSE-Double", true);
+    } else {
+        printf("no SSE plugin, plugin selection not tested\n");
+    }
+
+    remove(manifestFile);
+    printf("plugins: %d failures\n", failures);
+    return failures;
+#endif // _WIN32
+}
@@ -0,0 +1,204 @@
+/*
+ *  ratematrix.cpp
+ *  BEAGLE
+ *
+ *  Checks transition matrices built from beagleSetRateMatrix against
+ *  exp(Qt) computed by scaling and squaring, for reversible models with
+ *  standard and transposed inverse eigenvectors, for a non-reversible
+ *  model with complex eigenvalues, and across cache hits and buffers
+ *  overwritten by beagleSetEigenDecomposition. Also checks transition
+ *  matrices and derivatives from beagleSetUniformizationRateMatrix.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <stdio.h>
+#include <cmath>
+#include <vector>
+
+#include "unittest.h"
+
+namespace {
+
+const double edgeLength = 0.3;
+
+/* exp(Qt) by scaling, a Taylor series and repeated squaring. */
+std::vector<double> expm(const std::vector<double>& q, int n, double t) {
+    int squarings = 8;
+    double scale = t / (1 << squarings);
+    std::vector<double> result(n * n, 0.0), term(n * n, 0.0), next(n * n);
+    for (int i = 0; i < n; i++)
+        result[i * n + i] = term[i * n + i] = 1.0;
+    for (int k = 1; k < 20; k++) {
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                double sum = 0.0;
+                for (int l = 0; l < n; l++)
+                    sum += term[i * n + l] * q[l * n + j];
+                next[i * n + j] = sum * scale / k;
+            }
+        }
+        term = next;
+        for (int i = 0; i < n * n; i++)
+            result[i] += term[i];
+    }
+    for (int s = 0; s < squarings; s++) {
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                double sum = 0.0;
+                for (int l = 0; l < n; l++)
+                    sum += result[i * n + l] * result[l * n + j];
+                next[i * n + j] = sum;
+            }
+        }
+        result = next;
+    }
+    return result;
+}
+
+int createInstance(int n, long flags) {
+    int instance = createCPUInstance(0, 0, 0, n, 1, 2, 3, 1, 0, flags);
+    if (instance >= 0) {
+        double rate = 1.0;
+        beagleSetCategoryRates(instance, &rate);
+    }
+    return instance;
+}
+
+/* Sets Q into eigen buffer eigenIndex and compares the resulting P(t) with exp(Qt). */
+int checkRateMatrix(const char* label, int instance, int eigenIndex, const std::vector<double>& q,
+                    const std::vector<double>* freqs, int n) {
+    int returnCode = beagleSetRateMatrix(instance, eigenIndex, &q[0], (freqs ? &(*freqs)[0] : NULL));
+    if (returnCode != BEAGLE_SUCCESS) {
+        fprintf(stderr, "%s: beagleSetRateMatrix failed with error %d\n", label, returnCode);
+        return 1;
+    }
+
+    int matrixIndex = 0;
+    double length = edgeLength;
+    beagleUpdateTransitionMatrices(instance, eigenIndex, &matrixIndex, NULL, NULL, &length, 1);
+
+    std::vector<double> matrix(n * n);
+    beagleGetTransitionMatrix(instance, matrixIndex, &matrix[0]);
+    std::vector<double> expected = expm(q, n, edgeLength);
+
+    double maxError = 0.0;
+    for (int i = 0; i < n * n; i++)
+        maxError = fmax(maxError, fabs(matrix[i] - expected[i]));
+
+    return check(label, maxError, 1e-9);
+}
+
+/* Uniformized P(t), dP/dt = QP and d2P/dt2 = Q^2 P against exp(Qt). */
+int checkUniformization(const char* label, int instance, const std::vector<double>& q, int n,
+                        double length) {
+    int returnCode = beagleSetUniformizationRateMatrix(instance, 0, &q[0]);
+    if (returnCode != BEAGLE_SUCCESS) {
+        fprintf(stderr, "%s: beagleSetUniformizationRateMatrix failed with error %d\n", label, returnCode);
+        return 1;
+    }
+
+    int matrixIndices[3] = { 0, 1, 2 };
+    beagleUpdateTransitionMatrices(instance, 0, &matrixIndices[0], &matrixIndices[1], &matrixIndices[2],
+                                   &length, 1);
+
+    std::vector<double> matrices[3];
+    for (int m = 0; m < 3; m++) {
+        matrices[m].resize(n * n);
+        beagleGetTransitionMatrix(instance, matrixIndices[m], &matrices[m][0]);
+    }
+
+    std::vector<double> expected[3];
+    expected[0] = expm(q, n, length);
+    for (int m = 1; m < 3; m++) {
+        expected[m].assign(n * n, 0.0);
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++)
+                for (int k = 0; k < n; k++)
+                    expected[m][i * n + j] += q[i * n + k] * expected[m - 1][k * n + j];
+    }
+
+    double maxError = 0.0;
+    for (int m = 0; m < 3; m++)
+        for (int i = 0; i < n * n; i++)
+            maxError = fmax(maxError, fabs(matrices[m][i] - expected[m][i]));
+
+    char uniformizedLabel[96];
+    snprintf(uniformizedLabel, sizeof(uniformizedLabel), "%s uniformized t=%g", label, length);
+    return check(uniformizedLabel, maxError, 1e-9);
+}
+
+} // namespace
+
+int runRateMatrixTests() {
+
+    int failures = 0;
+
+    int stateCounts[3] = { 4, 20, 61 };
+    for (int s = 0; s < 3; s++) {
+        int n = stateCounts[s];
+        std::vector<double> freqs1, freqs2;
+        std::vector<double> q1 = makeReversibleRateMatrix(n, 17, &freqs1);
+        std::vector<double> q2 = makeReversibleRateMatrix(n, 29, &freqs2);
+
+        long flagSets[2] = { BEAGLE_FLAG_INVEVEC_STANDARD, BEAGLE_FLAG_INVEVEC_TRANSPOSED };
+        for (int f = 0; f < 2; f++) {
+            int instance = createInstance(n, flagSets[f]);
+            if (instance < 0) {
+                fprintf(stderr, "failed to create instance: %d\n", instance);
+                return failures + 1;
+            }
+
+            char label[64];
+            snprintf(label, sizeof(label), "%d-state%s", n, (f == 0 ? "" : " transposed"));
+
+            // new, new, reverted (cache hit), repeated (buffer already current), other buffer
+            failures += checkRateMatrix(label, instance, 0, q1, &freqs1, n);
+            failures += checkRateMatrix(label, instance, 0, q2, &freqs2, n);
+            failures += checkRateMatrix(label, instance, 0, q1, &freqs1, n);
+            failures += checkRateMatrix(label, instance, 0, q1, &freqs1, n);
+            failures += checkRateMatrix(label, instance, 1, q1, NULL, n);
+
+            // an eigen buffer overwritten directly must be rebuilt on the next cache hit
+            std::vector<double> identity(n * n, 0.0), zeros(n, 0.0);
+            for (int i = 0; i < n; i++)
+                identity[i * n + i] = 1.0;
+            beagleSetEigenDecomposition(instance, 0, &identity[0], &identity[0], &zeros[0]);
+            failures += checkRateMatrix(label, instance, 0, q1, &freqs1, n);
+
+            // uniformization, including a branch long enough for exp(-lambda t) to underflow,
+            // then back to the eigen decomposition
+            failures += checkUniformization(label, instance, q2, n, edgeLength);
+            failures += checkUniformization(label, instance, q2, n, 400.0);
+            failures += checkRateMatrix(label, instance, 0, q1, &freqs1, n);
+
+            beagleFinalizeInstance(instance);
+        }
+    }
+
+    // non-reversible cyclic model: eigenvalues 0 and -1.5 +/- 0.866i
+    std::vector<double> cyclic(9, 0.0);
+    cyclic[0 * 3 + 1] = cyclic[1 * 3 + 2] = cyclic[2 * 3 + 0] = 1.0;
+    for (int i = 0; i < 3; i++)
+        cyclic[i * 3 + i] = -1.0;
+
+    int instance = createInstance(3, BEAGLE_FLAG_EIGEN_COMPLEX);
+    if (instance >= 0) {
+        failures += checkRateMatrix("3-state complex", instance, 0, cyclic, NULL, 3);
+        failures += checkUniformization("3-state complex", instance, cyclic, 3, edgeLength);
+        beagleFinalizeInstance(instance);
+    }
+
+    instance = createInstance(3, BEAGLE_FLAG_EIGEN_REAL);
+    if (instance >= 0) {
+        if (beagleSetRateMatrix(instance, 0, &cyclic[0], NULL) == BEAGLE_SUCCESS) {
+            fprintf(stderr, "3-state real: complex eigenvalues accepted\n");
+            failures++;
+        }
+        beagleFinalizeInstance(instance);
+    }
+
+    return failures;
+}
@@ -0,0 +1,166 @@
+/*
+ *  sparse.cpp
+ *  BEAGLE
+ *
+ *  Checks root log likelihoods for a large state space against a direct
+ *  calculation, with transition matrices sparse enough to use the sparse
+ *  partials kernels and dense enough to use the standard ones, without
+ *  scaling, with scale factors written by the operations and with scale
+ *  factors read back by a second traversal.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <vector>
+
+#include "unittest.h"
+
+namespace {
+
+const int stateCount = 120;
+const int patternCount = 37;
+const int categoryCount = 2;
+const int tipCount = 4;
+
+/* Tips 0 and 3 are compact states, tips 1 and 2 are partials. */
+struct Data {
+    std::vector<int> states[tipCount];
+    std::vector<double> partials[tipCount];
+    std::vector<double> matrices[2 * tipCount - 2];
+};
+
+Data makeData(double fill, unsigned int seed) {
+    const int n = stateCount;
+    Data data;
+    srand(seed);
+    for (int t = 0; t < tipCount; t++) {
+        data.partials[t].resize(n * patternCount);
+        data.states[t].resize(patternCount);
+        for (int k = 0; k < patternCount; k++) {
+            int state = rand() % (n + 1); // n is missing
+            data.states[t][k] = state;
+            for (int i = 0; i < n; i++) {
+                if (t == 0 || t == 3)
+                    data.partials[t][k * n + i] = (state == n || state == i ? 1.0 : 0.0);
+                else
+                    data.partials[t][k * n + i] = rand() / (double) RAND_MAX;
+            }
+        }
+    }
+    for (int m = 0; m < 2 * tipCount - 2; m++) {
+        data.matrices[m].resize(n * n * categoryCount);
+        for (int i = 0; i < n * n * categoryCount; i++) {
+            double x = rand() / (double) RAND_MAX;
+            // keep the diagonal so no row is empty
+            bool diagonal = ((i % (n * n)) / n == i % n);
+            data.matrices[m][i] = (diagonal || x < fill ? 0.01 * rand() / (double) RAND_MAX : 0.0);
+        }
+    }
+    return data;
+}
+
+/* ((0,1)4,(2,3)5)6 with matrix c for child c and matrices 4, 5 for the internal nodes. */
+double directLogLikelihood(const Data& data) {
+    const int n = stateCount;
+    double logL = 0.0;
+    for (int k = 0; k < patternCount; k++) {
+        double siteL = 0.0;
+        for (int l = 0; l < categoryCount; l++) {
+            std::vector<double> node[2 * tipCount - 1];
+            for (int t = 0; t < tipCount; t++)
+                node[t].assign(&data.partials[t][k * n], &data.partials[t][k * n] + n);
+            int children[3][2] = { {0, 1}, {2, 3}, {4, 5} };
+            for (int p = 0; p < 3; p++) {
+                node[tipCount + p].assign(n, 1.0);
+                for (int c = 0; c < 2; c++) {
+                    int child = children[p][c];
+                    const double* m = &data.matrices[child][l * n * n];
+                    for (int i = 0; i < n; i++) {
+                        double sum = 0.0;
+                        for (int j = 0; j < n; j++)
+                            sum += m[i * n + j] * node[child][j];
+                        node[tipCount + p][i] *= sum;
+                    }
+                }
+            }
+            for (int i = 0; i < n; i++)
+                siteL += node[6][i] / n / categoryCount;
+        }
+        logL += log(siteL);
+    }
+    return logL;
+}
+
+int checkData(const char* label, const Data& data) {
+    const int n = stateCount;
+    int instance = createCPUInstance(tipCount, 2 * tipCount - 1, 2, n, patternCount, 1,
+                                     2 * tipCount - 2, categoryCount, 4, 0);
+    if (instance < 0) {
+        fprintf(stderr, "failed to create instance: %d\n", instance);
+        return 1;
+    }
+
+    beagleSetTipStates(instance, 0, &data.states[0][0]);
+    beagleSetTipPartials(instance, 1, &data.partials[1][0]);
+    beagleSetTipPartials(instance, 2, &data.partials[2][0]);
+    beagleSetTipStates(instance, 3, &data.states[3][0]);
+    for (int m = 0; m < 2 * tipCount - 2; m++)
+        beagleSetTransitionMatrix(instance, m, &data.matrices[m][0], 1.0);
+
+    std::vector<double> freqs(n, 1.0 / n), weights(categoryCount, 1.0 / categoryCount),
+                        rates(categoryCount, 1.0), patternWeights(patternCount, 1.0);
+    beagleSetStateFrequencies(instance, 0, &freqs[0]);
+    beagleSetCategoryWeights(instance, 0, &weights[0]);
+    beagleSetCategoryRates(instance, &rates[0]);
+    beagleSetPatternWeights(instance, &patternWeights[0]);
+
+    const double expected = directLogLikelihood(data);
+    int failures = 0;
+    int rootIndex = 6, zero = 0, cumulativeIndex = 3;
+    int scaleIndices[3] = { 0, 1, 2 };
+
+    for (int pass = 0; pass < 3; pass++) {
+        // no scaling, writing scale factors, reading the scale factors written before
+        BeagleOperation operations[3] = {
+            { 4, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 0, 0, 1, 1 },
+            { 5, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 2, 2, 3, 3 },
+            { 6, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 4, 4, 5, 5 } };
+        for (int op = 0; op < 3; op++) {
+            if (pass == 1)
+                operations[op].destinationScaleWrite = scaleIndices[op];
+            else if (pass == 2)
+                operations[op].destinationScaleRead = scaleIndices[op];
+        }
+        beagleUpdatePartials(instance, operations, 3, BEAGLE_OP_NONE);
+
+        int cumulative = BEAGLE_OP_NONE;
+        if (pass > 0) {
+            beagleResetScaleFactors(instance, cumulativeIndex);
+            beagleAccumulateScaleFactors(instance, scaleIndices, 3, cumulativeIndex);
+            cumulative = cumulativeIndex;
+        }
+        double logL;
+        beagleCalculateRootLogLikelihoods(instance, &rootIndex, &zero, &zero, &cumulative, 1, &logL);
+
+        char passLabel[64];
+        snprintf(passLabel, sizeof(passLabel), "%s pass %d", label, pass);
+        failures += checkRelative(passLabel, logL, expected, 1e-8);
+    }
+
+    beagleFinalizeInstance(instance);
+    return failures;
+}
+
+} // namespace
+
+int runSparseTests() {
+    int failures = 0;
+    failures += checkData("sparse", makeData(0.05, 7));
+    failures += checkData("dense", makeData(0.6, 11));
+    return failures;
+}
@@ -0,0 +1,378 @@
+/*
+ *  unittest.cpp
+ *  BEAGLE
+ *
+ *  Runs the named test suites, or all of them, and the fixtures they share.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+
+#include "unittest.h"
+
+const double kTreeCategoryRates[UT_CATEGORY_COUNT] = { 0.1, 0.5, 1.2, 2.2 };
+
+int createCPUInstance(int tipCount,
+                      int partialsBufferCount,
+                      int compactBufferCount,
+                      int stateCount,
+                      int patternCount,
+                      int eigenBufferCount,
+                      int matrixBufferCount,
+                      int categoryCount,
+                      int scaleBufferCount,
+                      long preferenceFlags,
+                      long requirementFlags,
+                      long* outFlags) {
+    BeagleInstanceDetails instDetails;
+    int instance = beagleCreateInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                                        patternCount, eigenBufferCount, matrixBufferCount, categoryCount,
+                                        scaleBufferCount, NULL, 0, preferenceFlags,
+                                        requirementFlags | BEAGLE_FLAG_PROCESSOR_CPU, &instDetails);
+    if (instance >= 0 && outFlags != NULL)
+        *outFlags = instDetails.flags;
+    return instance;
+}
+
+BalancedTree makeBalancedTree(int tipCount, int patternCount, int stateCount, unsigned int seed,
+                              int conservedPercent, int missingPercent) {
+    BalancedTree tree;
+    tree.tipCount = tipCount;
+    tree.patternCount = patternCount;
+    tree.stateCount = stateCount;
+    srand(seed);
+
+    tree.tipStates.resize(tipCount * patternCount);
+    for (int k = 0; k < patternCount; k++) {
+        int ancestral = rand() % stateCount;
+        for (int i = 0; i < tipCount; i++) {
+            int r = rand() % 100;
+            tree.tipStates[i * patternCount + k] = (r < conservedPercent ? ancestral :
+                                                    (r < 100 - missingPercent ? rand() % stateCount : stateCount));
+        }
+    }
+
+    const int nodeCount = 2 * tipCount - 1;
+    tree.edgeLengths.resize(nodeCount);
+    for (int i = 0; i < nodeCount; i++)
+        tree.edgeLengths[i] = 0.01 + 0.2 * (rand() / (double) RAND_MAX);
+
+    std::vector<int> level;
+    for (int i = 0; i < tipCount; i++)
+        level.push_back(i);
+
+    tree.root = nodeCount - 1;
+    int next = tipCount;
+    while (level.size() > 1) {
+        std::vector<int> parents;
+        for (size_t i = 0; i + 1 < level.size(); i += 2) {
+            BeagleOperation op;
+            op.destinationPartials = next;
+            op.destinationScaleWrite = (next == tree.root ? BEAGLE_OP_NONE : next - tipCount);
+            op.destinationScaleRead = BEAGLE_OP_NONE;
+            op.child1Partials = level[i];
+            op.child1TransitionMatrix = level[i];
+            op.child2Partials = level[i + 1];
+            op.child2TransitionMatrix = level[i + 1];
+            if (next == tree.root) {
+                tree.rootChild1 = level[i];
+                tree.rootChild2 = level[i + 1];
+            }
+            tree.operations.push_back(op);
+            parents.push_back(next++);
+        }
+        level = parents;
+    }
+
+    tree.edgeLengths[tree.rootChild2] += tree.edgeLengths[tree.rootChild1];
+    tree.edgeLengths[tree.rootChild1] = 0.0;
+
+    return tree;
+}
+
+int createTreeInstance(const BalancedTree& tree, int partialsTipCount, int matrixBufferCount,
+                       long preferenceFlags, long requirementFlags, long* outFlags) {
+    const int n = tree.stateCount;
+    const int internalCount = tree.tipCount - 1;
+    int instance = createCPUInstance(tree.tipCount, internalCount + partialsTipCount,
+                                     tree.tipCount - partialsTipCount, n, tree.patternCount, 1,
+                                     matrixBufferCount, UT_CATEGORY_COUNT, internalCount + 1,
+                                     preferenceFlags | (preferenceFlags & BEAGLE_FLAG_SCALERS_RAW ? 0 :
+                                                        BEAGLE_FLAG_SCALERS_LOG),
+                                     requirementFlags | BEAGLE_FLAG_SCALING_MANUAL, outFlags);
+    if (instance < 0)
+        return instance;
+
+    std::vector<double> tipPartials(tree.patternCount * n);
+    for (int i = 0; i < tree.tipCount; i++) {
+        const int* states = &tree.tipStates[i * tree.patternCount];
+        if (i < partialsTipCount) {
+            for (int k = 0; k < tree.patternCount; k++)
+                for (int j = 0; j < n; j++)
+                    tipPartials[k * n + j] = (states[k] == n || states[k] == j ? 1.0 : 0.0);
+            beagleSetTipPartials(instance, i, &tipPartials[0]);
+        } else {
+            beagleSetTipStates(instance, i, states);
+        }
+    }
+
+    std::vector<double> patternWeights(tree.patternCount);
+    for (int k = 0; k < tree.patternCount; k++)
+        patternWeights[k] = 1.0 + (k % 3);
+    beagleSetPatternWeights(instance, &patternWeights[0]);
+
+    std::vector<double> freqs(n, 1.0 / n);
+    beagleSetStateFrequencies(instance, 0, &freqs[0]);
+
+    double weights[UT_CATEGORY_COUNT] = { 0.25, 0.25, 0.25, 0.25 };
+    beagleSetCategoryRates(instance, kTreeCategoryRates);
+    beagleSetCategoryWeights(instance, 0, weights);
+
+    return instance;
+}
+
+void updateJC69TransitionMatrices(int instance, const BalancedTree& tree) {
+    double evec[4 * 4] = {
+         1.0,  2.0,  0.0,  0.5,
+         1.0,  -2.0,  0.5,  0.0,
+         1.0,  2.0, 0.0,  -0.5,
+         1.0,  -2.0,  -0.5,  0.0
+    };
+    double ivec[4 * 4] = {
+         0.25,  0.25,  0.25,  0.25,
+         0.125,  -0.125,  0.125,  -0.125,
+         0.0,  1.0,  0.0,  -1.0,
+         1.0,  0.0,  -1.0,  0.0
+    };
+    double eval[4] = { 0.0, -1.3333333333333333, -1.3333333333333333, -1.3333333333333333 };
+    beagleSetEigenDecomposition(instance, 0, evec, ivec, eval);
+
+    const int edgeCount = 2 * tree.tipCount - 2;
+    std::vector<int> nodeIndices(edgeCount);
+    for (int i = 0; i < edgeCount; i++)
+        nodeIndices[i] = i;
+    beagleUpdateTransitionMatrices(instance, 0, &nodeIndices[0], NULL, NULL, &tree.edgeLengths[0], edgeCount);
+}
+
+void setJCTransitionMatrices(int instance, const BalancedTree& tree, bool derivatives) {
+    const int n = tree.stateCount;
+    const int nodeCount = 2 * tree.tipCount - 1;
+    const double beta = n / (n - 1.0);
+    std::vector<double> matrix(UT_CATEGORY_COUNT * n * n);
+    std::vector<double> firstDeriv(matrix.size());
+    std::vector<double> secondDeriv(matrix.size());
+    for (int node = 0; node < nodeCount - 1; node++) {
+        for (int l = 0; l < UT_CATEGORY_COUNT; l++) {
+            const double rate = kTreeCategoryRates[l];
+            double e = exp(-beta * rate * tree.edgeLengths[node]);
+            double d1 = -beta * rate * e;
+            double d2 = beta * rate * beta * rate * e;
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    int u = (l * n + i) * n + j;
+                    matrix[u] = (i == j ? 1.0 / n + (n - 1.0) / n * e : (1.0 - e) / n);
+                    firstDeriv[u] = (i == j ? (n - 1.0) / n * d1 : -d1 / n);
+                    secondDeriv[u] = (i == j ? (n - 1.0) / n * d2 : -d2 / n);
+                }
+            }
+        }
+        beagleSetTransitionMatrix(instance, node, &matrix[0], 1.0);
+        if (derivatives) {
+            beagleSetTransitionMatrix(instance, nodeCount + node, &firstDeriv[0], 0.0);
+            beagleSetTransitionMatrix(instance, 2 * nodeCount + node, &secondDeriv[0], 0.0);
+        }
+    }
+}
+
+void calculateTreeLikelihoods(int instance, const BalancedTree& tree, TreeResults* results) {
+    int cumulativeIndex = tree.tipCount - 1;
+    beagleResetScaleFactors(instance, cumulativeIndex);
+    beagleUpdatePartials(instance, &tree.operations[0], (int) tree.operations.size(), cumulativeIndex);
+
+    int rootIndex = tree.root;
+    int categoryWeightsIndex = 0;
+    int stateFrequencyIndex = 0;
+    beagleCalculateRootLogLikelihoods(instance, &rootIndex, &categoryWeightsIndex,
+                                      &stateFrequencyIndex, &cumulativeIndex, 1, &results->rootLogL);
+
+    results->siteLogLs.resize(tree.patternCount);
+    beagleGetSiteLogLikelihoods(instance, &results->siteLogLs[0]);
+
+    int parentIndex = tree.rootChild1;
+    int childIndex = tree.rootChild2;
+    beagleCalculateEdgeLogLikelihoods(instance, &parentIndex, &childIndex, &childIndex, NULL, NULL,
+                                      &categoryWeightsIndex, &stateFrequencyIndex, &cumulativeIndex,
+                                      1, &results->edgeLogL, NULL, NULL);
+}
+
+int compareTreeResults(const char* label, const TreeResults& reference, const TreeResults& results,
+                       double tolerance) {
+    int failures = 0;
+
+    printf("%s: root = %.10f / %.10f\tedge = %.10f / %.10f\n", label,
+           reference.rootLogL, results.rootLogL, reference.edgeLogL, results.edgeLogL);
+
+    if (fabs(reference.rootLogL - results.rootLogL) > tolerance * fabs(reference.rootLogL) ||
+        fabs(reference.edgeLogL - results.edgeLogL) > tolerance * fabs(reference.edgeLogL)) {
+        fprintf(stderr, "%s: log likelihood differs from reference\n", label);
+        failures++;
+    }
+
+    for (size_t k = 0; k < reference.siteLogLs.size(); k++) {
+        if (fabs(reference.siteLogLs[k] - results.siteLogLs[k]) > tolerance * fabs(reference.siteLogLs[k])) {
+            fprintf(stderr, "%s: site %d log likelihood differs from reference\n", label, (int) k);
+            failures++;
+            break;
+        }
+    }
+
+    return failures;
+}
+
+std::vector<double> makeReversibleRateMatrix(int n, unsigned int seed, std::vector<double>* outFreqs) {
+    srand(seed);
+    std::vector<double>& freqs = *outFreqs;
+    freqs.resize(n);
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) {
+        freqs[i] = 0.5 + rand() / (double) RAND_MAX;
+        sum += freqs[i];
+    }
+    for (int i = 0; i < n; i++)
+        freqs[i] /= sum;
+
+    std::vector<double> q(n * n, 0.0);
+    for (int i = 0; i < n; i++) {
+        for (int j = i + 1; j < n; j++) {
+            double rate = 0.1 + rand() / (double) RAND_MAX;
+            q[i * n + j] = rate * freqs[j];
+            q[j * n + i] = rate * freqs[i];
+        }
+    }
+    double mu = 0.0;
+    for (int i = 0; i < n; i++) {
+        double row = 0.0;
+        for (int j = 0; j < n; j++)
+            row += (i == j ? 0.0 : q[i * n + j]);
+        q[i * n + i] = -row;
+        mu += freqs[i] * row;
+    }
+    for (int i = 0; i < n * n; i++)
+        q[i] /= mu;
+    return q;
+}
+
+void setHKYRateMatrix(int instance, int eigenIndex, double kappa, const double* freqs) {
+    double q[4 * 4];
+    for (int i = 0; i < 4; i++) {
+        double sum = 0.0;
+        for (int j = 0; j < 4; j++) {
+            if (j != i)
+                sum += (q[i * 4 + j] = ((i + j) % 2 == 0 ? kappa : 1.0) * freqs[j]);
+        }
+        q[i * 4 + i] = -sum;
+    }
+    beagleSetRateMatrix(instance, eigenIndex, q, freqs);
+}
+
+void setPatternPartitions(int instance, int patternCount, int partitionCount) {
+    std::vector<int> partitions(patternCount);
+    for (int k = 0; k < patternCount; k++)
+        partitions[k] = (int) ((long) k * partitionCount / patternCount);
+    beagleSetPatternPartitions(instance, partitionCount, &partitions[0]);
+}
+
+double maxMatrixDifference(int instanceA, int matrixA, int instanceB, int matrixB, int matrixSize) {
+    std::vector<double> a(matrixSize), b(matrixSize);
+    beagleGetTransitionMatrix(instanceA, matrixA, &a[0]);
+    beagleGetTransitionMatrix(instanceB, matrixB, &b[0]);
+    double difference = 0.0;
+    for (int i = 0; i < matrixSize; i++)
+        difference = std::max(difference, fabs(a[i] - b[i]));
+    return difference;
+}
+
+int check(const char* label, double difference, double tolerance) {
+    printf("%s: max difference %.3e\n", label, difference);
+    if (!(difference <= tolerance)) {
+        fprintf(stderr, "%s: exceeds %.1e\n", label, tolerance);
+        return 1;
+    }
+    return 0;
+}
+
+int checkRelative(const char* label, double value, double expected, double tolerance) {
+    printf("%s: %.10f (expected %.10f)\n", label, value, expected);
+    if (!(fabs(value - expected) <= tolerance * fabs(expected))) {
+        fprintf(stderr, "%s: differs by more than %.1e relative\n", label, tolerance);
+        return 1;
+    }
+    return 0;
+}
+
+struct Suite {
+    const char* name;
+    int (*run)();
+};
+
+const Suite suites[] = {
+    { "mixed",          runMixedTests },
+    { "openmp",         runOpenMPTests },
+    { "partialslayout", runPartialsLayoutTests },
+    { "edgeperedge",    runEdgePerEdgeTests },
+    { "ratematrix",     runRateMatrixTests },
+    { "sparse",         runSparseTests },
+    { "evaluate",       runEvaluateTests },
+    { "checkpoint",     runCheckpointTests },
+    { "epochmatrix",    runEpochMatrixTests },
+    { "edgegradient",   runEdgeGradientTests },
+    { "multimodel",     runMultiModelTests },
+    { "matrixmemo",     runMatrixMemoTests },
+    { "missingdata",    runMissingDataTests },
+    { "fixedstate",     runFixedStateTests },
+    { "plugins",        runPluginTests } };
+
+const int suiteCount = sizeof(suites) / sizeof(Suite);
+
+const char* unittestProgram = "unittest";
+
+int main(int argc, const char* argv[]) {
+
+    unittestProgram = argv[0];
+    if (argc == 4 && strcmp(argv[1], "--plugin-child") == 0)
+        return runPluginChild(argv[2], argv[3]);
+
+    int failedSuites = 0;
+
+    for (int s = 0; s < suiteCount; s++) {
+        bool selected = (argc < 2);
+        for (int a = 1; a < argc; a++)
+            selected = selected || (strcmp(argv[a], suites[s].name) == 0);
+        if (!selected)
+            continue;
+        printf("== %s\n", suites[s].name);
+        if (suites[s].run() != 0) {
+            fprintf(stderr, "== %s FAILED\n", suites[s].name);
+            failedSuites++;
+        }
+    }
+
+    for (int a = 1; a < argc; a++) {
+        bool known = false;
+        for (int s = 0; s < suiteCount; s++)
+            known = known || (strcmp(argv[a], suites[s].name) == 0);
+        if (!known) {
+            fprintf(stderr, "unknown suite %s\n", argv[a]);
+            failedSuites++;
+        }
+    }
+
+    return (failedSuites == 0 ? 0 : 1);
+}
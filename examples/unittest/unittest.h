@@ -0,0 +1,129 @@
+/*
+ *  unittest.h
+ *  BEAGLE
+ *
+ *  Fixtures shared by the test suites of the unittest driver.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#ifndef __BEAGLE_UNITTEST_H__
+#define __BEAGLE_UNITTEST_H__
+
+#include <vector>
+
+#include "libhmsbeagle/beagle.h"
+
+#define UT_CATEGORY_COUNT   4   // rate categories of the tree fixtures
+
+/* Suites, each returning its number of failures. */
+int runMixedTests();
+int runOpenMPTests();
+int runPartialsLayoutTests();
+int runEdgePerEdgeTests();
+int runRateMatrixTests();
+int runSparseTests();
+int runEvaluateTests();
+int runCheckpointTests();
+int runEpochMatrixTests();
+int runEdgeGradientTests();
+int runMultiModelTests();
+int runMatrixMemoTests();
+int runMissingDataTests();
+int runFixedStateTests();
+int runPluginTests();
+
+/* The child process of the plugin tests, run as unittest --plugin-child <plugins|-> <none|sse|any>. */
+int runPluginChild(const char* selectedPlugins, const char* vector);
+
+/* The path this driver was run as. */
+extern const char* unittestProgram;
+
+/* A CPU instance; requirementFlags default to double precision. */
+int createCPUInstance(int tipCount,
+                      int partialsBufferCount,
+                      int compactBufferCount,
+                      int stateCount,
+                      int patternCount,
+                      int eigenBufferCount,
+                      int matrixBufferCount,
+                      int categoryCount,
+                      int scaleBufferCount,
+                      long preferenceFlags,
+                      long requirementFlags = BEAGLE_FLAG_PRECISION_DOUBLE,
+                      long* outFlags = NULL);
+
+/*
+ * A balanced tree whose internal nodes join consecutive pairs of the previous level, with
+ * matrix n for the edge above node n. Every internal node but the root writes scale buffer
+ * n - tipCount, and the root edge lies wholly on rootChild2.
+ */
+struct BalancedTree {
+    int tipCount;
+    int patternCount;
+    int stateCount;
+    std::vector<int> tipStates;             // [tip][pattern], stateCount where missing
+    std::vector<double> edgeLengths;        // [node]
+    std::vector<BeagleOperation> operations;
+    int root;
+    int rootChild1;
+    int rootChild2;
+};
+
+BalancedTree makeBalancedTree(int tipCount, int patternCount, int stateCount, unsigned int seed,
+                              int conservedPercent, int missingPercent);
+
+struct TreeResults {
+    double rootLogL;
+    double edgeLogL;                        // across the root, from rootChild1
+    std::vector<double> siteLogLs;
+};
+
+/*
+ * An instance for the tree with manual log scalers (raw if preferenceFlags ask for them, as
+ * reading fixed scale factors needs), the first partialsTipCount tips set as partials and the
+ * rest as states, uniform frequencies, UT_CATEGORY_COUNT rate categories and pattern weights
+ * 1 + k % 3.
+ */
+int createTreeInstance(const BalancedTree& tree, int partialsTipCount, int matrixBufferCount,
+                       long preferenceFlags, long requirementFlags, long* outFlags = NULL);
+
+/* The rates set by createTreeInstance. */
+extern const double kTreeCategoryRates[UT_CATEGORY_COUNT];
+
+/* JC69 eigen system of a 4-state instance, then matrices for every edge of the tree. */
+void updateJC69TransitionMatrices(int instance, const BalancedTree& tree);
+
+/*
+ * Closed-form Jukes-Cantor matrices for every edge of the tree, with first and second
+ * derivatives in matrices nodeCount + n and 2 nodeCount + n when derivatives is set.
+ */
+void setJCTransitionMatrices(int instance, const BalancedTree& tree, bool derivatives);
+
+/* Post-order traversal accumulating scale factors, then root, site and root-edge log likelihoods. */
+void calculateTreeLikelihoods(int instance, const BalancedTree& tree, TreeResults* results);
+
+/* Relative comparison of root, edge and site log likelihoods. */
+int compareTreeResults(const char* label, const TreeResults& reference, const TreeResults& results,
+                       double tolerance);
+
+/* A random reversible rate matrix normalised to one expected substitution per unit time. */
+std::vector<double> makeReversibleRateMatrix(int stateCount, unsigned int seed, std::vector<double>* outFreqs);
+
+/* HKY-like 4-state rate matrix with transition/transversion ratio kappa. */
+void setHKYRateMatrix(int instance, int eigenIndex, double kappa, const double* freqs);
+
+/* Equal contiguous pattern partitions; on threaded instances each starts a worker thread. */
+void setPatternPartitions(int instance, int patternCount, int partitionCount);
+
+double maxMatrixDifference(int instanceA, int matrixA, int instanceB, int matrixB, int matrixSize);
+
+/* Reports a failure when difference is not within tolerance. */
+int check(const char* label, double difference, double tolerance);
+
+/* Reports a failure when value is not within tolerance relative to expected. */
+int checkRelative(const char* label, double value, double expected, double tolerance);
+
+#endif // __BEAGLE_UNITTEST_H__
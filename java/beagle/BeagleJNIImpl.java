@@ -5,6 +5,11 @@
 
 package beagle;
 
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.DoubleBuffer;
+import java.nio.IntBuffer;
+
 /*
  * BeagleJNIjava
  *
@@ -502,6 +507,111 @@ public class BeagleJNIImpl implements Beagle {
         }
     }
 
+    /**
+     * Allocates a direct, native-order buffer that can be registered with registerBuffer.
+     */
+    public static DoubleBuffer allocateDoubleBuffer(int length) {
+        return ByteBuffer.allocateDirect(length * 8).order(ByteOrder.nativeOrder()).asDoubleBuffer();
+    }
+
+    public static IntBuffer allocateIntBuffer(int length) {
+        return ByteBuffer.allocateDirect(length * 4).order(ByteOrder.nativeOrder()).asIntBuffer();
+    }
+
+    /**
+     * Registers a direct buffer with this instance and returns its handle. The library reads
+     * and writes the buffer in place for the lifetime of the instance, so the *Direct methods
+     * below move no data through the JVM.
+     */
+    public int registerBuffer(final DoubleBuffer buffer) {
+        return registerBuffer(buffer, buffer.isDirect() && buffer.order() == ByteOrder.nativeOrder(), 8);
+    }
+
+    public int registerBuffer(final IntBuffer buffer) {
+        return registerBuffer(buffer, buffer.isDirect() && buffer.order() == ByteOrder.nativeOrder(), 4);
+    }
+
+    private int registerBuffer(final java.nio.Buffer buffer, boolean usable, int elementSize) {
+        if (!usable) {
+            throw new IllegalArgumentException("buffer must be direct and in native byte order");
+        }
+        int handle = BeagleJNIWrapper.INSTANCE.registerDirectBuffer(instance, buffer, elementSize);
+        if (handle < 0) {
+            throw new BeagleException("registerBuffer", handle);
+        }
+        return handle;
+    }
+
+    public void unregisterBuffers() {
+        int errCode = BeagleJNIWrapper.INSTANCE.unregisterDirectBuffers(instance);
+        if (errCode != 0) {
+            throw new BeagleException("unregisterBuffers", errCode);
+        }
+    }
+
+    public void setTipStatesDirect(int tipIndex, int bufferHandle) {
+        int errCode = BeagleJNIWrapper.INSTANCE.setTipStatesDirect(instance, tipIndex, bufferHandle);
+        if (errCode != 0) {
+            throw new BeagleException("setTipStatesDirect", errCode);
+        }
+    }
+
+    public void setTipPartialsDirect(int tipIndex, int bufferHandle) {
+        int errCode = BeagleJNIWrapper.INSTANCE.setTipPartialsDirect(instance, tipIndex, bufferHandle);
+        if (errCode != 0) {
+            throw new BeagleException("setTipPartialsDirect", errCode);
+        }
+    }
+
+    public void setPartialsDirect(int bufferIndex, int bufferHandle) {
+        int errCode = BeagleJNIWrapper.INSTANCE.setPartialsDirect(instance, bufferIndex, bufferHandle);
+        if (errCode != 0) {
+            throw new BeagleException("setPartialsDirect", errCode);
+        }
+    }
+
+    public void getPartialsDirect(int bufferIndex, int scaleIndex, int bufferHandle) {
+        int errCode = BeagleJNIWrapper.INSTANCE.getPartialsDirect(instance, bufferIndex, scaleIndex, bufferHandle);
+        if (errCode != 0) {
+            throw new BeagleException("getPartialsDirect", errCode);
+        }
+    }
+
+    /**
+     * Updates partials from operations held in a registered int buffer, seven indices per
+     * operation in the order used by updatePartials.
+     */
+    public void updatePartialsDirect(int operationsHandle, int operationCount, int cumulativeScaleIndex) {
+        int errCode = BeagleJNIWrapper.INSTANCE.updatePartialsDirect(instance, operationsHandle, operationCount, cumulativeScaleIndex);
+        if (errCode != 0) {
+            throw new BeagleException("updatePartialsDirect", errCode);
+        }
+    }
+
+    public void getSiteLogLikelihoodsDirect(int bufferHandle) {
+        int errCode = BeagleJNIWrapper.INSTANCE.getSiteLogLikelihoodsDirect(instance, bufferHandle);
+        if (errCode != 0) {
+            throw new BeagleException("getSiteLogLikelihoodsDirect", errCode);
+        }
+    }
+
+    /**
+     * Runs a beagleEvaluate command stream in one native call. outResults receives the log
+     * likelihood and, if the stream requests them, the first and second derivatives.
+     */
+    public void evaluate(final int[] commands,
+                         int commandLength,
+                         final double[] values,
+                         int valueCount,
+                         final double[] outResults) {
+        int errCode = BeagleJNIWrapper.INSTANCE.evaluate(instance, commands, commandLength,
+                values, valueCount, outResults);
+        // We probably don't want the Floating Point error to throw an exception...
+        if (errCode != 0 && errCode != BeagleErrorCode.FLOATING_POINT_ERROR.getErrCode()) {
+            throw new BeagleException("evaluate", errCode);
+        }
+    }
+
     public InstanceDetails getDetails() {
         return details;
     }
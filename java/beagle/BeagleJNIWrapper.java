@@ -272,6 +272,31 @@ public class BeagleJNIWrapper {
                                               double[] outFirstDerivative,
                                               double[] outDiagonalSecondDerivative);
 
+    /* Direct buffers registered once per instance and passed by handle afterwards */
+
+    public native int registerDirectBuffer(int instance, final java.nio.Buffer buffer, int elementSize);
+
+    public native int unregisterDirectBuffers(int instance);
+
+    public native int setTipStatesDirect(int instance, int tipIndex, int handle);
+
+    public native int setTipPartialsDirect(int instance, int tipIndex, int handle);
+
+    public native int setPartialsDirect(int instance, int bufferIndex, int handle);
+
+    public native int getPartialsDirect(int instance, int bufferIndex, int scaleIndex, int handle);
+
+    public native int updatePartialsDirect(int instance, int handle, int operationCount, int cumulativeScaleIndex);
+
+    public native int getSiteLogLikelihoodsDirect(int instance, int handle);
+
+    public native int evaluate(int instance,
+                               final int[] commands,
+                               int commandLength,
+                               final double[] values,
+                               int valueCount,
+                               final double[] outResults);
+
     /* Library loading routines */
 
     private static String getPlatformSpecificLibraryName()
@@ -0,0 +1,177 @@
+/*
+ * JNIBenchmark.java
+ *
+ */
+
+package beagle;
+
+import java.nio.DoubleBuffer;
+import java.nio.IntBuffer;
+import java.util.Random;
+
+/*
+ * JNIBenchmark
+ *
+ * Times the array and direct-buffer JNI paths of BeagleJNIImpl for the calls made
+ * on every likelihood evaluation: setPartials, getPartials, updatePartials and
+ * getSiteLogLikelihoods. Follows the JMH pattern of warmup iterations followed by
+ * measured iterations, reporting the mean and standard deviation per call.
+ *
+ * java -Djava.library.path=<lib dir> -cp beagle.jar beagle.JNIBenchmark [taxa] [patterns] [states]
+ */
+
+public class JNIBenchmark {
+
+    private static final int WARMUP_ITERATIONS = 5;
+    private static final int MEASURED_ITERATIONS = 10;
+    private static final long ITERATION_NANOS = 200000000L;
+
+    private interface Call {
+        void run();
+    }
+
+    private static void bench(String name, Call call) {
+        // calibrate the number of calls per iteration
+        int calls = 1;
+        while (true) {
+            long start = System.nanoTime();
+            for (int i = 0; i < calls; i++) {
+                call.run();
+            }
+            if (System.nanoTime() - start > ITERATION_NANOS / 10 || calls > (1 << 24)) {
+                break;
+            }
+            calls *= 2;
+        }
+        calls *= 10;
+
+        double[] nanosPerCall = new double[MEASURED_ITERATIONS];
+        for (int iteration = 0; iteration < WARMUP_ITERATIONS + MEASURED_ITERATIONS; iteration++) {
+            long start = System.nanoTime();
+            for (int i = 0; i < calls; i++) {
+                call.run();
+            }
+            long elapsed = System.nanoTime() - start;
+            if (iteration >= WARMUP_ITERATIONS) {
+                nanosPerCall[iteration - WARMUP_ITERATIONS] = (double) elapsed / calls;
+            }
+        }
+
+        double mean = 0.0;
+        for (double x : nanosPerCall) {
+            mean += x / MEASURED_ITERATIONS;
+        }
+        double variance = 0.0;
+        for (double x : nanosPerCall) {
+            variance += (x - mean) * (x - mean) / (MEASURED_ITERATIONS - 1);
+        }
+        System.out.println(String.format("%-28s %12.1f ns/op  +- %8.1f", name, mean, Math.sqrt(variance)));
+    }
+
+    public static void main(String[] args) {
+        final int tipCount = (args.length > 0 ? Integer.parseInt(args[0]) : 8);
+        final int patternCount = (args.length > 1 ? Integer.parseInt(args[1]) : 1000);
+        final int stateCount = (args.length > 2 ? Integer.parseInt(args[2]) : 4);
+        final int categoryCount = 4;
+        final int partialsLength = stateCount * patternCount * categoryCount;
+
+        BeagleJNIWrapper.loadBeagleLibrary();
+
+        final BeagleJNIImpl beagle = new BeagleJNIImpl(tipCount, 2 * tipCount - 1, 0, stateCount,
+                patternCount, 1, 2 * tipCount - 2, categoryCount, 0, null, 0,
+                BeagleFlag.PROCESSOR_CPU.getMask());
+
+        System.out.println("taxa " + tipCount + ", patterns " + patternCount + ", states " + stateCount +
+                ", categories " + categoryCount);
+
+        Random random = new Random(1);
+        final double[] partials = new double[partialsLength];
+        for (int i = 0; i < partialsLength; i++) {
+            partials[i] = random.nextDouble();
+        }
+        double[] tipPartials = new double[stateCount * patternCount];
+        for (int i = 0; i < tipPartials.length; i++) {
+            tipPartials[i] = random.nextDouble();
+        }
+        for (int tip = 0; tip < tipCount; tip++) {
+            beagle.setTipPartials(tip, tipPartials);
+        }
+
+        double[] patternWeights = new double[patternCount];
+        java.util.Arrays.fill(patternWeights, 1.0);
+        beagle.setPatternWeights(patternWeights);
+        double[] frequencies = new double[stateCount];
+        java.util.Arrays.fill(frequencies, 1.0 / stateCount);
+        beagle.setStateFrequencies(0, frequencies);
+        double[] categoryWeights = new double[categoryCount];
+        java.util.Arrays.fill(categoryWeights, 1.0 / categoryCount);
+        beagle.setCategoryWeights(0, categoryWeights);
+
+        double[] matrix = new double[stateCount * stateCount * categoryCount];
+        for (int i = 0; i < matrix.length; i++) {
+            matrix[i] = random.nextDouble() / stateCount;
+        }
+        for (int m = 0; m < 2 * tipCount - 2; m++) {
+            beagle.setTransitionMatrix(m, matrix, 1.0);
+        }
+
+        // a caterpillar tree
+        final int operationCount = tipCount - 1;
+        final int[] operations = new int[operationCount * 7];
+        int previous = 0;
+        for (int i = 0; i < operationCount; i++) {
+            int[] op = { tipCount + i, -1, -1, previous, previous, i + 1, i + 1 };
+            System.arraycopy(op, 0, operations, i * 7, 7);
+            previous = tipCount + i;
+        }
+        final int root = previous;
+        final double[] siteLogLikelihoods = new double[patternCount];
+
+        final DoubleBuffer partialsBuffer = BeagleJNIImpl.allocateDoubleBuffer(partialsLength);
+        partialsBuffer.put(partials);
+        final IntBuffer operationsBuffer = BeagleJNIImpl.allocateIntBuffer(operations.length);
+        operationsBuffer.put(operations);
+        final DoubleBuffer siteBuffer = BeagleJNIImpl.allocateDoubleBuffer(patternCount);
+        final int partialsHandle = beagle.registerBuffer(partialsBuffer);
+        final int operationsHandle = beagle.registerBuffer(operationsBuffer);
+        final int siteHandle = beagle.registerBuffer(siteBuffer);
+
+        final int[] rootIndices = { root };
+        final int[] zeros = { 0 };
+        final int[] noScaling = { -1 };
+        final double[] logL = new double[1];
+
+        bench("setPartials array", new Call() {
+            public void run() { beagle.setPartials(root, partials); }
+        });
+        bench("setPartials direct", new Call() {
+            public void run() { beagle.setPartialsDirect(root, partialsHandle); }
+        });
+        bench("getPartials array", new Call() {
+            public void run() { beagle.getPartials(root, -1, partials); }
+        });
+        bench("getPartials direct", new Call() {
+            public void run() { beagle.getPartialsDirect(root, -1, partialsHandle); }
+        });
+        bench("updatePartials array", new Call() {
+            public void run() { beagle.updatePartials(operations, operationCount, -1); }
+        });
+        bench("updatePartials direct", new Call() {
+            public void run() { beagle.updatePartialsDirect(operationsHandle, operationCount, -1); }
+        });
+
+        beagle.calculateRootLogLikelihoods(rootIndices, zeros, zeros, noScaling, 1, logL);
+        bench("getSiteLogLikelihoods array", new Call() {
+            public void run() { beagle.getSiteLogLikelihoods(siteLogLikelihoods); }
+        });
+        bench("getSiteLogLikelihoods direct", new Call() {
+            public void run() { beagle.getSiteLogLikelihoodsDirect(siteHandle); }
+        });
+
+        double difference = 0.0;
+        for (int k = 0; k < patternCount; k++) {
+            difference = Math.max(difference, Math.abs(siteBuffer.get(k) - siteLogLikelihoods[k]));
+        }
+        System.out.println("logL " + logL[0] + ", max site difference between paths " + difference);
+    }
+}
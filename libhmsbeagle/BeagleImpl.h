@@ -18,6 +18,9 @@
 #ifndef __beagle_impl__
 #define __beagle_impl__
 
+#include <cstddef>
+#include <vector>
+
 #include "libhmsbeagle/beagle.h"
 
 #ifdef DOUBLE_PRECISION
@@ -51,6 +54,8 @@ public:
 
     virtual int setCPUThreadCount(int threadCount) = 0;
 
+    virtual int setPartialsLayout(int layout) = 0;
+
     virtual int setTipStates(int tipIndex,
                              const int* inStates) = 0;
 
@@ -73,6 +78,9 @@ public:
                                       const double* inInverseEigenVectors,
                                       const double* inEigenValues) = 0;
 
+    virtual int setUniformizationRateMatrix(int eigenIndex,
+                                            const double* inRateMatrix) = 0;
+
     virtual int setStateFrequencies(int stateFrequenciesIndex,
                                   const double* inStateFrequencies) = 0;
 
@@ -118,6 +126,17 @@ public:
 											const int* resultIndices,
 											int matrixCount) = 0;
 
+    // Product of per-segment transition matrices for each branch of an epoch model; not
+    // implemented by default.
+    virtual int updateEpochTransitionMatrices(const int* segmentCounts,
+                                              const int* eigenIndices,
+                                              const int* categoryRateIndices,
+                                              const double* segmentLengths,
+                                              const int* probabilityIndices,
+                                              const int* firstDerivativeIndices,
+                                              const int* secondDerivativeIndices,
+                                              int count);
+
     virtual int updateTransitionMatrices(int eigenIndex,
                                          const int* probabilityIndices,
                                          const int* firstDerivativeIndices,
@@ -125,6 +144,12 @@ public:
                                          const double* edgeLengths,
                                          int count) = 0;
 
+    // Memoises updateTransitionMatrices results by eigen decomposition and edge length.
+    virtual int setTransitionMatrixMemo(bool enabled);
+
+    virtual int getTransitionMatrixMemoCounts(long* outHitCount,
+                                              long* outMissCount);
+
     virtual int updateTransitionMatricesWithModelCategories(int* eigenIndices,
                                          const int* probabilityIndices,
                                          const int* firstDerivativeIndices,
@@ -223,6 +248,34 @@ public:
 			                           double *outSumDerivatives,
 			                           double *outSumSquaredDerivatives) = 0;
 
+    // Branch-length gradient (and diagonal Hessian) of all edges in one call; not implemented
+    // by default.
+    virtual int calculateEdgeGradients(const int* postorderOperations,
+                                       int postorderCount,
+                                       const int* preorderOperations,
+                                       int preorderCount,
+                                       const int* postBufferIndices,
+                                       const int* preBufferIndices,
+                                       const int* differentialMatrixIndices,
+                                       const int* secondDifferentialMatrixIndices,
+                                       const int* categoryWeightsIndices,
+                                       const int* categoryRatesIndices,
+                                       int count,
+                                       double* outGradient,
+                                       double* outDiagonalHessian);
+
+    // Rate-matrix parameter gradients from cross products of all edges; not implemented by
+    // default.
+    virtual int calculateParameterGradients(const int* postBufferIndices,
+                                            const int* preBufferIndices,
+                                            const int* categoryRatesIndices,
+                                            const int* categoryWeightsIndices,
+                                            const double* edgeLengths,
+                                            int count,
+                                            const int* differentialMatrixIndices,
+                                            int parameterCount,
+                                            double* outGradients);
+
     virtual int calculateEdgeLogLikelihoods(const int* parentBufferIndices,
                                             const int* childBufferIndices,
                                             const int* probabilityIndices,
@@ -254,6 +307,19 @@ public:
                                                        double* outSumSecondDerivativeByPartition,
                                                        double* outSumSecondDerivative) = 0;
 
+    virtual int calculateEdgeLogLikelihoodsPerEdge(const int* parentBufferIndices,
+                                                   const int* childBufferIndices,
+                                                   const int* probabilityIndices,
+                                                   const int* firstDerivativeIndices,
+                                                   const int* secondDerivativeIndices,
+                                                   const int* categoryWeightsIndices,
+                                                   const int* stateFrequenciesIndices,
+                                                   const int* cumulativeScaleIndices,
+                                                   int count,
+                                                   double* outLogLikelihoods,
+                                                   double* outFirstDerivatives,
+                                                   double* outSecondDerivatives) = 0;
+
     virtual int getLogLikelihood(double* outSumLogLikelihood) = 0;
 
     virtual int getDerivatives(double* outSumFirstDerivative,
@@ -263,12 +329,279 @@ public:
 
     virtual int getSiteDerivatives(double* outFirstDerivatives,
                                    double* outSecondDerivatives) = 0;
+
+    // Runs a beagleEvaluate command stream through the calls above; implementations may override
+    // to fuse commands further.
+    virtual int evaluate(const int* commands,
+                         int commandLength,
+                         const double* values,
+                         int valueCount,
+                         double* outSumLogLikelihood,
+                         double* outSumFirstDerivative,
+                         double* outSumSecondDerivative);
+
+    // Checks that a command stream is well formed and its edge lengths are within values.
+    static int validateCommands(const int* commands,
+                                int commandLength,
+                                int valueCount);
+
+    // Writes or reads the whole instance state for beagleSaveInstanceState and
+    // beagleRestoreInstanceState.
+    virtual int saveState(const char* fileName);
+
+    virtual int restoreState(const char* fileName);
 //protected:
     int resourceNumber;
 };
 
+inline int BeagleImpl::updateEpochTransitionMatrices(const int* segmentCounts,
+                                                      const int* eigenIndices,
+                                                      const int* categoryRateIndices,
+                                                      const double* segmentLengths,
+                                                      const int* probabilityIndices,
+                                                      const int* firstDerivativeIndices,
+                                                      const int* secondDerivativeIndices,
+                                                      int count) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+inline int BeagleImpl::calculateEdgeGradients(const int* postorderOperations,
+                                               int postorderCount,
+                                               const int* preorderOperations,
+                                               int preorderCount,
+                                               const int* postBufferIndices,
+                                               const int* preBufferIndices,
+                                               const int* differentialMatrixIndices,
+                                               const int* secondDifferentialMatrixIndices,
+                                               const int* categoryWeightsIndices,
+                                               const int* categoryRatesIndices,
+                                               int count,
+                                               double* outGradient,
+                                               double* outDiagonalHessian) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+inline int BeagleImpl::calculateParameterGradients(const int* postBufferIndices,
+                                                    const int* preBufferIndices,
+                                                    const int* categoryRatesIndices,
+                                                    const int* categoryWeightsIndices,
+                                                    const double* edgeLengths,
+                                                    int count,
+                                                    const int* differentialMatrixIndices,
+                                                    int parameterCount,
+                                                    double* outGradients) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+inline int BeagleImpl::setTransitionMatrixMemo(bool enabled) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+inline int BeagleImpl::getTransitionMatrixMemoCounts(long* outHitCount,
+                                                      long* outMissCount) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+inline int BeagleImpl::saveState(const char* fileName) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+inline int BeagleImpl::restoreState(const char* fileName) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+inline int BeagleImpl::validateCommands(const int* commands,
+                                         int commandLength,
+                                         int valueCount) {
+    if (commandLength < 0 || (commandLength > 0 && commands == NULL))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    long valuesUsed = 0;
+    int pos = 0;
+    while (pos < commandLength) {
+        const int code = commands[pos++];
+        const long remaining = commandLength - pos;
+        long header;
+        long length;
+        switch (code) {
+            case BEAGLE_COMMAND_UPDATE_TRANSITION_MATRICES:
+            case BEAGLE_COMMAND_EDGE_LOG_LIKELIHOODS:
+                header = (code == BEAGLE_COMMAND_EDGE_LOG_LIKELIHOODS ? 2 : 3);
+                if (remaining < header)
+                    return BEAGLE_ERROR_OUT_OF_RANGE;
+                {
+                    const int count = commands[pos + header - 2];
+                    const int order = commands[pos + header - 1];
+                    if (count < 0 || order < 0 || order > 2)
+                        return BEAGLE_ERROR_OUT_OF_RANGE;
+                    if (code == BEAGLE_COMMAND_UPDATE_TRANSITION_MATRICES) {
+                        length = header + (long) count * (1 + order);
+                        valuesUsed += count;
+                    } else {
+                        length = header + (long) count * (6 + order);
+                    }
+                }
+                break;
+            case BEAGLE_COMMAND_UPDATE_PARTIALS:
+            case BEAGLE_COMMAND_ACCUMULATE_SCALE_FACTORS:
+                if (remaining < 2 || commands[pos] < 0)
+                    return BEAGLE_ERROR_OUT_OF_RANGE;
+                length = 2 + (long) commands[pos] *
+                         (code == BEAGLE_COMMAND_UPDATE_PARTIALS ? BEAGLE_OP_COUNT : 1);
+                break;
+            case BEAGLE_COMMAND_RESET_SCALE_FACTORS:
+                length = 1;
+                break;
+            case BEAGLE_COMMAND_ROOT_LOG_LIKELIHOODS:
+                if (remaining < 1 || commands[pos] < 0)
+                    return BEAGLE_ERROR_OUT_OF_RANGE;
+                length = 1 + (long) commands[pos] * 4;
+                break;
+            default:
+                return BEAGLE_ERROR_OUT_OF_RANGE;
+        }
+        if (length > remaining)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        pos += (int) length;
+    }
+
+    if (valuesUsed > valueCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    return BEAGLE_SUCCESS;
+}
+
+/*
+ * Consecutive matrix updates with the same eigen buffer and derivative order, and consecutive
+ * partials updates with the same cumulative scale buffer, are merged into single calls so that
+ * each runs as one threaded or asynchronous batch.
+ */
+inline int BeagleImpl::evaluate(const int* commands,
+                                int commandLength,
+                                const double* values,
+                                int valueCount,
+                                double* outSumLogLikelihood,
+                                double* outSumFirstDerivative,
+                                double* outSumSecondDerivative) {
+    int returnCode = validateCommands(commands, commandLength, valueCount);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    std::vector<int> merged[3];
+    int valuesUsed = 0;
+    int pos = 0;
+    while (pos < commandLength) {
+        const int code = commands[pos];
+        const int* args = commands + pos + 1;
+        switch (code) {
+            case BEAGLE_COMMAND_UPDATE_TRANSITION_MATRICES: {
+                const int eigenIndex = args[0];
+                const int order = args[2];
+                const int* indices[3] = { args + 3, args + 3 + args[1], args + 3 + 2 * args[1] };
+                int count = args[1];
+                pos += 4 + count * (1 + order);
+                if (pos < commandLength && commands[pos] == code && commands[pos + 1] == eigenIndex &&
+                    commands[pos + 3] == order) {
+                    for (int d = 0; d <= order; d++)
+                        merged[d].assign(indices[d], indices[d] + count);
+                    while (pos < commandLength && commands[pos] == code &&
+                           commands[pos + 1] == eigenIndex && commands[pos + 3] == order) {
+                        const int next = commands[pos + 2];
+                        for (int d = 0; d <= order; d++)
+                            merged[d].insert(merged[d].end(), commands + pos + 4 + d * next,
+                                             commands + pos + 4 + (d + 1) * next);
+                        count += next;
+                        pos += 4 + next * (1 + order);
+                    }
+                    for (int d = 0; d <= order; d++)
+                        indices[d] = merged[d].data();
+                }
+                if (count > 0)
+                    returnCode = updateTransitionMatrices(eigenIndex, indices[0],
+                                                          (order > 0 ? indices[1] : NULL),
+                                                          (order > 1 ? indices[2] : NULL),
+                                                          values + valuesUsed, count);
+                valuesUsed += count;
+                break;
+            }
+            case BEAGLE_COMMAND_UPDATE_PARTIALS: {
+                const int cumulativeScaleIndex = args[1];
+                const int* operations = args + 2;
+                int count = args[0];
+                pos += 3 + count * BEAGLE_OP_COUNT;
+                if (pos < commandLength && commands[pos] == code && commands[pos + 2] == cumulativeScaleIndex) {
+                    merged[0].assign(operations, operations + count * BEAGLE_OP_COUNT);
+                    while (pos < commandLength && commands[pos] == code &&
+                           commands[pos + 2] == cumulativeScaleIndex) {
+                        const int next = commands[pos + 1];
+                        merged[0].insert(merged[0].end(), commands + pos + 3,
+                                         commands + pos + 3 + next * BEAGLE_OP_COUNT);
+                        count += next;
+                        pos += 3 + next * BEAGLE_OP_COUNT;
+                    }
+                    operations = merged[0].data();
+                }
+                if (count > 0)
+                    returnCode = updatePartials(operations, count, cumulativeScaleIndex);
+                break;
+            }
+            case BEAGLE_COMMAND_RESET_SCALE_FACTORS:
+                returnCode = resetScaleFactors(args[0]);
+                pos += 2;
+                break;
+            case BEAGLE_COMMAND_ACCUMULATE_SCALE_FACTORS:
+                if (args[0] > 0)
+                    returnCode = accumulateScaleFactors(args + 2, args[0], args[1]);
+                pos += 3 + args[0];
+                break;
+            case BEAGLE_COMMAND_ROOT_LOG_LIKELIHOODS: {
+                const int count = args[0];
+                pos += 2 + count * 4;
+                if (count > 0) {
+                    double logL = 0.0;
+                    returnCode = calculateRootLogLikelihoods(args + 1, args + 1 + count,
+                                                             args + 1 + 2 * count, args + 1 + 3 * count,
+                                                             count, &logL);
+                    if (outSumLogLikelihood != NULL)
+                        *outSumLogLikelihood = logL;
+                }
+                break;
+            }
+            case BEAGLE_COMMAND_EDGE_LOG_LIKELIHOODS: {
+                const int count = args[0];
+                const int order = args[1];
+                const int* lists = args + 2;
+                pos += 3 + count * (6 + order);
+                if (count > 0) {
+                    double logL = 0.0, firstDerivative = 0.0, secondDerivative = 0.0;
+                    const int* tail = lists + (3 + order) * count;
+                    returnCode = calculateEdgeLogLikelihoods(lists, lists + count, lists + 2 * count,
+                                                             (order > 0 ? lists + 3 * count : NULL),
+                                                             (order > 1 ? lists + 4 * count : NULL),
+                                                             tail, tail + count, tail + 2 * count,
+                                                             count, &logL, &firstDerivative,
+                                                             &secondDerivative);
+                    if (outSumLogLikelihood != NULL)
+                        *outSumLogLikelihood = logL;
+                    if (order > 0 && outSumFirstDerivative != NULL)
+                        *outSumFirstDerivative = firstDerivative;
+                    if (order > 1 && outSumSecondDerivative != NULL)
+                        *outSumSecondDerivative = secondDerivative;
+                }
+                break;
+            }
+        }
+        if (returnCode < 0)
+            return returnCode;
+    }
+
+    return returnCode;
+}
+
 class BeagleImplFactory {
 public:
+    virtual ~BeagleImplFactory() {}
+
     virtual BeagleImpl* createImpl(int tipCount,
                                    int partialsBufferCount,
                                    int compactBufferCount,
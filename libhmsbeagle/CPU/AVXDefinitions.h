@@ -47,6 +47,7 @@ typedef double VecEl_t;
 #	define VEC_MADD(a, b, c)	_mm256_add_pd(_mm256_mul_pd((a), (b)), (c))
 #	define VEC_SPLAT(a)			_mm256_set1_pd(a)
 #	define VEC_ADD(a, b)		_mm256_add_pd(a, b)
+#	define VEC_MAX(a, b)		_mm256_max_pd((a), (b))
 #   define VEC_SWAP(a)			_mm256_shuffle_pd(a, a, _MM_SHUFFLE2(0,1))
 # 	define VEC_SETZERO()		_mm256_setzero_pd()
 #	define VEC_SET1(a)			_mm256_set_sd((a))
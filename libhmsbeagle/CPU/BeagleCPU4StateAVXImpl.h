@@ -50,6 +50,9 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::gTransitionMatrices;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::kPatternCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::kPaddedPatternCount;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::kPartialsLayout;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::kPartialsPatternStride;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::kPartialsCategoryStride;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::kExtraPatterns;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::kStateCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::gTipStates;
@@ -131,6 +134,9 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gTransitionMatrices;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::kPatternCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::kPaddedPatternCount;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::kPartialsLayout;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::kPartialsPatternStride;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::kPartialsCategoryStride;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::kExtraPatterns;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::kStateCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gTipStates;
@@ -141,6 +147,8 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::realtypeMin;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::outLogLikelihoodsTmp;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gPatternWeights;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::accumulateRescaleFactorsRange;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::scalingExponentThreshold;
 
 public:
     virtual const char* getName();
@@ -191,6 +199,16 @@ private:
                                                  const double* __restrict matrices2,
                                                  int* activateScaling);
 
+    virtual void rescalePartialsRange(double* __restrict destP,
+                                      double* __restrict scaleFactors,
+                                      double* __restrict cumulativeScaleFactors,
+                                      int startPattern,
+                                      int endPattern);
+
+    virtual bool exceedsScalingExponent(const double* destP,
+                                        int startPattern,
+                                        int endPattern);
+
     virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
                                        const int childBufferIndex,
                                        const int probabilityIndex,
@@ -199,6 +217,18 @@ private:
                                        const int scalingFactorsIndex,
                                        double* outSumLogLikelihood);
 
+    virtual void calcEdgeLogLikelihoodsDerivativesRange(const int parentBufferIndex,
+                                                        const int childBufferIndex,
+                                                        const int probabilityIndex,
+                                                        const int firstDerivativeIndex,
+                                                        const int secondDerivativeIndex,
+                                                        const int categoryWeightsIndex,
+                                                        const int stateFrequenciesIndex,
+                                                        const int scalingFactorsIndex,
+                                                        int startPattern,
+                                                        int endPattern,
+                                                        double* outSums);
+
 };
 
 
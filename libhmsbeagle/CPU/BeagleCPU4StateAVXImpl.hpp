@@ -133,6 +133,7 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesStates(double* d
 	V_Real *destPvec = (V_Real *)destP;
 
     for (int l = 0; l < kCategoryCount; l++) {
+        destPvec = (V_Real *)(destP + l*kPartialsCategoryStride);
 
     	//AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
@@ -141,14 +142,13 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesStates(double* d
             const int state_q = states_q[k];
             const int state_r = states_r[k];
 
-            *destPvec++ = VEC_MULT(vu_mq[state_q][0].vx, vu_mr[state_r][0].vx);
-            *destPvec++ = VEC_MULT(vu_mq[state_q][1].vx, vu_mr[state_r][1].vx);
+            destPvec[0] = VEC_MULT(vu_mq[state_q][0].vx, vu_mr[state_r][0].vx);
+            destPvec[1] = VEC_MULT(vu_mq[state_q][1].vx, vu_mr[state_r][1].vx);
+            destPvec += kPartialsPatternStride / 2;
 
         }
 
         w += OFFSET*4;
-        if (kExtraPatterns)
-        	destPvec += kExtraPatterns * 2;
     }
 }
 
@@ -190,6 +190,8 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesPartials(double*
 	V_Real destr_01, destr_23;
 
     for (int l = 0; l < kCategoryCount; l++) {
+        destPvec = (V_Real *)(destP + l*kPartialsCategoryStride);
+        v = l*kPartialsCategoryStride;
 
     	//AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
@@ -208,16 +210,13 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesPartials(double*
 			destr_23 = VEC_MADD(vp2, vu_mr[2][1].vx, destr_23);
 			destr_23 = VEC_MADD(vp3, vu_mr[3][1].vx, destr_23);
 
-            *destPvec++ = VEC_MULT(vu_mq[state_q][0].vx, destr_01);
-            *destPvec++ = VEC_MULT(vu_mq[state_q][1].vx, destr_23);
+            destPvec[0] = VEC_MULT(vu_mq[state_q][0].vx, destr_01);
+            destPvec[1] = VEC_MULT(vu_mq[state_q][1].vx, destr_23);
+            destPvec += kPartialsPatternStride / 2;
 
-            v += 4;
+            v += kPartialsPatternStride;
         }
         w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
     }
 }
 
@@ -254,6 +253,8 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesPartialsFixedSca
 	V_Real destr_01, destr_23;
 
     for (int l = 0; l < kCategoryCount; l++) {
+        destPvec = (V_Real *)(destP + l*kPartialsCategoryStride);
+        v = l*kPartialsCategoryStride;
 
     	//AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
@@ -274,16 +275,13 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesPartialsFixedSca
 			destr_23 = VEC_MADD(vp2, vu_mr[2][1].vx, destr_23);
 			destr_23 = VEC_MADD(vp3, vu_mr[3][1].vx, destr_23);
 
-            *destPvec++ = VEC_DIV(VEC_MULT(vu_mq[state_q][0].vx, destr_01), scaleFactor);
-            *destPvec++ = VEC_DIV(VEC_MULT(vu_mq[state_q][1].vx, destr_23), scaleFactor);
+            destPvec[0] = VEC_DIV(VEC_MULT(vu_mq[state_q][0].vx, destr_01), scaleFactor);
+            destPvec[1] = VEC_DIV(VEC_MULT(vu_mq[state_q][1].vx, destr_23), scaleFactor);
+            destPvec += kPartialsPatternStride / 2;
 
-            v += 4;
+            v += kPartialsPatternStride;
         }
         w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
     }
 }
 
@@ -322,6 +320,8 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartials(doubl
 //	}
 
     for (int l = 0; l < kCategoryCount; l++) {
+        destPvec = (V_Real *)(destP + l*kPartialsCategoryStride);
+        v = l*kPartialsCategoryStride;
 
 		/* Load transition-probability matrices into vectors */
     	AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
@@ -389,8 +389,7 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartials(doubl
 //        	*destPvec = VEC_MULT(destq_0123, destr_0123); // Single store
 //        	destPvec += 1;
 
-        	VEC_STORE(destP, VEC_MULT(destq_0123, destr_0123));
-        	destP += 4;
+        	VEC_STORE(destP + v, VEC_MULT(destq_0123, destr_0123));
 
 //        	for (int i = 0; i < 4; ++i) {
 //        		fprintf(stderr, " %5.3e", ((double*)destPvec)[i]);
@@ -398,13 +397,9 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartials(doubl
 //        	fprintf(stderr, "\n");
 
 
-            v += 4;
+            v += kPartialsPatternStride;
         }
         w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
     }
 }
 
@@ -441,6 +436,8 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartialsFixedS
 	V_Real *destPvec = (V_Real *)destP;
 
 	for (int l = 0; l < kCategoryCount; l++) {
+        destPvec = (V_Real *)(destP + l*kPartialsCategoryStride);
+        v = l*kPartialsCategoryStride;
 
 		/* Load transition-probability matrices into vectors */
     	//AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
@@ -486,14 +483,10 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartialsFixedS
             destPvec[0] = VEC_DIV(VEC_MULT(destq_01, destr_01), scaleFactor);
             destPvec[1] = VEC_DIV(VEC_MULT(destq_23, destr_23), scaleFactor);
 
-            destPvec += 2;
-            v += 4;
+            destPvec += kPartialsPatternStride / 2;
+            v += kPartialsPatternStride;
         }
         w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
     }
 }
 
@@ -520,13 +513,70 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartialsAutoSc
                                                                     const double*  partials_r,
                                                                     const double*  matrices_r,
                                                                     int* activateScaling) {
-    // TODO: implement calcPartialsPartialsAutoScaling with AVX
-    BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartialsAutoScaling(destP,
-                                                                partials_q,
-                                                                matrices_q,
-                                                                partials_r,
-                                                                matrices_r,
-                                                                activateScaling);
+    calcPartialsPartials(destP, partials_q, matrices_q, partials_r, matrices_r);
+    if (*activateScaling == 0 && exceedsScalingExponent(destP, 0, kPatternCount))
+        *activateScaling = 1;
+}
+
+/*
+ * True if any partial has a binary exponent larger in magnitude than scalingExponentThreshold,
+ * i.e. |x| >= 2^threshold or 0 < |x| < 2^-(threshold + 1).
+ */
+BEAGLE_CPU_4_AVX_TEMPLATE
+bool BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::exceedsScalingExponent(const double* destP,
+                                                                            int startPattern,
+                                                                            int endPattern) {
+    const V_Real signMask = VEC_SPLAT(-0.0);
+    const V_Real lower = VEC_SPLAT(ldexp(1.0, -scalingExponentThreshold - 1));
+    const V_Real upper = VEC_SPLAT(ldexp(1.0, scalingExponentThreshold));
+    const V_Real zero = VEC_SETZERO();
+    V_Real outside = VEC_SETZERO();
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        const V_Real* vp = (const V_Real*)(destP + l*kPartialsCategoryStride + startPattern*kPartialsPatternStride);
+        for (int k = startPattern; k < endPattern; k++) {
+            const V_Real x = _mm256_andnot_pd(signMask, *vp);
+            outside = _mm256_or_pd(outside, _mm256_cmp_pd(x, upper, _CMP_GE_OQ));
+            outside = _mm256_or_pd(outside, _mm256_and_pd(_mm256_cmp_pd(x, lower, _CMP_LT_OQ),
+                                                          _mm256_cmp_pd(x, zero, _CMP_GT_OQ)));
+            vp += kPartialsPatternStride / 4;
+        }
+    }
+
+    return _mm256_movemask_pd(outside) != 0;
+}
+
+/*
+ * Re-scales the partial likelihoods of a range of patterns such that the largest is one.
+ */
+BEAGLE_CPU_4_AVX_TEMPLATE
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::rescalePartialsRange(double* destP,
+                                                                           double* scaleFactors,
+                                                                           double* cumulativeScaleFactors,
+                                                                           int startPattern,
+                                                                           int endPattern) {
+    for (int k = startPattern; k < endPattern; k++) {
+        V_Real vmax = VEC_SETZERO();
+        for (int l = 0; l < kCategoryCount; l++)
+            vmax = VEC_MAX(vmax, *(const V_Real*)(destP + l*kPartialsCategoryStride + k*kPartialsPatternStride));
+
+        __m128d hmax = _mm_max_pd(_mm256_castpd256_pd128(vmax), _mm256_extractf128_pd(vmax, 1));
+        hmax = _mm_max_pd(hmax, _mm_unpackhi_pd(hmax, hmax));
+
+        double max = _mm_cvtsd_f64(hmax);
+        if (max == 0)
+            max = 1.0;
+
+        const V_Real oneOverMax = VEC_SPLAT(1.0 / max);
+        for (int l = 0; l < kCategoryCount; l++) {
+            V_Real* vp = (V_Real*)(destP + l*kPartialsCategoryStride + k*kPartialsPatternStride);
+            *vp = VEC_MULT(*vp, oneOverMax);
+        }
+
+        scaleFactors[k] = max;
+    }
+
+    accumulateRescaleFactorsRange(scaleFactors, cumulativeScaleFactors, startPattern, endPattern);
 }
 
 BEAGLE_CPU_4_AVX_TEMPLATE
@@ -574,12 +624,12 @@ int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcEdgeLogLikelihoods(cons
         const int* statesChild = gTipStates[childIndex];
 
         int w = 0;
-        V_Real *vcl_r = (V_Real *)cl_r;
         for(int l = 0; l < kCategoryCount; l++) {
 
             VecUnion vu_m[OFFSET][2];
             AVX_PREFETCH_MATRIX(transMatrix + w, vu_m)
 
+           V_Real *vcl_r = (V_Real *)(cl_r + l*kPartialsCategoryStride);
            V_Real *vcl_p = (V_Real *)cl_p;
 
            for(int k = 0; k < kPatternCount; k++) {
@@ -587,24 +637,24 @@ int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcEdgeLogLikelihoods(cons
                 const int stateChild = statesChild[k];
                 V_Real vwt = VEC_SPLAT(wt[l]);
 
-                V_Real wtdPartials = VEC_MULT(*vcl_r++, vwt);
+                V_Real wtdPartials = VEC_MULT(vcl_r[0], vwt);
                 *vcl_p++ = VEC_MADD(vu_m[stateChild][0].vx, wtdPartials, *vcl_p);
 
-                wtdPartials = VEC_MULT(*vcl_r++, vwt);
+                wtdPartials = VEC_MULT(vcl_r[1], vwt);
                 *vcl_p++ = VEC_MADD(vu_m[stateChild][1].vx, wtdPartials, *vcl_p);
+
+                vcl_r += kPartialsPatternStride / 2;
             }
            w += OFFSET*4;
-           vcl_r += 2 * kExtraPatterns;
         }
     } else { // Integrate against a partial at the child
 
         const double* cl_q = gPartials[childIndex];
-        V_Real * vcl_r = (V_Real *)cl_r;
-        int v = 0;
         int w = 0;
 
         for(int l = 0; l < kCategoryCount; l++) {
 
+            int v = l*kPartialsCategoryStride;
             V_Real * vcl_p = (V_Real *)cl_p;
 
             VecUnion vu_m[OFFSET][2];
@@ -628,17 +678,13 @@ int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcEdgeLogLikelihoods(cons
                 vclp_01 = VEC_MULT(vclp_01, vwt);
                 vclp_23 = VEC_MULT(vclp_23, vwt);
 
-                *vcl_p++ = VEC_MADD(vclp_01, *vcl_r++, *vcl_p);
-                *vcl_p++ = VEC_MADD(vclp_23, *vcl_r++, *vcl_p);
+                const V_Real * vcl_r = (const V_Real *)(cl_r + v);
+                *vcl_p++ = VEC_MADD(vclp_01, vcl_r[0], *vcl_p);
+                *vcl_p++ = VEC_MADD(vclp_23, vcl_r[1], *vcl_p);
 
-                v += 4;
+                v += kPartialsPatternStride;
             }
             w += 4*OFFSET;
-            if (kExtraPatterns) {
-                vcl_r += 2 * kExtraPatterns;
-                v += 4 * kExtraPatterns;
-            }
-
         }
     }
 
@@ -672,6 +718,123 @@ int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcEdgeLogLikelihoods(cons
 }
 
 
+BEAGLE_CPU_4_AVX_TEMPLATE
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcEdgeLogLikelihoodsDerivativesRange(
+                                                  const int parIndex,
+                                                  const int childIndex,
+                                                  const int probIndex,
+                                                  const int firstDerivativeIndex,
+                                                  const int secondDerivativeIndex,
+                                                  const int categoryWeightsIndex,
+                                                  const int stateFrequenciesIndex,
+                                                  const int scalingFactorsIndex,
+                                                  int startPattern,
+                                                  int endPattern,
+                                                  double* outSums) {
+
+    const double* cl_r = gPartials[parIndex];
+    const double* transMatrix = gTransitionMatrices[probIndex];
+    const double* firstDerivMatrix = (firstDerivativeIndex == BEAGLE_OP_NONE ?
+                                      transMatrix : gTransitionMatrices[firstDerivativeIndex]);
+    const double* secondDerivMatrix = (secondDerivativeIndex == BEAGLE_OP_NONE ?
+                                       transMatrix : gTransitionMatrices[secondDerivativeIndex]);
+    const double* wt = gCategoryWeights[categoryWeightsIndex];
+    const double* freqs = gStateFrequencies[stateFrequenciesIndex];
+    const int* statesChild = (childIndex < kTipCount ? gTipStates[childIndex] : NULL);
+    const double* cl_q = gPartials[childIndex];
+    const double* scalingFactors = (scalingFactorsIndex == BEAGLE_OP_NONE ?
+                                    NULL : gScaleBuffers[scalingFactorsIndex]);
+
+    // The four lanes of each site sum are added together once all categories are done
+    V_Real vSiteL[BEAGLE_CPU_EDGE_CHUNK_PATTERN_COUNT];
+    V_Real vSiteD1[BEAGLE_CPU_EDGE_CHUNK_PATTERN_COUNT];
+    V_Real vSiteD2[BEAGLE_CPU_EDGE_CHUNK_PATTERN_COUNT];
+
+    double sumLogLikelihood = 0.0;
+    double sumFirstDerivative = 0.0;
+    double sumSecondDerivative = 0.0;
+
+    for (int chunkStart = startPattern; chunkStart < endPattern; chunkStart += BEAGLE_CPU_EDGE_CHUNK_PATTERN_COUNT) {
+        const int chunkEnd = std::min(chunkStart + BEAGLE_CPU_EDGE_CHUNK_PATTERN_COUNT, endPattern);
+
+        for (int k = 0; k < chunkEnd - chunkStart; k++) {
+            vSiteL[k] = VEC_SETZERO();
+            vSiteD1[k] = VEC_SETZERO();
+            vSiteD2[k] = VEC_SETZERO();
+        }
+
+        int w = 0;
+        for (int l = 0; l < kCategoryCount; l++) {
+            const V_Real vfw = VEC_MULT(_mm256_loadu_pd(freqs), VEC_SPLAT(wt[l]));
+
+            VecUnion vu_m[OFFSET], vu_d1[OFFSET], vu_d2[OFFSET];
+            { AVX_PREFETCH_MATRICES(transMatrix + w, firstDerivMatrix + w, vu_m, vu_d1) }
+            { AVX_PREFETCH_MATRICES(secondDerivMatrix + w, secondDerivMatrix + w, vu_d2, vu_d2) }
+
+            int v = l*kPartialsCategoryStride + chunkStart*kPartialsPatternStride;
+
+            for (int k = 0; k < chunkEnd - chunkStart; k++) {
+                const V_Real vr = VEC_MULT(_mm256_load_pd(cl_r + v), vfw);
+
+                V_Real vp, vd1, vd2;
+
+                if (statesChild != NULL) { // Integrate against a state at the child
+                    const int stateChild = statesChild[chunkStart + k];
+                    vp = vu_m[stateChild].vx;
+                    vd1 = vu_d1[stateChild].vx;
+                    vd2 = vu_d2[stateChild].vx;
+                } else { // Integrate against a partial at the child
+                    V_Real vcl_q0, vcl_q1, vcl_q2, vcl_q3;
+                    AVX_PREFETCH_PARTIALS(vcl_q,cl_q,v);
+
+                    vp = VEC_MULT(vcl_q0, vu_m[0].vx);
+                    vp = VEC_MADD(vcl_q1, vu_m[1].vx, vp);
+                    vp = VEC_MADD(vcl_q2, vu_m[2].vx, vp);
+                    vp = VEC_MADD(vcl_q3, vu_m[3].vx, vp);
+
+                    vd1 = VEC_MULT(vcl_q0, vu_d1[0].vx);
+                    vd1 = VEC_MADD(vcl_q1, vu_d1[1].vx, vd1);
+                    vd1 = VEC_MADD(vcl_q2, vu_d1[2].vx, vd1);
+                    vd1 = VEC_MADD(vcl_q3, vu_d1[3].vx, vd1);
+
+                    vd2 = VEC_MULT(vcl_q0, vu_d2[0].vx);
+                    vd2 = VEC_MADD(vcl_q1, vu_d2[1].vx, vd2);
+                    vd2 = VEC_MADD(vcl_q2, vu_d2[2].vx, vd2);
+                    vd2 = VEC_MADD(vcl_q3, vu_d2[3].vx, vd2);
+                }
+
+                vSiteL[k] = VEC_MADD(vp, vr, vSiteL[k]);
+                vSiteD1[k] = VEC_MADD(vd1, vr, vSiteD1[k]);
+                vSiteD2[k] = VEC_MADD(vd2, vr, vSiteD2[k]);
+
+                v += kPartialsPatternStride;
+            }
+            w += 4*OFFSET;
+        }
+
+        for (int k = chunkStart; k < chunkEnd; k++) {
+            VecUnion vuL, vuD1, vuD2;
+            vuL.vx = vSiteL[k - chunkStart];
+            vuD1.vx = vSiteD1[k - chunkStart];
+            vuD2.vx = vSiteD2[k - chunkStart];
+
+            const double likelihood = (vuL.x[0] + vuL.x[1]) + (vuL.x[2] + vuL.x[3]);
+            double logLikelihood = log(likelihood);
+            if (scalingFactors != NULL)
+                logLikelihood += scalingFactors[k];
+            const double firstDerivative = ((vuD1.x[0] + vuD1.x[1]) + (vuD1.x[2] + vuD1.x[3])) / likelihood;
+            const double secondDerivative = ((vuD2.x[0] + vuD2.x[1]) + (vuD2.x[2] + vuD2.x[3])) / likelihood;
+            sumLogLikelihood += logLikelihood * gPatternWeights[k];
+            sumFirstDerivative += firstDerivative * gPatternWeights[k];
+            sumSecondDerivative += (secondDerivative - firstDerivative * firstDerivative) * gPatternWeights[k];
+        }
+    }
+
+    outSums[0] = sumLogLikelihood;
+    outSums[1] = sumFirstDerivative;
+    outSums[2] = sumSecondDerivative;
+}
+
 BEAGLE_CPU_4_AVX_TEMPLATE
 int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::getPaddedPatternsModulus() {
 	return 1;  // We currently do not vectorize across patterns
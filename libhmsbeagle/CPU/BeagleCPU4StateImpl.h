@@ -44,7 +44,11 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kPatternCount;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kMatrixSize;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kPaddedPatternCount;
+	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kPartialsLayout;
+	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kPartialsPatternStride;
+	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kPartialsCategoryStride;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kExtraPatterns;
+	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kRescaleBlockPatternCount;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kStateCount;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gTipStates;
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kCategoryCount;
@@ -63,6 +67,7 @@ protected:
   using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::scalingExponentThreshold;
   using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gPatternPartitionsStartPatterns;
   using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateDerivatives;
+  using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateRescaleFactorsRange;
   using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogDerivatives;
 
 public:
@@ -118,7 +123,9 @@ public:
                                              const REALTYPE *categoryWeights,
                                              double *outDerivatives,
                                              double *outSumDerivatives,
-                                             double *outSumSquaredDerivatives);
+                                             double *outSumSquaredDerivatives,
+                                             int startPattern,
+                                             int endPattern);
 
     virtual void calcEdgeLogDerivativesPartials(const REALTYPE *postOrderPartial,
                                                const REALTYPE *preOrderPartial,
@@ -129,7 +136,9 @@ public:
                                                const int scalingFactorsIndex,
                                                double *outDerivatives,
                                                double *outSumDerivatives,
-                                               double *outSumSquaredDerivatives);
+                                               double *outSumSquaredDerivatives,
+                                               int startPattern,
+                                               int endPattern);
 
     virtual void calcCrossProductsStates(const int *tipStates,
                                          const REALTYPE *preOrderPartial,
@@ -137,7 +146,9 @@ public:
                                          const REALTYPE *categoryWeights,
                                          const double edgeLength,
                                          double *outCrossProducts,
-                                         double *outSumSquaredDerivatives);
+                                         double *outSumSquaredDerivatives,
+                                         int startPattern,
+                                         int endPattern);
 
     virtual void calcCrossProductsPartials(const REALTYPE *postOrderPartial,
                                            const REALTYPE *preOrderPartial,
@@ -145,7 +156,9 @@ public:
                                            const REALTYPE *categoryWeights,
                                            const double edgeLength,
                                            double *outCrossProducts,
-                                           double *outSumSquaredDerivatives);
+                                           double *outSumSquaredDerivatives,
+                                           int startPattern,
+                                           int endPattern);
 
     virtual int calcRootLogLikelihoods(const int bufferIndex,
                                         const int categoryWeightsIndex,
@@ -186,6 +199,18 @@ public:
                                                   int partitionCount,
                                                   double* outSumLogLikelihoodByPartition);
 
+    virtual void calcEdgeLogLikelihoodsDerivativesRange(const int parentBufferIndex,
+                                                        const int childBufferIndex,
+                                                        const int probabilityIndex,
+                                                        const int firstDerivativeIndex,
+                                                        const int secondDerivativeIndex,
+                                                        const int categoryWeightsIndex,
+                                                        const int stateFrequenciesIndex,
+                                                        const int scalingFactorsIndex,
+                                                        int startPattern,
+                                                        int endPattern,
+                                                        double* outSums);
+
     virtual void calcStatesStatesFixedScaling(REALTYPE *destP,
                                               const int *child0States,
                                               const REALTYPE *child0TransMat,
@@ -233,16 +258,11 @@ public:
                                                      int partitionCount,
                                                      double* outSumLogLikelihoodByPartition);
 
-    virtual void rescalePartials(REALTYPE *destP,
-    		                     REALTYPE *scaleFactors,
-                                 REALTYPE *cumulativeScaleFactors,
-                                 const int  fillWithOnes);
-
-    virtual void rescalePartialsByPartition(REALTYPE *destP,
-                                            REALTYPE *scaleFactors,
-                                            REALTYPE *cumulativeScaleFactors,
-                                            const int fillWithOnes,
-                                            const int partitionIndex);
+    virtual void rescalePartialsRange(REALTYPE *destP,
+                                      REALTYPE *scaleFactors,
+                                      REALTYPE *cumulativeScaleFactors,
+                                      int startPattern,
+                                      int endPattern);
 
 
 };
@@ -191,11 +191,10 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
                                                                int startPattern,
                                                                int endPattern) {
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*4*kPaddedPatternCount;
+        int v = l*kPartialsCategoryStride;
         if (startPattern != 0) {
-          v += 4*startPattern;
+          v += kPartialsPatternStride*startPattern;
         }
 
         int w = l*4*OFFSET;
@@ -213,7 +212,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
                            matrices2[w + OFFSET*2 + state2];
             destP[v + 3] = matrices1[w + OFFSET*3 + state1] *
                            matrices2[w + OFFSET*3 + state2];
-           v += 4;
+           v += kPartialsPatternStride;
         }
     }
 }
@@ -228,11 +227,10 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALT
                                                                            int startPattern,
                                                                            int endPattern) {
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*4*kPaddedPatternCount;
+        int v = l*kPartialsCategoryStride;
         if (startPattern != 0) {
-          v += 4*startPattern;
+          v += kPartialsPatternStride*startPattern;
         }
 
         int w = l*4*OFFSET;
@@ -251,7 +249,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALT
                            matrices2[w + OFFSET*2 + state2] / scaleFactor;
             destP[v + 3] = matrices1[w + OFFSET*3 + state1] *
                            matrices2[w + OFFSET*3 + state2] / scaleFactor;
-            v += 4;
+            v += kPartialsPatternStride;
         }
     }
 }
@@ -268,11 +266,10 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP
                                                                  int startPattern,
                                                                  int endPattern) {
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int u = l*4*kPaddedPatternCount;
+        int u = l*kPartialsCategoryStride;
         if (startPattern != 0) {
-          u += 4*startPattern;
+          u += kPartialsPatternStride*startPattern;
         }
 
         int w = l*4*OFFSET;
@@ -292,7 +289,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP
             destP[u + 2] = matrices1[w + OFFSET*2 + state1] * sum22;
             destP[u + 3] = matrices1[w + OFFSET*3 + state1] * sum23;
 
-            u += 4;
+            u += kPartialsPatternStride;
         }
     }
 }
@@ -307,11 +304,10 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesPartialsFixedScaling(REA
                                                                              int startPattern,
                                                                              int endPattern) {
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int u = l*4*kPaddedPatternCount;
+        int u = l*kPartialsCategoryStride;
         if (startPattern != 0) {
-          u += 4*startPattern;
+          u += kPartialsPatternStride*startPattern;
         }
 
         int w = l*4*OFFSET;
@@ -332,7 +328,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesPartialsFixedScaling(REA
             destP[u + 2] = matrices1[w + OFFSET*2 + state1] * sum22 / scaleFactor;
             destP[u + 3] = matrices1[w + OFFSET*3 + state1] * sum23 / scaleFactor;
 
-            u += 4;
+            u += kPartialsPatternStride;
         }
     }
 }
@@ -347,11 +343,10 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartials(REALTYPE* des
                                                                    int endPattern) {
 
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int u = l*4*kPaddedPatternCount;
+        int u = l*kPartialsCategoryStride;
         if (startPattern != 0) {
-          u += 4*startPattern;
+          u += kPartialsPatternStride*startPattern;
         }
         int w = l*4*OFFSET;
 
@@ -370,7 +365,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartials(REALTYPE* des
             destP[u + 2] = sum12 * sum22;
             destP[u + 3] = sum13 * sum23;
 
-            u += 4;
+            u += kPartialsPatternStride;
 
         }
     }
@@ -386,11 +381,10 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcPrePartialsPartials(REALTYPE*
                                                                    int endPattern) {
 
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int u = l*4*kPaddedPatternCount;
+        int u = l*kPartialsCategoryStride;
         if (startPattern != 0) {
-            u += 4*startPattern;
+            u += kPartialsPatternStride*startPattern;
         }
         int w = l*4*OFFSET;
 
@@ -412,7 +406,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcPrePartialsPartials(REALTYPE*
             destP[u + 2] = sum12;
             destP[u + 3] = sum13;
 
-            u += 4;
+            u += kPartialsPatternStride;
 
         }
     }
@@ -428,11 +422,10 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcPrePartialsStates(REALTYPE* de
                                                                     int endPattern) {
 
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int u = l*4*kPaddedPatternCount;
+        int u = l*kPartialsCategoryStride;
         if (startPattern != 0) {
-            u += 4*startPattern;
+            u += kPartialsPatternStride*startPattern;
         }
         int w = l*4*OFFSET;
 
@@ -454,7 +447,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcPrePartialsStates(REALTYPE* de
             destP[u + 2] = sum12;
             destP[u + 3] = sum13;
 
-            u += 4;
+            u += kPartialsPatternStride;
 
         }
     }
@@ -469,9 +462,8 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsAutoScaling(RE
                                                                     int* activateScaling) {
 
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int u = l*4*kPaddedPatternCount;
+        int u = l*kPartialsCategoryStride;
         int w = l*4*OFFSET;
 
         PREFETCH_MATRIX(1,matrices1,w);
@@ -508,7 +500,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsAutoScaling(RE
                 }
             }
 
-            u += 4;
+            u += kPartialsPatternStride;
 
         }
     }
@@ -525,11 +517,10 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsFixedScaling(R
                                                                                int startPattern,
                                                                                int endPattern) {
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int u = l*4*kPaddedPatternCount;
+        int u = l*kPartialsCategoryStride;
         if (startPattern != 0) {
-          u += 4*startPattern;
+          u += kPartialsPatternStride*startPattern;
         }
 
         int w = l*4*OFFSET;
@@ -554,7 +545,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsFixedScaling(R
             destP[u + 2] = sum12 * sum22 / scaleFactor;
             destP[u + 3] = sum13 * sum23 / scaleFactor;
 
-            u += 4;
+            u += kPartialsPatternStride;
         }
     }
 }
@@ -657,37 +648,25 @@ void inline BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::integrateOutStatesAndScaleB
 }
 
 #define FAST_MAX(x,y)	(x > y ? x : y)
-//#define BEAGLE_TEST_OPTIMIZATION
 /*
- * Re-scales the partial likelihoods such that the largest is one.
+ * Re-scales the partial likelihoods of a range of patterns such that the largest is one.
  */
 BEAGLE_CPU_TEMPLATE
-void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::rescalePartials(REALTYPE* destP,
-		REALTYPE* scaleFactors,
-		REALTYPE* cumulativeScaleFactors,
-        const int  fillWithOnes) {
-
-	bool useLogScalars = kFlags & BEAGLE_FLAG_SCALERS_LOG;
+void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::rescalePartialsRange(REALTYPE* destP,
+                                                                   REALTYPE* scaleFactors,
+                                                                   REALTYPE* cumulativeScaleFactors,
+                                                                   int startPattern,
+                                                                   int endPattern) {
 
-    for (int k = 0; k < kPatternCount; k++) {
+    for (int k = startPattern; k < endPattern; k++) {
     	REALTYPE max = 0;
-        const int patternOffset = k * 4;
+        const int patternOffset = k * kPartialsPatternStride;
         for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * 4 + patternOffset;
-
-#ifdef BEAGLE_TEST_OPTIMIZATION
+            const int offset = l * kPartialsCategoryStride + patternOffset;
             REALTYPE max01 = FAST_MAX(destP[offset + 0], destP[offset + 1]);
             REALTYPE max23 = FAST_MAX(destP[offset + 2], destP[offset + 3]);
             max = FAST_MAX(max, max01);
             max = FAST_MAX(max, max23);
-#else
-			#pragma unroll
-            for (int i = 0; i < 4; i++) {
-                if(destP[offset] > max)
-                    max = destP[offset];
-                offset++;
-            }
-#endif
         }
 
         if (max == 0)
@@ -695,81 +674,16 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::rescalePartials(REALTYPE* destP,
 
         REALTYPE oneOverMax = REALTYPE(1.0) / max;
         for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * 4 + patternOffset;
+            int offset = l * kPartialsCategoryStride + patternOffset;
 			#pragma unroll
             for (int i = 0; i < 4; i++)
                 destP[offset++] *= oneOverMax;
         }
 
-        if (useLogScalars) {
-            REALTYPE logMax = log(max);
-            scaleFactors[k] = logMax;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += logMax;
-        } else {
-            scaleFactors[k] = max;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += log(max);
-        }
+        scaleFactors[k] = max;
     }
-}
-
-BEAGLE_CPU_TEMPLATE
-void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::rescalePartialsByPartition(
-                                                                    REALTYPE* destP,
-                                                                    REALTYPE* scaleFactors,
-                                                                    REALTYPE* cumulativeScaleFactors,
-                                                                    const int fillWithOnes,
-                                                                    const int partitionIndex) {
-
-    bool useLogScalars = kFlags & BEAGLE_FLAG_SCALERS_LOG;
-
-    int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
-    int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
 
-    for (int k = startPattern; k < endPattern; k++) {
-      REALTYPE max = 0;
-        const int patternOffset = k * 4;
-        for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * 4 + patternOffset;
-
-#ifdef BEAGLE_TEST_OPTIMIZATION
-            REALTYPE max01 = FAST_MAX(destP[offset + 0], destP[offset + 1]);
-            REALTYPE max23 = FAST_MAX(destP[offset + 2], destP[offset + 3]);
-            max = FAST_MAX(max, max01);
-            max = FAST_MAX(max, max23);
-#else
-      #pragma unroll
-            for (int i = 0; i < 4; i++) {
-                if(destP[offset] > max)
-                    max = destP[offset];
-                offset++;
-            }
-#endif
-        }
-
-        if (max == 0)
-            max = REALTYPE(1.0);
-
-        REALTYPE oneOverMax = REALTYPE(1.0) / max;
-        for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * 4 + patternOffset;
-      #pragma unroll
-            for (int i = 0; i < 4; i++)
-                destP[offset++] *= oneOverMax;
-        }
-
-        if (useLogScalars) {
-            REALTYPE logMax = log(max);
-            scaleFactors[k] = logMax;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += logMax;
-        } else {
-            scaleFactors[k] = max;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += log(max);
-        }
-    }
+    accumulateRescaleFactorsRange(scaleFactors, cumulativeScaleFactors, startPattern, endPattern);
 }
 
 
@@ -795,10 +709,10 @@ int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int pa
     if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
         const int* statesChild = gTipStates[childIndex];
-        int v = 0; // Index for parent partials
         int w = 0;
         for(int l = 0; l < kCategoryCount; l++) {
             int u = 0; // Index in resulting product-partials (summed over categories)
+            int v = l*kPartialsCategoryStride; // Index for parent partials
             const REALTYPE weight = wt[l];
             for(int k = 0; k < kPatternCount; k++) {
 
@@ -810,11 +724,9 @@ int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int pa
                 integrationTmp[u + 3] += transMatrix[w + OFFSET*3 + stateChild] * partialsParent[v + 3] * weight;
 
                 u += 4;
-                v += 4;
+                v += kPartialsPatternStride;
             }
             w += OFFSET*4;
-            if (kExtraPatterns)
-            	v += 4 * kExtraPatterns;
         }
 
     } else { // Integrate against a partial at the child
@@ -827,7 +739,7 @@ int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int pa
         for(int l = 0; l < kCategoryCount; l++) {
             int u = 0;
 			#if 1//
-			int v = l*kPaddedPatternCount*4;
+			int v = l*kPartialsCategoryStride;
 			#endif
             const REALTYPE weight = wt[l];
 
@@ -847,7 +759,7 @@ int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int pa
                 integrationTmp[u + 3] += sum13 * partialsParent[v + 3] * weight;
 
                 u += 4;
-                v += 4;
+                v += kPartialsPatternStride;
             }
             w += OFFSET*4;
 			#if 0//
@@ -894,10 +806,10 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
         if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
             const int* statesChild = gTipStates[childIndex];
-            int v = startPattern * 4; // Index for parent partials
             int w = 0;
             for(int l = 0; l < kCategoryCount; l++) {
                 int u = startPattern * 4; // Index in resulting product-partials (summed over categories)
+                int v = l*kPartialsCategoryStride + startPattern*kPartialsPatternStride; // Index for parent partials
                 const REALTYPE weight = wt[l];
                 for(int k = startPattern; k < endPattern; k++) {
 
@@ -909,12 +821,9 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
                     integrationTmp[u + 3] += transMatrix[w + OFFSET*3 + stateChild] * partialsParent[v + 3] * weight;
 
                     u += 4;
-                    v += 4;
+                    v += kPartialsPatternStride;
                 }
                 w += OFFSET*4;
-                if (kExtraPatterns)
-                  v += 4 * kExtraPatterns;
-                v += ((kPatternCount - endPattern) + startPattern) * 4;
             }
         } else { // Integrate against a partial at the child
             const REALTYPE* partialsChild = gPartials[childIndex];
@@ -925,7 +834,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
             for(int l = 0; l < kCategoryCount; l++) {
                 int u = startPattern * 4;
           #if 1//
-          int v = l*kPaddedPatternCount*4 + startPattern * 4;
+          int v = l*kPartialsCategoryStride + startPattern*kPartialsPatternStride;
           #endif
                 const REALTYPE weight = wt[l];
 
@@ -945,7 +854,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
                     integrationTmp[u + 3] += sum13 * partialsParent[v + 3] * weight;
 
                     u += 4;
-                    v += 4;
+                    v += kPartialsPatternStride;
                 }
                 w += OFFSET*4;
           #if 0//
@@ -975,14 +884,16 @@ int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoods(const int bu
     int v = 0;
     const REALTYPE wt0 = wt[0];
     for (int k = 0; k < kPatternCount; k++) {
-        integrationTmp[v    ] = rootPartials[v    ] * wt0;
-        integrationTmp[v + 1] = rootPartials[v + 1] * wt0;
-        integrationTmp[v + 2] = rootPartials[v + 2] * wt0;
-        integrationTmp[v + 3] = rootPartials[v + 3] * wt0;
-        v += 4;
+        integrationTmp[u    ] = rootPartials[v    ] * wt0;
+        integrationTmp[u + 1] = rootPartials[v + 1] * wt0;
+        integrationTmp[u + 2] = rootPartials[v + 2] * wt0;
+        integrationTmp[u + 3] = rootPartials[v + 3] * wt0;
+        u += 4;
+        v += kPartialsPatternStride;
     }
     for (int l = 1; l < kCategoryCount; l++) {
         u = 0;
+        v = l*kPartialsCategoryStride;
         const REALTYPE wtl = wt[l];
         for (int k = 0; k < kPatternCount; k++) {
             integrationTmp[u    ] += rootPartials[v    ] * wtl;
@@ -991,14 +902,122 @@ int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoods(const int bu
             integrationTmp[u + 3] += rootPartials[v + 3] * wtl;
 
             u += 4;
-            v += 4;
+            v += kPartialsPatternStride;
         }
-		v += 4 * kExtraPatterns;
     }
 
     return integrateOutStatesAndScale(integrationTmp, stateFrequenciesIndex, scalingFactorsIndex, outSumLogLikelihood);
 }
 
+BEAGLE_CPU_TEMPLATE
+void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsDerivativesRange(const int parIndex,
+                                                                                    const int childIndex,
+                                                                                    const int probIndex,
+                                                                                    const int firstDerivativeIndex,
+                                                                                    const int secondDerivativeIndex,
+                                                                                    const int categoryWeightsIndex,
+                                                                                    const int stateFrequenciesIndex,
+                                                                                    const int scalingFactorsIndex,
+                                                                                    int startPattern,
+                                                                                    int endPattern,
+                                                                                    double* outSums) {
+
+    const REALTYPE* partialsParent = gPartials[parIndex];
+    const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
+    const REALTYPE* firstDerivMatrix = (firstDerivativeIndex == BEAGLE_OP_NONE ?
+                                        transMatrix : gTransitionMatrices[firstDerivativeIndex]);
+    const REALTYPE* secondDerivMatrix = (secondDerivativeIndex == BEAGLE_OP_NONE ?
+                                         transMatrix : gTransitionMatrices[secondDerivativeIndex]);
+    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
+    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
+    const int* statesChild = (childIndex < kTipCount ? gTipStates[childIndex] : NULL);
+    const REALTYPE* partialsChild = gPartials[childIndex];
+    const REALTYPE* scalingFactors = (scalingFactorsIndex == BEAGLE_OP_NONE ?
+                                      NULL : gScaleBuffers[scalingFactorsIndex]);
+
+    REALTYPE siteL[BEAGLE_CPU_EDGE_CHUNK_PATTERN_COUNT];
+    REALTYPE siteD1[BEAGLE_CPU_EDGE_CHUNK_PATTERN_COUNT];
+    REALTYPE siteD2[BEAGLE_CPU_EDGE_CHUNK_PATTERN_COUNT];
+
+    double sumLogLikelihood = 0.0;
+    double sumFirstDerivative = 0.0;
+    double sumSecondDerivative = 0.0;
+
+    for (int chunkStart = startPattern; chunkStart < endPattern; chunkStart += BEAGLE_CPU_EDGE_CHUNK_PATTERN_COUNT) {
+        const int chunkEnd = std::min(chunkStart + BEAGLE_CPU_EDGE_CHUNK_PATTERN_COUNT, endPattern);
+
+        for (int k = 0; k < chunkEnd - chunkStart; k++) {
+            siteL[k] = 0.0;
+            siteD1[k] = 0.0;
+            siteD2[k] = 0.0;
+        }
+
+        int w = 0;
+        for (int l = 0; l < kCategoryCount; l++) {
+            const REALTYPE fw0 = freqs[0] * wt[l];
+            const REALTYPE fw1 = freqs[1] * wt[l];
+            const REALTYPE fw2 = freqs[2] * wt[l];
+            const REALTYPE fw3 = freqs[3] * wt[l];
+
+            if (statesChild != NULL) { // Integrate against a state at the child
+                for (int k = chunkStart; k < chunkEnd; k++) {
+                    const int v = l*kPartialsCategoryStride + k*kPartialsPatternStride;
+                    const int stateChild = statesChild[k];
+
+                    PREFETCH_PARTIALS(2,partialsParent,v);
+                    p20 *= fw0; p21 *= fw1; p22 *= fw2; p23 *= fw3;
+
+                    PREFETCH_MATRIX_COLUMN(1,transMatrix,w + stateChild);
+                    PREFETCH_MATRIX_COLUMN(3,firstDerivMatrix,w + stateChild);
+                    PREFETCH_MATRIX_COLUMN(4,secondDerivMatrix,w + stateChild);
+
+                    siteL[k - chunkStart]  += sum10 * p20 + sum11 * p21 + sum12 * p22 + sum13 * p23;
+                    siteD1[k - chunkStart] += sum30 * p20 + sum31 * p21 + sum32 * p22 + sum33 * p23;
+                    siteD2[k - chunkStart] += sum40 * p20 + sum41 * p21 + sum42 * p22 + sum43 * p23;
+                }
+            } else { // Integrate against a partial at the child
+                PREFETCH_MATRIX(1,transMatrix,w);
+                PREFETCH_MATRIX(3,firstDerivMatrix,w);
+                PREFETCH_MATRIX(4,secondDerivMatrix,w);
+
+                for (int k = chunkStart; k < chunkEnd; k++) {
+                    const int v = l*kPartialsCategoryStride + k*kPartialsPatternStride;
+
+                    PREFETCH_PARTIALS(1,partialsChild,v);
+                    PREFETCH_PARTIALS(3,partialsChild,v);
+                    PREFETCH_PARTIALS(4,partialsChild,v);
+                    DO_INTEGRATION(1);
+                    DO_INTEGRATION(3);
+                    DO_INTEGRATION(4);
+
+                    PREFETCH_PARTIALS(2,partialsParent,v);
+                    p20 *= fw0; p21 *= fw1; p22 *= fw2; p23 *= fw3;
+
+                    siteL[k - chunkStart]  += sum10 * p20 + sum11 * p21 + sum12 * p22 + sum13 * p23;
+                    siteD1[k - chunkStart] += sum30 * p20 + sum31 * p21 + sum32 * p22 + sum33 * p23;
+                    siteD2[k - chunkStart] += sum40 * p20 + sum41 * p21 + sum42 * p22 + sum43 * p23;
+                }
+            }
+            w += OFFSET*4;
+        }
+
+        for (int k = chunkStart; k < chunkEnd; k++) {
+            const REALTYPE likelihood = siteL[k - chunkStart];
+            REALTYPE logLikelihood = log(likelihood);
+            if (scalingFactors != NULL)
+                logLikelihood += scalingFactors[k];
+            const REALTYPE firstDerivative = siteD1[k - chunkStart] / likelihood;
+            sumLogLikelihood += logLikelihood * gPatternWeights[k];
+            sumFirstDerivative += firstDerivative * gPatternWeights[k];
+            sumSecondDerivative += (siteD2[k - chunkStart] / likelihood - firstDerivative * firstDerivative) * gPatternWeights[k];
+        }
+    }
+
+    outSums[0] = sumLogLikelihood;
+    outSums[1] = sumFirstDerivative;
+    outSums[2] = sumSecondDerivative;
+}
+
 BEAGLE_CPU_TEMPLATE
 void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogDerivativesStates(const int *tipStates,
                                                                            const REALTYPE *preOrderPartial,
@@ -1008,16 +1027,17 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogDerivativesStates(const
                                                                            const REALTYPE *categoryWeights,
                                                                            double *outDerivatives,
                                                                            double *outSumDerivatives,
-                                                                           double *outSumSquaredDerivatives) {
+                                                                           double *outSumSquaredDerivatives,
+                                                                           int startPattern,
+                                                                           int endPattern) {
 
     for (int category = 0; category < kCategoryCount; category++) {
 
         const REALTYPE *firstDerivMatrix = gTransitionMatrices[firstDerivativeIndex] + category * kMatrixSize;
 
-        for (int pattern = 0; pattern < kPatternCount; pattern++) {
+        for (int pattern = startPattern; pattern < endPattern; pattern++) {
 
-            const int patternIndex = category * kPatternCount + pattern;
-            const int localPatternOffset = patternIndex * 4;
+            const int localPatternOffset = category * kPartialsCategoryStride + pattern * kPartialsPatternStride;
 
             const int state = tipStates[pattern];
 
@@ -1047,20 +1067,22 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogDerivativesPartials(con
                                                                              const int scalingFactorsIndex,
                                                                              double *outDerivatives,
                                                                              double *outSumDerivatives,
-                                                                             double *outSumSquaredDerivatives) {
+                                                                             double *outSumSquaredDerivatives,
+                                                                             int startPattern,
+                                                                             int endPattern) {
 
     const REALTYPE* transMatrix = gTransitionMatrices[firstDerivativeIndex];
 
     int w = 0;
     for(int l = 0; l < kCategoryCount; l++) {
 
-        int v = l*kPaddedPatternCount*4;
+        int v = l*kPartialsCategoryStride + startPattern*kPartialsPatternStride;
 
         const REALTYPE weight = categoryWeights[l];
 
         PREFETCH_MATRIX(1,transMatrix,w); // TODO Use _TRANSPOSE and then reverse integration below
 
-        for(int k = 0; k < kPatternCount; k++) {
+        for (int k = startPattern; k < endPattern; k++) {
 
             PREFETCH_PARTIALS(1, postOrderPartial,v);
             PREFETCH_PARTIALS(0, preOrderPartial, v);
@@ -1076,7 +1098,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogDerivativesPartials(con
             grandDenominatorDerivTmp[k] += (p10 * p00 + p11 * p01 + p12 * p02 + p13 * p03) * weight;
             grandNumeratorDerivTmp[k] += (sum10 * p00 + sum11 * p01 + sum12 * p02 + sum13 * p03) * weight;
 
-            v += 4;
+            v += kPartialsPatternStride;
         }
         w += OFFSET*4;
     }
@@ -1091,17 +1113,20 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcCrossProductsStates(const int
                                                                 const REALTYPE *categoryWeights,
                                                                 const double edgeLength,
                                                                 double *outCrossProducts,
-                                                                double *outSumSquaredDerivatives) {
+                                                                double *outSumSquaredDerivatives,
+                                                                int startPattern,
+                                                                int endPattern) {
 #ifdef OLD_CP_STATES
     return BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcCrossProductsStates(tipStates, preOrderPartial, categoryRates,
-            categoryWeights, edgeLength, outCrossProducts, outSumSquaredDerivatives);
+            categoryWeights, edgeLength, outCrossProducts, outSumSquaredDerivatives,
+            startPattern, endPattern);
 #else
     std::array<REALTYPE, 16> acrossPatterns;
     acrossPatterns.fill((REALTYPE) 0);
 
     std::array<REALTYPE, 16> withinPattern;
 
-    for (int pattern = 0; pattern < kPatternCount; pattern++) {
+    for (int pattern = startPattern; pattern < endPattern; pattern++) {
 
         withinPattern.fill((REALTYPE) 0);
         REALTYPE patternDenominator = 0.0;
@@ -1115,8 +1140,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcCrossProductsStates(const int
                 const REALTYPE scale = (REALTYPE) categoryRates[category] * edgeLength;
 
                 const REALTYPE weight = categoryWeights[category];
-                const int patternIndex = category * kPatternCount + pattern;
-                const int v = patternIndex * 4;
+                const int v = category * kPartialsCategoryStride + pattern * kPartialsPatternStride;
 
                 REALTYPE denominator = preOrderPartial[v + state];
                 patternDenominator += denominator * weight;
@@ -1142,8 +1166,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcCrossProductsStates(const int
                 const REALTYPE scale = (REALTYPE) categoryRates[category] * edgeLength;
 
                 const REALTYPE weight = categoryWeights[category];
-                const int patternIndex = category * kPatternCount + pattern;
-                const int v = patternIndex * 4;
+                const int v = category * kPartialsCategoryStride + pattern * kPartialsPatternStride;
 
                 REALTYPE denominator = 0.0;
                 for (int k = 0; k < 4; k++) {
@@ -1180,12 +1203,15 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcCrossProductsPartials(const RE
                                                                         const REALTYPE *categoryWeights,
                                                                         const double edgeLength,
                                                                         double *outCrossProducts,
-                                                                        double *outSumSquaredDerivatives) {
+                                                                        double *outSumSquaredDerivatives,
+                                                                        int startPattern,
+                                                                        int endPattern) {
 
 
 #ifdef OLD_CP_PARTIALS
     return BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcCrossProductsPartials(postOrderPartial, preOrderPartial,
-            categoryRates, categoryWeights, edgeLength, outCrossProducts, outSumSquaredDerivatives);
+            categoryRates, categoryWeights, edgeLength, outCrossProducts, outSumSquaredDerivatives,
+            startPattern, endPattern);
 #else
 
     std::array<REALTYPE, 16> acrossPatterns;
@@ -1193,7 +1219,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcCrossProductsPartials(const RE
 
     std::array<REALTYPE, 16> withinPattern;
 
-    for (int pattern = 0; pattern < kPatternCount; pattern++) {
+    for (int pattern = startPattern; pattern < endPattern; pattern++) {
 
         withinPattern.fill((REALTYPE) 0.0);
 
@@ -1203,8 +1229,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcCrossProductsPartials(const RE
 
             const REALTYPE scale = (REALTYPE) categoryRates[category] * edgeLength;
             const REALTYPE weight = categoryWeights[category];
-            const int patternIndex = category * kPatternCount + pattern; // Bad memory access
-            const int v = patternIndex * 4;
+            const int v = category * kPartialsCategoryStride + pattern * kPartialsPatternStride;
 
             PREFETCH_PARTIALS(pre, preOrderPartial, v);
             PREFETCH_PARTIALS(post, postOrderPartial, v);
@@ -1274,18 +1299,20 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartition(
         assert(rootPartials);
         const REALTYPE* wt = gCategoryWeights[categoryWeightsIndices[p]];
 
-        int v = startPattern * 4;
+        int u = startPattern * 4;
+        int v = startPattern * kPartialsPatternStride;
         const REALTYPE wt0 = wt[0];
         for (int k = startPattern; k < endPattern; k++) {
-            integrationTmp[v    ] = rootPartials[v    ] * wt0;
-            integrationTmp[v + 1] = rootPartials[v + 1] * wt0;
-            integrationTmp[v + 2] = rootPartials[v + 2] * wt0;
-            integrationTmp[v + 3] = rootPartials[v + 3] * wt0;
-            v += 4;
+            integrationTmp[u    ] = rootPartials[v    ] * wt0;
+            integrationTmp[u + 1] = rootPartials[v + 1] * wt0;
+            integrationTmp[u + 2] = rootPartials[v + 2] * wt0;
+            integrationTmp[u + 3] = rootPartials[v + 3] * wt0;
+            u += 4;
+            v += kPartialsPatternStride;
         }
         for (int l = 1; l < kCategoryCount; l++) {
-            int u = startPattern * 4;
-            v += ((kPatternCount - endPattern) + startPattern) * 4;
+            u = startPattern * 4;
+            v = l * kPartialsCategoryStride + startPattern * kPartialsPatternStride;
             const REALTYPE wtl = wt[l];
             for (int k = startPattern; k < endPattern; k++) {
                 integrationTmp[u    ] += rootPartials[v    ] * wtl;
@@ -1294,9 +1321,8 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartition(
                 integrationTmp[u + 3] += rootPartials[v + 3] * wtl;
 
                 u += 4;
-                v += 4;
+                v += kPartialsPatternStride;
             }
-        v += 4 * kExtraPatterns;
         }
     }
     integrateOutStatesAndScaleByPartition(integrationTmp, stateFrequenciesIndices, cumulativeScaleIndices, partitionIndices, partitionCount, outSumLogLikelihoodByPartition);
@@ -1325,14 +1351,16 @@ int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const i
 
         const REALTYPE wt0 = wt[0];
         for (int k = 0; k < kPatternCount; k++) {
-            integrationTmp[v    ] = rootPartials[v    ] * wt0;
-            integrationTmp[v + 1] = rootPartials[v + 1] * wt0;
-            integrationTmp[v + 2] = rootPartials[v + 2] * wt0;
-            integrationTmp[v + 3] = rootPartials[v + 3] * wt0;
-            v += 4;
+            integrationTmp[u    ] = rootPartials[v    ] * wt0;
+            integrationTmp[u + 1] = rootPartials[v + 1] * wt0;
+            integrationTmp[u + 2] = rootPartials[v + 2] * wt0;
+            integrationTmp[u + 3] = rootPartials[v + 3] * wt0;
+            u += 4;
+            v += kPartialsPatternStride;
         }
         for (int l = 1; l < kCategoryCount; l++) {
             u = 0;
+            v = l * kPartialsCategoryStride;
             const REALTYPE wtl = wt[l];
             for (int k = 0; k < kPatternCount; k++) {
                 integrationTmp[u    ] += rootPartials[v    ] * wtl;
@@ -1341,9 +1369,8 @@ int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const i
                 integrationTmp[u + 3] += rootPartials[v + 3] * wtl;
 
                 u += 4;
-                v += 4;
+                v += kPartialsPatternStride;
             }
-            v += 4 * kExtraPatterns;
         }
 
         REALTYPE freq0, freq1, freq2, freq3;
@@ -1493,7 +1520,7 @@ BEAGLE_CPU_FACTORY_TEMPLATE
 const long BeagleCPU4StateImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getFlags() {
     long flags =  BEAGLE_FLAG_COMPUTATION_SYNCH |
                   BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-                  BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+                  BEAGLE_CPU_THREADING_FLAGS |
                   BEAGLE_FLAG_PROCESSOR_CPU |
                   BEAGLE_FLAG_VECTOR_NONE |
                   BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
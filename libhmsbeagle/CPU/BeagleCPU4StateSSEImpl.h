@@ -50,6 +50,9 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::gTransitionMatrices;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::kPatternCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::kPaddedPatternCount;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::kPartialsLayout;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::kPartialsPatternStride;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::kPartialsCategoryStride;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::kExtraPatterns;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::kStateCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::gTipStates;
@@ -142,6 +145,9 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::gTransitionMatrices;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::kPatternCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::kPaddedPatternCount;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::kPartialsLayout;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::kPartialsPatternStride;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::kPartialsCategoryStride;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::kExtraPatterns;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::kStateCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::gTipStates;
@@ -156,6 +162,9 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::grandDenominatorDerivTmp;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::grandNumeratorDerivTmp;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::accumulateDerivatives;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::accumulateRescaleFactorsRange;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::kRescaleBlockPatternCount;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::scalingExponentThreshold;
 
 public:
     virtual const char* getName();
@@ -241,7 +250,9 @@ private:
 										 const double* __restrict categoryWeights,
 										 const double edgeLength,
 										 double* __restrict outCrossProducts,
-										 double* __restrict outSumSquaredDerivatives);
+										 double* __restrict outSumSquaredDerivatives,
+										 int startPattern,
+										 int endPattern);
 
 	virtual void calcCrossProductsPartials(const double* __restrict postOrderPartial,
 										   const double* __restrict preOrderPartial,
@@ -249,7 +260,9 @@ private:
 										   const double* __restrict categoryWeights,
 										   const double edgeLength,
 										   double* __restrict outCrossProducts,
-										   double* __restrict outSumSquaredDerivatives);
+										   double* __restrict outSumSquaredDerivatives,
+										   int startPattern,
+										   int endPattern);
 
     virtual void calcEdgeLogDerivativesPartials(const double* __restrict postOrderPartial,
                                                 const double* __restrict preOrderPartial,
@@ -260,7 +273,9 @@ private:
                                                 const int scalingFactorsIndex,
                                                 double* outDerivatives,
                                                 double* outSumDerivatives,
-                                                double* outSumSquaredDerivatives);
+                                                double* outSumSquaredDerivatives,
+                                                int startPattern,
+                                                int endPattern);
 
     virtual void calcEdgeLogDerivativesStates(const int* tipStates,
                                               const double *__restrict preOrderPartial,
@@ -270,7 +285,9 @@ private:
                                               const double* __restrict categoryWeights,
                                               double *outDerivatives,
                                               double *outSumDerivatives,
-                                              double *outSumSquaredDerivatives);
+                                              double *outSumSquaredDerivatives,
+                                              int startPattern,
+                                              int endPattern);
 
     virtual void calcPartialsPartialsFixedScaling(double* __restrict destP,
                                                   const double* __restrict child0Partials,
@@ -288,6 +305,16 @@ private:
                                                  const double* __restrict matrices2,
                                                  int* activateScaling);
 
+    virtual void rescalePartialsRange(double* __restrict destP,
+                                      double* __restrict scaleFactors,
+                                      double* __restrict cumulativeScaleFactors,
+                                      int startPattern,
+                                      int endPattern);
+
+    virtual bool exceedsScalingExponent(const double* destP,
+                                        int startPattern,
+                                        int endPattern);
+
     virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
                                        const int childBufferIndex,
                                        const int probabilityIndex,
@@ -306,6 +333,18 @@ private:
                                                   int partitionCount,
                                                   double* outSumLogLikelihoodByPartition);
 
+    virtual void calcEdgeLogLikelihoodsDerivativesRange(const int parentBufferIndex,
+                                                        const int childBufferIndex,
+                                                        const int probabilityIndex,
+                                                        const int firstDerivativeIndex,
+                                                        const int secondDerivativeIndex,
+                                                        const int categoryWeightsIndex,
+                                                        const int stateFrequenciesIndex,
+                                                        const int scalingFactorsIndex,
+                                                        int startPattern,
+                                                        int endPattern,
+                                                        double* outSums);
+
 };
 
 
@@ -140,15 +140,13 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesStates(double* d
                                                                        int startPattern,
                                                                        int endPattern) {
 
-    int patternDefficit = kPatternCount + kExtraPatterns - endPattern;
-
 	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
 
     int w = 0;
 	V_Real *destPvec = (V_Real *)destP;
 
     for (int l = 0; l < kCategoryCount; l++) {
-      destPvec += startPattern*2;
+      destPvec = (V_Real *)(destP + l*kPartialsCategoryStride + startPattern*kPartialsPatternStride);
     	SSE_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
         for (int k = startPattern; k < endPattern; k++) {
@@ -156,16 +154,13 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesStates(double* d
             const int state_q = states_q[k];
             const int state_r = states_r[k];
 
-            *destPvec++ = VEC_MULT(vu_mq[state_q][0].vx, vu_mr[state_r][0].vx);
-            *destPvec++ = VEC_MULT(vu_mq[state_q][1].vx, vu_mr[state_r][1].vx);
+            destPvec[0] = VEC_MULT(vu_mq[state_q][0].vx, vu_mr[state_r][0].vx);
+            destPvec[1] = VEC_MULT(vu_mq[state_q][1].vx, vu_mr[state_r][1].vx);
+            destPvec += kPartialsPatternStride / 2;
 
         }
 
         w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        }
-        destPvec += patternDefficit * 2;
     }
 }
 
@@ -183,8 +178,6 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesPartials(double*
                                                                          int startPattern,
                                                                          int endPattern) {
 
-    int patternDefficit = kPatternCount + kExtraPatterns - endPattern;
-
     int v = 0;
     int w = 0;
 
@@ -193,8 +186,8 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesPartials(double*
 	V_Real destr_01, destr_23;
 
     for (int l = 0; l < kCategoryCount; l++) {
-      destPvec += startPattern*2;
-      v += startPattern*4;
+      destPvec = (V_Real *)(destP + l*kPartialsCategoryStride + startPattern*kPartialsPatternStride);
+      v = l*kPartialsCategoryStride + startPattern*kPartialsPatternStride;
     	SSE_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
         for (int k = startPattern; k < endPattern; k++) {
@@ -212,18 +205,13 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesPartials(double*
 			destr_23 = VEC_MADD(vp2, vu_mr[2][1].vx, destr_23);
 			destr_23 = VEC_MADD(vp3, vu_mr[3][1].vx, destr_23);
 
-            *destPvec++ = VEC_MULT(vu_mq[state_q][0].vx, destr_01);
-            *destPvec++ = VEC_MULT(vu_mq[state_q][1].vx, destr_23);
+            destPvec[0] = VEC_MULT(vu_mq[state_q][0].vx, destr_01);
+            destPvec[1] = VEC_MULT(vu_mq[state_q][1].vx, destr_23);
+            destPvec += kPartialsPatternStride / 2;
 
-            v += 4;
+            v += kPartialsPatternStride;
         }
         w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
-        destPvec += patternDefficit * 2;
-        v += patternDefficit * 4;
     }
 }
 
@@ -237,8 +225,6 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesPartialsFixedSca
                                                                                      int startPattern,
                                                                                      int endPattern) {
 
-    int patternDefficit = kPatternCount + kExtraPatterns - endPattern;
-
     int v = 0;
     int w = 0;
 
@@ -247,8 +233,8 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesPartialsFixedSca
     V_Real destr_01, destr_23;
 
     for (int l = 0; l < kCategoryCount; l++) {
-      destPvec += startPattern*2;
-      v += startPattern*4;
+      destPvec = (V_Real *)(destP + l*kPartialsCategoryStride + startPattern*kPartialsPatternStride);
+      v = l*kPartialsCategoryStride + startPattern*kPartialsPatternStride;
     	SSE_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
         for (int k = startPattern; k < endPattern; k++) {
@@ -268,18 +254,13 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesPartialsFixedSca
 			destr_23 = VEC_MADD(vp2, vu_mr[2][1].vx, destr_23);
 			destr_23 = VEC_MADD(vp3, vu_mr[3][1].vx, destr_23);
 
-            *destPvec++ = VEC_MULT(VEC_MULT(vu_mq[state_q][0].vx, destr_01), scaleFactor);
-            *destPvec++ = VEC_MULT(VEC_MULT(vu_mq[state_q][1].vx, destr_23), scaleFactor);
+            destPvec[0] = VEC_MULT(VEC_MULT(vu_mq[state_q][0].vx, destr_01), scaleFactor);
+            destPvec[1] = VEC_MULT(VEC_MULT(vu_mq[state_q][1].vx, destr_23), scaleFactor);
+            destPvec += kPartialsPatternStride / 2;
 
-            v += 4;
+            v += kPartialsPatternStride;
         }
         w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
-        destPvec += patternDefficit * 2;
-        v += patternDefficit * 4;
     }
 }
 
@@ -292,8 +273,6 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPartialsPartials(doubl
                                                                            int startPattern,
                                                                            int endPattern) {
 
-    int patternDefficit = kPatternCount + kExtraPatterns - endPattern;
-
     int v = 0;
     int w = 0;
 
@@ -302,8 +281,8 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPartialsPartials(doubl
 	  V_Real *destPvec = (V_Real *)destP;
 
     for (int l = 0; l < kCategoryCount; l++) {
-      destPvec += startPattern*2;
-      v += startPattern*4;
+      destPvec = (V_Real *)(destP + l*kPartialsCategoryStride + startPattern*kPartialsPatternStride);
+      v = l*kPartialsCategoryStride + startPattern*kPartialsPatternStride;
 		/* Load transition-probability matrices into vectors */
     	SSE_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
@@ -374,7 +353,7 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPartialsPartials(doubl
 #			if 1//
             destPvec[0] = VEC_MULT(destq_01, destr_01);
             destPvec[1] = VEC_MULT(destq_23, destr_23);
-            destPvec += 2;
+            destPvec += kPartialsPatternStride / 2;
 
 #			else	/* VEC_STORE did demonstrate a measurable performance gain as
 					   it copies all (2/4) values to memory simultaneously;
@@ -385,15 +364,9 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPartialsPartials(doubl
 
 #			endif
 
-            v += 4;
+            v += kPartialsPatternStride;
         }
         w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
-        destPvec += patternDefficit * 2;
-        v += patternDefficit * 4;
     }
 }
 
@@ -406,8 +379,6 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPrePartialsPartials(do
                                                                            int startPattern,
                                                                            int endPattern) {
 
-    int patternDefficit = kPatternCount + kExtraPatterns - endPattern;
-
     int v = 0;
     int w = 0;
 
@@ -416,8 +387,8 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPrePartialsPartials(do
     V_Real *destPvec = (V_Real *)destP;
 
     for (int l = 0; l < kCategoryCount; l++) {
-        destPvec += startPattern*2;
-        v += startPattern*4;
+        destPvec = (V_Real *)(destP + l*kPartialsCategoryStride + startPattern*kPartialsPatternStride);
+        v = l*kPartialsCategoryStride + startPattern*kPartialsPatternStride;
         /* Load transition-probability matrices into vectors */
         SSE_PREFETCH_PRE_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
@@ -458,21 +429,15 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPrePartialsPartials(do
 
             destPvec[0] = destq_01;
             destPvec[1] = destq_23;
-            destPvec += 2;
+            destPvec += kPartialsPatternStride / 2;
 
                 /* VEC_STORE did demonstrate a measurable performance gain as
                it copies all (2/4) values to memory simultaneously;
                I can no longer reproduce the performance gain (?) */
 
-            v += 4;
+            v += kPartialsPatternStride;
         }
         w += OFFSET*4;
-        if (kExtraPatterns) {
-            destPvec += kExtraPatterns * 2;
-            v += kExtraPatterns * 4;
-        }
-        destPvec += patternDefficit * 2;
-        v += patternDefficit * 4;
     }
 }
 
@@ -485,8 +450,6 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPrePartialsStates(doub
                                                                               int startPattern,
                                                                               int endPattern) {
 
-    int patternDefficit = kPatternCount + kExtraPatterns - endPattern;
-
     int v = 0;
     int w = 0;
 
@@ -495,8 +458,8 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPrePartialsStates(doub
     V_Real *destPvec = (V_Real *)destP;
 
     for (int l = 0; l < kCategoryCount; l++) {
-        destPvec += startPattern*2;
-        v += startPattern*4;
+        destPvec = (V_Real *)(destP + l*kPartialsCategoryStride + startPattern*kPartialsPatternStride);
+        v = l*kPartialsCategoryStride + startPattern*kPartialsPatternStride;
         /* Load transition-probability matrices into vectors */
         SSE_PREFETCH_PRE_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
@@ -527,21 +490,15 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPrePartialsStates(doub
 
             destPvec[0] = destq_01;
             destPvec[1] = destq_23;
-            destPvec += 2;
+            destPvec += kPartialsPatternStride / 2;
 
             /* VEC_STORE did demonstrate a measurable performance gain as
            it copies all (2/4) values to memory simultaneously;
            I can no longer reproduce the performance gain (?) */
 
-            v += 4;
+            v += kPartialsPatternStride;
         }
         w += OFFSET*4;
-        if (kExtraPatterns) {
-            destPvec += kExtraPatterns * 2;
-            v += kExtraPatterns * 4;
-        }
-        destPvec += patternDefficit * 2;
-        v += patternDefficit * 4;
     }
 }
 
@@ -552,12 +509,15 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcCrossProductsPartials(
                                                                                 const double *categoryWeights,
                                                                                 const double edgeLength,
                                                                                 double *outCrossProducts,
-                                                                                double *outSumSquaredDerivatives) {
+                                                                                double *outSumSquaredDerivatives,
+                                                                                int startPattern,
+                                                                                int endPattern) {
 #if 0
     return BeagleCPU4StateImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcCrossProductsPartials(postOrderPartial, preOrderPartial,
                                                                                    categoryRates, categoryWeights,
                                                                                    edgeLength, outCrossProducts,
-                                                                                   outSumSquaredDerivatives);
+                                                                                   outSumSquaredDerivatives,
+                                                                                   startPattern, endPattern);
 #else
 
     std::array<V_Real, 8> vAcrossPatterns;
@@ -565,7 +525,7 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcCrossProductsPartials(
 
     std::array<V_Real, 8> vWithinPattern;
 
-    for (int pattern = 0; pattern < kPatternCount; pattern++) {
+    for (int pattern = startPattern; pattern < endPattern; pattern++) {
 
         vWithinPattern.fill(V_Real());
 
@@ -576,8 +536,7 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcCrossProductsPartials(
             const V_Real scale = VEC_SPLAT(categoryRates[category] * edgeLength);
             const V_Real weight = VEC_SPLAT(categoryWeights[category]);
 
-            const int patternIndex = category * kPatternCount + pattern; // Bad memory access
-            const int v = patternIndex * 4;
+            const int v = category * kPartialsCategoryStride + pattern * kPartialsPatternStride;
 
             V_Real pre0, pre1, pre2, pre3;
             SSE_PREFETCH_PARTIALS(pre, preOrderPartial, v);
@@ -625,11 +584,14 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcCrossProductsStates(co
                                                                               const double *categoryWeights,
                                                                               const double edgeLength,
                                                                               double *outCrossProducts,
-                                                                              double *outSumSquaredDerivatives) {
+                                                                              double *outSumSquaredDerivatives,
+                                                                              int startPattern,
+                                                                              int endPattern) {
 
     return BeagleCPU4StateImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcCrossProductsStates(tipStates, preOrderPartial, categoryRates,
                                                                                  categoryWeights, edgeLength, outCrossProducts,
-                                                                                 outSumSquaredDerivatives);
+                                                                                 outSumSquaredDerivatives,
+                                                                                 startPattern, endPattern);
 }
 
 BEAGLE_CPU_4_SSE_TEMPLATE template <bool DoDerivatives, bool DoSum, bool DoSumSquared>
@@ -750,15 +712,12 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogDerivativesPart
                                                                                      const int scalingFactorsIndex,
                                                                                      double* outDerivatives,
                                                                                      double* outSumDerivatives,
-                                                                                     double* outSumSquaredDerivatives) {
-    double* cl_p = integrationTmp;
-    memset(cl_p, 0, (kPatternCount * kStateCount)*sizeof(double));
-
+                                                                                     double* outSumSquaredDerivatives,
+                                                                                     int startPattern,
+                                                                                     int endPattern) {
     const double* cl_r = preOrderPartial;
     const double* wt = categoryWeights;
 
-    V_Real * vcl_r = (V_Real *)cl_r;
-
     int v = 0;
     int w = 0;
     const double* transMatrix = gTransitionMatrices[firstDerivativeIndex];
@@ -769,13 +728,15 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogDerivativesPart
         VecUnion vu_m[OFFSET][2];
         SSE_PREFETCH_MATRIX(transMatrix + w, vu_m);
 
-        V_Real * vcl_p = (V_Real *)cl_p;
-        V_Real vwt = VEC_SPLAT(wt[l]);
-        for (int k = 0; k < kPatternCount; k++) {
+        v = l*kPartialsCategoryStride + startPattern*kPartialsPatternStride;
+
+        for (int k = startPattern; k < endPattern; k++) {
 
             /* This would probably be faster on PPC/Altivec, which has a fused multiply-add
                vector instruction */
 
+            V_Real * vcl_r = (V_Real *)(cl_r + v);
+
             V_Real vcl_q0, vcl_q1, vcl_q2, vcl_q3;
             SSE_PREFETCH_PARTIALS(vcl_q,postOrderPartial,v);
 
@@ -806,13 +767,9 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogDerivativesPart
             grandNumeratorDerivTmp[k] += numer; // TODO Merge [numer, denom] into single SSE transactions
             grandDenominatorDerivTmp[k] += denon;
 
-            v += 4;
+            v += kPartialsPatternStride;
         }
         w += 4*OFFSET;
-        if (kExtraPatterns) {
-            vcl_r += 2 * kExtraPatterns;
-            v += 4 * kExtraPatterns;
-        }
     }
 }
 
@@ -825,17 +782,14 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogDerivativesStat
                                                                                    const double* categoryWeights,
                                                                                    double *outDerivatives,
                                                                                    double *outSumDerivatives,
-                                                                                   double *outSumSquaredDerivatives) {
-    double* cl_p = integrationTmp;
-    memset(cl_p, 0, (kPatternCount * kStateCount)*sizeof(double));
-
-    const double* cl_r = preOrderPartial;
+                                                                                   double *outSumSquaredDerivatives,
+                                                                                   int startPattern,
+                                                                                   int endPattern) {
     const double* wt = categoryWeights;
 
     const int* statesChild = tipStates;
 
     int w = 0;
-    V_Real *vcl_r = (V_Real *)cl_r;
     const double* transMatrix = gTransitionMatrices[firstDerivativeIndex];
 
     for (int l = 0; l < kCategoryCount; l++) {
@@ -844,28 +798,27 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogDerivativesStat
         VecUnion vu_m[OFFSET][2];
         SSE_PREFETCH_MATRIX(transMatrix + w, vu_m);
 
-        V_Real * vcl_p = (V_Real *)cl_p;
-        V_Real vwt = VEC_SPLAT(wt[l]);
-        for (int k = 0; k < kPatternCount; k++) {
+        const double* cl_r = preOrderPartial + l*kPartialsCategoryStride + startPattern*kPartialsPatternStride;
+
+        for (int k = startPattern; k < endPattern; k++) {
 
             const int stateChild = statesChild[k];
 
+            V_Real *vcl_r = (V_Real *)cl_r;
             V_Real p01, p23;
-            p01 = VEC_MULT(vu_m[stateChild][0].vx, *vcl_r++);
-            p23 = VEC_MULT(vu_m[stateChild][1].vx, *vcl_r++);
+            p01 = VEC_MULT(vu_m[stateChild][0].vx, vcl_r[0]);
+            p23 = VEC_MULT(vu_m[stateChild][1].vx, vcl_r[1]);
 
             V_Real vnumer = VEC_ADD(p01, p23);
             vnumer = VEC_ADD(vnumer, VEC_SWAP(vnumer));
 
             double numer = _mm_cvtsd_f64(vnumer);
-            double denom = cl_r[stateChild & 3]; cl_r += 4;
+            double denom = cl_r[stateChild & 3]; cl_r += kPartialsPatternStride;
 
             grandNumeratorDerivTmp[k] += numer * wt[l];
             grandDenominatorDerivTmp[k] += denom * wt[l];
         }
         w += OFFSET*4;
-        vcl_r += 2 * kExtraPatterns;
-        cl_r += 4 * kExtraPatterns;
     }
 }
 
@@ -879,8 +832,6 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPartialsPartialsFixedS
                                                                                        int startPattern,
                                                                                        int endPattern) {
 
-    int patternDefficit = kPatternCount + kExtraPatterns - endPattern;
-
     int v = 0;
     int w = 0;
 
@@ -889,8 +840,8 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPartialsPartialsFixedS
 	V_Real *destPvec = (V_Real *)destP;
 
 	for (int l = 0; l < kCategoryCount; l++) {
-      destPvec += startPattern*2;
-      v += startPattern*4;
+      destPvec = (V_Real *)(destP + l*kPartialsCategoryStride + startPattern*kPartialsPatternStride);
+      v = l*kPartialsCategoryStride + startPattern*kPartialsPatternStride;
 		/* Load transition-probability matrices into vectors */
     	SSE_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
@@ -936,16 +887,10 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPartialsPartialsFixedS
             destPvec[0] = VEC_MULT(VEC_MULT(destq_01, destr_01), scaleFactor);
             destPvec[1] = VEC_MULT(VEC_MULT(destq_23, destr_23), scaleFactor);
 
-            destPvec += 2;
-            v += 4;
+            destPvec += kPartialsPatternStride / 2;
+            v += kPartialsPatternStride;
         }
         w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
-        destPvec += patternDefficit * 2;
-        v += patternDefficit * 4;
     }
 }
 
@@ -972,13 +917,76 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPartialsPartialsAutoSc
                                                                     const double*  partials_r,
                                                                     const double*  matrices_r,
                                                                     int* activateScaling) {
-    // TODO: implement calcPartialsPartialsAutoScaling with SSE
-    BeagleCPU4StateImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPartialsPartialsAutoScaling(destP,
-                                                                partials_q,
-                                                                matrices_q,
-                                                                partials_r,
-                                                                matrices_r,
-                                                                activateScaling);
+    // Check each block of patterns for out-of-range exponents while it is still in cache
+    for (int blockStart = 0; blockStart < kPatternCount; blockStart += kRescaleBlockPatternCount) {
+        const int blockEnd = std::min(blockStart + kRescaleBlockPatternCount, kPatternCount);
+        calcPartialsPartials(destP, partials_q, matrices_q, partials_r, matrices_r, blockStart, blockEnd);
+        if (*activateScaling == 0 && exceedsScalingExponent(destP, blockStart, blockEnd))
+            *activateScaling = 1;
+    }
+}
+
+/*
+ * True if any partial has a binary exponent larger in magnitude than scalingExponentThreshold,
+ * i.e. |x| >= 2^threshold or 0 < |x| < 2^-(threshold + 1).
+ */
+BEAGLE_CPU_4_SSE_TEMPLATE
+bool BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::exceedsScalingExponent(const double* destP,
+                                                                            int startPattern,
+                                                                            int endPattern) {
+    const V_Real signMask = VEC_SPLAT(-0.0);
+    const V_Real lower = VEC_SPLAT(ldexp(1.0, -scalingExponentThreshold - 1));
+    const V_Real upper = VEC_SPLAT(ldexp(1.0, scalingExponentThreshold));
+    const V_Real zero = VEC_SETZERO();
+    V_Real outside = VEC_SETZERO();
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        const V_Real* vp = (const V_Real*)(destP + l*kPartialsCategoryStride + startPattern*kPartialsPatternStride);
+        for (int k = startPattern; k < endPattern; k++) {
+            for (int j = 0; j < 2; j++) {
+                const V_Real x = _mm_andnot_pd(signMask, vp[j]);
+                outside = _mm_or_pd(outside, _mm_cmpge_pd(x, upper));
+                outside = _mm_or_pd(outside, _mm_and_pd(_mm_cmplt_pd(x, lower), _mm_cmpgt_pd(x, zero)));
+            }
+            vp += kPartialsPatternStride / 2;
+        }
+    }
+
+    return _mm_movemask_pd(outside) != 0;
+}
+
+/*
+ * Re-scales the partial likelihoods of a range of patterns such that the largest is one.
+ */
+BEAGLE_CPU_4_SSE_TEMPLATE
+void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::rescalePartialsRange(double* destP,
+                                                                           double* scaleFactors,
+                                                                           double* cumulativeScaleFactors,
+                                                                           int startPattern,
+                                                                           int endPattern) {
+    for (int k = startPattern; k < endPattern; k++) {
+        V_Real vmax = VEC_SETZERO();
+        for (int l = 0; l < kCategoryCount; l++) {
+            const V_Real* vp = (const V_Real*)(destP + l*kPartialsCategoryStride + k*kPartialsPatternStride);
+            vmax = VEC_MAX(vmax, VEC_MAX(vp[0], vp[1]));
+        }
+        vmax = VEC_MAX(vmax, VEC_SWAP(vmax));
+
+        double max = _mm_cvtsd_f64(vmax);
+        if (max == 0)
+            max = 1.0;
+
+        const V_Real oneOverMax = VEC_SPLAT(1.0 / max);
+        for (int l = 0; l < kCategoryCount; l++) {
+            V_Real* vp = (V_Real*)(destP + l*kPartialsCategoryStride + k*kPartialsPatternStride);
+            vp[0] = VEC_MULT(vp[0], oneOverMax);
+            vp[1] = VEC_MULT(vp[1], oneOverMax);
+        }
+
+        scaleFactors[k] = max;
+    }
+
+    accumulateRescaleFactorsRange(scaleFactors, cumulativeScaleFactors, startPattern, endPattern);
 }
 
 BEAGLE_CPU_4_SSE_TEMPLATE
@@ -1026,12 +1034,12 @@ int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoods(cons
         const int* statesChild = gTipStates[childIndex];
 
         int w = 0;
-        V_Real *vcl_r = (V_Real *)cl_r;
         for(int l = 0; l < kCategoryCount; l++) {
 
             VecUnion vu_m[OFFSET][2];
             SSE_PREFETCH_MATRIX(transMatrix + w, vu_m)
 
+           V_Real *vcl_r = (V_Real *)(cl_r + l*kPartialsCategoryStride);
            V_Real *vcl_p = (V_Real *)cl_p;
 
            for(int k = 0; k < kPatternCount; k++) {
@@ -1039,26 +1047,26 @@ int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoods(cons
                 const int stateChild = statesChild[k];
                 V_Real vwt = VEC_SPLAT(wt[l]);
 
-                V_Real wtdPartials = VEC_MULT(*vcl_r++, vwt);
+                V_Real wtdPartials = VEC_MULT(vcl_r[0], vwt);
                 *vcl_p = VEC_MADD(vu_m[stateChild][0].vx, wtdPartials, *vcl_p);
                 vcl_p++;
 
-                wtdPartials = VEC_MULT(*vcl_r++, vwt);
+                wtdPartials = VEC_MULT(vcl_r[1], vwt);
                 *vcl_p = VEC_MADD(vu_m[stateChild][1].vx, wtdPartials, *vcl_p);
                 vcl_p++;
+
+                vcl_r += kPartialsPatternStride / 2;
             }
            w += OFFSET*4;
-           vcl_r += 2 * kExtraPatterns;
         }
     } else { // Integrate against a partial at the child
 
         const double* cl_q = gPartials[childIndex];
-        V_Real * vcl_r = (V_Real *)cl_r;
-        int v = 0;
         int w = 0;
 
         for(int l = 0; l < kCategoryCount; l++) {
 
+            int v = l*kPartialsCategoryStride;
             V_Real * vcl_p = (V_Real *)cl_p;
 
             VecUnion vu_m[OFFSET][2];
@@ -1082,19 +1090,15 @@ int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoods(cons
                 vclp_01 = VEC_MULT(vclp_01, vwt);
                 vclp_23 = VEC_MULT(vclp_23, vwt);
 
-                *vcl_p = VEC_MADD(vclp_01, *vcl_r++, *vcl_p);
+                const V_Real * vcl_r = (const V_Real *)(cl_r + v);
+                *vcl_p = VEC_MADD(vclp_01, vcl_r[0], *vcl_p);
                 vcl_p++;
-                *vcl_p = VEC_MADD(vclp_23, *vcl_r++, *vcl_p);
+                *vcl_p = VEC_MADD(vclp_23, vcl_r[1], *vcl_p);
                 vcl_p++;
 
-                v += 4;
+                v += kPartialsPatternStride;
             }
             w += 4*OFFSET;
-            if (kExtraPatterns) {
-                vcl_r += 2 * kExtraPatterns;
-                v += 4 * kExtraPatterns;
-            }
-
         }
     }
 
@@ -1195,12 +1199,12 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoodsByPa
             const int* statesChild = gTipStates[childIndex];
 
             int w = 0;
-            V_Real *vcl_r = (V_Real *) (cl_r + startPattern * 4);
             for(int l = 0; l < kCategoryCount; l++) {
 
                 VecUnion vu_m[OFFSET][2];
                 SSE_PREFETCH_MATRIX(transMatrix + w, vu_m)
 
+               V_Real *vcl_r = (V_Real *) (cl_r + l*kPartialsCategoryStride + startPattern*kPartialsPatternStride);
                V_Real *vcl_p = (V_Real *) (cl_p + startPattern * 4);
 
                for(int k = startPattern; k < endPattern; k++) {
@@ -1208,27 +1212,26 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoodsByPa
                     const int stateChild = statesChild[k];
                     V_Real vwt = VEC_SPLAT(wt[l]);
 
-                    V_Real wtdPartials = VEC_MULT(*vcl_r++, vwt);
+                    V_Real wtdPartials = VEC_MULT(vcl_r[0], vwt);
                     *vcl_p = VEC_MADD(vu_m[stateChild][0].vx, wtdPartials, *vcl_p);
                     vcl_p++;
 
-                    wtdPartials = VEC_MULT(*vcl_r++, vwt);
+                    wtdPartials = VEC_MULT(vcl_r[1], vwt);
                     *vcl_p = VEC_MADD(vu_m[stateChild][1].vx, wtdPartials, *vcl_p);
                     vcl_p++;
+
+                    vcl_r += kPartialsPatternStride / 2;
                 }
                w += OFFSET*4;
-               vcl_r += 2 * kExtraPatterns;
-               vcl_r += ((kPatternCount - endPattern) + startPattern) * 2;
             }
         } else { // Integrate against a partial at the child
 
             const double* cl_q = gPartials[childIndex];
-            V_Real * vcl_r = (V_Real *)  (cl_r + startPattern * 4);
-            int v = startPattern * 4;
             int w = 0;
 
             for(int l = 0; l < kCategoryCount; l++) {
 
+                int v = l*kPartialsCategoryStride + startPattern*kPartialsPatternStride;
                 V_Real * vcl_p = (V_Real *) (cl_p + startPattern * 4);
 
                 VecUnion vu_m[OFFSET][2];
@@ -1252,22 +1255,15 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoodsByPa
                     vclp_01 = VEC_MULT(vclp_01, vwt);
                     vclp_23 = VEC_MULT(vclp_23, vwt);
 
-                    *vcl_p = VEC_MADD(vclp_01, *vcl_r++, *vcl_p);
+                    const V_Real * vcl_r = (const V_Real *)(cl_r + v);
+                    *vcl_p = VEC_MADD(vclp_01, vcl_r[0], *vcl_p);
                     vcl_p++;
-                    *vcl_p = VEC_MADD(vclp_23, *vcl_r++, *vcl_p);
+                    *vcl_p = VEC_MADD(vclp_23, vcl_r[1], *vcl_p);
                     vcl_p++;
 
-                    v += 4;
+                    v += kPartialsPatternStride;
                 }
                 w += 4*OFFSET;
-                if (kExtraPatterns) {
-                    vcl_r += 2 * kExtraPatterns;
-                    v += 4 * kExtraPatterns;
-                }
-
-               vcl_r += ((kPatternCount - endPattern) + startPattern) * 2;
-               v     += ((kPatternCount - endPattern) + startPattern) * 4;
-
             }
         }
 
@@ -1297,6 +1293,145 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoodsByPa
     }
 }
 
+BEAGLE_CPU_4_SSE_TEMPLATE
+void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoodsDerivativesRange(
+                                                  const int parIndex,
+                                                  const int childIndex,
+                                                  const int probIndex,
+                                                  const int firstDerivativeIndex,
+                                                  const int secondDerivativeIndex,
+                                                  const int categoryWeightsIndex,
+                                                  const int stateFrequenciesIndex,
+                                                  const int scalingFactorsIndex,
+                                                  int startPattern,
+                                                  int endPattern,
+                                                  double* outSums) {
+
+    const double* cl_r = gPartials[parIndex];
+    const double* transMatrix = gTransitionMatrices[probIndex];
+    const double* firstDerivMatrix = (firstDerivativeIndex == BEAGLE_OP_NONE ?
+                                      transMatrix : gTransitionMatrices[firstDerivativeIndex]);
+    const double* secondDerivMatrix = (secondDerivativeIndex == BEAGLE_OP_NONE ?
+                                       transMatrix : gTransitionMatrices[secondDerivativeIndex]);
+    const double* wt = gCategoryWeights[categoryWeightsIndex];
+    const double* freqs = gStateFrequencies[stateFrequenciesIndex];
+    const int* statesChild = (childIndex < kTipCount ? gTipStates[childIndex] : NULL);
+    const double* cl_q = gPartials[childIndex];
+    const double* scalingFactors = (scalingFactorsIndex == BEAGLE_OP_NONE ?
+                                    NULL : gScaleBuffers[scalingFactorsIndex]);
+
+    // Both lanes of each site sum are added together once all categories are done
+    V_Real vSiteL[BEAGLE_CPU_EDGE_CHUNK_PATTERN_COUNT];
+    V_Real vSiteD1[BEAGLE_CPU_EDGE_CHUNK_PATTERN_COUNT];
+    V_Real vSiteD2[BEAGLE_CPU_EDGE_CHUNK_PATTERN_COUNT];
+
+    double sumLogLikelihood = 0.0;
+    double sumFirstDerivative = 0.0;
+    double sumSecondDerivative = 0.0;
+
+    for (int chunkStart = startPattern; chunkStart < endPattern; chunkStart += BEAGLE_CPU_EDGE_CHUNK_PATTERN_COUNT) {
+        const int chunkEnd = std::min(chunkStart + BEAGLE_CPU_EDGE_CHUNK_PATTERN_COUNT, endPattern);
+
+        for (int k = 0; k < chunkEnd - chunkStart; k++) {
+            vSiteL[k] = VEC_SETZERO();
+            vSiteD1[k] = VEC_SETZERO();
+            vSiteD2[k] = VEC_SETZERO();
+        }
+
+        int w = 0;
+        for (int l = 0; l < kCategoryCount; l++) {
+            const V_Real vwt = VEC_SPLAT(wt[l]);
+            const V_Real vfw_01 = VEC_MULT(_mm_loadu_pd(freqs), vwt);
+            const V_Real vfw_23 = VEC_MULT(_mm_loadu_pd(freqs + 2), vwt);
+
+            VecUnion vu_m[OFFSET][2], vu_d1[OFFSET][2], vu_d2[OFFSET][2];
+            { SSE_PREFETCH_MATRIX(transMatrix + w, vu_m) }
+            { SSE_PREFETCH_MATRIX(firstDerivMatrix + w, vu_d1) }
+            { SSE_PREFETCH_MATRIX(secondDerivMatrix + w, vu_d2) }
+
+            int v = l*kPartialsCategoryStride + chunkStart*kPartialsPatternStride;
+
+            for (int k = 0; k < chunkEnd - chunkStart; k++) {
+                const V_Real* vcl_r = (const V_Real*)(cl_r + v);
+                const V_Real vr_01 = VEC_MULT(vcl_r[0], vfw_01);
+                const V_Real vr_23 = VEC_MULT(vcl_r[1], vfw_23);
+
+                V_Real vp_01, vp_23, vd1_01, vd1_23, vd2_01, vd2_23;
+
+                if (statesChild != NULL) { // Integrate against a state at the child
+                    const int stateChild = statesChild[chunkStart + k];
+                    vp_01 = vu_m[stateChild][0].vx;
+                    vp_23 = vu_m[stateChild][1].vx;
+                    vd1_01 = vu_d1[stateChild][0].vx;
+                    vd1_23 = vu_d1[stateChild][1].vx;
+                    vd2_01 = vu_d2[stateChild][0].vx;
+                    vd2_23 = vu_d2[stateChild][1].vx;
+                } else { // Integrate against a partial at the child
+                    V_Real vcl_q0, vcl_q1, vcl_q2, vcl_q3;
+                    SSE_PREFETCH_PARTIALS(vcl_q,cl_q,v);
+
+                    vp_01 = VEC_MULT(vcl_q0, vu_m[0][0].vx);
+                    vp_01 = VEC_MADD(vcl_q1, vu_m[1][0].vx, vp_01);
+                    vp_01 = VEC_MADD(vcl_q2, vu_m[2][0].vx, vp_01);
+                    vp_01 = VEC_MADD(vcl_q3, vu_m[3][0].vx, vp_01);
+                    vp_23 = VEC_MULT(vcl_q0, vu_m[0][1].vx);
+                    vp_23 = VEC_MADD(vcl_q1, vu_m[1][1].vx, vp_23);
+                    vp_23 = VEC_MADD(vcl_q2, vu_m[2][1].vx, vp_23);
+                    vp_23 = VEC_MADD(vcl_q3, vu_m[3][1].vx, vp_23);
+
+                    vd1_01 = VEC_MULT(vcl_q0, vu_d1[0][0].vx);
+                    vd1_01 = VEC_MADD(vcl_q1, vu_d1[1][0].vx, vd1_01);
+                    vd1_01 = VEC_MADD(vcl_q2, vu_d1[2][0].vx, vd1_01);
+                    vd1_01 = VEC_MADD(vcl_q3, vu_d1[3][0].vx, vd1_01);
+                    vd1_23 = VEC_MULT(vcl_q0, vu_d1[0][1].vx);
+                    vd1_23 = VEC_MADD(vcl_q1, vu_d1[1][1].vx, vd1_23);
+                    vd1_23 = VEC_MADD(vcl_q2, vu_d1[2][1].vx, vd1_23);
+                    vd1_23 = VEC_MADD(vcl_q3, vu_d1[3][1].vx, vd1_23);
+
+                    vd2_01 = VEC_MULT(vcl_q0, vu_d2[0][0].vx);
+                    vd2_01 = VEC_MADD(vcl_q1, vu_d2[1][0].vx, vd2_01);
+                    vd2_01 = VEC_MADD(vcl_q2, vu_d2[2][0].vx, vd2_01);
+                    vd2_01 = VEC_MADD(vcl_q3, vu_d2[3][0].vx, vd2_01);
+                    vd2_23 = VEC_MULT(vcl_q0, vu_d2[0][1].vx);
+                    vd2_23 = VEC_MADD(vcl_q1, vu_d2[1][1].vx, vd2_23);
+                    vd2_23 = VEC_MADD(vcl_q2, vu_d2[2][1].vx, vd2_23);
+                    vd2_23 = VEC_MADD(vcl_q3, vu_d2[3][1].vx, vd2_23);
+                }
+
+                vSiteL[k] = VEC_MADD(vp_01, vr_01, vSiteL[k]);
+                vSiteL[k] = VEC_MADD(vp_23, vr_23, vSiteL[k]);
+                vSiteD1[k] = VEC_MADD(vd1_01, vr_01, vSiteD1[k]);
+                vSiteD1[k] = VEC_MADD(vd1_23, vr_23, vSiteD1[k]);
+                vSiteD2[k] = VEC_MADD(vd2_01, vr_01, vSiteD2[k]);
+                vSiteD2[k] = VEC_MADD(vd2_23, vr_23, vSiteD2[k]);
+
+                v += kPartialsPatternStride;
+            }
+            w += 4*OFFSET;
+        }
+
+        for (int k = chunkStart; k < chunkEnd; k++) {
+            VecUnion vuL, vuD1, vuD2;
+            vuL.vx = vSiteL[k - chunkStart];
+            vuD1.vx = vSiteD1[k - chunkStart];
+            vuD2.vx = vSiteD2[k - chunkStart];
+
+            const double likelihood = vuL.x[0] + vuL.x[1];
+            double logLikelihood = log(likelihood);
+            if (scalingFactors != NULL)
+                logLikelihood += scalingFactors[k];
+            const double firstDerivative = (vuD1.x[0] + vuD1.x[1]) / likelihood;
+            sumLogLikelihood += logLikelihood * gPatternWeights[k];
+            sumFirstDerivative += firstDerivative * gPatternWeights[k];
+            sumSecondDerivative += ((vuD2.x[0] + vuD2.x[1]) / likelihood - firstDerivative * firstDerivative) * gPatternWeights[k];
+        }
+    }
+
+    outSums[0] = sumLogLikelihood;
+    outSums[1] = sumFirstDerivative;
+    outSums[2] = sumSecondDerivative;
+}
+
 BEAGLE_CPU_4_SSE_TEMPLATE
 int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::getPaddedPatternsModulus() {
 	return 1;  // We currently do not vectorize across patterns
@@ -1401,7 +1536,7 @@ template <>
 const long BeagleCPU4StateSSEImplFactory<double>::getFlags() {
     return BEAGLE_FLAG_COMPUTATION_SYNCH |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+           BEAGLE_CPU_THREADING_FLAGS |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_SSE |
            BEAGLE_FLAG_PRECISION_DOUBLE |
@@ -1416,7 +1551,7 @@ template <>
 const long BeagleCPU4StateSSEImplFactory<float>::getFlags() {
     return BEAGLE_FLAG_COMPUTATION_SYNCH |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+           BEAGLE_CPU_THREADING_FLAGS |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_SSE |
            BEAGLE_FLAG_PRECISION_SINGLE |
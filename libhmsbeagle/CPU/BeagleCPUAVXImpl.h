@@ -56,6 +56,9 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::gTransitionMatrices;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kPatternCount;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kPaddedPatternCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kPartialsLayout;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kPartialsPatternStride;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kPartialsCategoryStride;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kExtraPatterns;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kStateCount;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::gTipStates;
@@ -130,6 +133,9 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::gTransitionMatrices;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::kPatternCount;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::kPaddedPatternCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::kPartialsLayout;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::kPartialsPatternStride;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::kPartialsCategoryStride;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::kExtraPatterns;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::kStateCount;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::gTipStates;
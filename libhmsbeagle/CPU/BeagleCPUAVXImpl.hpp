@@ -223,10 +223,9 @@ void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcPartialsPartials(double* __res
     };
 
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-    	double* destPu = destP + l*kPartialsPaddedStateCount*kPatternCount;
-    	int v = l*kPartialsPaddedStateCount*kPatternCount;
+    	double* destPu = destP + l*kPartialsCategoryStride;
+    	int v = l*kPartialsCategoryStride;
         for (int k = 0; k < kPatternCount; k++) {
             int w = l * kMatrixSize;
             for (int i = 0; i < kStateCount; ++i) {
@@ -270,8 +269,8 @@ void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcPartialsPartials(double* __res
                 destPu++;
 //                fprintf(stderr,"clear\n");
             }
-            destPu += P_PAD;
-            v += kPartialsPaddedStateCount;
+            destPu += P_PAD + kPartialsPatternStride - kPartialsPaddedStateCount;
+            v += kPartialsPatternStride;
         }
     }
 }
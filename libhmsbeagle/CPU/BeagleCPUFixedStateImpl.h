@@ -0,0 +1,166 @@
+/*
+ *  BeagleCPUFixedStateImpl.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#ifndef __BeagleCPUFixedStateImpl__
+#define __BeagleCPUFixedStateImpl__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include "libhmsbeagle/CPU/BeagleCPUImpl.h"
+
+#define BEAGLE_CPU_FIXED_GENERIC    REALTYPE, T_PAD, P_PAD, STATE_COUNT
+#define BEAGLE_CPU_FIXED_TEMPLATE   template <typename REALTYPE, int T_PAD, int P_PAD, int STATE_COUNT>
+
+#define BEAGLE_CPU_FIXED_BLOCK_PATTERN_COUNT    8  // patterns per register block; one child's sums are live at a time
+
+// fully unroll register-block loops so the sums stay in registers at any optimisation level
+#if defined(__clang__)
+#define BEAGLE_CPU_FIXED_UNROLL     _Pragma("unroll")
+#elif defined(__GNUC__)
+#define BEAGLE_CPU_FIXED_UNROLL     _Pragma("GCC unroll 16")
+#else
+#define BEAGLE_CPU_FIXED_UNROLL
+#endif
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * Post-order partials kernels for a state count fixed at compile time (16, 20, 61 and 64 states
+ * are instantiated by BeagleCPUFixedStateImplFactory), so that state loops have constant trip
+ * counts and register blocks span whole rows. Everything else is inherited from BeagleCPUImpl.
+ * Setting the environment variable BEAGLE_CPU_FIXED_STATES to 0 disables the factory.
+ */
+BEAGLE_CPU_FIXED_TEMPLATE
+class BeagleCPUFixedStateImpl : public BeagleCPUImpl<BEAGLE_CPU_GENERIC> {
+
+protected:
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kCategoryCount;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kMatrixSize;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kPartialsPatternStride;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kPartialsCategoryStride;
+
+    // destination states rounded up to whole register blocks
+    static const int kFixedPaddedStateCount = ((STATE_COUNT + BEAGLE_CPU_BLOCK_STATE_COUNT - 1) /
+                                               BEAGLE_CPU_BLOCK_STATE_COUNT) * BEAGLE_CPU_BLOCK_STATE_COUNT;
+
+public:
+    virtual ~BeagleCPUFixedStateImpl();
+
+    virtual const char* getName();
+
+    virtual void calcStatesPartials(REALTYPE* destP,
+                                    const int* states1,
+                                    const REALTYPE* matrices1,
+                                    const REALTYPE* partials2,
+                                    const REALTYPE* matrices2,
+                                    int startPattern,
+                                    int endPattern);
+
+    virtual void calcStatesPartialsFixedScaling(REALTYPE* destP,
+                                                const int* states1,
+                                                const REALTYPE* matrices1,
+                                                const REALTYPE* partials2,
+                                                const REALTYPE* matrices2,
+                                                const REALTYPE* scaleFactors,
+                                                int startPattern,
+                                                int endPattern);
+
+    virtual void calcPartialsPartials(REALTYPE* destP,
+                                      const REALTYPE* partials1,
+                                      const REALTYPE* matrices1,
+                                      const REALTYPE* partials2,
+                                      const REALTYPE* matrices2,
+                                      int startPattern,
+                                      int endPattern);
+
+    virtual void calcPartialsPartialsFixedScaling(REALTYPE* destP,
+                                                  const REALTYPE* partials1,
+                                                  const REALTYPE* matrices1,
+                                                  const REALTYPE* partials2,
+                                                  const REALTYPE* matrices2,
+                                                  const REALTYPE* scaleFactors,
+                                                  int startPattern,
+                                                  int endPattern);
+
+private:
+
+    // states1 selects the child given as tip states; partials1 is then unused
+    template <bool STATES1>
+    void calcFixedPartials(REALTYPE* destP,
+                           const int* states1,
+                           const REALTYPE* partials1,
+                           const REALTYPE* matrices1,
+                           const REALTYPE* partials2,
+                           const REALTYPE* matrices2,
+                           const REALTYPE* scaleFactors,
+                           int startPattern,
+                           int endPattern);
+
+    template <bool STATES1, int BLOCK_PATTERNS>
+    void calcFixedPartialsBlock(REALTYPE* destP,
+                                const int* states1,
+                                const REALTYPE* partials1,
+                                const REALTYPE* matrix1T,
+                                const REALTYPE* partials2,
+                                const REALTYPE* matrix2T,
+                                const REALTYPE* scaleFactors);
+};
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+class BeagleCPUFixedStateImplFactory : public BeagleImplFactory {
+public:
+    virtual BeagleImpl* createImpl(int tipCount,
+                                   int partialsBufferCount,
+                                   int compactBufferCount,
+                                   int stateCount,
+                                   int patternCount,
+                                   int eigenBufferCount,
+                                   int matrixBufferCount,
+                                   int categoryCount,
+                                   int scaleBufferCount,
+                                   int resourceNumber,
+                                   int pluginResourceNumber,
+                                   long preferenceFlags,
+                                   long requirementFlags,
+                                   int* errorCode);
+
+    virtual const char* getName();
+    virtual const long getFlags();
+
+private:
+    template <int STATE_COUNT>
+    BeagleImpl* createFixedStateImpl(int tipCount,
+                                     int partialsBufferCount,
+                                     int compactBufferCount,
+                                     int patternCount,
+                                     int eigenBufferCount,
+                                     int matrixBufferCount,
+                                     int categoryCount,
+                                     int scaleBufferCount,
+                                     int resourceNumber,
+                                     int pluginResourceNumber,
+                                     long preferenceFlags,
+                                     long requirementFlags,
+                                     int* errorCode);
+};
+
+}	// namespace cpu
+}	// namespace beagle
+
+// now include the file containing template function implementations
+#include "libhmsbeagle/CPU/BeagleCPUFixedStateImpl.hpp"
+
+#endif // __BeagleCPUFixedStateImpl__
@@ -0,0 +1,373 @@
+/*
+ *  BeagleCPUFixedStateImpl.hpp
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#ifndef BEAGLE_CPU_FIXED_STATE_IMPL_HPP
+#define BEAGLE_CPU_FIXED_STATE_IMPL_HPP
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "libhmsbeagle/beagle.h"
+#include "libhmsbeagle/CPU/BeagleCPUImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUFixedStateImpl.h"
+
+namespace beagle {
+namespace cpu {
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+inline const char* getBeagleCPUFixedStateName(){ return "CPU-FixedState-Unknown"; };
+
+template<>
+inline const char* getBeagleCPUFixedStateName<double>(){ return "CPU-FixedState-Double"; };
+
+template<>
+inline const char* getBeagleCPUFixedStateName<float>(){ return "CPU-FixedState-Single"; };
+
+BEAGLE_CPU_FIXED_TEMPLATE
+BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::~BeagleCPUFixedStateImpl() {
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+const char* BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::getName() {
+    return getBeagleCPUFixedStateName<REALTYPE>();
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcStatesPartials(REALTYPE* destP,
+                                                                           const int* states1,
+                                                                           const REALTYPE* matrices1,
+                                                                           const REALTYPE* partials2,
+                                                                           const REALTYPE* matrices2,
+                                                                           int startPattern,
+                                                                           int endPattern) {
+    calcFixedPartials<true>(destP, states1, NULL, matrices1, partials2, matrices2, NULL,
+                            startPattern, endPattern);
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcStatesPartialsFixedScaling(REALTYPE* destP,
+                                                                                       const int* states1,
+                                                                                       const REALTYPE* matrices1,
+                                                                                       const REALTYPE* partials2,
+                                                                                       const REALTYPE* matrices2,
+                                                                                       const REALTYPE* scaleFactors,
+                                                                                       int startPattern,
+                                                                                       int endPattern) {
+    calcFixedPartials<true>(destP, states1, NULL, matrices1, partials2, matrices2, scaleFactors,
+                            startPattern, endPattern);
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcPartialsPartials(REALTYPE* destP,
+                                                                             const REALTYPE* partials1,
+                                                                             const REALTYPE* matrices1,
+                                                                             const REALTYPE* partials2,
+                                                                             const REALTYPE* matrices2,
+                                                                             int startPattern,
+                                                                             int endPattern) {
+    calcFixedPartials<false>(destP, NULL, partials1, matrices1, partials2, matrices2, NULL,
+                             startPattern, endPattern);
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcPartialsPartialsFixedScaling(REALTYPE* destP,
+                                                                                         const REALTYPE* partials1,
+                                                                                         const REALTYPE* matrices1,
+                                                                                         const REALTYPE* partials2,
+                                                                                         const REALTYPE* matrices2,
+                                                                                         const REALTYPE* scaleFactors,
+                                                                                         int startPattern,
+                                                                                         int endPattern) {
+    calcFixedPartials<false>(destP, NULL, partials1, matrices1, partials2, matrices2, scaleFactors,
+                             startPattern, endPattern);
+}
+
+/*
+ * Same scheme as BeagleCPUImpl::calcPartialsPartialsBlocked, with the transposed matrices on the
+ * stack. A tip-state child reads its row of the transposed matrix directly; the extra row
+ * STATE_COUNT holds ones for missing states.
+ */
+BEAGLE_CPU_FIXED_TEMPLATE
+template <bool STATES1>
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcFixedPartials(REALTYPE* destP,
+                                                                          const int* states1,
+                                                                          const REALTYPE* partials1,
+                                                                          const REALTYPE* matrices1,
+                                                                          const REALTYPE* partials2,
+                                                                          const REALTYPE* matrices2,
+                                                                          const REALTYPE* scaleFactors,
+                                                                          int startPattern,
+                                                                          int endPattern) {
+    const int matrixIncr = STATE_COUNT + T_PAD;
+    const int paddedStateCount = kFixedPaddedStateCount;
+
+    REALTYPE matrix1T[(STATE_COUNT + 1) * paddedStateCount];
+    REALTYPE matrix2T[STATE_COUNT * paddedStateCount];
+
+    for (int j = 0; j < STATE_COUNT; j++) {
+        for (int i = STATE_COUNT; i < paddedStateCount; i++) {
+            matrix1T[j*paddedStateCount + i] = 0.0;
+            matrix2T[j*paddedStateCount + i] = 0.0;
+        }
+    }
+    for (int i = 0; i < paddedStateCount; i++)
+        matrix1T[STATE_COUNT*paddedStateCount + i] = (i < STATE_COUNT ? 1.0 : 0.0);
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        const REALTYPE* matrix1 = matrices1 + l*kMatrixSize;
+        const REALTYPE* matrix2 = matrices2 + l*kMatrixSize;
+        for (int i = 0; i < STATE_COUNT; i++) {
+            for (int j = 0; j < STATE_COUNT; j++) {
+                matrix1T[j*paddedStateCount + i] = matrix1[i*matrixIncr + j];
+                matrix2T[j*paddedStateCount + i] = matrix2[i*matrixIncr + j];
+            }
+        }
+
+        const int v = l*kPartialsCategoryStride;
+        int k = startPattern;
+        for (; k + BEAGLE_CPU_FIXED_BLOCK_PATTERN_COUNT <= endPattern; k += BEAGLE_CPU_FIXED_BLOCK_PATTERN_COUNT) {
+            const int u = v + k*kPartialsPatternStride;
+            calcFixedPartialsBlock<STATES1, BEAGLE_CPU_FIXED_BLOCK_PATTERN_COUNT>(&destP[u],
+                                                                            (STATES1 ? &states1[k] : NULL),
+                                                                            (STATES1 ? NULL : &partials1[u]),
+                                                                            matrix1T, &partials2[u], matrix2T,
+                                                                            (scaleFactors == NULL ? NULL : &scaleFactors[k]));
+        }
+        for (; k < endPattern; k++) {
+            const int u = v + k*kPartialsPatternStride;
+            calcFixedPartialsBlock<STATES1, 1>(&destP[u],
+                                               (STATES1 ? &states1[k] : NULL),
+                                               (STATES1 ? NULL : &partials1[u]),
+                                               matrix1T, &partials2[u], matrix2T,
+                                               (scaleFactors == NULL ? NULL : &scaleFactors[k]));
+        }
+    }
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+template <bool STATES1, int BLOCK_PATTERNS>
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcFixedPartialsBlock(REALTYPE* destP,
+                                                                               const int* states1,
+                                                                               const REALTYPE* partials1,
+                                                                               const REALTYPE* matrix1T,
+                                                                               const REALTYPE* partials2,
+                                                                               const REALTYPE* matrix2T,
+                                                                               const REALTYPE* scaleFactors) {
+    const int BLOCK_STATES = BEAGLE_CPU_BLOCK_STATE_COUNT;
+    const int paddedStateCount = kFixedPaddedStateCount;
+
+    REALTYPE oneOverScaleFactors[BLOCK_PATTERNS];
+    BEAGLE_CPU_FIXED_UNROLL
+    for (int r = 0; r < BLOCK_PATTERNS; r++)
+        oneOverScaleFactors[r] = (scaleFactors == NULL ? REALTYPE(1.0) : REALTYPE(1.0) / scaleFactors[r]);
+
+    for (int i = 0; i < paddedStateCount; i += BLOCK_STATES) {
+        const int width = (STATE_COUNT - i < BLOCK_STATES ? STATE_COUNT - i : BLOCK_STATES);
+
+        // first child into the destination, so only one set of sums is live at a time
+        if (STATES1) {
+            BEAGLE_CPU_FIXED_UNROLL
+            for (int r = 0; r < BLOCK_PATTERNS; r++) {
+                const REALTYPE* m1 = &matrix1T[states1[r]*paddedStateCount + i];
+                REALTYPE* destPtr = &destP[r*kPartialsPatternStride + i];
+                #pragma omp simd
+                for (int c = 0; c < width; c++)
+                    destPtr[c] = m1[c] * oneOverScaleFactors[r];
+            }
+        } else {
+            REALTYPE sums[BLOCK_PATTERNS][BLOCK_STATES];
+            BEAGLE_CPU_FIXED_UNROLL
+            for (int r = 0; r < BLOCK_PATTERNS; r++)
+                #pragma omp simd
+                for (int c = 0; c < BLOCK_STATES; c++)
+                    sums[r][c] = 0.0;
+
+            for (int j = 0; j < STATE_COUNT; j++) {
+                const REALTYPE* m1 = &matrix1T[j*paddedStateCount + i];
+                BEAGLE_CPU_FIXED_UNROLL
+                for (int r = 0; r < BLOCK_PATTERNS; r++) {
+                    const REALTYPE p1 = partials1[r*kPartialsPatternStride + j];
+                    #pragma omp simd
+                    for (int c = 0; c < BLOCK_STATES; c++)
+                        sums[r][c] += m1[c] * p1;
+                }
+            }
+
+            BEAGLE_CPU_FIXED_UNROLL
+
+            for (int r = 0; r < BLOCK_PATTERNS; r++) {
+                REALTYPE* destPtr = &destP[r*kPartialsPatternStride + i];
+                #pragma omp simd
+                for (int c = 0; c < width; c++)
+                    destPtr[c] = sums[r][c] * oneOverScaleFactors[r];
+            }
+        }
+
+        REALTYPE sums[BLOCK_PATTERNS][BLOCK_STATES];
+        BEAGLE_CPU_FIXED_UNROLL
+        for (int r = 0; r < BLOCK_PATTERNS; r++)
+            #pragma omp simd
+            for (int c = 0; c < BLOCK_STATES; c++)
+                sums[r][c] = 0.0;
+
+        for (int j = 0; j < STATE_COUNT; j++) {
+            const REALTYPE* m2 = &matrix2T[j*paddedStateCount + i];
+            BEAGLE_CPU_FIXED_UNROLL
+            for (int r = 0; r < BLOCK_PATTERNS; r++) {
+                const REALTYPE p2 = partials2[r*kPartialsPatternStride + j];
+                #pragma omp simd
+                for (int c = 0; c < BLOCK_STATES; c++)
+                    sums[r][c] += m2[c] * p2;
+            }
+        }
+
+        BEAGLE_CPU_FIXED_UNROLL
+
+        for (int r = 0; r < BLOCK_PATTERNS; r++) {
+            REALTYPE* destPtr = &destP[r*kPartialsPatternStride + i];
+            #pragma omp simd
+            for (int c = 0; c < width; c++)
+                destPtr[c] *= sums[r][c];
+        }
+    }
+
+    if (P_PAD) {
+        BEAGLE_CPU_FIXED_UNROLL
+        for (int r = 0; r < BLOCK_PATTERNS; r++) {
+            for (int pad = STATE_COUNT; pad < STATE_COUNT + P_PAD; pad++)
+                destP[r*kPartialsPatternStride + pad] = 0.0;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// BeagleCPUFixedStateImplFactory public methods
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+BeagleImpl* BeagleCPUFixedStateImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(int tipCount,
+                                             int partialsBufferCount,
+                                             int compactBufferCount,
+                                             int stateCount,
+                                             int patternCount,
+                                             int eigenBufferCount,
+                                             int matrixBufferCount,
+                                             int categoryCount,
+                                             int scaleBufferCount,
+                                             int resourceNumber,
+                                             int pluginResourceNumber,
+                                             long preferenceFlags,
+                                             long requirementFlags,
+                                             int* errorCode) {
+
+    // BEAGLE_CPU_FIXED_STATES=0 leaves every state count to the generic kernels, for comparison
+    const char* fixedStates = getenv("BEAGLE_CPU_FIXED_STATES");
+    if (fixedStates != NULL && strcmp(fixedStates, "0") == 0)
+        return NULL;
+
+    switch (stateCount) {
+        case 16: return createFixedStateImpl<16>(tipCount, partialsBufferCount, compactBufferCount, patternCount,
+                                                 eigenBufferCount, matrixBufferCount, categoryCount, scaleBufferCount,
+                                                 resourceNumber, pluginResourceNumber, preferenceFlags,
+                                                 requirementFlags, errorCode);
+        case 20: return createFixedStateImpl<20>(tipCount, partialsBufferCount, compactBufferCount, patternCount,
+                                                 eigenBufferCount, matrixBufferCount, categoryCount, scaleBufferCount,
+                                                 resourceNumber, pluginResourceNumber, preferenceFlags,
+                                                 requirementFlags, errorCode);
+        case 61: return createFixedStateImpl<61>(tipCount, partialsBufferCount, compactBufferCount, patternCount,
+                                                 eigenBufferCount, matrixBufferCount, categoryCount, scaleBufferCount,
+                                                 resourceNumber, pluginResourceNumber, preferenceFlags,
+                                                 requirementFlags, errorCode);
+        case 64: return createFixedStateImpl<64>(tipCount, partialsBufferCount, compactBufferCount, patternCount,
+                                                 eigenBufferCount, matrixBufferCount, categoryCount, scaleBufferCount,
+                                                 resourceNumber, pluginResourceNumber, preferenceFlags,
+                                                 requirementFlags, errorCode);
+        default: return NULL;
+    }
+}
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+template <int STATE_COUNT>
+BeagleImpl* BeagleCPUFixedStateImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createFixedStateImpl(int tipCount,
+                                             int partialsBufferCount,
+                                             int compactBufferCount,
+                                             int patternCount,
+                                             int eigenBufferCount,
+                                             int matrixBufferCount,
+                                             int categoryCount,
+                                             int scaleBufferCount,
+                                             int resourceNumber,
+                                             int pluginResourceNumber,
+                                             long preferenceFlags,
+                                             long requirementFlags,
+                                             int* errorCode) {
+
+    BeagleImpl* impl = new BeagleCPUFixedStateImpl<REALTYPE, T_PAD_DEFAULT, P_PAD_DEFAULT, STATE_COUNT>();
+
+    try {
+        *errorCode =
+            impl->createInstance(tipCount, partialsBufferCount, compactBufferCount, STATE_COUNT,
+                                 patternCount, eigenBufferCount, matrixBufferCount,
+                                 categoryCount,scaleBufferCount, resourceNumber,
+                                 pluginResourceNumber,
+                                 preferenceFlags, requirementFlags);
+        if (*errorCode == BEAGLE_SUCCESS) {
+            return impl;
+        }
+        delete impl;
+        return NULL;
+    }
+    catch(...) {
+        if (DEBUGGING_OUTPUT)
+            std::cerr << "exception in initialize\n";
+        delete impl;
+        throw;
+    }
+
+    delete impl;
+
+    return NULL;
+}
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+const char* BeagleCPUFixedStateImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
+    return getBeagleCPUFixedStateName<BEAGLE_CPU_FACTORY_GENERIC>();
+}
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+const long BeagleCPUFixedStateImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getFlags() {
+    long flags = BEAGLE_FLAG_COMPUTATION_SYNCH |
+                 BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_DYNAMIC |
+                 BEAGLE_CPU_THREADING_FLAGS |
+                 BEAGLE_FLAG_PROCESSOR_CPU |
+                 BEAGLE_FLAG_VECTOR_NONE |
+                 BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
+                 BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL |
+                 BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
+                 BEAGLE_FLAG_PREORDER_TRANSPOSE_MANUAL | BEAGLE_FLAG_PREORDER_TRANSPOSE_AUTO |
+                 BEAGLE_FLAG_FRAMEWORK_CPU;
+    if (DOUBLE_PRECISION)
+        flags |= BEAGLE_FLAG_PRECISION_DOUBLE;
+    else
+        flags |= BEAGLE_FLAG_PRECISION_SINGLE;
+    return flags;
+}
+
+}	// namespace cpu
+}	// namespace beagle
+
+#endif // BEAGLE_CPU_FIXED_STATE_IMPL_HPP
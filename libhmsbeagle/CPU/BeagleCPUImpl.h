@@ -25,14 +25,22 @@
 #include "libhmsbeagle/BeagleImpl.h"
 #include "libhmsbeagle/CPU/Precision.h"
 #include "libhmsbeagle/CPU/EigenDecomposition.h"
+#include "libhmsbeagle/CPU/EigenDecompositionUniformization.h"
+#include "libhmsbeagle/CPU/InstanceState.h"
 
 #include <vector>
+#include <map>
 #include <thread>
 #include <future>
 #include <queue>
 #include <condition_variable>
 #include <mutex>
 #include <functional>
+#include <atomic>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #define BEAGLE_CPU_GENERIC	REALTYPE, T_PAD, P_PAD
 #define BEAGLE_CPU_TEMPLATE	template <typename REALTYPE, int T_PAD, int P_PAD>
@@ -40,6 +48,13 @@
 #define BEAGLE_CPU_FACTORY_GENERIC	REALTYPE
 #define BEAGLE_CPU_FACTORY_TEMPLATE	template <typename REALTYPE>
 
+// Threading modes supported by the CPU implementations; OpenMP only when built with it
+#ifdef _OPENMP
+#define BEAGLE_CPU_THREADING_FLAGS  (BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP | BEAGLE_FLAG_THREADING_OPENMP)
+#else
+#define BEAGLE_CPU_THREADING_FLAGS  (BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP)
+#endif
+
 #define T_PAD_DEFAULT   1   // Pad transition matrix rows with an extra 1.0 for ambiguous characters
 #define P_PAD_DEFAULT   0   // No partials padding necessary for non-SSE implementations
 
@@ -48,6 +63,30 @@
 #define BEAGLE_CPU_ASYNC_MIN_PATTERN_COUNT_LOW        256  // do not use CPU auto-threading for problems with fewer patterns on CPUs with many cores
 #define BEAGLE_CPU_ASYNC_MIN_PATTERN_COUNT_HIGH       768  // do not use CPU auto-threading for problems with fewer patterns on CPUs with few cores
 #define BEAGLE_CPU_ASYNC_LIMIT_PATTERN_COUNT       262144  // do not use all CPU cores for problems with fewer patterns
+#define BEAGLE_CPU_OPENMP_MIN_BLOCK_PATTERN_COUNT      64  // minimum number of patterns per OpenMP pattern block
+#define BEAGLE_CPU_OPENMP_BLOCK_ALIGNMENT               8  // align OpenMP pattern blocks so threads do not share cache lines
+#define BEAGLE_CPU_RESCALE_BLOCK_SIZE               65536  // bytes of destination partials computed and rescaled per block
+#define BEAGLE_CPU_EDGE_CHUNK_PATTERN_COUNT           256  // patterns of site likelihoods held on the stack per edge task
+#define BEAGLE_CPU_SCALE_BLOCK_PATTERN_COUNT         1024  // patterns of a cumulative scale buffer summed into per pass
+#define BEAGLE_CPU_SCALE_ASYNC_MIN_COUNT            65536  // do not thread scale factor sums over fewer buffer patterns
+#define BEAGLE_CPU_EPOCH_ASYNC_MIN_COUNT          1048576  // do not thread epoch matrix products over fewer multiply-adds
+#define BEAGLE_CPU_MATRIX_ASYNC_MIN_COUNT         1048576  // do not thread multi-model matrix updates over fewer multiply-adds
+#define BEAGLE_CPU_GRADIENT_BLOCK_PATTERN_COUNT       256  // patterns of an edge per gradient work item, summed in order
+#define BEAGLE_CPU_GRADIENT_ASYNC_MIN_COUNT        262144  // do not thread edge gradients over fewer multiply-adds
+#define BEAGLE_CPU_MISSING_MIN_RUN_LENGTH               8  // copy rather than compute runs of at least this many all-missing patterns
+#define BEAGLE_CPU_MISSING_TAG_LIMIT           0x80000000  // retag all-missing runs from scratch once this many tags are issued
+
+#define BEAGLE_CPU_EIGEN_CUBE_MAX_STATE_COUNT         128  // use square eigen buffers above this state count, cubes need O(n^3) memory
+#define BEAGLE_CPU_SPARSE_MIN_STATE_COUNT             100  // consider sparse transition matrices from this state count
+#define BEAGLE_CPU_SPARSE_MAX_FILL                   0.15  // keep a matrix sparse when at most this fraction of entries remains
+#define BEAGLE_CPU_SPARSE_THRESHOLD                 1E-15  // drop matrix entries of at most this magnitude from sparse matrices
+#define BEAGLE_CPU_BLOCKED_MIN_STATE_COUNT             16  // use the register-blocked partials kernel from this state count
+#define BEAGLE_CPU_BLOCK_PATTERN_COUNT                  4  // patterns per register block
+#if defined(__AVX512F__)
+#define BEAGLE_CPU_BLOCK_STATE_COUNT                   16  // destination states per register block
+#else
+#define BEAGLE_CPU_BLOCK_STATE_COUNT                    8
+#endif
 
 namespace beagle {
 namespace cpu {
@@ -63,10 +102,14 @@ protected:
     int kPatternCount; /// the number of data patterns in each partial and tipStates element
     int kPaddedPatternCount; /// the number of data patterns padded to be a multiple of 2 or 4
     int kExtraPatterns; /// kPaddedPatternCount - kPatternCount
+    int kRescaleBlockPatternCount; /// patterns computed and rescaled together in a rescaled update
     int kMatrixCount; /// the number of transition matrices to alloc and store
     int kStateCount; /// the number of states
     int kTransPaddedStateCount;
     int kPartialsPaddedStateCount;
+    int kPartialsLayout; /// one of BEAGLE_PARTIALS_LAYOUT_*
+    int kPartialsPatternStride; /// distance between consecutive patterns of a category in a partials buffer
+    int kPartialsCategoryStride; /// distance between consecutive categories of a pattern in a partials buffer
     int kEigenDecompCount; /// the number of eigen solutions to alloc and store
     int kCategoryCount;
     int kScaleBufferCount;
@@ -88,6 +131,7 @@ protected:
     int scalingExponentThreshold;
 
     EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>* gEigenDecomposition;
+    EigenDecompositionUniformization<BEAGLE_CPU_EIGEN_GENERIC>* gUniformization; // wraps gEigenDecomposition once used
 
     double** gCategoryRates; // Kept in double-precision until multiplication by edgelength
     double* gPatternWeights;
@@ -131,6 +175,45 @@ protected:
     REALTYPE* outSecondDerivativesTmp;
 
     REALTYPE* ones;
+
+    REALTYPE* gDynamicScaleTmp; // per-pattern maxima of blocks rescaled by dynamic scaling
+
+    REALTYPE* gEpochMatrices;   // segment matrices of the last epoch update, with derivatives
+    size_t kEpochMatricesSize;
+
+    // transposed, zero-padded matrices of the blocked partials kernel, one slot per pattern partition
+    // holding every category of both children; a retained slot is reused while its sources match
+    REALTYPE* gBlockedMatrices;
+    int kBlockedPaddedStateCount;
+    int kBlockedMatricesSlotCount;
+    std::vector<const REALTYPE*> gBlockedMatricesSources;  // [slot * 2 + child], NULL if not transposed
+    std::vector<int> gBlockedMatricesRetained;              // [slot], not bool: set by concurrent threads
+
+    // thresholded CSR copies of transition matrices with few non-negligible entries
+    bool kSparseMatricesEnabled;
+    int* gSparseMatrixStates;   // per matrix, one of the BEAGLE_CPU_SPARSE_* states below
+    int** gSparseRowOffsets;    // [category * (kStateCount + 1) + row] into the columns and values
+    int** gSparseColumns;
+    REALTYPE** gSparseValues;
+    int* gSparseCapacities;
+
+    enum { BEAGLE_CPU_SPARSE_UNKNOWN = 0, BEAGLE_CPU_SPARSE_DENSE, BEAGLE_CPU_SPARSE_SPARSE };
+
+    // per buffer and pattern, non-zero where the subtree below is entirely missing; patterns of a
+    // buffer with equal tags hold equal partials
+    unsigned int** gMissingTags;
+    std::atomic<unsigned int> kNextMissingTag;
+    enum { BEAGLE_CPU_MISSING_NONE = 0, BEAGLE_CPU_MISSING_TIP, BEAGLE_CPU_MISSING_FIRST_TAG };
+
+    // buffers holding the matrices computed for each eigen decomposition and edge length
+    struct MatrixMemoEntry {
+        int matrixIndices[3];   // probability, first and second derivative, -1 if not held
+    };
+    bool kMatrixMemoEnabled;
+    std::vector<std::map<double, MatrixMemoEntry> > gMatrixMemo;   // per eigen decomposition
+    std::vector<std::pair<int, double> > gMatrixMemoKeys;          // per matrix, the entry holding it, -1 if none
+    long kMatrixMemoHitCount;
+    long kMatrixMemoMissCount;
     REALTYPE* zeros;
 
     struct threadData
@@ -143,6 +226,7 @@ protected:
     };
 
     int kNumThreads;
+    int kOpenMPThreadCount;
     bool kThreadingEnabled;
     bool kAutoPartitioningEnabled;
     bool kAutoRootPartitioningEnabled;
@@ -178,6 +262,8 @@ public:
 
     int setCPUThreadCount(int threadCount);
 
+    int setPartialsLayout(int layout);
+
     // set the states for a given tip
     //
     // tipIndex the index of the tip
@@ -219,6 +305,10 @@ public:
                               const double* inInverseEigenVectors,
                               const double* inEigenValues);
 
+    // computes transition matrices for eigenIndex by uniformization of a rate matrix
+    int setUniformizationRateMatrix(int eigenIndex,
+                                    const double* inRateMatrix);
+
     int setStateFrequencies(int stateFrequenciesIndex,
                             const double* inStateFrequencies);
 
@@ -258,6 +348,15 @@ public:
                                    const int* resultIndices,
                                    int count);
 
+    int updateEpochTransitionMatrices(const int* segmentCounts,
+                                      const int* eigenIndices,
+                                      const int* categoryRateIndices,
+                                      const double* segmentLengths,
+                                      const int* probabilityIndices,
+                                      const int* firstDerivativeIndices,
+                                      const int* secondDerivativeIndices,
+                                      int count);
+
 	int addTransitionMatrices(const int* firstIndices,
 	                          const int* secondIndices,
 	                          const int* resultIndices,
@@ -280,6 +379,11 @@ public:
                                  const double* edgeLengths,
                                  int count);
 
+    int setTransitionMatrixMemo(bool enabled);
+
+    int getTransitionMatrixMemoCounts(long* outHitCount,
+                                      long* outMissCount);
+
     int updateTransitionMatricesWithModelCategories(int* eigenIndices,
                                  const int* probabilityIndices,
                                  const int* firstDerivativeIndices,
@@ -415,6 +519,19 @@ public:
                                                double* outSumSecondDerivativeByPartition,
                                                double* outSumSecondDerivative);
 
+    int calculateEdgeLogLikelihoodsPerEdge(const int* parentBufferIndices,
+                                           const int* childBufferIndices,
+                                           const int* probabilityIndices,
+                                           const int* firstDerivativeIndices,
+                                           const int* secondDerivativeIndices,
+                                           const int* categoryWeightsIndices,
+                                           const int* stateFrequenciesIndices,
+                                           const int* cumulativeScaleIndices,
+                                           int count,
+                                           double* outLogLikelihoods,
+                                           double* outFirstDerivatives,
+                                           double* outSecondDerivatives);
+
     int calculateEdgeDerivatives(const int *postBufferIndices,
                                  const int *preBufferIndices,
                                  const int *derivativeMatrixIndices,
@@ -435,6 +552,30 @@ public:
                                double *outSumDerivatives,
                                double *outSumSquaredDerivatives);
 
+    int calculateEdgeGradients(const int* postorderOperations,
+                               int postorderCount,
+                               const int* preorderOperations,
+                               int preorderCount,
+                               const int* postBufferIndices,
+                               const int* preBufferIndices,
+                               const int* differentialMatrixIndices,
+                               const int* secondDifferentialMatrixIndices,
+                               const int* categoryWeightsIndices,
+                               const int* categoryRatesIndices,
+                               int count,
+                               double* outGradient,
+                               double* outDiagonalHessian);
+
+    int calculateParameterGradients(const int* postBufferIndices,
+                                    const int* preBufferIndices,
+                                    const int* categoryRatesIndices,
+                                    const int* categoryWeightsIndices,
+                                    const double* edgeLengths,
+                                    int count,
+                                    const int* differentialMatrixIndices,
+                                    int parameterCount,
+                                    double* outGradients);
+
     int getLogLikelihood(double* outSumLogLikelihood);
 
     int getDerivatives(double* outSumFirstDerivative,
@@ -445,6 +586,10 @@ public:
     int getSiteDerivatives(double* outFirstDerivatives,
                            double* outSecondDerivatives);
 
+    int saveState(const char* fileName);
+
+    int restoreState(const char* fileName);
+
     int block(void);
 
 	virtual const char* getName();
@@ -457,6 +602,112 @@ protected:
                            int operationCount,
                            int cumulativeScalingIndex);
 
+    void fillStateHeader(InstanceStateHeader* header);
+
+    // blocks a subclass appends to the state file after those of this class
+    virtual bool writeExtendedState(FILE* file);
+
+    virtual bool readExtendedState(FILE* file);
+
+    // multiplies the segment matrices of branches [startBranch, endBranch) of an epoch update
+    void epochProductsRange(const int* segmentOffsets,
+                            const double* segmentLengths,
+                            const int* probabilityIndices,
+                            const int* firstDerivativeIndices,
+                            const int* secondDerivativeIndices,
+                            int startBranch,
+                            int endBranch);
+
+    // C (+)= scale * A * B for one category of padded transition matrices
+    void multiplyPaddedMatrices(const REALTYPE* A,
+                                const REALTYPE* B,
+                                REALTYPE scale,
+                                REALTYPE* C,
+                                bool accumulate);
+
+    // updateTransitionMatrices through the memo of eigen decomposition eigenIndex
+    int updateTransitionMatricesWithMemo(int eigenIndex,
+                                         const int* probabilityIndices,
+                                         const int* firstDerivativeIndices,
+                                         const int* secondDerivativeIndices,
+                                         const double* edgeLengths,
+                                         int count);
+
+    // computes the partials of one operation for patterns [startPattern, endPattern)
+    void upPartialsRange(REALTYPE* destPartials,
+                         const int* tipStates1,
+                         const REALTYPE* partials1,
+                         const REALTYPE* matrices1,
+                         int child1TransMatIndex,
+                         const int* tipStates2,
+                         const REALTYPE* partials2,
+                         const REALTYPE* matrices2,
+                         int child2TransMatIndex,
+                         int rescale,
+                         REALTYPE* scalingFactors,
+                         REALTYPE* cumulativeScaleBuffer,
+                         int parIndex,
+                         int readScalingIndex,
+                         bool sparse,
+                         int startPattern,
+                         int endPattern);
+
+    // copies the partials and scale factor of pattern sourcePattern to [startPattern, endPattern)
+    void copyMissingPatterns(REALTYPE* destPartials,
+                             REALTYPE* scaleFactors,
+                             REALTYPE* cumulativeScaleFactors,
+                             int sourcePattern,
+                             int startPattern,
+                             int endPattern);
+
+    // retags a buffer from its tip states or partials, or clears the tags of an internal buffer
+    void resetMissingTags(int bufferIndex);
+
+    // clears internal buffer tags before the tag counter can wrap around
+    void recycleMissingTags();
+
+    // drops the memo entry holding a matrix, if any
+    void dropMatrixMemoEntry(int matrixIndex);
+
+    // drops the memo entries of an eigen decomposition, or all entries for -1
+    void clearMatrixMemo(int eigenIndex);
+
+    // marks matrices as changed: they are re-examined for sparsity before their next use and
+    // dropped from the transition matrix memo
+    void invalidateMatrices(const int* matrixIndices,
+                            int count);
+
+    // builds sparse copies of the matrices used by partials children of operations
+    void prepareSparseMatrices(const int* operations,
+                               int count,
+                               bool byPartition);
+
+    void analyzeSparseMatrix(int matrixIndex);
+
+    // children given as states (statesN != NULL) use the dense matrix, partials the sparse one
+    void calcSparseMatrixPartials(REALTYPE* destP,
+                                  const int* offsets,
+                                  const int* columns,
+                                  const REALTYPE* values,
+                                  const REALTYPE* partials,
+                                  int category,
+                                  bool accumulate,
+                                  int startPattern,
+                                  int endPattern);
+
+    void calcPartialsSparse(REALTYPE* destP,
+                            const int* states1,
+                            const REALTYPE* partials1,
+                            const REALTYPE* matrices1,
+                            int matrixIndex1,
+                            const int* states2,
+                            const REALTYPE* partials2,
+                            const REALTYPE* matrices2,
+                            int matrixIndex2,
+                            const REALTYPE* scaleFactors,
+                            int startPattern,
+                            int endPattern);
+
     virtual int upPrePartials(bool byPartition,
                               const int* operations,
                               int count,
@@ -483,7 +734,9 @@ protected:
 //                                              const REALTYPE *cumulativeScaleBuffer,
                                               double *siteLogLikelihoods,
                                               double *outLogFirstDerivatives,
-                                              double *outLogDiagonalSecondDerivatives);
+                                              double *outLogDiagonalSecondDerivatives,
+                                              int startPattern,
+                                              int endPattern);
 
     virtual void calcEdgeLogDerivativesPartials(const REALTYPE *postOrderPartial,
                                                 const REALTYPE *preOrderPartial,
@@ -495,7 +748,9 @@ protected:
 //                                                const REALTYPE *cumulativeScaleBuffer,
                                                 double *siteLogLikelihoods,
                                                 double *outLogFirstDerivatives,
-                                                double *outLogDiagonalSecondDerivatives);
+                                                double *outLogDiagonalSecondDerivatives,
+                                                int startPattern,
+                                                int endPattern);
 
     virtual int calcCrossProducts(const int *postBufferIndices,
                                   const int *preBufferIndices,
@@ -512,7 +767,9 @@ protected:
                                          const REALTYPE *categoryWeights,
                                          const double edgeLength,
                                          double *outCrossProducts,
-                                         double *outSumSquaredDerivatives);
+                                         double *outSumSquaredDerivatives,
+                                         int startPattern,
+                                         int endPattern);
 
     virtual void calcCrossProductsPartials(const REALTYPE *postOrderPartial,
                                            const REALTYPE *preOrderPartial,
@@ -520,7 +777,9 @@ protected:
                                            const REALTYPE *categoryWeights,
                                            const double edgeLength,
                                            double *outCrossProducts,
-                                           double *outSumSquaredDerivatives);
+                                           double *outSumSquaredDerivatives,
+                                           int startPattern,
+                                           int endPattern);
 
     virtual void resetDerivativeTemporaries();
 
@@ -536,6 +795,66 @@ protected:
     virtual int upPartialsByPartitionAsync(const int* operations,
                                            int operationCount);
 
+    virtual int upPrePartialsByPartitionAsync(const int* operations,
+                                              int operationCount);
+
+    virtual void calcEdgeLogDerivativesByPartition(const int *postBufferIndices,
+                                                   const int *preBufferIndices,
+                                                   const int *firstDerivativeIndices,
+                                                   const REALTYPE *categoryWeights,
+                                                   int count,
+                                                   int partitionIndex,
+                                                   double *outDerivatives,
+                                                   double *outSumDerivativesByNode,
+                                                   double *outSumSquaredDerivativesByNode);
+
+    virtual void calcEdgeLogDerivativesByPartitionAsync(const int *postBufferIndices,
+                                                        const int *preBufferIndices,
+                                                        const int *firstDerivativeIndices,
+                                                        const REALTYPE *categoryWeights,
+                                                        int count,
+                                                        double *outDerivatives,
+                                                        double *outSumDerivatives,
+                                                        double *outSumSquaredDerivatives);
+
+    virtual void calcCrossProductsByPartition(const int *postBufferIndices,
+                                              const int *preBufferIndices,
+                                              const double *categoryRates,
+                                              const REALTYPE *categoryWeights,
+                                              const double *edgeLengths,
+                                              int count,
+                                              int partitionIndex,
+                                              double *outCrossProducts);
+
+    virtual void calcCrossProductsByPartitionAsync(const int *postBufferIndices,
+                                                   const int *preBufferIndices,
+                                                   const double *categoryRates,
+                                                   const REALTYPE *categoryWeights,
+                                                   const double *edgeLengths,
+                                                   int count,
+                                                   double *outCrossProducts);
+
+    virtual void calcEdgeGradientBlocks(const int* postBufferIndices,
+                                        const int* preBufferIndices,
+                                        const int* differentialMatrixIndices,
+                                        const int* secondDifferentialMatrixIndices,
+                                        const int* categoryWeightsIndices,
+                                        const int* categoryRatesIndices,
+                                        int blocksPerEdge,
+                                        int startBlock,
+                                        int endBlock,
+                                        double* outBlockSums);
+
+    virtual void calcParameterCrossProductBlocks(const int* postBufferIndices,
+                                                 const int* preBufferIndices,
+                                                 const int* categoryRatesIndices,
+                                                 const int* categoryWeightsIndices,
+                                                 const double* edgeLengths,
+                                                 int blocksPerEdge,
+                                                 int startBlock,
+                                                 int endBlock,
+                                                 double* outCrossProducts);
+
     virtual int reorderPatternsByPartition();
 
     virtual void calcStatesStates(REALTYPE* destP,
@@ -703,6 +1022,34 @@ protected:
                                                    double* outSumFirstDerivative,
                                                    double* outSumSecondDerivative);
 
+    // Pattern-weighted sums of site log likelihoods and derivatives along one edge for a
+    // range of patterns; uses no shared scratch buffers so edges can run concurrently
+    virtual void calcEdgeLogLikelihoodsDerivativesRange(const int parentBufferIndex,
+                                                        const int childBufferIndex,
+                                                        const int probabilityIndex,
+                                                        const int firstDerivativeIndex,
+                                                        const int secondDerivativeIndex,
+                                                        const int categoryWeightsIndex,
+                                                        const int stateFrequenciesIndex,
+                                                        const int scalingFactorsIndex,
+                                                        int startPattern,
+                                                        int endPattern,
+                                                        double* outSums);
+
+    void calcEdgeLogLikelihoodsPerEdgeTasks(const int* parentBufferIndices,
+                                            const int* childBufferIndices,
+                                            const int* probabilityIndices,
+                                            const int* firstDerivativeIndices,
+                                            const int* secondDerivativeIndices,
+                                            const int* categoryWeightsIndices,
+                                            const int* stateFrequenciesIndices,
+                                            const int* cumulativeScaleIndices,
+                                            int blockCount,
+                                            int firstTask,
+                                            int taskStride,
+                                            int taskCount,
+                                            double* outTaskSums);
+
     virtual void calcStatesStatesFixedScaling(REALTYPE *destP,
                                               const int *child0States,
                                               const REALTYPE *child0TransMat,
@@ -739,6 +1086,15 @@ protected:
                                             int startPattern,
                                             int endPattern);
 
+    void calcPartialsPartialsBlocked(REALTYPE* destP,
+                                     const REALTYPE* partials1,
+                                     const REALTYPE* matrices1,
+                                     const REALTYPE* partials2,
+                                     const REALTYPE* matrices2,
+                                     const REALTYPE* scaleFactors,
+                                     int startPattern,
+                                     int endPattern);
+
     virtual void calcPartialsPartialsAutoScaling(REALTYPE* destP,
                                                   const REALTYPE* partials1,
                                                   const REALTYPE* matrices1,
@@ -757,6 +1113,46 @@ protected:
                                             const int fillWithOnes,
                                             const int partitionIndex);
 
+    virtual void rescalePartialsRange(REALTYPE *destP,
+                                      REALTYPE *scaleFactors,
+                                      REALTYPE *cumulativeScaleFactors,
+                                      int startPattern,
+                                      int endPattern);
+
+    void accumulateRescaleFactorsRange(REALTYPE *scaleFactors,
+                                       REALTYPE *cumulativeScaleFactors,
+                                       int startPattern,
+                                       int endPattern);
+
+    // Adds (sign 1) or removes (sign -1) the factors of several scale buffers in one pass
+    void sumScaleFactors(const int* scalingIndices,
+                         int count,
+                         int cumulativeScalingIndex,
+                         double sign);
+
+    virtual void sumScaleFactorsRange(const int* scalingIndices,
+                                      int count,
+                                      int cumulativeScalingIndex,
+                                      double sign,
+                                      int startPattern,
+                                      int endPattern);
+
+    // True if any non-zero partial has a binary exponent beyond scalingExponentThreshold
+    virtual bool exceedsScalingExponent(const REALTYPE* destP,
+                                        int startPattern,
+                                        int endPattern);
+
+    bool hasScaleFactors(const REALTYPE* scaleFactors,
+                         int startPattern,
+                         int endPattern);
+
+    void dynamicRescalePartialsRange(REALTYPE* destP,
+                                     const REALTYPE* readScaleFactors,
+                                     REALTYPE* writeScaleFactors,
+                                     REALTYPE* cumulativeScaleFactors,
+                                     int startPattern,
+                                     int endPattern);
+
     virtual void autoRescalePartials(REALTYPE *destP,
     		                     signed short *scaleFactors);
 
@@ -766,8 +1162,32 @@ protected:
 
     void threadWaiting(threadData* tData);
 
+    void enqueueThreadTask(int threadIndex,
+                           std::packaged_task<void()>& threadTask);
+
+    void waitThreadTasks(int threadCount);
+
+    void stopPartitionThreads();
+
 private:
 
+    void setOpenMPPatternBlocks(int threadCount);
+
+    void allocateBlockedMatrices(int slotCount);
+
+    int getBlockedMatricesSlot(int startPattern);
+
+    void retainBlockedMatrices(int startPattern, int endPattern, bool retain);
+
+    template <int BLOCK_PATTERNS>
+    void calcPartialsPartialsBlock(REALTYPE* destP,
+                                   const REALTYPE* partials1,
+                                   const REALTYPE* matrix1T,
+                                   const REALTYPE* partials2,
+                                   const REALTYPE* matrix2T,
+                                   int paddedStateCount,
+                                   const REALTYPE* scaleFactors);
+
     template <bool DoDerivatives>
     void accumulateDerivativesDispatch1(double* outDerivatives,
                                double* outSumDerivatives,
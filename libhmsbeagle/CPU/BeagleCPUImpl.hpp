@@ -70,12 +70,14 @@
 #include <cassert>
 #include <vector>
 #include <cfloat>
+#include <algorithm>
 
 #include "libhmsbeagle/beagle.h"
 #include "libhmsbeagle/CPU/Precision.h"
 #include "libhmsbeagle/CPU/BeagleCPUImpl.h"
 #include "libhmsbeagle/CPU/EigenDecompositionCube.h"
 #include "libhmsbeagle/CPU/EigenDecompositionSquare.h"
+#include "libhmsbeagle/CPU/InstanceState.h"
 
 namespace beagle {
 namespace cpu {
@@ -133,14 +135,29 @@ BeagleCPUImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUImpl() {
     }
     free(gTransitionMatrices);
 
+    if (kSparseMatricesEnabled) {
+        for (int i = 0; i < kMatrixCount; i++) {
+            free(gSparseRowOffsets[i]);
+            free(gSparseColumns[i]);
+            free(gSparseValues[i]);
+        }
+        free(gSparseMatrixStates);
+        free(gSparseRowOffsets);
+        free(gSparseColumns);
+        free(gSparseValues);
+        free(gSparseCapacities);
+    }
+
     for(unsigned int i=0; i<kBufferCount; i++) {
         if (gPartials[i] != NULL)
             free(gPartials[i]);
         if (gTipStates[i] != NULL)
             free(gTipStates[i]);
+        free(gMissingTags[i]);
     }
     free(gPartials);
     free(gTipStates);
+    free(gMissingTags);
 
     if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
         for(unsigned int i=0; i<kScaleBufferCount; i++) {
@@ -193,33 +210,13 @@ BeagleCPUImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUImpl() {
 
     free(ones);
     free(zeros);
+    free(gDynamicScaleTmp);
+    free(gEpochMatrices);
+    free(gBlockedMatrices);
 
     delete gEigenDecomposition;
 
-    if (kThreadingEnabled) {
-        // Send stop signal to all threads and join them...
-        for (int i = 0; i < kNumThreads; i++) {
-            threadData* td = &gThreads[i];
-            std::unique_lock<std::mutex> l(td->m);
-            td->stop = true;
-            td->cv.notify_one();
-        }
-
-        // Join all the threads
-        for (int i = 0; i < kNumThreads; i++) {
-            threadData* td = &gThreads[i];
-            td->t.join();
-        }
-
-        delete[] gThreads;
-        delete[] gFutures;
-
-        for (int i=0; i<kNumThreads; i++) {
-            free(gThreadOperations[i]);
-        }
-        free(gThreadOperations);
-        free(gThreadOpCounts);
-    }
+    stopPartitionThreads();
 
     if (kAutoPartitioningEnabled) {
         free(gAutoPartitionOperations);
@@ -287,6 +284,13 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
 
     kMatrixSize = (T_PAD + kStateCount) * kStateCount;
 
+    // Rescaled updates compute and rescale blocks of patterns that stay in cache
+    kRescaleBlockPatternCount = BEAGLE_CPU_RESCALE_BLOCK_SIZE /
+                                (kPartialsPaddedStateCount * kCategoryCount * sizeof(REALTYPE));
+    kRescaleBlockPatternCount -= kRescaleBlockPatternCount % modulus;
+    if (kRescaleBlockPatternCount < modulus)
+        kRescaleBlockPatternCount = modulus;
+
     int scaleBufferSize = kPaddedPatternCount;
 
     kFlags = 0;
@@ -320,17 +324,25 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
     else
         kFlags |= BEAGLE_FLAG_INVEVEC_STANDARD;
 
+#ifdef _OPENMP
+    // auto scaling decides whether to rescale across all patterns, so it cannot be split into blocks
+    if ((requirementFlags & BEAGLE_FLAG_THREADING_OPENMP || preferenceFlags & BEAGLE_FLAG_THREADING_OPENMP) &&
+        !(kFlags & BEAGLE_FLAG_SCALING_AUTO))
+        kFlags |= BEAGLE_FLAG_THREADING_OPENMP;
+    else
+#endif
     if (requirementFlags & BEAGLE_FLAG_THREADING_CPP || preferenceFlags & BEAGLE_FLAG_THREADING_CPP)
         kFlags |= BEAGLE_FLAG_THREADING_CPP;
     else
         kFlags |= BEAGLE_FLAG_THREADING_NONE;
 
-    if (kFlags & BEAGLE_FLAG_EIGEN_COMPLEX)
+    if (kFlags & BEAGLE_FLAG_EIGEN_COMPLEX || kStateCount > BEAGLE_CPU_EIGEN_CUBE_MAX_STATE_COUNT)
         gEigenDecomposition = new EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>(kEigenDecompCount,
                 kStateCount,kCategoryCount,kFlags);
     else
         gEigenDecomposition = new EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>(kEigenDecompCount,
                 kStateCount, kCategoryCount,kFlags);
+    gUniformization = NULL;
 
     gCategoryRates = (double**) calloc(sizeof(double), kEigenDecompCount);
     if (gCategoryRates == NULL)
@@ -343,6 +355,10 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
     // TODO: if pattern padding is implemented this will create problems with setTipPartials
     kPartialsSize = kPaddedPatternCount * kPartialsPaddedStateCount * kCategoryCount;
 
+    kPartialsLayout = BEAGLE_PARTIALS_LAYOUT_CATEGORY_MAJOR;
+    kPartialsPatternStride = kPartialsPaddedStateCount;
+    kPartialsCategoryStride = kPaddedPatternCount * kPartialsPaddedStateCount;
+
     gPartials = (REALTYPE**) malloc(sizeof(REALTYPE*) * kBufferCount);
     if (gPartials == NULL)
      throw std::bad_alloc();
@@ -372,6 +388,16 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
             throw std::bad_alloc();
     }
 
+    gMissingTags = (unsigned int**) malloc(sizeof(unsigned int*) * kBufferCount);
+    if (gMissingTags == NULL)
+        throw std::bad_alloc();
+    for (int i = 0; i < kBufferCount; i++) {
+        gMissingTags[i] = (unsigned int*) calloc(kPaddedPatternCount, sizeof(unsigned int));
+        if (gMissingTags[i] == NULL)
+            throw std::bad_alloc();
+    }
+    kNextMissingTag = BEAGLE_CPU_MISSING_FIRST_TAG;
+
     gScaleBuffers = NULL;
 
     gAutoScaleBuffers = NULL;
@@ -418,6 +444,18 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
             throw std::bad_alloc();
     }
 
+    kSparseMatricesEnabled = (kStateCount >= BEAGLE_CPU_SPARSE_MIN_STATE_COUNT);
+    if (kSparseMatricesEnabled) {
+        gSparseMatrixStates = (int*) calloc(kMatrixCount, sizeof(int));
+        gSparseRowOffsets = (int**) calloc(kMatrixCount, sizeof(int*));
+        gSparseColumns = (int**) calloc(kMatrixCount, sizeof(int*));
+        gSparseValues = (REALTYPE**) calloc(kMatrixCount, sizeof(REALTYPE*));
+        gSparseCapacities = (int*) calloc(kMatrixCount, sizeof(int));
+        if (gSparseMatrixStates == NULL || gSparseRowOffsets == NULL || gSparseColumns == NULL ||
+            gSparseValues == NULL || gSparseCapacities == NULL)
+            throw std::bad_alloc();
+    }
+
     integrationTmp = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPatternCount * kStateCount);
     firstDerivTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount * kStateCount);
     secondDerivTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount * kStateCount);
@@ -440,8 +478,30 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
         ones[i] = 1.0;
     }
 
+    gEpochMatrices = NULL;
+    kEpochMatricesSize = 0;
+
+    gBlockedMatrices = NULL;
+    kBlockedPaddedStateCount = ((kStateCount + BEAGLE_CPU_BLOCK_STATE_COUNT - 1) / BEAGLE_CPU_BLOCK_STATE_COUNT) *
+                               BEAGLE_CPU_BLOCK_STATE_COUNT;
+    kBlockedMatricesSlotCount = 0;
+    if (kStateCount >= BEAGLE_CPU_BLOCKED_MIN_STATE_COUNT)
+        allocateBlockedMatrices(1);
+
+    kMatrixMemoEnabled = false;
+    kMatrixMemoHitCount = 0;
+    kMatrixMemoMissCount = 0;
+
+    gDynamicScaleTmp = NULL;
+    if (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC) {
+        gDynamicScaleTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kPaddedPatternCount);
+        if (gDynamicScaleTmp == NULL)
+            throw std::bad_alloc();
+    }
+
     kThreadingEnabled = false;
     kAutoPartitioningEnabled = false;
+    kAutoRootPartitioningEnabled = false;
     if (kFlags & BEAGLE_FLAG_THREADING_CPP) {
         int hardwareThreads = std::thread::hardware_concurrency();
         if (kStateCount <= 4) {
@@ -486,6 +546,12 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
         }
     }
 
+#ifdef _OPENMP
+    kOpenMPThreadCount = 1;
+    if (kFlags & BEAGLE_FLAG_THREADING_OPENMP)
+        setOpenMPPatternBlocks(omp_get_max_threads());
+#endif
+
     return BEAGLE_SUCCESS;
 }
 
@@ -518,8 +584,16 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUThreadCount(int threadCount) {
     if (threadCount < 1)
         return BEAGLE_ERROR_OUT_OF_RANGE;
 
+#ifdef _OPENMP
+    if (kFlags & BEAGLE_FLAG_THREADING_OPENMP) {
+        setOpenMPPatternBlocks(threadCount);
+        return BEAGLE_SUCCESS;
+    }
+#endif
+
     kThreadingEnabled = false;
     kAutoPartitioningEnabled = false;
+    kAutoRootPartitioningEnabled = false;
     if (kFlags & BEAGLE_FLAG_THREADING_CPP) {
         int hardwareThreads = std::thread::hardware_concurrency();
         if (kStateCount <= 4) {
@@ -566,6 +640,54 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUThreadCount(int threadCount) {
     return BEAGLE_SUCCESS;
 }
 
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPartialsLayout(int layout) {
+
+    if (layout != BEAGLE_PARTIALS_LAYOUT_CATEGORY_MAJOR &&
+        layout != BEAGLE_PARTIALS_LAYOUT_PATTERN_MAJOR)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    if (layout == kPartialsLayout)
+        return BEAGLE_SUCCESS;
+
+    int patternStride, categoryStride;
+    if (layout == BEAGLE_PARTIALS_LAYOUT_PATTERN_MAJOR) {
+        patternStride = kPartialsPaddedStateCount * kCategoryCount;
+        categoryStride = kPartialsPaddedStateCount;
+    } else {
+        patternStride = kPartialsPaddedStateCount;
+        categoryStride = kPartialsPaddedStateCount * kPaddedPatternCount;
+    }
+
+    // Convert existing buffers, swapping each with a scratch buffer of the same size
+    REALTYPE* scratch = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
+    if (scratch == NULL)
+        throw std::bad_alloc();
+
+    for (int i = 0; i < kBufferCount; i++) {
+        REALTYPE* partials = gPartials[i];
+        if (partials == NULL)
+            continue;
+        for (int l = 0; l < kCategoryCount; l++) {
+            for (int k = 0; k < kPaddedPatternCount; k++) {
+                memcpy(scratch + l * categoryStride + k * patternStride,
+                       partials + l * kPartialsCategoryStride + k * kPartialsPatternStride,
+                       sizeof(REALTYPE) * kPartialsPaddedStateCount);
+            }
+        }
+        gPartials[i] = scratch;
+        scratch = partials;
+    }
+
+    free(scratch);
+
+    kPartialsLayout = layout;
+    kPartialsPatternStride = patternStride;
+    kPartialsCategoryStride = categoryStride;
+
+    return BEAGLE_SUCCESS;
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipStates(int tipIndex,
                                 const int* inStates) {
@@ -579,6 +701,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipStates(int tipIndex,
     for (int j = kPatternCount; j < kPaddedPatternCount; j++) {
         gTipStates[tipIndex][j] = kStateCount;
     }
+    resetMissingTags(tipIndex);
 
     return BEAGLE_SUCCESS;
 }
@@ -596,10 +719,11 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipPartials(int tipIndex,
     }
 
     const double* inPartialsOffset;
-    REALTYPE* tmpRealPartialsOffset = gPartials[tipIndex];
+    REALTYPE* tmpRealPartialsOffset;
     for (int l = 0; l < kCategoryCount; l++) {
         inPartialsOffset = inPartials;
         for (int i = 0; i < kPatternCount; i++) {
+            tmpRealPartialsOffset = gPartials[tipIndex] + l*kPartialsCategoryStride + i*kPartialsPatternStride;
             beagleMemCpy(tmpRealPartialsOffset, inPartialsOffset, kStateCount);
             tmpRealPartialsOffset += kStateCount;
             // Pad extra buffer with zeros
@@ -609,11 +733,16 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipPartials(int tipIndex,
             inPartialsOffset += kStateCount;
         }
         // Pad extra buffer with zeros
-        for(int k = 0; k < kPartialsPaddedStateCount * (kPaddedPatternCount - kPatternCount); k++) {
-            *tmpRealPartialsOffset++ = 0;
+        for (int i = kPatternCount; i < kPaddedPatternCount; i++) {
+            tmpRealPartialsOffset = gPartials[tipIndex] + l*kPartialsCategoryStride + i*kPartialsPatternStride;
+            for(int k = 0; k < kPartialsPaddedStateCount; k++) {
+                *tmpRealPartialsOffset++ = 0;
+            }
         }
     }
 
+    resetMissingTags(tipIndex);
+
     return BEAGLE_SUCCESS;
 }
 
@@ -655,17 +784,21 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setRootPrePartials(const int *bufferIndic
                     return BEAGLE_ERROR_OUT_OF_MEMORY;
             }
             const REALTYPE *inPartialsOffset = gStateFrequencies[stateFrequenciesIndex];
-            REALTYPE *tmpRealPartialsOffset = gPartials[bufferIndex];
+            REALTYPE *tmpRealPartialsOffset;
             for (int l = 0; l < kCategoryCount; l++) {
                 for (int i = 0; i < kPatternCount; i++) {
+                    tmpRealPartialsOffset = gPartials[bufferIndex] + l*kPartialsCategoryStride + i*kPartialsPatternStride;
                     beagleMemCpy(tmpRealPartialsOffset, inPartialsOffset, kStateCount);
-                    tmpRealPartialsOffset += kPartialsPaddedStateCount;
                 }
                 // Pad extra buffer with zeros
-                for (int k = 0; k < kPartialsPaddedStateCount * (kPaddedPatternCount - kPatternCount); k++) {
-                    *tmpRealPartialsOffset++ = 0;
+                for (int i = kPatternCount; i < kPaddedPatternCount; i++) {
+                    tmpRealPartialsOffset = gPartials[bufferIndex] + l*kPartialsCategoryStride + i*kPartialsPatternStride;
+                    for (int k = 0; k < kPartialsPaddedStateCount; k++) {
+                        *tmpRealPartialsOffset++ = 0;
+                    }
                 }
             }
+            resetMissingTags(bufferIndex);
 
             return BEAGLE_SUCCESS;
         }
@@ -688,9 +821,10 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPartials(int bufferIndex,
     }
 
     const double* inPartialsOffset = inPartials;
-    REALTYPE* tmpRealPartialsOffset = gPartials[bufferIndex];
+    REALTYPE* tmpRealPartialsOffset;
     for (int l = 0; l < kCategoryCount; l++) {
         for (int i = 0; i < kPatternCount; i++) {
+            tmpRealPartialsOffset = gPartials[bufferIndex] + l*kPartialsCategoryStride + i*kPartialsPatternStride;
             beagleMemCpy(tmpRealPartialsOffset, inPartialsOffset, kStateCount);
             tmpRealPartialsOffset += kStateCount;
             // Pad extra buffer with zeros
@@ -700,11 +834,16 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPartials(int bufferIndex,
             inPartialsOffset += kStateCount;
         }
         // Pad extra buffer with zeros
-        for(int k = 0; k < kPartialsPaddedStateCount * (kPaddedPatternCount - kPatternCount); k++) {
-            *tmpRealPartialsOffset++ = 0;
+        for (int i = kPatternCount; i < kPaddedPatternCount; i++) {
+            tmpRealPartialsOffset = gPartials[bufferIndex] + l*kPartialsCategoryStride + i*kPartialsPatternStride;
+            for(int k = 0; k < kPartialsPaddedStateCount; k++) {
+                *tmpRealPartialsOffset++ = 0;
+            }
         }
     }
 
+    resetMissingTags(bufferIndex);
+
     return BEAGLE_SUCCESS;
 }
 
@@ -717,9 +856,11 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getPartials(int bufferIndex,
     if (bufferIndex < 0 || bufferIndex >= kBufferCount)
         return BEAGLE_ERROR_OUT_OF_RANGE;
 
-    if ((kPatternCount == kPaddedPatternCount) && (kStateCount == kPartialsPaddedStateCount)) {
+    const bool categoryMajor = (kPartialsLayout == BEAGLE_PARTIALS_LAYOUT_CATEGORY_MAJOR);
+
+    if (categoryMajor && (kPatternCount == kPaddedPatternCount) && (kStateCount == kPartialsPaddedStateCount)) {
         beagleMemCpy(outPartials, gPartials[bufferIndex], kPartialsSize);
-    } else if (kStateCount == kPartialsPaddedStateCount) {
+    } else if (categoryMajor && kStateCount == kPartialsPaddedStateCount) {
         double *offsetOutPartials = outPartials;
         REALTYPE* offsetBeaglePartials = gPartials[bufferIndex];
         for(int l = 0; l < kCategoryCount; l++) {
@@ -729,14 +870,12 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getPartials(int bufferIndex,
         }
     } else {
         double *offsetOutPartials = outPartials;
-        REALTYPE* offsetBeaglePartials = gPartials[bufferIndex];
         for(int l = 0; l < kCategoryCount; l++) {
             for (int i = 0; i < kPatternCount; i++) {
+                REALTYPE* offsetBeaglePartials = gPartials[bufferIndex] + l*kPartialsCategoryStride + i*kPartialsPatternStride;
                 beagleMemCpy(offsetOutPartials, offsetBeaglePartials, kStateCount);
                 offsetOutPartials += kStateCount;
-                offsetBeaglePartials += kPartialsPaddedStateCount;
             }
-            offsetBeaglePartials += (kPaddedPatternCount - kPatternCount) * kPartialsPaddedStateCount;
         }
     }
 
@@ -763,6 +902,24 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setEigenDecomposition(int eigenIndex,
                                          const double* inEigenValues) {
 
     gEigenDecomposition->setEigenDecomposition(eigenIndex, inEigenVectors, inInverseEigenVectors, inEigenValues);
+    clearMatrixMemo(eigenIndex);
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setUniformizationRateMatrix(int eigenIndex,
+                                                                   const double* inRateMatrix) {
+    if (eigenIndex < 0 || eigenIndex >= kEigenDecompCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    if (gUniformization == NULL) {
+        gUniformization = new EigenDecompositionUniformization<BEAGLE_CPU_EIGEN_GENERIC>(gEigenDecomposition,
+                kEigenDecompCount, kStateCount, kCategoryCount, kFlags);
+        gEigenDecomposition = gUniformization;
+    }
+
+    gUniformization->setRateMatrix(eigenIndex, inRateMatrix);
+    clearMatrixMemo(eigenIndex);
     return BEAGLE_SUCCESS;
 }
 
@@ -775,6 +932,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCategoryRates(const double* inCategory
             return BEAGLE_ERROR_OUT_OF_MEMORY;
     }
     memcpy(gCategoryRates[categoryRatesIndex], inCategoryRates, sizeof(double) * kCategoryCount);
+    clearMatrixMemo(-1);
     return BEAGLE_SUCCESS;
 }
 
@@ -789,6 +947,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCategoryRatesWithIndex(int categoryRat
             return BEAGLE_ERROR_OUT_OF_MEMORY;
     }
     memcpy(gCategoryRates[categoryRatesIndex], inCategoryRates, sizeof(double) * kCategoryCount);
+    if (categoryRatesIndex == 0)
+        clearMatrixMemo(-1);
     return BEAGLE_SUCCESS;
 }
 
@@ -814,17 +974,21 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPatternPartitions(int partitionCount,
         gPatternPartitions = (int*) malloc(sizeof(int) * kPatternCount);
         if (gPatternPartitions == NULL)
             throw std::bad_alloc();
+    }
 
-        if (kAutoPartitioningEnabled) {
-            free(gAutoPartitionOperations);
-            if (kAutoRootPartitioningEnabled) {
-                free(gAutoPartitionIndices);
-                free(gAutoPartitionOutSumLogLikelihoods);
-                kAutoRootPartitioningEnabled = false;
-            }
-            kAutoPartitioningEnabled = false;
+    // explicit partitions replace any automatic pattern partitioning
+    if (kAutoPartitioningEnabled) {
+        free(gAutoPartitionOperations);
+        if (kAutoRootPartitioningEnabled) {
+            free(gAutoPartitionIndices);
+            free(gAutoPartitionOutSumLogLikelihoods);
+            kAutoRootPartitioningEnabled = false;
         }
+        kAutoPartitioningEnabled = false;
     }
+    if (gBlockedMatrices != NULL && partitionCount > kBlockedMatricesSlotCount)
+        allocateBlockedMatrices(partitionCount);
+
     if (!kPartitionsInitialised || partitionCount > kMaxPartitionCount) {
         if (kPartitionsInitialised) {
             free(gPatternPartitionsStartPatterns);
@@ -836,39 +1000,16 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPatternPartitions(int partitionCount,
         kMaxPartitionCount = partitionCount;
     }
 
-    if (kThreadingEnabled) {
-        // Send stop signal to all threads and join them...
-        for (int i = 0; i < kNumThreads; i++) {
-            threadData* td = &gThreads[i];
-            std::unique_lock<std::mutex> l(td->m);
-            td->stop = true;
-            td->cv.notify_one();
-        }
-
-        // Join all the threads
-        for (int i = 0; i < kNumThreads; i++) {
-            threadData* td = &gThreads[i];
-            td->t.join();
-        }
-
-        delete[] gThreads;
-        delete[] gFutures;
-
-        for (int i=0; i<kNumThreads; i++) {
-            free(gThreadOperations[i]);
-        }
-        free(gThreadOperations);
-        free(gThreadOpCounts);
-
-        kThreadingEnabled = false;
-    }
+    stopPartitionThreads();
 
-    if (kFlags & BEAGLE_FLAG_THREADING_CPP) {
+    if (kFlags & (BEAGLE_FLAG_THREADING_CPP | BEAGLE_FLAG_THREADING_OPENMP)) {
         kNumThreads = partitionCount;
 
         gThreads = new threadData[kNumThreads];
-        for (int i = 0; i < kNumThreads; i++) {
-            gThreads[i].t = std::thread(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::threadWaiting, this, &gThreads[i]);
+        if (!(kFlags & BEAGLE_FLAG_THREADING_OPENMP)) {
+            for (int i = 0; i < kNumThreads; i++) {
+                gThreads[i].t = std::thread(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::threadWaiting, this, &gThreads[i]);
+            }
         }
 
         gFutures = new std::shared_future<void>[kNumThreads];
@@ -1031,6 +1172,253 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getSiteDerivatives(double* outFirstDeriva
     return BEAGLE_SUCCESS;
 }
 
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::fillStateHeader(InstanceStateHeader* header) {
+    memset(header, 0, sizeof(InstanceStateHeader));
+    memcpy(header->magic, BEAGLE_CPU_STATE_MAGIC, sizeof(header->magic));
+    header->version = BEAGLE_CPU_STATE_VERSION;
+    header->realTypeSize = (int) sizeof(REALTYPE);
+    header->tipCount = kTipCount;
+    header->bufferCount = kBufferCount;
+    header->stateCount = kStateCount;
+    header->patternCount = kPatternCount;
+    header->paddedPatternCount = kPaddedPatternCount;
+    header->partialsPaddedStateCount = kPartialsPaddedStateCount;
+    header->partialsLayout = kPartialsLayout;
+    header->eigenDecompCount = kEigenDecompCount;
+    header->matrixCount = kMatrixCount;
+    header->matrixSize = kMatrixSize;
+    header->categoryCount = kCategoryCount;
+    header->scaleBufferCount = kScaleBufferCount;
+    header->flags = kFlags;
+    header->uniformization = (gUniformization != NULL ? 1 : 0);
+    header->partitionCount = (kPartitionsInitialised ? kPartitionCount : 0);
+}
+
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::writeExtendedState(FILE* file) {
+    return true;
+}
+
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::readExtendedState(FILE* file) {
+    return true;
+}
+
+/*
+ * The state file is the header followed by blocks in the order below, each padded to
+ * BEAGLE_CPU_STATE_ALIGNMENT bytes, then those of writeExtendedState. Buffers that may be
+ * unset (tips, category rates, weights and frequencies) are preceded by a block of presence
+ * flags.
+ */
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::saveState(const char* fileName) {
+    // the state of reordered patterns cannot be replayed through setPatternPartitions
+    if (kPatternsReordered)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    FILE* file = fopen(fileName, "wb");
+    if (file == NULL)
+        return BEAGLE_ERROR_GENERAL;
+
+    InstanceStateHeader header;
+    fillStateHeader(&header);
+    bool ok = writeStateBlock(file, &header, sizeof(InstanceStateHeader));
+
+    if (ok && header.partitionCount > 0)
+        ok = writeStateBlock(file, gPatternPartitions, sizeof(int) * kPatternCount);
+    if (ok)
+        ok = writeStateBlock(file, gPatternWeights, sizeof(double) * kPatternCount);
+
+    std::vector<char> present(kEigenDecompCount);
+    for (int i = 0; i < kEigenDecompCount; i++)
+        present[i] = (gCategoryRates[i] != NULL) | ((gCategoryWeights[i] != NULL) << 1) |
+                     ((gStateFrequencies[i] != NULL) << 2);
+    if (ok)
+        ok = writeStateBlock(file, &present[0], kEigenDecompCount);
+    for (int i = 0; ok && i < kEigenDecompCount; i++) {
+        if (gCategoryRates[i] != NULL)
+            ok = writeStateBlock(file, gCategoryRates[i], sizeof(double) * kCategoryCount);
+        if (ok && gCategoryWeights[i] != NULL)
+            ok = writeStateBlock(file, gCategoryWeights[i], sizeof(REALTYPE) * kCategoryCount);
+        if (ok && gStateFrequencies[i] != NULL)
+            ok = writeStateBlock(file, gStateFrequencies[i], sizeof(REALTYPE) * kStateCount);
+    }
+
+    present.resize(kBufferCount);
+    for (int i = 0; i < kBufferCount; i++)
+        present[i] = (gTipStates[i] != NULL) | ((gPartials[i] != NULL) << 1);
+    if (ok)
+        ok = writeStateBlock(file, &present[0], kBufferCount);
+    for (int i = 0; ok && i < kBufferCount; i++) {
+        if (gTipStates[i] != NULL)
+            ok = writeStateBlock(file, gTipStates[i], sizeof(int) * kPaddedPatternCount);
+        if (ok && gPartials[i] != NULL)
+            ok = writeStateBlock(file, gPartials[i], sizeof(REALTYPE) * kPartialsSize);
+    }
+
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+        for (int i = 0; ok && i < kScaleBufferCount; i++)
+            ok = writeStateBlock(file, gAutoScaleBuffers[i], sizeof(signed short) * kPaddedPatternCount);
+        if (ok)
+            ok = writeStateBlock(file, gActiveScalingFactors, sizeof(int) * kInternalPartialsBufferCount);
+    } else {
+        for (int i = 0; ok && i < kScaleBufferCount; i++)
+            ok = writeStateBlock(file, gScaleBuffers[i], sizeof(REALTYPE) * kPaddedPatternCount);
+    }
+
+    for (int i = 0; ok && i < kMatrixCount; i++)
+        ok = writeStateBlock(file, gTransitionMatrices[i], sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
+
+    if (ok)
+        ok = gEigenDecomposition->writeState(file);
+
+    // site results of the last likelihood calculation
+    if (ok)
+        ok = writeStateBlock(file, outLogLikelihoodsTmp, sizeof(REALTYPE) * kPatternCount) &&
+             writeStateBlock(file, outFirstDerivativesTmp, sizeof(REALTYPE) * kPatternCount) &&
+             writeStateBlock(file, outSecondDerivativesTmp, sizeof(REALTYPE) * kPatternCount);
+    if (ok)
+        ok = writeExtendedState(file);
+
+    if (fclose(file) != 0)
+        ok = false;
+    if (!ok) {
+        remove(fileName);
+        return BEAGLE_ERROR_GENERAL;
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::restoreState(const char* fileName) {
+    FILE* file = fopen(fileName, "rb");
+    if (file == NULL)
+        return BEAGLE_ERROR_GENERAL;
+
+    InstanceStateHeader header, expected;
+    fillStateHeader(&expected);
+    if (!readStateBlock(file, &header, sizeof(InstanceStateHeader))) {
+        fclose(file);
+        return BEAGLE_ERROR_GENERAL;
+    }
+    // everything but the uniformization and partition fields must match this instance
+    if (memcmp(&header, &expected, offsetof(InstanceStateHeader, uniformization)) != 0 ||
+        header.partitionCount < 0 || header.partitionCount > kPatternCount) {
+        fclose(file);
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    bool ok = true;
+    std::vector<double> values(kPatternCount > kStateCount ? kPatternCount : kStateCount);
+    std::vector<REALTYPE> realValues(kCategoryCount > kStateCount ? kCategoryCount : kStateCount);
+
+    if (header.partitionCount > 0) {
+        std::vector<int> partitions(kPatternCount);
+        ok = readStateBlock(file, &partitions[0], sizeof(int) * kPatternCount);
+        if (ok)
+            ok = (setPatternPartitions(header.partitionCount, &partitions[0]) == BEAGLE_SUCCESS);
+    }
+    if (ok)
+        ok = readStateBlock(file, &values[0], sizeof(double) * kPatternCount) &&
+             setPatternWeights(&values[0]) == BEAGLE_SUCCESS;
+
+    // weights and frequencies go through their setters, which subclasses may extend
+    std::vector<char> present(kEigenDecompCount);
+    if (ok)
+        ok = readStateBlock(file, &present[0], kEigenDecompCount);
+    for (int i = 0; ok && i < kEigenDecompCount; i++) {
+        if (present[i] & 1)
+            ok = readStateBlock(file, &values[0], sizeof(double) * kCategoryCount) &&
+                 setCategoryRatesWithIndex(i, &values[0]) == BEAGLE_SUCCESS;
+        if (ok && (present[i] & 2)) {
+            ok = readStateBlock(file, &realValues[0], sizeof(REALTYPE) * kCategoryCount);
+            std::copy(realValues.begin(), realValues.begin() + kCategoryCount, values.begin());
+            ok = ok && setCategoryWeights(i, &values[0]) == BEAGLE_SUCCESS;
+        }
+        if (ok && (present[i] & 4)) {
+            ok = readStateBlock(file, &realValues[0], sizeof(REALTYPE) * kStateCount);
+            std::copy(realValues.begin(), realValues.begin() + kStateCount, values.begin());
+            ok = ok && setStateFrequencies(i, &values[0]) == BEAGLE_SUCCESS;
+        }
+    }
+
+    // tip buffers hold states or partials as in the saved instance
+    present.resize(kBufferCount);
+    if (ok)
+        ok = readStateBlock(file, &present[0], kBufferCount);
+    for (int i = 0; ok && i < kBufferCount; i++) {
+        if (present[i] & 1) {
+            if (gTipStates[i] == NULL) {
+                gTipStates[i] = (int*) mallocAligned(sizeof(int) * kPaddedPatternCount);
+                if (gTipStates[i] == NULL)
+                    throw std::bad_alloc();
+            }
+            ok = readStateBlock(file, gTipStates[i], sizeof(int) * kPaddedPatternCount);
+        } else if (gTipStates[i] != NULL) {
+            free(gTipStates[i]);
+            gTipStates[i] = NULL;
+        }
+        if (!ok)
+            break;
+        if (present[i] & 2) {
+            if (gPartials[i] == NULL) {
+                gPartials[i] = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
+                if (gPartials[i] == NULL)
+                    throw std::bad_alloc();
+            }
+            ok = readStateBlock(file, gPartials[i], sizeof(REALTYPE) * kPartialsSize);
+        } else if (gPartials[i] != NULL && i < kTipCount) {
+            free(gPartials[i]);
+            gPartials[i] = NULL;
+        }
+    }
+    for (int i = 0; ok && i < kBufferCount; i++)
+        resetMissingTags(i);
+
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+        for (int i = 0; ok && i < kScaleBufferCount; i++)
+            ok = readStateBlock(file, gAutoScaleBuffers[i], sizeof(signed short) * kPaddedPatternCount);
+        if (ok)
+            ok = readStateBlock(file, gActiveScalingFactors, sizeof(int) * kInternalPartialsBufferCount);
+    } else {
+        for (int i = 0; ok && i < kScaleBufferCount; i++)
+            ok = readStateBlock(file, gScaleBuffers[i], sizeof(REALTYPE) * kPaddedPatternCount);
+    }
+
+    for (int i = 0; ok && i < kMatrixCount; i++)
+        ok = readStateBlock(file, gTransitionMatrices[i], sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
+    if (kSparseMatricesEnabled) {
+        for (int i = 0; i < kMatrixCount; i++)
+            gSparseMatrixStates[i] = BEAGLE_CPU_SPARSE_UNKNOWN;
+    }
+    clearMatrixMemo(-1);
+
+    if (ok) {
+        if (header.uniformization && gUniformization == NULL) {
+            gUniformization = new EigenDecompositionUniformization<BEAGLE_CPU_EIGEN_GENERIC>(gEigenDecomposition,
+                    kEigenDecompCount, kStateCount, kCategoryCount, kFlags);
+            gEigenDecomposition = gUniformization;
+        }
+        if (!header.uniformization && gUniformization != NULL)
+            ok = gUniformization->readDecompositionState(file);
+        else
+            ok = gEigenDecomposition->readState(file);
+    }
+
+    if (ok)
+        ok = readStateBlock(file, outLogLikelihoodsTmp, sizeof(REALTYPE) * kPatternCount) &&
+             readStateBlock(file, outFirstDerivativesTmp, sizeof(REALTYPE) * kPatternCount) &&
+             readStateBlock(file, outSecondDerivativesTmp, sizeof(REALTYPE) * kPatternCount);
+    if (ok)
+        ok = readExtendedState(file);
+
+    fclose(file);
+
+    return (ok ? BEAGLE_SUCCESS : BEAGLE_ERROR_GENERAL);
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTransitionMatrix(int matrixIndex,
                                        const double* inMatrix,
@@ -1051,6 +1439,7 @@ if (T_PAD != 0) {
     beagleMemCpy(gTransitionMatrices[matrixIndex], inMatrix,
                  kMatrixSize * kCategoryCount);
 }
+    invalidateMatrices(&matrixIndex, 1);
     return BEAGLE_SUCCESS;
 }
 
@@ -1086,6 +1475,7 @@ if (T_PAD != 0) {
                      kMatrixSize * kCategoryCount);
 }
     }
+    invalidateMatrices(matrixIndices, count);
 
     return BEAGLE_SUCCESS;
 }
@@ -1155,6 +1545,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::convolveTransitionMatrices(const int* fir
         }//END: rates loop
 
     }//END: u loop
+    invalidateMatrices(resultIndices, matrixCount);
 
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr, "\t Leaving BeagleCPUImpl::convolveTransitionMatrices \n");
@@ -1163,6 +1554,231 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::convolveTransitionMatrices(const int* fir
     return returnCode;
 }
 
+/*
+ * Sets each branch matrix to the product of the matrices of its segments, in order, with
+ * derivatives with respect to the branch length when every segment takes a fixed share of it.
+ * The segment matrices of all branches are computed in one batch per eigen decomposition and
+ * category rates into scratch space, and the products are split across the thread queues.
+ */
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateEpochTransitionMatrices(const int* segmentCounts,
+                                                                     const int* eigenIndices,
+                                                                     const int* categoryRateIndices,
+                                                                     const double* segmentLengths,
+                                                                     const int* probabilityIndices,
+                                                                     const int* firstDerivativeIndices,
+                                                                     const int* secondDerivativeIndices,
+                                                                     int count) {
+    if (count < 0 || (secondDerivativeIndices != NULL && firstDerivativeIndices == NULL))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    const int slots = 1 + (firstDerivativeIndices != NULL) + (secondDerivativeIndices != NULL);
+
+    std::vector<int> segmentOffsets(count + 1, 0);
+    for (int b = 0; b < count; b++) {
+        if (segmentCounts[b] < 1 ||
+            probabilityIndices[b] < 0 || probabilityIndices[b] >= kMatrixCount ||
+            (slots > 1 && (firstDerivativeIndices[b] < 0 || firstDerivativeIndices[b] >= kMatrixCount)) ||
+            (slots > 2 && (secondDerivativeIndices[b] < 0 || secondDerivativeIndices[b] >= kMatrixCount)))
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        segmentOffsets[b + 1] = segmentOffsets[b] + segmentCounts[b];
+    }
+    const int segmentCount = segmentOffsets[count];
+    for (int s = 0; s < segmentCount; s++) {
+        const int rateIndex = (categoryRateIndices != NULL ? categoryRateIndices[s] : 0);
+        if (eigenIndices[s] < 0 || eigenIndices[s] >= kEigenDecompCount ||
+            rateIndex < 0 || rateIndex >= kEigenDecompCount || gCategoryRates[rateIndex] == NULL)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    if (segmentCount == 0)
+        return BEAGLE_SUCCESS;
+
+    const size_t matrixStride = (size_t) kMatrixSize * kCategoryCount;
+    const size_t requiredSize = (size_t) segmentCount * slots * matrixStride;
+    if (requiredSize > kEpochMatricesSize) {
+        free(gEpochMatrices);
+        gEpochMatrices = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * requiredSize);
+        if (gEpochMatrices == NULL) {
+            kEpochMatricesSize = 0;
+            throw std::bad_alloc();
+        }
+        kEpochMatricesSize = requiredSize;
+    }
+
+    // segment s has its matrix and derivatives at slots s * slots + d of the scratch space
+    std::vector<REALTYPE*> segmentMatrices((size_t) segmentCount * slots);
+    for (size_t i = 0; i < segmentMatrices.size(); i++)
+        segmentMatrices[i] = gEpochMatrices + i * matrixStride;
+
+    // one batch per (eigen decomposition, category rates) pair
+    std::vector<int> segments(segmentCount);
+    for (int s = 0; s < segmentCount; s++)
+        segments[s] = s;
+    std::vector<long> keys(segmentCount);
+    for (int s = 0; s < segmentCount; s++)
+        keys[s] = (long) eigenIndices[s] * kEigenDecompCount +
+                  (categoryRateIndices != NULL ? categoryRateIndices[s] : 0);
+    std::stable_sort(segments.begin(), segments.end(),
+                     [&keys](int a, int b) { return keys[a] < keys[b]; });
+
+    std::vector<int> batchIndices(3 * (size_t) segmentCount);
+    std::vector<double> batchLengths(segmentCount);
+    for (int start = 0; start < segmentCount; ) {
+        int end = start;
+        while (end < segmentCount && keys[segments[end]] == keys[segments[start]])
+            end++;
+        const int n = end - start;
+        for (int i = 0; i < n; i++) {
+            const int s = segments[start + i];
+            for (int d = 0; d < slots; d++)
+                batchIndices[(size_t) d * segmentCount + i] = s * slots + d;
+            batchLengths[i] = segmentLengths[s];
+        }
+        const int first = segments[start];
+        gEigenDecomposition->updateTransitionMatrices(eigenIndices[first],
+                &batchIndices[0],
+                (slots > 1 ? &batchIndices[segmentCount] : NULL),
+                (slots > 2 ? &batchIndices[2 * (size_t) segmentCount] : NULL),
+                &batchLengths[0],
+                gCategoryRates[categoryRateIndices != NULL ? categoryRateIndices[first] : 0],
+                &segmentMatrices[0], n);
+        start = end;
+    }
+
+    const int threadCount = (kThreadingEnabled ? kNumThreads : 1);
+    const double work = (double) segmentCount * slots * kCategoryCount * kStateCount * kStateCount * kStateCount;
+    if (threadCount < 2 || count < 2 || work < BEAGLE_CPU_EPOCH_ASYNC_MIN_COUNT) {
+        epochProductsRange(&segmentOffsets[0], segmentLengths, probabilityIndices,
+                           firstDerivativeIndices, secondDerivativeIndices, 0, count);
+    } else {
+        const int branchesPerThread = (count + threadCount - 1) / threadCount;
+        int threadsUsed = 0;
+        for (int startBranch = 0; startBranch < count; startBranch += branchesPerThread) {
+            std::packaged_task<void()> threadTask(
+                std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::epochProductsRange, this,
+                          &segmentOffsets[0], segmentLengths, probabilityIndices,
+                          firstDerivativeIndices, secondDerivativeIndices,
+                          startBranch, std::min(startBranch + branchesPerThread, count)));
+            enqueueThreadTask(threadsUsed++, threadTask);
+        }
+        waitThreadTasks(threadsUsed);
+    }
+
+    invalidateMatrices(probabilityIndices, count);
+    invalidateMatrices(firstDerivativeIndices, count);
+    invalidateMatrices(secondDerivativeIndices, count);
+
+    return BEAGLE_SUCCESS;
+}
+
+/*
+ * Carries the product M of the segments so far with its derivatives, M' and M'', through
+ *   M' <- M' P + w M P'  and  M'' <- M'' P + 2 w M' P' + w^2 M P''
+ * where w is the segment's share of the branch length.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::epochProductsRange(const int* segmentOffsets,
+                                                          const double* segmentLengths,
+                                                          const int* probabilityIndices,
+                                                          const int* firstDerivativeIndices,
+                                                          const int* secondDerivativeIndices,
+                                                          int startBranch,
+                                                          int endBranch) {
+    const int slots = 1 + (firstDerivativeIndices != NULL) + (secondDerivativeIndices != NULL);
+    const size_t matrixStride = (size_t) kMatrixSize * kCategoryCount;
+
+    REALTYPE* products = (REALTYPE*) malloc(sizeof(REALTYPE) * kMatrixSize * 2 * slots);
+    if (products == NULL)
+        throw std::bad_alloc();
+    REALTYPE* M[3];
+    REALTYPE* T[3];
+    for (int d = 0; d < slots; d++) {
+        M[d] = products + (size_t) d * kMatrixSize;
+        T[d] = products + (size_t) (slots + d) * kMatrixSize;
+    }
+
+    for (int b = startBranch; b < endBranch; b++) {
+        const int firstSegment = segmentOffsets[b];
+        const int segmentCount = segmentOffsets[b + 1] - firstSegment;
+        double branchLength = 0.0;
+        for (int s = 0; s < segmentCount; s++)
+            branchLength += segmentLengths[firstSegment + s];
+
+        REALTYPE* outMatrices[3];
+        outMatrices[0] = gTransitionMatrices[probabilityIndices[b]];
+        if (slots > 1)
+            outMatrices[1] = gTransitionMatrices[firstDerivativeIndices[b]];
+        if (slots > 2)
+            outMatrices[2] = gTransitionMatrices[secondDerivativeIndices[b]];
+
+        for (int l = 0; l < kCategoryCount; l++) {
+            const size_t categoryOffset = (size_t) l * kMatrixSize;
+            for (int s = 0; s < segmentCount; s++) {
+                const REALTYPE* P[3];
+                for (int d = 0; d < slots; d++)
+                    P[d] = gEpochMatrices + ((size_t) (firstSegment + s) * slots + d) * matrixStride + categoryOffset;
+                const REALTYPE w = (REALTYPE) (branchLength > 0.0 ?
+                                               segmentLengths[firstSegment + s] / branchLength :
+                                               1.0 / segmentCount);
+                if (s == 0) {
+                    memcpy(M[0], P[0], sizeof(REALTYPE) * kMatrixSize);
+                    for (int d = 1; d < slots; d++) {
+                        const REALTYPE scale = (d == 1 ? w : w * w);
+                        for (int i = 0; i < kMatrixSize; i++)
+                            M[d][i] = scale * P[d][i];
+                    }
+                    continue;
+                }
+                multiplyPaddedMatrices(M[0], P[0], 1.0, T[0], false);
+                if (slots > 1) {
+                    multiplyPaddedMatrices(M[1], P[0], 1.0, T[1], false);
+                    multiplyPaddedMatrices(M[0], P[1], w, T[1], true);
+                }
+                if (slots > 2) {
+                    multiplyPaddedMatrices(M[2], P[0], 1.0, T[2], false);
+                    multiplyPaddedMatrices(M[1], P[1], 2 * w, T[2], true);
+                    multiplyPaddedMatrices(M[0], P[2], w * w, T[2], true);
+                }
+                for (int d = 0; d < slots; d++)
+                    std::swap(M[d], T[d]);
+            }
+
+            for (int d = 0; d < slots; d++) {
+                REALTYPE* out = outMatrices[d] + categoryOffset;
+                memcpy(out, M[d], sizeof(REALTYPE) * kMatrixSize);
+                if (T_PAD != 0) {
+                    for (int i = 0; i < kStateCount; i++)
+                        out[i * kTransPaddedStateCount + kStateCount] = (d == 0 ? 1.0 : 0.0);
+                }
+            }
+        }
+    }
+
+    free(products);
+}
+
+// row-major with i-k-j loops so the innermost loop runs along contiguous rows of B and C
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::multiplyPaddedMatrices(const REALTYPE* A,
+                                                              const REALTYPE* B,
+                                                              REALTYPE scale,
+                                                              REALTYPE* C,
+                                                              bool accumulate) {
+    for (int i = 0; i < kStateCount; i++) {
+        REALTYPE* __restrict c = C + i * kTransPaddedStateCount;
+        const REALTYPE* a = A + i * kTransPaddedStateCount;
+        if (!accumulate) {
+            for (int j = 0; j < kStateCount; j++)
+                c[j] = 0.0;
+        }
+        for (int k = 0; k < kStateCount; k++) {
+            const REALTYPE aik = scale * a[k];
+            const REALTYPE* __restrict bRow = B + k * kTransPaddedStateCount;
+            for (int j = 0; j < kStateCount; j++)
+                c[j] += aik * bRow[j];
+        }
+    }
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::addTransitionMatrices(const int* firstIndices,
                                                              const int* secondIndices,
@@ -1213,6 +1829,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::transposeTransitionMatrices(
             C += kStateCount * kTransPaddedStateCount;
         }
     }
+    invalidateMatrices(resultIndices, matrixCount);
 
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr, "\t Leaving BeagleCPUImpl::transposeTransitionMatrices \n");
@@ -1232,8 +1849,114 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatrices(int eigenIndex,
     //     printf("uTM %d %d %f %d\n", eigenIndex, probabilityIndices[i], edgeLengths[i], 0);
     // }
 
+    if (kMatrixMemoEnabled && eigenIndex >= 0 && eigenIndex < kEigenDecompCount)
+        return updateTransitionMatricesWithMemo(eigenIndex, probabilityIndices, firstDerivativeIndices,
+                                                secondDerivativeIndices, edgeLengths, count);
+
     gEigenDecomposition->updateTransitionMatrices(eigenIndex,probabilityIndices,firstDerivativeIndices,secondDerivativeIndices,
                                                   edgeLengths,gCategoryRates[0],gTransitionMatrices,count);
+    invalidateMatrices(probabilityIndices, count);
+    invalidateMatrices(firstDerivativeIndices, count);
+    invalidateMatrices(secondDerivativeIndices, count);
+    return BEAGLE_SUCCESS;
+}
+
+/*
+ * Edges whose eigen decomposition and length are memoised are copied from the buffers of their
+ * entry, or left alone when they are those buffers. Runs of other edges are computed together
+ * and become entries; a run is computed before any copy, as the copy may read from it.
+ */
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatricesWithMemo(int eigenIndex,
+                                                                        const int* probabilityIndices,
+                                                                        const int* firstDerivativeIndices,
+                                                                        const int* secondDerivativeIndices,
+                                                                        const double* edgeLengths,
+                                                                        int count) {
+    if (firstDerivativeIndices == NULL)
+        secondDerivativeIndices = NULL;
+    const int* indices[3] = { probabilityIndices, firstDerivativeIndices, secondDerivativeIndices };
+    std::map<double, MatrixMemoEntry>& memo = gMatrixMemo[eigenIndex];
+
+    int runStart = 0;
+    for (int u = 0; u <= count; u++) {
+        MatrixMemoEntry source;
+        bool hit = false;
+        if (u < count && edgeLengths[u] == edgeLengths[u] && memo.count(edgeLengths[u]) > 0) {
+            source = memo[edgeLengths[u]];
+            hit = true;
+            for (int d = 0; d < 3 && hit; d++) {
+                if (indices[d] == NULL)
+                    continue;
+                hit = (source.matrixIndices[d] >= 0);
+                // buffers overlapping their entry in another role are recomputed
+                for (int e = 0; e < 3 && hit; e++)
+                    hit = (e == d || indices[d][u] != source.matrixIndices[e]);
+            }
+        }
+
+        if ((hit || u == count) && runStart < u) {
+            gEigenDecomposition->updateTransitionMatrices(eigenIndex, probabilityIndices + runStart,
+                    (firstDerivativeIndices != NULL ? firstDerivativeIndices + runStart : NULL),
+                    (secondDerivativeIndices != NULL ? secondDerivativeIndices + runStart : NULL),
+                    edgeLengths + runStart, gCategoryRates[0], gTransitionMatrices, u - runStart);
+        }
+        if (u == count)
+            break;
+
+        if (hit) {
+            for (int d = 0; d < 3; d++) {
+                if (indices[d] != NULL && indices[d][u] != source.matrixIndices[d]) {
+                    invalidateMatrices(&indices[d][u], 1);
+                    memcpy(gTransitionMatrices[indices[d][u]], gTransitionMatrices[source.matrixIndices[d]],
+                           sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
+                }
+            }
+            kMatrixMemoHitCount++;
+            runStart = u + 1;
+        } else {
+            for (int d = 0; d < 3; d++) {
+                if (indices[d] != NULL)
+                    invalidateMatrices(&indices[d][u], 1);
+            }
+            const double edgeLength = edgeLengths[u];
+            if (edgeLength == edgeLength) {
+                if (memo.count(edgeLength) > 0)
+                    dropMatrixMemoEntry(memo[edgeLength].matrixIndices[0]);
+                MatrixMemoEntry& entry = memo[edgeLength];
+                for (int d = 0; d < 3; d++) {
+                    entry.matrixIndices[d] = (indices[d] != NULL ? indices[d][u] : -1);
+                    if (indices[d] != NULL)
+                        gMatrixMemoKeys[indices[d][u]] = std::make_pair(eigenIndex, edgeLength);
+                }
+            }
+            kMatrixMemoMissCount++;
+        }
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTransitionMatrixMemo(bool enabled) {
+    kMatrixMemoEnabled = false;
+    gMatrixMemo.clear();
+    gMatrixMemoKeys.clear();
+    if (enabled) {
+        gMatrixMemo.resize(kEigenDecompCount);
+        gMatrixMemoKeys.assign(kMatrixCount, std::make_pair(-1, 0.0));
+    }
+    kMatrixMemoEnabled = enabled;
+    kMatrixMemoHitCount = 0;
+    kMatrixMemoMissCount = 0;
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getTransitionMatrixMemoCounts(long* outHitCount,
+                                                                     long* outMissCount) {
+    *outHitCount = kMatrixMemoHitCount;
+    *outMissCount = kMatrixMemoMissCount;
     return BEAGLE_SUCCESS;
 }
 
@@ -1248,6 +1971,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatricesWithModelCategori
 
     gEigenDecomposition->updateTransitionMatricesWithModelCategories(eigenIndices,probabilityIndices,firstDerivativeIndices,secondDerivativeIndices,
                                                   edgeLengths,gTransitionMatrices,count);
+    invalidateMatrices(probabilityIndices, count);
+    invalidateMatrices(firstDerivativeIndices, count);
+    invalidateMatrices(secondDerivativeIndices, count);
     return BEAGLE_SUCCESS;
 }
 
@@ -1261,30 +1987,64 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatricesWithMultipleModel
                                                                                   const double* edgeLengths,
                                                                                   int count) {
 
-    // TODO: move loop to within gEigenDecomposition
-
+    if (firstDerivativeIndices == NULL)
+        secondDerivativeIndices = NULL;
+
+    // edges sharing an eigen system are batched together, so gather them in eigen order
+    std::vector<int> order(count);
+    for (int i = 0; i < count; i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+                     [eigenIndices](int a, int b) { return eigenIndices[a] < eigenIndices[b]; });
+
+    std::vector<int> sortedIndices(5 * (size_t) count);
+    std::vector<double> sortedLengths(count);
+    int* sortedEigens = &sortedIndices[0];
+    int* sortedRates = sortedEigens + count;
+    int* sortedProbabilities = sortedRates + count;
+    int* sortedFirst = sortedProbabilities + count;
+    int* sortedSecond = sortedFirst + count;
     for (int i = 0; i < count; i++) {
-        // printf("uTMWMM %d %d %f %d\n", eigenIndices[i], probabilityIndices[i], edgeLengths[i], categoryRateIndices[i]);
-
-        const int* firstDeriv  = NULL;
-        const int* secondDeriv = NULL;
-        if (firstDerivativeIndices != NULL && secondDerivativeIndices == NULL) {
-            firstDeriv = &firstDerivativeIndices[i];
-        } else if (firstDerivativeIndices != NULL && secondDerivativeIndices != NULL) {
-            firstDeriv  = &firstDerivativeIndices[i];
-            secondDeriv = &secondDerivativeIndices[i];
+        const int e = order[i];
+        sortedEigens[i] = eigenIndices[e];
+        sortedRates[i] = (categoryRateIndices != NULL ? categoryRateIndices[e] : 0);
+        sortedProbabilities[i] = probabilityIndices[e];
+        if (firstDerivativeIndices != NULL)
+            sortedFirst[i] = firstDerivativeIndices[e];
+        if (secondDerivativeIndices != NULL)
+            sortedSecond[i] = secondDerivativeIndices[e];
+        sortedLengths[i] = edgeLengths[e];
+    }
+    if (firstDerivativeIndices == NULL)
+        sortedFirst = NULL;
+    if (secondDerivativeIndices == NULL)
+        sortedSecond = NULL;
+
+    const int threadCount = (kThreadingEnabled ? kNumThreads : 1);
+    const double work = (double) count * kCategoryCount * kStateCount * kStateCount * kStateCount;
+    if (threadCount < 2 || count < 2 || work < BEAGLE_CPU_MATRIX_ASYNC_MIN_COUNT ||
+        !gEigenDecomposition->supportsConcurrentUpdates()) {
+        gEigenDecomposition->updateTransitionMatricesWithMultipleModels(sortedEigens, sortedRates,
+                sortedProbabilities, sortedFirst, sortedSecond, &sortedLengths[0], gCategoryRates,
+                gTransitionMatrices, 0, count);
+    } else {
+        const int edgesPerThread = (count + threadCount - 1) / threadCount;
+        int threadsUsed = 0;
+        for (int startEdge = 0; startEdge < count; startEdge += edgesPerThread) {
+            std::packaged_task<void()> threadTask(
+                std::bind(&EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatricesWithMultipleModels,
+                          gEigenDecomposition, sortedEigens, sortedRates, sortedProbabilities,
+                          sortedFirst, sortedSecond, &sortedLengths[0], gCategoryRates,
+                          gTransitionMatrices, startEdge, std::min(startEdge + edgesPerThread, count)));
+            enqueueThreadTask(threadsUsed++, threadTask);
         }
-
-        gEigenDecomposition->updateTransitionMatrices(eigenIndices[i],
-                                                      &probabilityIndices[i],
-                                                      firstDeriv,
-                                                      secondDeriv,
-                                                      &edgeLengths[i],
-                                                      gCategoryRates[categoryRateIndices[i]],
-                                                      gTransitionMatrices,
-                                                      1);
+        waitThreadTasks(threadsUsed);
     }
 
+    invalidateMatrices(probabilityIndices, count);
+    invalidateMatrices(firstDerivativeIndices, count);
+    invalidateMatrices(secondDerivativeIndices, count);
+
     return BEAGLE_SUCCESS;
 }
 
@@ -1296,16 +2056,20 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartials(const int* operations,
 
     int returnCode = BEAGLE_ERROR_GENERAL;
 
+    recycleMissingTags();
+
     if (kAutoPartitioningEnabled) {
         autoPartitionPartialsOperations(operations,
                                         gAutoPartitionOperations,
                                         count,
                                         cumulativeScaleIndex);
         count *= kPartitionCount;
+        prepareSparseMatrices((const int*) gAutoPartitionOperations, count, true);
         returnCode = upPartialsByPartitionAsync((const int*) gAutoPartitionOperations,
                                                 count);
     } else {
         bool byPartition = false;
+        prepareSparseMatrices(operations, count, byPartition);
         returnCode = upPartials(byPartition,
                                 operations,
                                 count,
@@ -1322,8 +2086,18 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePrePartials(const int *operations,
                                                          int cumulativeScaleIndex) {
     int returnCode = BEAGLE_ERROR_GENERAL;
 
-    bool byPartition = false;
-    returnCode = upPrePartials(byPartition, operations, count, cumulativeScaleIndex);
+    if (kAutoPartitioningEnabled) {
+        autoPartitionPartialsOperations(operations,
+                                        gAutoPartitionOperations,
+                                        count,
+                                        cumulativeScaleIndex);
+        count *= kPartitionCount;
+        returnCode = upPrePartialsByPartitionAsync((const int*) gAutoPartitionOperations,
+                                                   count);
+    } else {
+        bool byPartition = false;
+        returnCode = upPrePartials(byPartition, operations, count, cumulativeScaleIndex);
+    }
 
     return returnCode;
 }
@@ -1391,21 +2165,424 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateCrossProducts(const int *postBuf
             outSumSquaredDerivatives);
 }
 
+/*
+ * Derivatives of the log likelihood with respect to each edge length,
+ *   sum_p w_p N_p / D_p   and   sum_p w_p (N2_p / D_p - (N_p / D_p)^2)
+ * where D_p = sum_c pi_c pre' post, N_p = sum_c pi_c r_c pre' Q post and N2_p uses r_c^2 Q Q.
+ * Work items are blocks of BEAGLE_CPU_GRADIENT_BLOCK_PATTERN_COUNT patterns of one edge, split
+ * across the thread queues; block sums are added in order, so results do not depend on threading.
+ */
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartialsByPartition(const int* operations,
-                                                                 int count) {
-
-    int returnCode = BEAGLE_ERROR_GENERAL;
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateEdgeGradients(const int* postorderOperations,
+                                                              int postorderCount,
+                                                              const int* preorderOperations,
+                                                              int preorderCount,
+                                                              const int* postBufferIndices,
+                                                              const int* preBufferIndices,
+                                                              const int* differentialMatrixIndices,
+                                                              const int* secondDifferentialMatrixIndices,
+                                                              const int* categoryWeightsIndices,
+                                                              const int* categoryRatesIndices,
+                                                              int count,
+                                                              double* outGradient,
+                                                              double* outDiagonalHessian) {
+    const bool doHessian = (secondDifferentialMatrixIndices != NULL);
+    if (count < 0 || outGradient == NULL || (doHessian && outDiagonalHessian == NULL))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
 
-    if (kThreadingEnabled) {
-        returnCode = upPartialsByPartitionAsync(operations,
-                                                count);
+    for (int e = 0; e < count; e++) {
+        const int post = postBufferIndices[e];
+        const int pre = preBufferIndices[e];
+        const int weights = categoryWeightsIndices[e];
+        const int rates = (categoryRatesIndices != NULL ? categoryRatesIndices[e] : 0);
+        if (post < 0 || post >= kBufferCount || pre < 0 || pre >= kBufferCount ||
+            (gTipStates[post] == NULL && gPartials[post] == NULL) || gPartials[pre] == NULL ||
+            differentialMatrixIndices[e] < 0 || differentialMatrixIndices[e] >= kMatrixCount ||
+            (doHessian && (secondDifferentialMatrixIndices[e] < 0 ||
+                           secondDifferentialMatrixIndices[e] >= kMatrixCount)) ||
+            weights < 0 || weights >= kEigenDecompCount || gCategoryWeights[weights] == NULL ||
+            rates < 0 || rates >= kEigenDecompCount ||
+            (categoryRatesIndices != NULL && gCategoryRates[rates] == NULL))
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    int returnCode;
+    if (postorderOperations != NULL && postorderCount > 0) {
+        returnCode = updatePartials(postorderOperations, postorderCount, BEAGLE_OP_NONE);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+    }
+    if (preorderOperations != NULL && preorderCount > 0) {
+        returnCode = updatePrePartials(preorderOperations, preorderCount, BEAGLE_OP_NONE);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+    }
+    if (count == 0)
+        return BEAGLE_SUCCESS;
+
+    const int blocksPerEdge = (kPatternCount + BEAGLE_CPU_GRADIENT_BLOCK_PATTERN_COUNT - 1) /
+                              BEAGLE_CPU_GRADIENT_BLOCK_PATTERN_COUNT;
+    const int blockCount = count * blocksPerEdge;
+    std::vector<double> blockSums(2 * (size_t) blockCount);
+
+    const int threadCount = (kThreadingEnabled ? kNumThreads : 1);
+    const double work = (double) count * kPatternCount * kCategoryCount * kStateCount * kStateCount *
+                        (doHessian ? 2 : 1);
+    if (threadCount < 2 || blockCount < 2 || work < BEAGLE_CPU_GRADIENT_ASYNC_MIN_COUNT) {
+        calcEdgeGradientBlocks(postBufferIndices, preBufferIndices, differentialMatrixIndices,
+                               secondDifferentialMatrixIndices, categoryWeightsIndices,
+                               categoryRatesIndices, blocksPerEdge, 0, blockCount, &blockSums[0]);
     } else {
-        bool byPartition = true;
-        returnCode = upPartials(byPartition,
-                                operations,
-                                count,
-                                BEAGLE_OP_NONE);
+        const int blocksPerThread = (blockCount + threadCount - 1) / threadCount;
+        int threadsUsed = 0;
+        for (int startBlock = 0; startBlock < blockCount; startBlock += blocksPerThread) {
+            std::packaged_task<void()> threadTask(
+                std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeGradientBlocks, this,
+                          postBufferIndices, preBufferIndices, differentialMatrixIndices,
+                          secondDifferentialMatrixIndices, categoryWeightsIndices,
+                          categoryRatesIndices, blocksPerEdge, startBlock,
+                          std::min(startBlock + blocksPerThread, blockCount), &blockSums[0]));
+            enqueueThreadTask(threadsUsed++, threadTask);
+        }
+        waitThreadTasks(threadsUsed);
+    }
+
+    for (int e = 0; e < count; e++) {
+        double gradient = 0.0;
+        double hessian = 0.0;
+        for (int b = e * blocksPerEdge; b < (e + 1) * blocksPerEdge; b++) {
+            gradient += blockSums[2 * b];
+            hessian += blockSums[2 * b + 1];
+        }
+        outGradient[e] = gradient;
+        if (doHessian)
+            outDiagonalHessian[e] = hessian;
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+/*
+ * Numerators and denominator of each pattern of a block are accumulated over categories on the
+ * stack; a missing tip state has post-order partials of one.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeGradientBlocks(const int* postBufferIndices,
+                                                              const int* preBufferIndices,
+                                                              const int* differentialMatrixIndices,
+                                                              const int* secondDifferentialMatrixIndices,
+                                                              const int* categoryWeightsIndices,
+                                                              const int* categoryRatesIndices,
+                                                              int blocksPerEdge,
+                                                              int startBlock,
+                                                              int endBlock,
+                                                              double* outBlockSums) {
+    const bool doHessian = (secondDifferentialMatrixIndices != NULL);
+
+    REALTYPE numerator[BEAGLE_CPU_GRADIENT_BLOCK_PATTERN_COUNT];
+    REALTYPE secondNumerator[BEAGLE_CPU_GRADIENT_BLOCK_PATTERN_COUNT];
+    REALTYPE denominator[BEAGLE_CPU_GRADIENT_BLOCK_PATTERN_COUNT];
+
+    for (int block = startBlock; block < endBlock; block++) {
+        const int edge = block / blocksPerEdge;
+        const int startPattern = (block % blocksPerEdge) * BEAGLE_CPU_GRADIENT_BLOCK_PATTERN_COUNT;
+        const int patternCount = std::min(BEAGLE_CPU_GRADIENT_BLOCK_PATTERN_COUNT,
+                                          kPatternCount - startPattern);
+
+        const int* tipStates = gTipStates[postBufferIndices[edge]];
+        const REALTYPE* postOrderPartial = gPartials[postBufferIndices[edge]];
+        const REALTYPE* preOrderPartial = gPartials[preBufferIndices[edge]];
+        const REALTYPE* firstMatrix = gTransitionMatrices[differentialMatrixIndices[edge]];
+        const REALTYPE* secondMatrix = (doHessian ?
+                gTransitionMatrices[secondDifferentialMatrixIndices[edge]] : NULL);
+        const REALTYPE* categoryWeights = gCategoryWeights[categoryWeightsIndices[edge]];
+        const double* categoryRates = (categoryRatesIndices != NULL ?
+                gCategoryRates[categoryRatesIndices[edge]] : NULL);
+
+        std::fill(numerator, numerator + patternCount, (REALTYPE) 0);
+        std::fill(secondNumerator, secondNumerator + patternCount, (REALTYPE) 0);
+        std::fill(denominator, denominator + patternCount, (REALTYPE) 0);
+
+        for (int category = 0; category < kCategoryCount; category++) {
+            const REALTYPE rate = (categoryRates != NULL ? (REALTYPE) categoryRates[category] : 1);
+            const REALTYPE weight = categoryWeights[category];
+            const REALTYPE firstWeight = weight * rate;
+            const REALTYPE secondWeight = firstWeight * rate;
+            const REALTYPE* first = firstMatrix + category * kMatrixSize;
+            const REALTYPE* second = (doHessian ? secondMatrix + category * kMatrixSize : NULL);
+
+            for (int i = 0; i < patternCount; i++) {
+                const int pattern = startPattern + i;
+                const int v = category * kPartialsCategoryStride + pattern * kPartialsPatternStride;
+                const REALTYPE* pre = preOrderPartial + v;
+
+                REALTYPE sumFirst = 0.0;
+                REALTYPE sumSecond = 0.0;
+                REALTYPE sumDenominator = 0.0;
+
+                if (tipStates != NULL) {
+                    const int state = tipStates[pattern];
+                    if (state < kStateCount) {
+                        for (int k = 0; k < kStateCount; k++) {
+                            sumFirst += first[k * kTransPaddedStateCount + state] * pre[k];
+                            if (doHessian)
+                                sumSecond += second[k * kTransPaddedStateCount + state] * pre[k];
+                        }
+                        sumDenominator = pre[state];
+                    } else {
+                        for (int k = 0; k < kStateCount; k++) {
+                            REALTYPE firstRow = 0.0;
+                            REALTYPE secondRow = 0.0;
+                            for (int j = 0; j < kStateCount; j++) {
+                                firstRow += first[k * kTransPaddedStateCount + j];
+                                if (doHessian)
+                                    secondRow += second[k * kTransPaddedStateCount + j];
+                            }
+                            sumFirst += firstRow * pre[k];
+                            sumSecond += secondRow * pre[k];
+                            sumDenominator += pre[k];
+                        }
+                    }
+                } else {
+                    const REALTYPE* post = postOrderPartial + v;
+                    for (int k = 0; k < kStateCount; k++) {
+                        const REALTYPE* firstRow = first + k * kTransPaddedStateCount;
+                        REALTYPE firstSum = 0.0;
+                        for (int j = 0; j < kStateCount; j++)
+                            firstSum += firstRow[j] * post[j];
+                        sumFirst += firstSum * pre[k];
+                        if (doHessian) {
+                            const REALTYPE* secondRow = second + k * kTransPaddedStateCount;
+                            REALTYPE secondSum = 0.0;
+                            for (int j = 0; j < kStateCount; j++)
+                                secondSum += secondRow[j] * post[j];
+                            sumSecond += secondSum * pre[k];
+                        }
+                        sumDenominator += post[k] * pre[k];
+                    }
+                }
+
+                numerator[i] += firstWeight * sumFirst;
+                secondNumerator[i] += secondWeight * sumSecond;
+                denominator[i] += weight * sumDenominator;
+            }
+        }
+
+        double gradient = 0.0;
+        double hessian = 0.0;
+        for (int i = 0; i < patternCount; i++) {
+            const double patternWeight = gPatternWeights[startPattern + i];
+            const double derivative = numerator[i] / denominator[i];
+            gradient += patternWeight * derivative;
+            if (doHessian)
+                hessian += patternWeight * (secondNumerator[i] / denominator[i] - derivative * derivative);
+        }
+        outBlockSums[2 * block] = gradient;
+        outBlockSums[2 * block + 1] = hessian;
+    }
+}
+
+/*
+ * Cross products of all edges for each category, accumulated by blocks of patterns of one edge
+ * into one buffer per thread queue (summed in queue order), then contracted with the
+ * differential matrix of each parameter.
+ */
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateParameterGradients(const int* postBufferIndices,
+                                                                   const int* preBufferIndices,
+                                                                   const int* categoryRatesIndices,
+                                                                   const int* categoryWeightsIndices,
+                                                                   const double* edgeLengths,
+                                                                   int count,
+                                                                   const int* differentialMatrixIndices,
+                                                                   int parameterCount,
+                                                                   double* outGradients) {
+    if (count < 0 || parameterCount < 0 || (parameterCount > 0 && outGradients == NULL))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    for (int e = 0; e < count; e++) {
+        const int post = postBufferIndices[e];
+        const int pre = preBufferIndices[e];
+        const int rates = (categoryRatesIndices != NULL ? categoryRatesIndices[e] : 0);
+        const int weights = categoryWeightsIndices[e];
+        if (post < 0 || post >= kBufferCount || pre < 0 || pre >= kBufferCount ||
+            (gTipStates[post] == NULL && gPartials[post] == NULL) || gPartials[pre] == NULL ||
+            rates < 0 || rates >= kEigenDecompCount || gCategoryRates[rates] == NULL ||
+            weights < 0 || weights >= kEigenDecompCount || gCategoryWeights[weights] == NULL)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    for (int d = 0; d < parameterCount; d++) {
+        if (differentialMatrixIndices[d] < 0 || differentialMatrixIndices[d] >= kMatrixCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    const int crossProductsSize = kStateCount * kStateCount * kCategoryCount;
+    const int blocksPerEdge = (kPatternCount + BEAGLE_CPU_GRADIENT_BLOCK_PATTERN_COUNT - 1) /
+                              BEAGLE_CPU_GRADIENT_BLOCK_PATTERN_COUNT;
+    const int blockCount = count * blocksPerEdge;
+
+    int threadCount = (kThreadingEnabled ? kNumThreads : 1);
+    const double work = (double) count * kPatternCount * kCategoryCount * kStateCount * kStateCount;
+    if (blockCount < 2 || work < BEAGLE_CPU_GRADIENT_ASYNC_MIN_COUNT)
+        threadCount = 1;
+
+    std::vector<double> crossProducts((size_t) crossProductsSize * threadCount, 0.0);
+
+    if (threadCount == 1) {
+        calcParameterCrossProductBlocks(postBufferIndices, preBufferIndices, categoryRatesIndices,
+                                        categoryWeightsIndices, edgeLengths, blocksPerEdge,
+                                        0, blockCount, &crossProducts[0]);
+    } else {
+        const int blocksPerThread = (blockCount + threadCount - 1) / threadCount;
+        int threadsUsed = 0;
+        for (int startBlock = 0; startBlock < blockCount; startBlock += blocksPerThread) {
+            std::packaged_task<void()> threadTask(
+                std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcParameterCrossProductBlocks, this,
+                          postBufferIndices, preBufferIndices, categoryRatesIndices,
+                          categoryWeightsIndices, edgeLengths, blocksPerEdge, startBlock,
+                          std::min(startBlock + blocksPerThread, blockCount),
+                          &crossProducts[(size_t) threadsUsed * crossProductsSize]));
+            enqueueThreadTask(threadsUsed++, threadTask);
+        }
+        waitThreadTasks(threadsUsed);
+
+        for (int i = 1; i < threadsUsed; i++) {
+            const double* threadCrossProducts = &crossProducts[(size_t) i * crossProductsSize];
+            for (int k = 0; k < crossProductsSize; k++)
+                crossProducts[k] += threadCrossProducts[k];
+        }
+    }
+
+    for (int d = 0; d < parameterCount; d++) {
+        const REALTYPE* differential = gTransitionMatrices[differentialMatrixIndices[d]];
+        double gradient = 0.0;
+        for (int category = 0; category < kCategoryCount; category++) {
+            const double* cross = &crossProducts[(size_t) category * kStateCount * kStateCount];
+            const REALTYPE* matrix = differential + category * kMatrixSize;
+            for (int i = 0; i < kStateCount; i++) {
+                for (int j = 0; j < kStateCount; j++)
+                    gradient += cross[i * kStateCount + j] * matrix[i * kTransPaddedStateCount + j];
+            }
+        }
+        outGradients[d] = gradient;
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+/*
+ * Each pattern of a block adds w_p / L_p * pi_c * r_c * t times the outer product of its pre-order
+ * and post-order partials to the cross products of category c; a missing tip state has post-order
+ * partials of one.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcParameterCrossProductBlocks(const int* postBufferIndices,
+                                                                       const int* preBufferIndices,
+                                                                       const int* categoryRatesIndices,
+                                                                       const int* categoryWeightsIndices,
+                                                                       const double* edgeLengths,
+                                                                       int blocksPerEdge,
+                                                                       int startBlock,
+                                                                       int endBlock,
+                                                                       double* outCrossProducts) {
+    REALTYPE patternScale[BEAGLE_CPU_GRADIENT_BLOCK_PATTERN_COUNT];
+
+    for (int block = startBlock; block < endBlock; block++) {
+        const int edge = block / blocksPerEdge;
+        const int startPattern = (block % blocksPerEdge) * BEAGLE_CPU_GRADIENT_BLOCK_PATTERN_COUNT;
+        const int patternCount = std::min(BEAGLE_CPU_GRADIENT_BLOCK_PATTERN_COUNT,
+                                          kPatternCount - startPattern);
+
+        const int* tipStates = gTipStates[postBufferIndices[edge]];
+        const REALTYPE* postOrderPartial = gPartials[postBufferIndices[edge]];
+        const REALTYPE* preOrderPartial = gPartials[preBufferIndices[edge]];
+        const double* categoryRates = gCategoryRates[categoryRatesIndices != NULL ?
+                                                     categoryRatesIndices[edge] : 0];
+        const REALTYPE* categoryWeights = gCategoryWeights[categoryWeightsIndices[edge]];
+
+        // site likelihoods of the block
+        std::fill(patternScale, patternScale + patternCount, (REALTYPE) 0);
+        for (int category = 0; category < kCategoryCount; category++) {
+            const REALTYPE weight = categoryWeights[category];
+            for (int i = 0; i < patternCount; i++) {
+                const int pattern = startPattern + i;
+                const int v = category * kPartialsCategoryStride + pattern * kPartialsPatternStride;
+                const REALTYPE* pre = preOrderPartial + v;
+                REALTYPE likelihood = 0.0;
+                if (tipStates != NULL) {
+                    const int state = tipStates[pattern];
+                    if (state < kStateCount) {
+                        likelihood = pre[state];
+                    } else {
+                        for (int k = 0; k < kStateCount; k++)
+                            likelihood += pre[k];
+                    }
+                } else {
+                    const REALTYPE* post = postOrderPartial + v;
+                    for (int k = 0; k < kStateCount; k++)
+                        likelihood += pre[k] * post[k];
+                }
+                patternScale[i] += weight * likelihood;
+            }
+        }
+        for (int i = 0; i < patternCount; i++)
+            patternScale[i] = (REALTYPE) gPatternWeights[startPattern + i] / patternScale[i];
+
+        for (int category = 0; category < kCategoryCount; category++) {
+            const REALTYPE categoryScale = categoryWeights[category] *
+                                           (REALTYPE) (categoryRates[category] * edgeLengths[edge]);
+            double* __restrict cross = outCrossProducts + category * kStateCount * kStateCount;
+
+            for (int i = 0; i < patternCount; i++) {
+                const int pattern = startPattern + i;
+                const int v = category * kPartialsCategoryStride + pattern * kPartialsPatternStride;
+                const REALTYPE* pre = preOrderPartial + v;
+                const REALTYPE scale = categoryScale * patternScale[i];
+
+                if (tipStates != NULL) {
+                    const int state = tipStates[pattern];
+                    if (state < kStateCount) {
+                        for (int k = 0; k < kStateCount; k++)
+                            cross[k * kStateCount + state] += scale * pre[k];
+                    } else {
+                        for (int k = 0; k < kStateCount; k++) {
+                            const double a = scale * pre[k];
+                            for (int j = 0; j < kStateCount; j++)
+                                cross[k * kStateCount + j] += a;
+                        }
+                    }
+                } else {
+                    const REALTYPE* __restrict post = postOrderPartial + v;
+                    for (int k = 0; k < kStateCount; k++) {
+                        const double a = scale * pre[k];
+                        double* __restrict row = cross + k * kStateCount;
+                        for (int j = 0; j < kStateCount; j++)
+                            row[j] += a * post[j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartialsByPartition(const int* operations,
+                                                                 int count) {
+
+    int returnCode = BEAGLE_ERROR_GENERAL;
+
+    recycleMissingTags();
+    prepareSparseMatrices(operations, count, true);
+
+    if (kThreadingEnabled) {
+        returnCode = upPartialsByPartitionAsync(operations,
+                                                count);
+    } else {
+        bool byPartition = true;
+        returnCode = upPartials(byPartition,
+                                operations,
+                                count,
+                                BEAGLE_OP_NONE);
     }
 
     return returnCode;
@@ -1418,9 +2595,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePrePartialsByPartition(const int* o
     int returnCode = BEAGLE_ERROR_GENERAL;
 
     if (kThreadingEnabled) {
-//        TODO
-//        returnCode = upPrePartialsByPartitionAsync(operations,
-//                                                   count);
+        returnCode = upPrePartialsByPartitionAsync(operations,
+                                                   count);
     } else {
         bool byPartition = true;
         returnCode = upPrePartials(byPartition,
@@ -1476,20 +2652,44 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartialsByPartitionAsync(const int* ope
                       gThreadOpCounts[i],
                       BEAGLE_OP_NONE));
 
-        gFutures[i] = threadTask.get_future();
-        threadData* td = &gThreads[i];
+        enqueueThreadTask(i, threadTask);
+    }
 
-        std::unique_lock<std::mutex> l(td->m);
-        td->jobs.push(std::move(threadTask));
-        l.unlock();
+    waitThreadTasks(kNumThreads);
+
+    return BEAGLE_SUCCESS;
+}
 
-        gThreads[i].cv.notify_one();
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPrePartialsByPartitionAsync(const int* operations,
+                                                                     int count) {
+
+    int numOps = BEAGLE_PARTITION_OP_COUNT;
+
+    memset(gThreadOpCounts, 0, sizeof(int) * kNumThreads);
+
+    // operations for a partition stay on one thread and keep their pre-order sequence
+    for (int i=0; i<count; i++) {
+        int t = operations[i * numOps + 7] % kNumThreads;
+        for (int j=0; j<numOps; j++) {
+            gThreadOperations[t][gThreadOpCounts[t]*numOps + j] = operations[i*numOps + j];
+        }
+        gThreadOpCounts[t]++;
     }
 
     for (int i=0; i<kNumThreads; i++) {
-        gFutures[i].wait();
+        std::packaged_task<void()> threadTask(
+            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPrePartials, this,
+                      true,
+                      (const int*) gThreadOperations[i],
+                      gThreadOpCounts[i],
+                      BEAGLE_OP_NONE));
+
+        enqueueThreadTask(i, threadTask);
     }
 
+    waitThreadTasks(kNumThreads);
+
     return BEAGLE_SUCCESS;
 }
 
@@ -1562,10 +2762,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
         } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
             rescale = 1;
             scalingFactors = gScaleBuffers[parIndex - kTipCount];
-        } else if (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC) { // TODO: this is a quick and dirty implementation just so it returns correct results
-            if (tipStates1 == 0 && tipStates2 == 0) {
-                rescale = 1;
-                removeScaleFactors(&readScalingIndex, 1, cumulativeScaleIndex);
+        } else if (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC) {
+            if (tipStates1 == 0 && tipStates2 == 0 && writeScalingIndex >= 0) {
+                rescale = 3;
                 scalingFactors = gScaleBuffers[writeScalingIndex];
             }
         } else if (writeScalingIndex >= 0) {
@@ -1581,79 +2780,56 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
                      << " readIndex = " << readScalingIndex << "\n";
         }
 
-        if (tipStates1 != NULL) {
-            if (tipStates2 != NULL ) {
-                if (rescale == 0) { // Use fixed scaleFactors
-                    calcStatesStatesFixedScaling(destPartials, tipStates1, matrices1, tipStates2,
-                                                 matrices2, scalingFactors, startPattern, endPattern);
-                } else {
-                    // First compute without any scaling
-                    calcStatesStates(destPartials, tipStates1, matrices1, tipStates2, matrices2,
-                                     startPattern, endPattern);
-                    if (rescale == 1) { // Recompute scaleFactors
-                        if (byPartition) {
-                            rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
-                        } else {
-                            rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
-                        }
-                    }
+        const bool sparse = (kSparseMatricesEnabled && (tipStates1 == NULL || tipStates2 == NULL) &&
+                             (rescale == BEAGLE_OP_NONE || rescale == 0 || rescale == 1) &&
+                             (tipStates1 != NULL || gSparseMatrixStates[child1TransMatIndex] == BEAGLE_CPU_SPARSE_SPARSE) &&
+                             (tipStates2 != NULL || gSparseMatrixStates[child2TransMatIndex] == BEAGLE_CPU_SPARSE_SPARSE));
+
+        retainBlockedMatrices(startPattern, endPattern, true);
+        if (rescale == BEAGLE_OP_NONE || rescale == 0 || rescale == 1) {
+            // runs of patterns missing from both subtrees are computed once and copied
+            const unsigned int* tags1 = gMissingTags[child1Index];
+            const unsigned int* tags2 = gMissingTags[child2Index];
+            unsigned int* destTags = gMissingTags[parIndex];
+            const REALTYPE* readFactors = (rescale == 0 ? scalingFactors : NULL);
+            int rangeStart = startPattern;
+            int k = startPattern;
+            while (k < endPattern) {
+                if (tags1[k] == BEAGLE_CPU_MISSING_NONE || tags2[k] == BEAGLE_CPU_MISSING_NONE) {
+                    destTags[k++] = BEAGLE_CPU_MISSING_NONE;
+                    continue;
                 }
-            } else {
-                if (rescale == 0) {
-                    calcStatesPartialsFixedScaling(destPartials, tipStates1, matrices1, partials2,
-                                                   matrices2, scalingFactors, startPattern, endPattern);
-                } else {
-                    calcStatesPartials(destPartials, tipStates1, matrices1, partials2, matrices2,
-                                       startPattern, endPattern);
-                    if (rescale == 1) { // Recompute scaleFactors
-                        if (byPartition) {
-                            rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
-                        } else {
-                            rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
-                        }
-                    }
+                int runEnd = k + 1;
+                while (runEnd < endPattern && tags1[runEnd] == tags1[k] && tags2[runEnd] == tags2[k] &&
+                       (readFactors == NULL || readFactors[runEnd] == readFactors[k]))
+                    runEnd++;
+                std::fill(destTags + k, destTags + runEnd, (unsigned int) kNextMissingTag++);
+                if (runEnd - k >= BEAGLE_CPU_MISSING_MIN_RUN_LENGTH) {
+                    upPartialsRange(destPartials, tipStates1, partials1, matrices1, child1TransMatIndex,
+                                    tipStates2, partials2, matrices2, child2TransMatIndex, rescale,
+                                    scalingFactors, cumulativeScaleBuffer, parIndex, readScalingIndex,
+                                    sparse, rangeStart, k + 1);
+                    copyMissingPatterns(destPartials, (rescale == 1 ? scalingFactors : NULL),
+                                        cumulativeScaleBuffer, k, k + 1, runEnd);
+                    rangeStart = runEnd;
                 }
+                k = runEnd;
             }
-        } else {
-            if (tipStates2 != NULL) {
-                if (rescale == 0) {
-                    calcStatesPartialsFixedScaling(destPartials,tipStates2,matrices2,partials1,matrices1,
-                                                   scalingFactors, startPattern, endPattern);
-                } else {
-                    calcStatesPartials(destPartials, tipStates2, matrices2, partials1, matrices1,
-                                       startPattern, endPattern);
-                    if (rescale == 1) {// Recompute scaleFactors
-                        if (byPartition) {
-                            rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
-                        } else {
-                            rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
-                        }
-                    }
-                }
-            } else {
-                if (rescale == 2) {
-                    int sIndex = parIndex - kTipCount;
-                    calcPartialsPartialsAutoScaling(destPartials,partials1,matrices1,partials2,matrices2,
-                                                     &gActiveScalingFactors[sIndex]);
-                    if (gActiveScalingFactors[sIndex])
-                        autoRescalePartials(destPartials, gAutoScaleBuffers[sIndex]);
-
-                } else if (rescale == 0) {
-                    calcPartialsPartialsFixedScaling(destPartials,partials1,matrices1,partials2,
-                                                     matrices2,scalingFactors,startPattern,endPattern);
-                } else {
-                    calcPartialsPartials(destPartials, partials1, matrices1, partials2, matrices2,
-                                         startPattern, endPattern);
-                    if (rescale == 1) {// Recompute scaleFactors
-                        if (byPartition) {
-                            rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
-                        } else {
-                            rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
-                        }
-                    }
-                }
+            if (rangeStart < endPattern) {
+                upPartialsRange(destPartials, tipStates1, partials1, matrices1, child1TransMatIndex,
+                                tipStates2, partials2, matrices2, child2TransMatIndex, rescale,
+                                scalingFactors, cumulativeScaleBuffer, parIndex, readScalingIndex,
+                                sparse, rangeStart, endPattern);
             }
+        } else {
+            std::fill(gMissingTags[parIndex] + startPattern, gMissingTags[parIndex] + endPattern,
+                      (unsigned int) BEAGLE_CPU_MISSING_NONE);
+            upPartialsRange(destPartials, tipStates1, partials1, matrices1, child1TransMatIndex,
+                            tipStates2, partials2, matrices2, child2TransMatIndex, rescale,
+                            scalingFactors, cumulativeScaleBuffer, parIndex, readScalingIndex,
+                            sparse, startPattern, endPattern);
         }
+        retainBlockedMatrices(startPattern, endPattern, false);
 
         if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
             int parScalingIndex = parIndex - kTipCount;
@@ -1661,13 +2837,13 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
             int child2ScalingIndex = child2Index - kTipCount;
             if (child1ScalingIndex >= 0 && child2ScalingIndex >= 0) {
                 int scalingIndices[2] = {child1ScalingIndex, child2ScalingIndex};
-                accumulateScaleFactors(scalingIndices, 2, parScalingIndex);
+                sumScaleFactorsRange(scalingIndices, 2, parScalingIndex, 1.0, startPattern, endPattern);
             } else if (child1ScalingIndex >= 0) {
                 int scalingIndices[1] = {child1ScalingIndex};
-                accumulateScaleFactors(scalingIndices, 1, parScalingIndex);
+                sumScaleFactorsRange(scalingIndices, 1, parScalingIndex, 1.0, startPattern, endPattern);
             } else if (child2ScalingIndex >= 0) {
                 int scalingIndices[1] = {child2ScalingIndex};
-                accumulateScaleFactors(scalingIndices, 1, parScalingIndex);
+                sumScaleFactorsRange(scalingIndices, 1, parScalingIndex, 1.0, startPattern, endPattern);
             }
         }
 
@@ -1685,6 +2861,199 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
     return BEAGLE_SUCCESS;
 }
 
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartialsRange(REALTYPE* destPartials,
+                                                       const int* tipStates1,
+                                                       const REALTYPE* partials1,
+                                                       const REALTYPE* matrices1,
+                                                       int child1TransMatIndex,
+                                                       const int* tipStates2,
+                                                       const REALTYPE* partials2,
+                                                       const REALTYPE* matrices2,
+                                                       int child2TransMatIndex,
+                                                       int rescale,
+                                                       REALTYPE* scalingFactors,
+                                                       REALTYPE* cumulativeScaleBuffer,
+                                                       int parIndex,
+                                                       int readScalingIndex,
+                                                       bool sparse,
+                                                       int startPattern,
+                                                       int endPattern) {
+    if (sparse) {
+        if (rescale == 1) {
+            for (int blockStart = startPattern; blockStart < endPattern; blockStart += kRescaleBlockPatternCount) {
+                const int blockEnd = std::min(blockStart + kRescaleBlockPatternCount, endPattern);
+                calcPartialsSparse(destPartials, tipStates1, partials1, matrices1, child1TransMatIndex,
+                                   tipStates2, partials2, matrices2, child2TransMatIndex, NULL,
+                                   blockStart, blockEnd);
+                rescalePartialsRange(destPartials, scalingFactors, cumulativeScaleBuffer,
+                                     blockStart, blockEnd);
+            }
+        } else {
+            calcPartialsSparse(destPartials, tipStates1, partials1, matrices1, child1TransMatIndex,
+                               tipStates2, partials2, matrices2, child2TransMatIndex,
+                               (rescale == 0 ? scalingFactors : NULL), startPattern, endPattern);
+        }
+    } else if (tipStates1 != NULL) {
+        if (tipStates2 != NULL ) {
+            if (rescale == 0) { // Use fixed scaleFactors
+                calcStatesStatesFixedScaling(destPartials, tipStates1, matrices1, tipStates2,
+                                             matrices2, scalingFactors, startPattern, endPattern);
+            } else if (rescale == 1) { // Recompute scaleFactors block by block while still in cache
+                for (int blockStart = startPattern; blockStart < endPattern; blockStart += kRescaleBlockPatternCount) {
+                    const int blockEnd = std::min(blockStart + kRescaleBlockPatternCount, endPattern);
+                    calcStatesStates(destPartials, tipStates1, matrices1, tipStates2, matrices2,
+                                     blockStart, blockEnd);
+                    rescalePartialsRange(destPartials, scalingFactors, cumulativeScaleBuffer,
+                                         blockStart, blockEnd);
+                }
+            } else {
+                calcStatesStates(destPartials, tipStates1, matrices1, tipStates2, matrices2,
+                                 startPattern, endPattern);
+            }
+        } else {
+            if (rescale == 0) {
+                calcStatesPartialsFixedScaling(destPartials, tipStates1, matrices1, partials2,
+                                               matrices2, scalingFactors, startPattern, endPattern);
+            } else if (rescale == 1) {
+                for (int blockStart = startPattern; blockStart < endPattern; blockStart += kRescaleBlockPatternCount) {
+                    const int blockEnd = std::min(blockStart + kRescaleBlockPatternCount, endPattern);
+                    calcStatesPartials(destPartials, tipStates1, matrices1, partials2, matrices2,
+                                       blockStart, blockEnd);
+                    rescalePartialsRange(destPartials, scalingFactors, cumulativeScaleBuffer,
+                                         blockStart, blockEnd);
+                }
+            } else {
+                calcStatesPartials(destPartials, tipStates1, matrices1, partials2, matrices2,
+                                   startPattern, endPattern);
+            }
+        }
+    } else {
+        if (tipStates2 != NULL) {
+            if (rescale == 0) {
+                calcStatesPartialsFixedScaling(destPartials,tipStates2,matrices2,partials1,matrices1,
+                                               scalingFactors, startPattern, endPattern);
+            } else if (rescale == 1) {
+                for (int blockStart = startPattern; blockStart < endPattern; blockStart += kRescaleBlockPatternCount) {
+                    const int blockEnd = std::min(blockStart + kRescaleBlockPatternCount, endPattern);
+                    calcStatesPartials(destPartials, tipStates2, matrices2, partials1, matrices1,
+                                       blockStart, blockEnd);
+                    rescalePartialsRange(destPartials, scalingFactors, cumulativeScaleBuffer,
+                                         blockStart, blockEnd);
+                }
+            } else {
+                calcStatesPartials(destPartials, tipStates2, matrices2, partials1, matrices1,
+                                   startPattern, endPattern);
+            }
+        } else {
+            if (rescale == 2) {
+                int sIndex = parIndex - kTipCount;
+                calcPartialsPartialsAutoScaling(destPartials,partials1,matrices1,partials2,matrices2,
+                                                 &gActiveScalingFactors[sIndex]);
+                if (gActiveScalingFactors[sIndex])
+                    autoRescalePartials(destPartials, gAutoScaleBuffers[sIndex]);
+
+            } else if (rescale == 0) {
+                calcPartialsPartialsFixedScaling(destPartials,partials1,matrices1,partials2,
+                                                 matrices2,scalingFactors,startPattern,endPattern);
+            } else if (rescale == 1) {
+                for (int blockStart = startPattern; blockStart < endPattern; blockStart += kRescaleBlockPatternCount) {
+                    const int blockEnd = std::min(blockStart + kRescaleBlockPatternCount, endPattern);
+                    calcPartialsPartials(destPartials, partials1, matrices1, partials2, matrices2,
+                                         blockStart, blockEnd);
+                    rescalePartialsRange(destPartials, scalingFactors, cumulativeScaleBuffer,
+                                         blockStart, blockEnd);
+                }
+            } else if (rescale == 3) { // Only rescale blocks whose partials leave the safe range
+                const REALTYPE* readFactors = (readScalingIndex >= 0 ? gScaleBuffers[readScalingIndex] : NULL);
+                for (int blockStart = startPattern; blockStart < endPattern; blockStart += kRescaleBlockPatternCount) {
+                    const int blockEnd = std::min(blockStart + kRescaleBlockPatternCount, endPattern);
+                    const bool scaled = (readFactors != NULL && hasScaleFactors(readFactors, blockStart, blockEnd));
+                    if (scaled)
+                        calcPartialsPartialsFixedScaling(destPartials, partials1, matrices1, partials2, matrices2,
+                                                         readFactors, blockStart, blockEnd);
+                    else
+                        calcPartialsPartials(destPartials, partials1, matrices1, partials2, matrices2,
+                                             blockStart, blockEnd);
+                    dynamicRescalePartialsRange(destPartials, (scaled ? readFactors : NULL), scalingFactors,
+                                                cumulativeScaleBuffer, blockStart, blockEnd);
+                }
+            } else {
+                calcPartialsPartials(destPartials, partials1, matrices1, partials2, matrices2,
+                                     startPattern, endPattern);
+            }
+        }
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::copyMissingPatterns(REALTYPE* destPartials,
+                                                           REALTYPE* scaleFactors,
+                                                           REALTYPE* cumulativeScaleFactors,
+                                                           int sourcePattern,
+                                                           int startPattern,
+                                                           int endPattern) {
+    for (int l = 0; l < kCategoryCount; l++) {
+        REALTYPE* partials = destPartials + l * kPartialsCategoryStride;
+        const REALTYPE* source = partials + sourcePattern * kPartialsPatternStride;
+        for (int k = startPattern; k < endPattern; k++)
+            memcpy(partials + k * kPartialsPatternStride, source, sizeof(REALTYPE) * kPartialsPaddedStateCount);
+    }
+
+    if (scaleFactors == NULL)
+        return;
+
+    // the source factor is already in its final form, a log with BEAGLE_FLAG_SCALERS_LOG
+    for (int k = startPattern; k < endPattern; k++)
+        scaleFactors[k] = scaleFactors[sourcePattern];
+    if (cumulativeScaleFactors != NULL) {
+        if (kFlags & BEAGLE_FLAG_SCALERS_LOG) {
+            for (int k = startPattern; k < endPattern; k++)
+                cumulativeScaleFactors[k] += scaleFactors[k];
+        } else {
+            for (int k = startPattern; k < endPattern; k++)
+                cumulativeScaleFactors[k] += log(scaleFactors[k]);
+        }
+    }
+}
+
+/*
+ * Tip patterns are tagged missing where their state is missing or their partials are all one.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::resetMissingTags(int bufferIndex) {
+    unsigned int* tags = gMissingTags[bufferIndex];
+    memset(tags, 0, sizeof(unsigned int) * kPaddedPatternCount);
+    if (bufferIndex >= kTipCount)
+        return;
+
+    if (gTipStates[bufferIndex] != NULL) {
+        const int* states = gTipStates[bufferIndex];
+        for (int k = 0; k < kPatternCount; k++)
+            tags[k] = (states[k] == kStateCount ? BEAGLE_CPU_MISSING_TIP : BEAGLE_CPU_MISSING_NONE);
+    } else if (gPartials[bufferIndex] != NULL) {
+        for (int k = 0; k < kPatternCount; k++) {
+            bool missing = true;
+            for (int l = 0; l < kCategoryCount && missing; l++) {
+                const REALTYPE* partials = gPartials[bufferIndex] + l * kPartialsCategoryStride +
+                                           k * kPartialsPatternStride;
+                for (int i = 0; i < kStateCount && missing; i++)
+                    missing = (partials[i] == 1.0);
+            }
+            tags[k] = (missing ? BEAGLE_CPU_MISSING_TIP : BEAGLE_CPU_MISSING_NONE);
+        }
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::recycleMissingTags() {
+    if (kNextMissingTag < BEAGLE_CPU_MISSING_TAG_LIMIT)
+        return;
+    for (int i = kTipCount; i < kBufferCount; i++)
+        memset(gMissingTags[i], 0, sizeof(unsigned int) * kPaddedPatternCount);
+    kNextMissingTag = BEAGLE_CPU_MISSING_FIRST_TAG;
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPrePartials(bool byPartition,
                                                      const int* operations,
@@ -1752,6 +3121,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPrePartials(bool byPartition,
             startPattern = gPatternPartitionsStartPatterns[currentPartition];
             endPattern = gPatternPartitionsStartPatterns[currentPartition + 1];
         }
+        std::fill(gMissingTags[parIndex] + startPattern, gMissingTags[parIndex] + endPattern,
+                  (unsigned int) BEAGLE_CPU_MISSING_NONE);
 
         int rescale = BEAGLE_OP_NONE;
         REALTYPE *scalingFactors = NULL;
@@ -1763,13 +3134,11 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPrePartials(bool byPartition,
         } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
             rescale = 1;
             scalingFactors = gScaleBuffers[parIndex - kTipCount];
-        } else if (kFlags &
-                   BEAGLE_FLAG_SCALING_DYNAMIC) { // TODO: this is a quick and dirty implementation just so it returns correct results
-//            if (siblingStates == 0) {
-                rescale = 1;
-                removeScaleFactors(&readScalingIndex, 1, cumulativeScaleIndex);
+        } else if (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC) {
+            if (writeScalingIndex >= 0) {
+                rescale = 3;
                 scalingFactors = gScaleBuffers[writeScalingIndex];
-//            }
+            }
         } else if (writeScalingIndex >= 0) {
             rescale = 1;
             scalingFactors = gScaleBuffers[writeScalingIndex];
@@ -1791,16 +3160,25 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPrePartials(bool byPartition,
         /// comment out all conditions that's not implemented
 
         if (tipStates2 != NULL) {
-            calcPrePartialsStates(destPartials, partials1, matrices1, tipStates2, matrices2,
-                                  startPattern, endPattern);
-
-            if (rescale == 1) {// Recompute scaleFactors
-                if (byPartition) {
-                    rescalePartialsByPartition(destPartials, scalingFactors, cumulativeScaleBuffer, 0,
-                                               currentPartition);
-                } else {
-                    rescalePartials(destPartials, scalingFactors, cumulativeScaleBuffer, 0);
+            if (rescale == 1) {// Recompute scaleFactors block by block while still in cache
+                for (int blockStart = startPattern; blockStart < endPattern; blockStart += kRescaleBlockPatternCount) {
+                    const int blockEnd = std::min(blockStart + kRescaleBlockPatternCount, endPattern);
+                    calcPrePartialsStates(destPartials, partials1, matrices1, tipStates2, matrices2,
+                                          blockStart, blockEnd);
+                    rescalePartialsRange(destPartials, scalingFactors, cumulativeScaleBuffer,
+                                         blockStart, blockEnd);
                 }
+            } else if (rescale == 3) { // Only rescale blocks whose partials leave the safe range
+                for (int blockStart = startPattern; blockStart < endPattern; blockStart += kRescaleBlockPatternCount) {
+                    const int blockEnd = std::min(blockStart + kRescaleBlockPatternCount, endPattern);
+                    calcPrePartialsStates(destPartials, partials1, matrices1, tipStates2, matrices2,
+                                          blockStart, blockEnd);
+                    dynamicRescalePartialsRange(destPartials, NULL, scalingFactors, cumulativeScaleBuffer,
+                                                blockStart, blockEnd);
+                }
+            } else {
+                calcPrePartialsStates(destPartials, partials1, matrices1, tipStates2, matrices2,
+                                      startPattern, endPattern);
             }
 
         } else {
@@ -1816,16 +3194,25 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPrePartials(bool byPartition,
 //                //                                                     matrices2,scalingFactors,startPattern,endPattern);
 //            } else {
 
-                calcPrePartialsPartials(destPartials, partials1, matrices1, partials2, matrices2,
-                                        startPattern, endPattern);
-
                 if (rescale == 1) {// Recompute scaleFactors
-                    if (byPartition) {
-                        rescalePartialsByPartition(destPartials, scalingFactors, cumulativeScaleBuffer, 0,
-                                                   currentPartition);
-                    } else {
-                        rescalePartials(destPartials, scalingFactors, cumulativeScaleBuffer, 0);
+                    for (int blockStart = startPattern; blockStart < endPattern; blockStart += kRescaleBlockPatternCount) {
+                        const int blockEnd = std::min(blockStart + kRescaleBlockPatternCount, endPattern);
+                        calcPrePartialsPartials(destPartials, partials1, matrices1, partials2, matrices2,
+                                                blockStart, blockEnd);
+                        rescalePartialsRange(destPartials, scalingFactors, cumulativeScaleBuffer,
+                                             blockStart, blockEnd);
+                    }
+                } else if (rescale == 3) { // Only rescale blocks whose partials leave the safe range
+                    for (int blockStart = startPattern; blockStart < endPattern; blockStart += kRescaleBlockPatternCount) {
+                        const int blockEnd = std::min(blockStart + kRescaleBlockPatternCount, endPattern);
+                        calcPrePartialsPartials(destPartials, partials1, matrices1, partials2, matrices2,
+                                                blockStart, blockEnd);
+                        dynamicRescalePartialsRange(destPartials, NULL, scalingFactors, cumulativeScaleBuffer,
+                                                    blockStart, blockEnd);
                     }
+                } else {
+                    calcPrePartialsPartials(destPartials, partials1, matrices1, partials2, matrices2,
+                                            startPattern, endPattern);
                 }
 //            }
         }
@@ -1882,6 +3269,13 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcCrossProducts(const int *postBufferIn
                 * kStateCount * kStateCount);
     }
 
+    if (kThreadingEnabled) {
+        calcCrossProductsByPartitionAsync(postBufferIndices, preBufferIndices,
+                                          categoryRates, categoryWeights, edgeLengths,
+                                          count, outSumDerivatives);
+        return returnCode;
+    }
+
 //    std::fill(outCrossProducts, outCrossProducts + kStateCount * kStateCount, 0.0); // TODO Remove
 
     for (int nodeNum = 0; nodeNum < count; nodeNum++) {
@@ -1911,7 +3305,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcCrossProducts(const int *postBufferIn
                                     categoryWeights,
                                     edgeLength,
                                     outSumDerivatives,
-                                    outSumSquaredDerivatives);
+                                    outSumSquaredDerivatives,
+                                    0, kPatternCount);
 
         } else {
 
@@ -1921,7 +3316,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcCrossProducts(const int *postBufferIn
                                       categoryWeights,
                                       edgeLength,
                                       outSumDerivatives,
-                                      outSumSquaredDerivatives);
+                                      outSumSquaredDerivatives,
+                                      0, kPatternCount);
         }
 //
 //        accumulateDerivatives(outDerivativesForNode,
@@ -1955,6 +3351,14 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogDerivatives(const int *postBuf
     const double *categoryRates = NULL; // gCategoryRates[categoryRatesIndices[0]]; // TODO Generalize
     const REALTYPE *categoryWeights = gCategoryWeights[categoryWeightsIndices[0]]; // TODO Generalize
 
+    if (kThreadingEnabled) {
+        calcEdgeLogDerivativesByPartitionAsync(postBufferIndices, preBufferIndices,
+                                               firstDerivativeIndices, categoryWeights, count,
+                                               outDerivatives, outSumDerivatives,
+                                               outSumSquaredDerivatives);
+        return returnCode;
+    }
+
     for (int nodeNum = 0; nodeNum < count; nodeNum++) {
 
         const REALTYPE *preOrderPartial = gPartials[preBufferIndices[nodeNum]];
@@ -1979,7 +3383,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogDerivatives(const int *postBuf
                                         secondDerivativeIndex, categoryRates, categoryWeights,
                                         outDerivativesForNode,
                                         outSumDerivativesForNode,
-                                        outSumSquaredDerivativesForNode);
+                                        outSumSquaredDerivativesForNode,
+                                        0, kPatternCount);
 
         } else {
 
@@ -1989,7 +3394,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogDerivatives(const int *postBuf
                                        scalingFactorsIndex,
                                        outDerivativesForNode,
                                        outSumDerivativesForNode,
-                                       outSumSquaredDerivativesForNode);
+                                       outSumSquaredDerivativesForNode,
+                                       0, kPatternCount);
         }
 
         accumulateDerivatives(outDerivativesForNode,
@@ -2001,6 +3407,175 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogDerivatives(const int *postBuf
     return returnCode;
 }
 
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogDerivativesByPartition(const int *postBufferIndices,
+                                                                         const int *preBufferIndices,
+                                                                         const int *firstDerivativeIndices,
+                                                                         const REALTYPE *categoryWeights,
+                                                                         int count,
+                                                                         int partitionIndex,
+                                                                         double *outDerivatives,
+                                                                         double *outSumDerivativesByNode,
+                                                                         double *outSumSquaredDerivativesByNode) {
+
+    const int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
+    const int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
+
+    for (int nodeNum = 0; nodeNum < count; nodeNum++) {
+
+        const REALTYPE *preOrderPartial = gPartials[preBufferIndices[nodeNum]];
+        const int *tipStates = gTipStates[postBufferIndices[nodeNum]];
+
+        std::fill(grandNumeratorDerivTmp + startPattern, grandNumeratorDerivTmp + endPattern, 0);
+        std::fill(grandDenominatorDerivTmp + startPattern, grandDenominatorDerivTmp + endPattern, 0);
+
+        if (tipStates != NULL) {
+            calcEdgeLogDerivativesStates(tipStates, preOrderPartial, firstDerivativeIndices[nodeNum],
+                                         BEAGLE_OP_NONE, NULL, categoryWeights,
+                                         NULL, NULL, NULL,
+                                         startPattern, endPattern);
+        } else {
+            const REALTYPE *postOrderPartial = gPartials[postBufferIndices[nodeNum]];
+            calcEdgeLogDerivativesPartials(postOrderPartial, preOrderPartial, firstDerivativeIndices[nodeNum],
+                                           BEAGLE_OP_NONE, NULL, categoryWeights, -1,
+                                           NULL, NULL, NULL,
+                                           startPattern, endPattern);
+        }
+
+        double* outDerivativesForNode = (outDerivatives == NULL) ?
+                NULL : outDerivatives + nodeNum * kPatternCount;
+
+        double sum = 0.0;
+        double sumSquared = 0.0;
+        for (int k = startPattern; k < endPattern; k++) {
+            double derivative = grandNumeratorDerivTmp[k] / grandDenominatorDerivTmp[k];
+            if (outDerivativesForNode != NULL)
+                outDerivativesForNode[k] = derivative;
+            sum += derivative * gPatternWeights[k];
+            sumSquared += derivative * derivative * gPatternWeights[k];
+        }
+
+        if (outSumDerivativesByNode != NULL)
+            outSumDerivativesByNode[nodeNum] = sum;
+        if (outSumSquaredDerivativesByNode != NULL)
+            outSumSquaredDerivativesByNode[nodeNum] = sumSquared;
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogDerivativesByPartitionAsync(const int *postBufferIndices,
+                                                                              const int *preBufferIndices,
+                                                                              const int *firstDerivativeIndices,
+                                                                              const REALTYPE *categoryWeights,
+                                                                              int count,
+                                                                              double *outDerivatives,
+                                                                              double *outSumDerivatives,
+                                                                              double *outSumSquaredDerivatives) {
+
+    // per-partition partial sums, reduced in partition order so results do not depend on scheduling
+    std::vector<double> sumsByPartition(outSumDerivatives == NULL ? 0 : kPartitionCount * count);
+    std::vector<double> sumsSquaredByPartition(outSumSquaredDerivatives == NULL ? 0 : kPartitionCount * count);
+
+    for (int i=0; i<kNumThreads; i++) {
+
+        std::packaged_task<void()> threadTask(
+            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogDerivativesByPartition, this,
+                      postBufferIndices, preBufferIndices, firstDerivativeIndices,
+                      categoryWeights, count, i,
+                      outDerivatives,
+                      (outSumDerivatives == NULL ? (double*) NULL : &sumsByPartition[i * count]),
+                      (outSumSquaredDerivatives == NULL ? (double*) NULL : &sumsSquaredByPartition[i * count])));
+
+        enqueueThreadTask(i, threadTask);
+    }
+
+    waitThreadTasks(kNumThreads);
+
+    for (int nodeNum = 0; nodeNum < count; nodeNum++) {
+        if (outSumDerivatives != NULL) {
+            double sum = 0.0;
+            for (int i = 0; i < kNumThreads; i++)
+                sum += sumsByPartition[i * count + nodeNum];
+            outSumDerivatives[nodeNum] = sum;
+        }
+        if (outSumSquaredDerivatives != NULL) {
+            double sumSquared = 0.0;
+            for (int i = 0; i < kNumThreads; i++)
+                sumSquared += sumsSquaredByPartition[i * count + nodeNum];
+            outSumSquaredDerivatives[nodeNum] = sumSquared;
+        }
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcCrossProductsByPartition(const int *postBufferIndices,
+                                                                    const int *preBufferIndices,
+                                                                    const double *categoryRates,
+                                                                    const REALTYPE *categoryWeights,
+                                                                    const double *edgeLengths,
+                                                                    int count,
+                                                                    int partitionIndex,
+                                                                    double *outCrossProducts) {
+
+    const int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
+    const int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
+
+    for (int nodeNum = 0; nodeNum < count; nodeNum++) {
+
+        const REALTYPE *preOrderPartial = gPartials[preBufferIndices[nodeNum]];
+        const int *tipStates = gTipStates[postBufferIndices[nodeNum]];
+
+        if (tipStates != NULL) {
+            calcCrossProductsStates(tipStates, preOrderPartial, categoryRates, categoryWeights,
+                                    edgeLengths[nodeNum], outCrossProducts, NULL,
+                                    startPattern, endPattern);
+        } else {
+            const REALTYPE *postOrderPartial = gPartials[postBufferIndices[nodeNum]];
+            calcCrossProductsPartials(postOrderPartial, preOrderPartial, categoryRates, categoryWeights,
+                                      edgeLengths[nodeNum], outCrossProducts, NULL,
+                                      startPattern, endPattern);
+        }
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcCrossProductsByPartitionAsync(const int *postBufferIndices,
+                                                                         const int *preBufferIndices,
+                                                                         const double *categoryRates,
+                                                                         const REALTYPE *categoryWeights,
+                                                                         const double *edgeLengths,
+                                                                         int count,
+                                                                         double *outCrossProducts) {
+
+    const int crossProductsSize = kStateCount * kStateCount;
+
+    double* crossProductsByPartition = (double*) mallocAligned(sizeof(double) * crossProductsSize * kNumThreads);
+    if (crossProductsByPartition == NULL)
+        throw std::bad_alloc();
+    std::fill(crossProductsByPartition, crossProductsByPartition + crossProductsSize * kNumThreads, 0.0);
+
+    for (int i=0; i<kNumThreads; i++) {
+
+        std::packaged_task<void()> threadTask(
+            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcCrossProductsByPartition, this,
+                      postBufferIndices, preBufferIndices, categoryRates, categoryWeights,
+                      edgeLengths, count, i,
+                      &crossProductsByPartition[i * crossProductsSize]));
+
+        enqueueThreadTask(i, threadTask);
+    }
+
+    waitThreadTasks(kNumThreads);
+
+    for (int i = 0; i < kNumThreads; i++) {
+        for (int k = 0; k < crossProductsSize; k++) {
+            outCrossProducts[k] += crossProductsByPartition[i * crossProductsSize + k];
+        }
+    }
+
+    free(crossProductsByPartition);
+}
+
 BEAGLE_CPU_TEMPLATE template <bool DoDerivatives, bool DoSum, bool DoSumSquared>
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateDerivativesImpl(
         double* outDerivatives,
@@ -2091,25 +3666,27 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogDerivativesStates(const int *
                                                                      const REALTYPE *categoryWeights,
                                                                      double *outDerivatives,
                                                                      double *outSumDerivatives,
-                                                                     double *outSumSquaredDerivatives) {
+                                                                     double *outSumSquaredDerivatives,
+                                                                     int startPattern,
+                                                                     int endPattern) {
 
     const REALTYPE *firstDerivMatrix = gTransitionMatrices[firstDerivativeIndex];
 
     for (int category = 0; category < kCategoryCount; category++) {
 
-        for (int pattern = 0; pattern < kPatternCount; pattern++) {
+        for (int pattern = startPattern; pattern < endPattern; pattern++) {
 
-            const int patternIndex = category * kPatternCount + pattern;
+            const int v = category * kPartialsCategoryStride + pattern * kPartialsPatternStride;
             const int state = tipStates[pattern];
 
             REALTYPE numerator = 0.0;
-            REALTYPE denominator = preOrderPartial[patternIndex * kPartialsPaddedStateCount + (state % kStateCount)];
+            REALTYPE denominator = preOrderPartial[v + (state % kStateCount)];
             // TODO (state % kStateCount) is not correct; should imply missing character
             // TODO See calcCrossProductsStates() for possible solution
 
             for (int k = 0; k < kStateCount; k++) {
                 numerator += firstDerivMatrix[category * kMatrixSize + k * kTransPaddedStateCount + state] *
-                             preOrderPartial[patternIndex * kPartialsPaddedStateCount + k];
+                             preOrderPartial[v + k];
             }
 
             grandNumeratorDerivTmp[pattern] += categoryWeights[category] * numerator;
@@ -2125,9 +3702,11 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcCrossProductsStates(const int *tipSt
                                                                 const REALTYPE *categoryWeights,
                                                                 const double edgeLength,
                                                                 double *outCrossProducts,
-                                                                double *outSumSquaredDerivatives) {
+                                                                double *outSumSquaredDerivatives,
+                                                                int startPattern,
+                                                                int endPattern) {
 
-    for (int pattern = 0; pattern < kPatternCount; pattern++) {
+    for (int pattern = startPattern; pattern < endPattern; pattern++) {
 
         std::vector<REALTYPE> tmp(kStateCount * kStateCount, 0.0); // TODO Handle temporary memory better
 
@@ -2142,8 +3721,7 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcCrossProductsStates(const int *tipSt
                 const REALTYPE scale = (REALTYPE) categoryRates[category] * edgeLength;
 
                 const REALTYPE weight = categoryWeights[category];
-                const int patternIndex = category * kPatternCount + pattern;
-                const int v = patternIndex * kPartialsPaddedStateCount;
+                const int v = category * kPartialsCategoryStride + pattern * kPartialsPatternStride;
 
                 REALTYPE denominator = preOrderPartial[v + state];
                 patternDenominator += denominator * weight;
@@ -2165,8 +3743,7 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcCrossProductsStates(const int *tipSt
                 const REALTYPE scale = (REALTYPE) categoryRates[category] * edgeLength;
 
                 const REALTYPE weight = categoryWeights[category];
-                const int patternIndex = category * kPatternCount + pattern;
-                const int v = patternIndex * kPartialsPaddedStateCount;
+                const int v = category * kPartialsCategoryStride + pattern * kPartialsPatternStride;
 
                 REALTYPE denominator = 0.0;
                 for (int k = 0; k < kStateCount; k++) {
@@ -2198,9 +3775,11 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcCrossProductsPartials(const REALTYPE
                                                                   const REALTYPE *categoryWeights,
                                                                   const double edgeLength,
                                                                   double *outCrossProducts,
-                                                                  double *outSumSquaredDerivatives) {
+                                                                  double *outSumSquaredDerivatives,
+                                                                  int startPattern,
+                                                                  int endPattern) {
 
-    for (int pattern = 0; pattern < kPatternCount; pattern++) {
+    for (int pattern = startPattern; pattern < endPattern; pattern++) {
 
         std::vector<REALTYPE> tmp(kStateCount * kStateCount, 0.0); // TODO Handle temporary memory better
 
@@ -2211,8 +3790,7 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcCrossProductsPartials(const REALTYPE
             const REALTYPE scale = (REALTYPE) categoryRates[category] * edgeLength;
 
             const REALTYPE weight = categoryWeights[category];
-            const int patternIndex = category * kPatternCount + pattern; // Bad memory access
-            const int v = patternIndex * kPartialsPaddedStateCount;
+            const int v = category * kPartialsCategoryStride + pattern * kPartialsPatternStride;
 
             REALTYPE denominator = 0.0;
             for (int k = 0; k < kStateCount; k++) {
@@ -2247,19 +3825,20 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogDerivativesPartials(const REA
 //                                                                       const REALTYPE *cumulativeScaleBuffer,
                                                                        double *outDerivatives,
                                                                        double *outSumDerivatives,
-                                                                       double *outSumSquaredDerivatives) {
+                                                                       double *outSumSquaredDerivatives,
+                                                                       int startPattern,
+                                                                       int endPattern) {
 
     const REALTYPE *firstDerivMatrix = gTransitionMatrices[firstDerivativeIndex];
 
     for (int category = 0; category < kCategoryCount; category++) {
         const REALTYPE weight = categoryWeights[category];
 
-        for (int pattern = 0; pattern < kPatternCount; pattern++) {
+        for (int pattern = startPattern; pattern < endPattern; pattern++) {
 
             int w = category * kMatrixSize;
 
-            const int patternIndex = category * kPatternCount + pattern;
-            const int v = patternIndex * kPartialsPaddedStateCount;
+            const int v = category * kPartialsCategoryStride + pattern * kPartialsPatternStride;
 
             REALTYPE numerator = 0.0;
             REALTYPE denominator = 0.0;
@@ -2416,21 +3995,12 @@ BEAGLE_CPU_TEMPLATE
                       &partitionIndices[currentPartitionIndex], partitionCountThread,
                       &outSumLogLikelihoodByPartition[currentPartitionIndex]));
 
-        gFutures[i] = threadTask.get_future();
-        threadData* td = &gThreads[i];
-
-        std::unique_lock<std::mutex> l(td->m);
-        td->jobs.push(std::move(threadTask));
-        l.unlock();
-
-        gThreads[i].cv.notify_one();
+        enqueueThreadTask(i, threadTask);
 
         currentPartitionIndex += partitionCountThread;
     }
 
-    for (int i=0; i<kNumThreads; i++) {
-        gFutures[i].wait();
-    }
+    waitThreadTasks(threadsUsed);
 
 }
 
@@ -2452,20 +4022,11 @@ BEAGLE_CPU_TEMPLATE
                       &partitionIndices[i], 1,
                       &outSumLogLikelihoodByPartition[i]));
 
-        gFutures[i] = threadTask.get_future();
-        threadData* td = &gThreads[i];
-
-        std::unique_lock<std::mutex> l(td->m);
-        td->jobs.push(std::move(threadTask));
-        l.unlock();
-
-        gThreads[i].cv.notify_one();
+        enqueueThreadTask(i, threadTask);
 
     }
 
-    for (int i=0; i<kNumThreads; i++) {
-        gFutures[i].wait();
-    }
+    waitThreadTasks(kNumThreads);
 
 }
 
@@ -2504,17 +4065,18 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const int* bu
                 u++;
                 v++;
             }
-            v += P_PAD;
+            v += kPartialsPatternStride - kStateCount;
         }
         for (int l = 1; l < kCategoryCount; l++) {
             u = 0;
+            v = l * kPartialsCategoryStride;
             for (int k = 0; k < kPatternCount; k++) {
                 for (int i = 0; i < kStateCount; i++) {
                     integrationTmp[u] += rootPartials[v] * (REALTYPE) wt[l];
                     u++;
                     v++;
                 }
-                v += P_PAD;
+                v += kPartialsPatternStride - kStateCount;
             }
         }
         u = 0;
@@ -2600,6 +4162,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsPerCategory(
     int u = 0;
     int v = 0;
     for (int l = 0; l < kCategoryCount; l++) {
+        v = l * kPartialsCategoryStride;
         for (int k = 0; k < kPatternCount; k++) {
             REALTYPE sum = 0.0;
             for (int i = 0; i < kStateCount; i++) {
@@ -2608,7 +4171,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsPerCategory(
             }
             outLogLikelihoodPerCategory[u] = log(sum);
             u++;
-            v += P_PAD;
+            v += kPartialsPatternStride - kStateCount;
         }
     }
 
@@ -2646,17 +4209,18 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoods(const int bufferIn
             u++;
             v++;
         }
-        v += P_PAD;
+        v += kPartialsPatternStride - kStateCount;
     }
     for (int l = 1; l < kCategoryCount; l++) {
         u = 0;
+        v = l * kPartialsCategoryStride;
         for (int k = 0; k < kPatternCount; k++) {
             for (int i = 0; i < kStateCount; i++) {
                 integrationTmp[u] += rootPartials[v] * (REALTYPE) wt[l];
                 u++;
                 v++;
             }
-            v += P_PAD;
+            v += kPartialsPatternStride - kStateCount;
         }
     }
     u = 0;
@@ -2711,25 +4275,25 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartition(
         const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndices[p]];
         const int scalingFactorsIndex = cumulativeScaleIndices[p];
         int u = startPattern * kStateCount;
-        int v = startPattern * kPartialsPaddedStateCount;
+        int v = startPattern * kPartialsPatternStride;
         for (int k = startPattern; k < endPattern; k++) {
             for (int i = 0; i < kStateCount; i++) {
                 integrationTmp[u] = rootPartials[v] * (REALTYPE) wt[0];
                 u++;
                 v++;
             }
-            v += P_PAD;
+            v += kPartialsPatternStride - kStateCount;
         }
         for (int l = 1; l < kCategoryCount; l++) {
             u = startPattern * kStateCount;
-            v += ((kPatternCount - endPattern) + startPattern) * kPartialsPaddedStateCount;
+            v = l * kPartialsCategoryStride + startPattern * kPartialsPatternStride;
             for (int k = startPattern; k < endPattern; k++) {
                 for (int i = 0; i < kStateCount; i++) {
                     integrationTmp[u] += rootPartials[v] * (REALTYPE) wt[l];
                     u++;
                     v++;
                 }
-                v += P_PAD;
+                v += kPartialsPatternStride - kStateCount;
             }
         }
         u = startPattern * kStateCount;
@@ -2778,18 +4342,10 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateScaleFactors(const int* scaling
         }
 
     } else {
-        REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
-        for(int i=0; i<count; i++) {
-            const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
-            for(int j=0; j<kPatternCount; j++) {
-                if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
-                    cumulativeScaleBuffer[j] += scaleBuffer[j];
-                else
-                    cumulativeScaleBuffer[j] += log(scaleBuffer[j]);
-            }
-        }
+        sumScaleFactors(scalingIndices, count, cumulativeScalingIndex, 1.0);
 
         if (DEBUGGING_OUTPUT) {
+            REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
             fprintf(stderr,"Accumulating %d scale buffers into #%d\n",count,cumulativeScalingIndex);
             for(int j=0; j<kPatternCount; j++) {
                 fprintf(stderr,"cumulativeScaleBuffer[%d] = %2.5e\n",j,cumulativeScaleBuffer[j]);
@@ -2808,21 +4364,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateScaleFactorsByPartition(const i
     if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
         return BEAGLE_ERROR_NO_IMPLEMENTATION;
     } else {
-
-        int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
-        int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
-
-        REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
-        for(int i=0; i<count; i++) {
-            const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
-            for(int j=startPattern; j<endPattern; j++) {
-                if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
-                    cumulativeScaleBuffer[j] += scaleBuffer[j];
-                else
-                    cumulativeScaleBuffer[j] += log(scaleBuffer[j]);
-            }
-        }
-
+        sumScaleFactorsRange(scalingIndices, count, cumulativeScalingIndex, 1.0,
+                             gPatternPartitionsStartPatterns[partitionIndex],
+                             gPatternPartitionsStartPatterns[partitionIndex + 1]);
     }
 
     return BEAGLE_SUCCESS;
@@ -2832,16 +4376,7 @@ BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::removeScaleFactors(const int* scalingIndices,
                                                           int  count,
                                                           int  cumulativeScalingIndex) {
-    REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
-    for(int i=0; i<count; i++) {
-        const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
-        for(int j=0; j<kPatternCount; j++) {
-            if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
-                cumulativeScaleBuffer[j] -= scaleBuffer[j];
-            else
-                cumulativeScaleBuffer[j] -= log(scaleBuffer[j]);
-        }
-    }
+    sumScaleFactors(scalingIndices, count, cumulativeScalingIndex, -1.0);
 
     return BEAGLE_SUCCESS;
 }
@@ -2851,22 +4386,93 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::removeScaleFactorsByPartition(const int*
                                                                      int count,
                                                                      int cumulativeScalingIndex,
                                                                      int partitionIndex) {
+    sumScaleFactorsRange(scalingIndices, count, cumulativeScalingIndex, -1.0,
+                         gPatternPartitionsStartPatterns[partitionIndex],
+                         gPatternPartitionsStartPatterns[partitionIndex + 1]);
 
-    int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
-    int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
+    return BEAGLE_SUCCESS;
+}
+
+/*
+ * Splits the patterns across the thread queues when there is enough work, otherwise sums in
+ * the calling thread.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::sumScaleFactors(const int* scalingIndices,
+                                                       int count,
+                                                       int cumulativeScalingIndex,
+                                                       double sign) {
+    const int threadCount = (kThreadingEnabled ? kNumThreads : 1);
+
+    if (threadCount < 2 || (long) count * kPatternCount < BEAGLE_CPU_SCALE_ASYNC_MIN_COUNT) {
+        sumScaleFactorsRange(scalingIndices, count, cumulativeScalingIndex, sign, 0, kPatternCount);
+        return;
+    }
+
+    int patternsPerThread = (kPatternCount + threadCount - 1) / threadCount;
+    patternsPerThread += (-patternsPerThread) & (BEAGLE_CPU_OPENMP_BLOCK_ALIGNMENT - 1);
+
+    int threadsUsed = 0;
+    for (int startPattern = 0; startPattern < kPatternCount; startPattern += patternsPerThread) {
+        std::packaged_task<void()> threadTask(
+            std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::sumScaleFactorsRange, this,
+                      scalingIndices, count, cumulativeScalingIndex, sign,
+                      startPattern, std::min(startPattern + patternsPerThread, kPatternCount)));
 
+        enqueueThreadTask(threadsUsed++, threadTask);
+    }
+
+    waitThreadTasks(threadsUsed);
+}
+
+/*
+ * Sums blocks of the cumulative buffer while they are in cache, folding four scale buffers into
+ * each pass; the scaler format is checked once rather than per pattern.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::sumScaleFactorsRange(const int* scalingIndices,
+                                                            int count,
+                                                            int cumulativeScalingIndex,
+                                                            double sign,
+                                                            int startPattern,
+                                                            int endPattern) {
     REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
-    for(int i=0; i<count; i++) {
-        const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
-        for(int j=startPattern; j<endPattern; j++) {
-            if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
-                cumulativeScaleBuffer[j] -= scaleBuffer[j];
-            else
-                cumulativeScaleBuffer[j] -= log(scaleBuffer[j]);
+    const REALTYPE s = (REALTYPE) sign;
+    const bool logScalers = (kFlags & BEAGLE_FLAG_SCALERS_LOG);
+
+    for (int blockStart = startPattern; blockStart < endPattern; blockStart += BEAGLE_CPU_SCALE_BLOCK_PATTERN_COUNT) {
+        const int blockEnd = std::min(blockStart + BEAGLE_CPU_SCALE_BLOCK_PATTERN_COUNT, endPattern);
+
+        int i = 0;
+        for (; i + 4 <= count; i += 4) {
+            const REALTYPE* s0 = gScaleBuffers[scalingIndices[i    ]];
+            const REALTYPE* s1 = gScaleBuffers[scalingIndices[i + 1]];
+            const REALTYPE* s2 = gScaleBuffers[scalingIndices[i + 2]];
+            const REALTYPE* s3 = gScaleBuffers[scalingIndices[i + 3]];
+            if (logScalers) {
+                #pragma omp simd
+                for (int k = blockStart; k < blockEnd; k++)
+                    cumulativeScaleBuffer[k] += s * ((s0[k] + s1[k]) + (s2[k] + s3[k]));
+            } else {
+                #pragma omp simd
+                for (int k = blockStart; k < blockEnd; k++)
+                    cumulativeScaleBuffer[k] += s * ((log(s0[k]) + log(s1[k])) + (log(s2[k]) + log(s3[k])));
+            }
         }
-    }
 
-    return BEAGLE_SUCCESS;
+        for (; i < count; i++) {
+            const REALTYPE* s0 = gScaleBuffers[scalingIndices[i]];
+            if (logScalers) {
+                #pragma omp simd
+                for (int k = blockStart; k < blockEnd; k++)
+                    cumulativeScaleBuffer[k] += s * s0[k];
+            } else {
+                #pragma omp simd
+                for (int k = blockStart; k < blockEnd; k++)
+                    cumulativeScaleBuffer[k] += s * log(s0[k]);
+            }
+        }
+    }
 }
 
 
@@ -3109,6 +4715,146 @@ BEAGLE_CPU_TEMPLATE
     return returnCode;
 }
 
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateEdgeLogLikelihoodsPerEdge(const int* parentBufferIndices,
+                                                                          const int* childBufferIndices,
+                                                                          const int* probabilityIndices,
+                                                                          const int* firstDerivativeIndices,
+                                                                          const int* secondDerivativeIndices,
+                                                                          const int* categoryWeightsIndices,
+                                                                          const int* stateFrequenciesIndices,
+                                                                          const int* cumulativeScaleIndices,
+                                                                          int count,
+                                                                          double* outLogLikelihoods,
+                                                                          double* outFirstDerivatives,
+                                                                          double* outSecondDerivatives) {
+    if (count < 1)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    if (outFirstDerivatives == NULL)
+        firstDerivativeIndices = NULL;
+    if (firstDerivativeIndices == NULL || outSecondDerivatives == NULL)
+        secondDerivativeIndices = NULL;
+
+    for (int i = 0; i < count; i++) {
+        if (parentBufferIndices[i] < 0 || parentBufferIndices[i] >= kBufferCount ||
+            gPartials[parentBufferIndices[i]] == NULL ||
+            childBufferIndices[i] < 0 || childBufferIndices[i] >= kBufferCount ||
+            (gPartials[childBufferIndices[i]] == NULL &&
+             (childBufferIndices[i] >= kTipCount || gTipStates[childBufferIndices[i]] == NULL)))
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    if (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS)) {
+        // These modes build the cumulative scale factors for each edge in a shared buffer
+        double unusedDerivative;
+        for (int i = 0; i < count; i++) {
+            int returnCode = calculateEdgeLogLikelihoods(&parentBufferIndices[i], &childBufferIndices[i],
+                                                         &probabilityIndices[i],
+                                                         (firstDerivativeIndices == NULL ? NULL : &firstDerivativeIndices[i]),
+                                                         (secondDerivativeIndices == NULL ? NULL : &secondDerivativeIndices[i]),
+                                                         &categoryWeightsIndices[i], &stateFrequenciesIndices[i],
+                                                         cumulativeScaleIndices, 1, &outLogLikelihoods[i],
+                                                         (firstDerivativeIndices == NULL ? &unusedDerivative : &outFirstDerivatives[i]),
+                                                         (secondDerivativeIndices == NULL ? &unusedDerivative : &outSecondDerivatives[i]));
+            if (returnCode != BEAGLE_SUCCESS)
+                return returnCode;
+        }
+        return BEAGLE_SUCCESS;
+    }
+
+    // Split edges into blocks of patterns only when there are fewer edges than threads
+    int threadCount = (kThreadingEnabled ? kNumThreads : 1);
+    int blockCount = (threadCount + count - 1) / count;
+    if (blockCount > kPatternCount / BEAGLE_CPU_OPENMP_MIN_BLOCK_PATTERN_COUNT)
+        blockCount = kPatternCount / BEAGLE_CPU_OPENMP_MIN_BLOCK_PATTERN_COUNT;
+    if (blockCount < 1)
+        blockCount = 1;
+    const int taskCount = count * blockCount;
+    if (threadCount > taskCount)
+        threadCount = taskCount;
+
+    std::vector<double> taskSums(3 * taskCount);
+
+    if (threadCount > 1) {
+        for (int i = 0; i < threadCount; i++) {
+            std::packaged_task<void()> threadTask(
+                std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsPerEdgeTasks, this,
+                          parentBufferIndices, childBufferIndices, probabilityIndices,
+                          firstDerivativeIndices, secondDerivativeIndices,
+                          categoryWeightsIndices, stateFrequenciesIndices, cumulativeScaleIndices,
+                          blockCount, i, threadCount, taskCount, &taskSums[0]));
+            enqueueThreadTask(i, threadTask);
+        }
+        waitThreadTasks(threadCount);
+    } else {
+        calcEdgeLogLikelihoodsPerEdgeTasks(parentBufferIndices, childBufferIndices, probabilityIndices,
+                                           firstDerivativeIndices, secondDerivativeIndices,
+                                           categoryWeightsIndices, stateFrequenciesIndices, cumulativeScaleIndices,
+                                           blockCount, 0, 1, taskCount, &taskSums[0]);
+    }
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    for (int i = 0; i < count; i++) {
+        double sumLogLikelihood = 0.0;
+        double sumFirstDerivative = 0.0;
+        double sumSecondDerivative = 0.0;
+        for (int b = 0; b < blockCount; b++) {
+            const double* sums = &taskSums[3 * (i * blockCount + b)];
+            sumLogLikelihood += sums[0];
+            sumFirstDerivative += sums[1];
+            sumSecondDerivative += sums[2];
+        }
+
+        outLogLikelihoods[i] = sumLogLikelihood;
+        if (firstDerivativeIndices != NULL)
+            outFirstDerivatives[i] = sumFirstDerivative;
+        if (secondDerivativeIndices != NULL)
+            outSecondDerivatives[i] = sumSecondDerivative;
+
+        if (sumLogLikelihood != sumLogLikelihood)
+            returnCode = BEAGLE_ERROR_FLOATING_POINT;
+    }
+
+    return returnCode;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsPerEdgeTasks(const int* parentBufferIndices,
+                                                                           const int* childBufferIndices,
+                                                                           const int* probabilityIndices,
+                                                                           const int* firstDerivativeIndices,
+                                                                           const int* secondDerivativeIndices,
+                                                                           const int* categoryWeightsIndices,
+                                                                           const int* stateFrequenciesIndices,
+                                                                           const int* cumulativeScaleIndices,
+                                                                           int blockCount,
+                                                                           int firstTask,
+                                                                           int taskStride,
+                                                                           int taskCount,
+                                                                           double* outTaskSums) {
+    const int blockSize = (kPatternCount + blockCount - 1) / blockCount;
+
+    for (int task = firstTask; task < taskCount; task += taskStride) {
+        const int edge = task / blockCount;
+        const int startPattern = (task % blockCount) * blockSize;
+        const int endPattern = std::min(startPattern + blockSize, kPatternCount);
+
+        calcEdgeLogLikelihoodsDerivativesRange(parentBufferIndices[edge],
+                                               childBufferIndices[edge],
+                                               probabilityIndices[edge],
+                                               (firstDerivativeIndices == NULL ? BEAGLE_OP_NONE : firstDerivativeIndices[edge]),
+                                               (secondDerivativeIndices == NULL ? BEAGLE_OP_NONE : secondDerivativeIndices[edge]),
+                                               categoryWeightsIndices[edge],
+                                               stateFrequenciesIndices[edge],
+                                               (cumulativeScaleIndices == NULL ? BEAGLE_OP_NONE : cumulativeScaleIndices[edge]),
+                                               startPattern,
+                                               endPattern,
+                                               &outTaskSums[3 * task]);
+    }
+}
+
 BEAGLE_CPU_TEMPLATE
     void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartitionAsync(
                                                         const int* parentBufferIndices,
@@ -3144,21 +4890,12 @@ BEAGLE_CPU_TEMPLATE
                       partitionCountThread,
                       &outSumLogLikelihoodByPartition[currentPartitionIndex]));
 
-        gFutures[i] = threadTask.get_future();
-        threadData* td = &gThreads[i];
-
-        std::unique_lock<std::mutex> l(td->m);
-        td->jobs.push(std::move(threadTask));
-        l.unlock();
-
-        gThreads[i].cv.notify_one();
+        enqueueThreadTask(i, threadTask);
 
         currentPartitionIndex += partitionCountThread;
     }
 
-    for (int i=0; i<kNumThreads; i++) {
-        gFutures[i].wait();
-    }
+    waitThreadTasks(threadsUsed);
 
 }
 
@@ -3187,19 +4924,10 @@ BEAGLE_CPU_TEMPLATE
                       1,
                       &outSumLogLikelihoodByPartition[i]));
 
-        gFutures[i] = threadTask.get_future();
-        threadData* td = &gThreads[i];
-
-        std::unique_lock<std::mutex> l(td->m);
-        td->jobs.push(std::move(threadTask));
-        l.unlock();
-
-        gThreads[i].cv.notify_one();
+        enqueueThreadTask(i, threadTask);
     }
 
-    for (int i=0; i<kNumThreads; i++) {
-        gFutures[i].wait();
-    }
+    waitThreadTasks(kNumThreads);
 
 }
 
@@ -3229,10 +4957,10 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int parIndex
     if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
         const int* statesChild = gTipStates[childIndex];
-        int v = 0; // Index for parent partials
 
         for(int l = 0; l < kCategoryCount; l++) {
             int u = 0; // Index in resulting product-partials (summed over categories)
+            int v = l * kPartialsCategoryStride; // Index for parent partials
             const REALTYPE weight = wt[l];
             for(int k = 0; k < kPatternCount; k++) {
 
@@ -3245,18 +4973,18 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int parIndex
 
                     w += kTransPaddedStateCount;
                 }
-                v += kPartialsPaddedStateCount;
+                v += kPartialsPatternStride;
             }
         }
 
     } else { // Integrate against a partial at the child
 
         const REALTYPE* partialsChild = gPartials[childIndex];
-        int v = 0;
         int stateCountModFour = (kStateCount / 4) * 4;
 
         for(int l = 0; l < kCategoryCount; l++) {
             int u = 0;
+            int v = l * kPartialsCategoryStride; // Index for parent partials
             const REALTYPE weight = wt[l];
             for(int k = 0; k < kPatternCount; k++) {
                 int w = l * kMatrixSize;
@@ -3287,7 +5015,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int parIndex
                     // increment for the extra column at the end
                     w += T_PAD;
                 }
-                v += kPartialsPaddedStateCount;
+                v += kPartialsPatternStride;
             }
         }
     }
@@ -3358,10 +5086,10 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
 
         if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
             const int* statesChild = gTipStates[childIndex];
-            int v = startPattern * kPartialsPaddedStateCount; // Index for parent partials
 
             for(int l = 0; l < kCategoryCount; l++) {
                 int u = startPattern * kStateCount; // Index in resulting product-partials (summed over categories)
+                int v = l * kPartialsCategoryStride + startPattern * kPartialsPatternStride;
                 const REALTYPE weight = wt[l];
                 for(int k = startPattern; k < endPattern; k++) {
 
@@ -3374,18 +5102,17 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
 
                         w += kTransPaddedStateCount;
                     }
-                    v += kPartialsPaddedStateCount;
+                    v += kPartialsPatternStride;
                 }
-                v += ((kPatternCount - endPattern) + startPattern) * kPartialsPaddedStateCount;
             }
 
         } else { // Integrate against a partial at the child
             const REALTYPE* partialsChild = gPartials[childIndex];
-            int v = startPattern * kPartialsPaddedStateCount;
             int stateCountModFour = (kStateCount / 4) * 4;
 
             for(int l = 0; l < kCategoryCount; l++) {
                 int u = startPattern * kStateCount;
+                int v = l * kPartialsCategoryStride + startPattern * kPartialsPatternStride;
                 const REALTYPE weight = wt[l];
                 for(int k = startPattern; k < endPattern; k++) {
                     int w = l * kMatrixSize;
@@ -3416,9 +5143,8 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
                         // increment for the extra column at the end
                         w += T_PAD;
                     }
-                    v += kPartialsPaddedStateCount;
+                    v += kPartialsPatternStride;
                 }
-                v += ((kPatternCount - endPattern) + startPattern) * kPartialsPaddedStateCount;
             }
         }
 
@@ -3496,10 +5222,10 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDerivByParti
         if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
             const int* statesChild = gTipStates[childIndex];
-            int v = startPattern * kPartialsPaddedStateCount; // Index for parent partials
 
             for(int l = 0; l < kCategoryCount; l++) {
                 int u = startPattern * kStateCount; // Index in resulting product-partials (summed over categories)
+                int v = l * kPartialsCategoryStride + startPattern * kPartialsPatternStride;
                 const REALTYPE weight = wt[l];
                 for(int k = startPattern; k < endPattern; k++) {
 
@@ -3514,18 +5240,17 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDerivByParti
 
                         w += kTransPaddedStateCount;
                     }
-                    v += kPartialsPaddedStateCount;
+                    v += kPartialsPatternStride;
                 }
-                v += ((kPatternCount - endPattern) + startPattern) * kPartialsPaddedStateCount;
             }
 
         } else { // Integrate against a partial at the child
 
             const REALTYPE* partialsChild = gPartials[childIndex];
-            int v = startPattern * kPartialsPaddedStateCount;
 
             for(int l = 0; l < kCategoryCount; l++) {
                 int u = startPattern * kStateCount;
+                int v = l * kPartialsCategoryStride + startPattern * kPartialsPatternStride;
                 const REALTYPE weight = wt[l];
                 for(int k = startPattern; k < endPattern; k++) {
                     int w = l * kMatrixSize;
@@ -3548,9 +5273,8 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDerivByParti
                         secondDerivTmp[u] += sumOverJD2 * partialsParent[v + i] * weight;
                         u++;
                     }
-                    v += kPartialsPaddedStateCount;
+                    v += kPartialsPatternStride;
                 }
-                v += ((kPatternCount - endPattern) + startPattern) * kPartialsPaddedStateCount;
             }
         }
 
@@ -3622,10 +5346,10 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsMulti(const int* pa
         if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
             const int* statesChild = gTipStates[childIndex];
-            int v = 0; // Index for parent partials
 
             for(int l = 0; l < kCategoryCount; l++) {
                 int u = 0; // Index in resulting product-partials (summed over categories)
+                int v = l * kPartialsCategoryStride; // Index for parent partials
                 const REALTYPE weight = wt[l];
                 for(int k = 0; k < kPatternCount; k++) {
 
@@ -3638,16 +5362,16 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsMulti(const int* pa
 
                         w += kTransPaddedStateCount;
                     }
-                    v += kPartialsPaddedStateCount;
+                    v += kPartialsPatternStride;
                 }
             }
         } else {
             const REALTYPE* partialsChild = gPartials[childIndex];
-            int v = 0;
             int stateCountModFour = (kStateCount / 4) * 4;
 
             for(int l = 0; l < kCategoryCount; l++) {
                 int u = 0;
+                int v = l * kPartialsCategoryStride; // Index for parent partials
                 const REALTYPE weight = wt[l];
                 for(int k = 0; k < kPatternCount; k++) {
                     int w = l * kMatrixSize;
@@ -3678,7 +5402,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsMulti(const int* pa
                         // increment for the extra column at the end
                         w += T_PAD;
                     }
-                    v += kPartialsPaddedStateCount;
+                    v += kPartialsPatternStride;
                 }
             }
 
@@ -3777,10 +5501,10 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsFirstDeriv(const in
     if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
         const int* statesChild = gTipStates[childIndex];
-        int v = 0; // Index for parent partials
 
         for(int l = 0; l < kCategoryCount; l++) {
             int u = 0; // Index in resulting product-partials (summed over categories)
+            int v = l * kPartialsCategoryStride; // Index for parent partials
             const REALTYPE weight = wt[l];
             for(int k = 0; k < kPatternCount; k++) {
 
@@ -3794,17 +5518,17 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsFirstDeriv(const in
 
                     w += kTransPaddedStateCount;
                 }
-                v += kPartialsPaddedStateCount;
+                v += kPartialsPatternStride;
             }
         }
 
     } else { // Integrate against a partial at the child
 
         const REALTYPE* partialsChild = gPartials[childIndex];
-        int v = 0;
 
         for(int l = 0; l < kCategoryCount; l++) {
             int u = 0;
+            int v = l * kPartialsCategoryStride; // Index for parent partials
             const REALTYPE weight = wt[l];
             for(int k = 0; k < kPatternCount; k++) {
                 int w = l * kMatrixSize;
@@ -3824,7 +5548,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsFirstDeriv(const in
                     firstDerivTmp[u] += sumOverJD1 * partialsParent[v + i] * weight;
                     u++;
                 }
-                v += kPartialsPaddedStateCount;
+                v += kPartialsPatternStride;
             }
         }
     }
@@ -3896,10 +5620,10 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDeriv(const i
     if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
         const int* statesChild = gTipStates[childIndex];
-        int v = 0; // Index for parent partials
 
         for(int l = 0; l < kCategoryCount; l++) {
             int u = 0; // Index in resulting product-partials (summed over categories)
+            int v = l * kPartialsCategoryStride; // Index for parent partials
             const REALTYPE weight = wt[l];
             for(int k = 0; k < kPatternCount; k++) {
 
@@ -3914,17 +5638,17 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDeriv(const i
 
                     w += kTransPaddedStateCount;
                 }
-                v += kPartialsPaddedStateCount;
+                v += kPartialsPatternStride;
             }
         }
 
     } else { // Integrate against a partial at the child
 
         const REALTYPE* partialsChild = gPartials[childIndex];
-        int v = 0;
 
         for(int l = 0; l < kCategoryCount; l++) {
             int u = 0;
+            int v = l * kPartialsCategoryStride; // Index for parent partials
             const REALTYPE weight = wt[l];
             for(int k = 0; k < kPatternCount; k++) {
                 int w = l * kMatrixSize;
@@ -3947,7 +5671,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDeriv(const i
                     secondDerivTmp[u] += sumOverJD2 * partialsParent[v + i] * weight;
                     u++;
                 }
-                v += kPartialsPaddedStateCount;
+                v += kPartialsPatternStride;
             }
         }
     }
@@ -3995,6 +5719,95 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDeriv(const i
 
 
 
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsDerivativesRange(const int parIndex,
+                                                                               const int childIndex,
+                                                                               const int probIndex,
+                                                                               const int firstDerivativeIndex,
+                                                                               const int secondDerivativeIndex,
+                                                                               const int categoryWeightsIndex,
+                                                                               const int stateFrequenciesIndex,
+                                                                               const int scalingFactorsIndex,
+                                                                               int startPattern,
+                                                                               int endPattern,
+                                                                               double* outSums) {
+
+    const REALTYPE* partialsParent = gPartials[parIndex];
+    const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
+    const REALTYPE* firstDerivMatrix = (firstDerivativeIndex == BEAGLE_OP_NONE ?
+                                        transMatrix : gTransitionMatrices[firstDerivativeIndex]);
+    const REALTYPE* secondDerivMatrix = (secondDerivativeIndex == BEAGLE_OP_NONE ?
+                                         transMatrix : gTransitionMatrices[secondDerivativeIndex]);
+    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
+    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
+    const int* statesChild = (childIndex < kTipCount ? gTipStates[childIndex] : NULL);
+    const REALTYPE* partialsChild = gPartials[childIndex];
+    const REALTYPE* scalingFactors = (scalingFactorsIndex == BEAGLE_OP_NONE ?
+                                      NULL : gScaleBuffers[scalingFactorsIndex]);
+
+    double sumLogLikelihood = 0.0;
+    double sumFirstDerivative = 0.0;
+    double sumSecondDerivative = 0.0;
+
+    for (int k = startPattern; k < endPattern; k++) {
+        REALTYPE sumOverL = 0.0;
+        REALTYPE sumOverLD1 = 0.0;
+        REALTYPE sumOverLD2 = 0.0;
+
+        for (int l = 0; l < kCategoryCount; l++) {
+            const int v = l * kPartialsCategoryStride + k * kPartialsPatternStride;
+            const int w = l * kMatrixSize;
+            REALTYPE sumOverI = 0.0;
+            REALTYPE sumOverID1 = 0.0;
+            REALTYPE sumOverID2 = 0.0;
+
+            if (statesChild != NULL) {
+                const int stateChild = statesChild[k];
+                for (int i = 0; i < kStateCount; i++) {
+                    const REALTYPE parent = freqs[i] * partialsParent[v + i];
+                    const int u = w + i * kTransPaddedStateCount + stateChild;
+                    sumOverI += transMatrix[u] * parent;
+                    sumOverID1 += firstDerivMatrix[u] * parent;
+                    sumOverID2 += secondDerivMatrix[u] * parent;
+                }
+            } else {
+                for (int i = 0; i < kStateCount; i++) {
+                    const int u = w + i * kTransPaddedStateCount;
+                    REALTYPE sumOverJ = 0.0;
+                    REALTYPE sumOverJD1 = 0.0;
+                    REALTYPE sumOverJD2 = 0.0;
+                    for (int j = 0; j < kStateCount; j++) {
+                        sumOverJ += transMatrix[u + j] * partialsChild[v + j];
+                        sumOverJD1 += firstDerivMatrix[u + j] * partialsChild[v + j];
+                        sumOverJD2 += secondDerivMatrix[u + j] * partialsChild[v + j];
+                    }
+                    const REALTYPE parent = freqs[i] * partialsParent[v + i];
+                    sumOverI += sumOverJ * parent;
+                    sumOverID1 += sumOverJD1 * parent;
+                    sumOverID2 += sumOverJD2 * parent;
+                }
+            }
+
+            sumOverL += sumOverI * wt[l];
+            sumOverLD1 += sumOverID1 * wt[l];
+            sumOverLD2 += sumOverID2 * wt[l];
+        }
+
+        REALTYPE logLikelihood = log(sumOverL);
+        if (scalingFactors != NULL)
+            logLikelihood += scalingFactors[k];
+        sumLogLikelihood += logLikelihood * gPatternWeights[k];
+
+        const REALTYPE firstDerivative = sumOverLD1 / sumOverL;
+        sumFirstDerivative += firstDerivative * gPatternWeights[k];
+        sumSecondDerivative += (sumOverLD2 / sumOverL - firstDerivative * firstDerivative) * gPatternWeights[k];
+    }
+
+    outSums[0] = sumLogLikelihood;
+    outSums[1] = sumFirstDerivative;
+    outSums[2] = sumSecondDerivative;
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::block(void) {
     // Do nothing.
@@ -4015,89 +5828,150 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::rescalePartials(REALTYPE* destP,
             fprintf(stderr,"destP[%d] = %.5f\n",i,destP[i]);
     }
 
-    // TODO None of the code below has been optimized.
-    for (int k = 0; k < kPatternCount; k++) {
+    rescalePartialsRange(destP, scaleFactors, cumulativeScaleFactors, 0, kPatternCount);
+
+    if (DEBUGGING_OUTPUT) {
+        for(int i=0; i<kPatternCount; i++)
+            fprintf(stderr,"new scaleFactor[%d] = %.5f\n",i,scaleFactors[i]);
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::rescalePartialsByPartition(REALTYPE* destP,
+                                                                   REALTYPE* scaleFactors,
+                                                                   REALTYPE* cumulativeScaleFactors,
+                                                                   const int fillWithOnes,
+                                                                   const int partitionIndex) {
+    rescalePartialsRange(destP, scaleFactors, cumulativeScaleFactors,
+                         gPatternPartitionsStartPatterns[partitionIndex],
+                         gPatternPartitionsStartPatterns[partitionIndex + 1]);
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::rescalePartialsRange(REALTYPE* destP,
+                                                             REALTYPE* scaleFactors,
+                                                             REALTYPE* cumulativeScaleFactors,
+                                                             int startPattern,
+                                                             int endPattern) {
+    for (int k = startPattern; k < endPattern; k++) {
         REALTYPE max = 0;
-        const int patternOffset = k * kPartialsPaddedStateCount;
+        const int patternOffset = k * kPartialsPatternStride;
         for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
-            for (int i = 0; i < kStateCount; i++) {
-                if(destP[offset] > max)
-                    max = destP[offset];
-                offset++;
-            }
+            const REALTYPE* partials = destP + l * kPartialsCategoryStride + patternOffset;
+            #pragma omp simd reduction(max:max)
+            for (int i = 0; i < kStateCount; i++)
+                max = (partials[i] > max ? partials[i] : max);
         }
 
         if (max == 0)
             max = 1.0;
 
-        REALTYPE oneOverMax = REALTYPE(1.0) / max;
+        const REALTYPE oneOverMax = REALTYPE(1.0) / max;
         for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
+            REALTYPE* partials = destP + l * kPartialsCategoryStride + patternOffset;
+            #pragma omp simd
             for (int i = 0; i < kStateCount; i++)
-                destP[offset++] *= oneOverMax;
+                partials[i] *= oneOverMax;
         }
 
-        if (kFlags & BEAGLE_FLAG_SCALERS_LOG) {
-            REALTYPE logMax = log(max);
-            scaleFactors[k] = logMax;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += logMax;
-        } else {
-            scaleFactors[k] = max;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += log(max);
-        }
-    }
-    if (DEBUGGING_OUTPUT) {
-        for(int i=0; i<kPatternCount; i++)
-            fprintf(stderr,"new scaleFactor[%d] = %.5f\n",i,scaleFactors[i]);
+        scaleFactors[k] = max;
     }
+
+    accumulateRescaleFactorsRange(scaleFactors, cumulativeScaleFactors, startPattern, endPattern);
 }
 
+/*
+ * Converts per-pattern maxima left in scaleFactors by a rescale into scale factors and adds
+ * their logs to the cumulative factors; a separate pass over the patterns so the logs vectorise.
+ */
 BEAGLE_CPU_TEMPLATE
-void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::rescalePartialsByPartition(REALTYPE* destP,
-                                                                   REALTYPE* scaleFactors,
-                                                                   REALTYPE* cumulativeScaleFactors,
-                                                                   const int fillWithOnes,
-                                                                   const int partitionIndex) {
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateRescaleFactorsRange(REALTYPE* scaleFactors,
+                                                                      REALTYPE* cumulativeScaleFactors,
+                                                                      int startPattern,
+                                                                      int endPattern) {
+    if (kFlags & BEAGLE_FLAG_SCALERS_LOG) {
+        #pragma omp simd
+        for (int k = startPattern; k < endPattern; k++)
+            scaleFactors[k] = log(scaleFactors[k]);
+        if (cumulativeScaleFactors != NULL) {
+            #pragma omp simd
+            for (int k = startPattern; k < endPattern; k++)
+                cumulativeScaleFactors[k] += scaleFactors[k];
+        }
+    } else if (cumulativeScaleFactors != NULL) {
+        #pragma omp simd
+        for (int k = startPattern; k < endPattern; k++)
+            cumulativeScaleFactors[k] += log(scaleFactors[k]);
+    }
+}
 
-    int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
-    int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::exceedsScalingExponent(const REALTYPE* destP,
+                                                               int startPattern,
+                                                               int endPattern) {
+    const REALTYPE lower = ldexp(REALTYPE(1.0), -scalingExponentThreshold - 1);
+    const REALTYPE upper = ldexp(REALTYPE(1.0), scalingExponentThreshold);
+    int outside = 0;
 
-    // TODO None of the code below has been optimized.
-    for (int k = startPattern; k < endPattern; k++) {
-        REALTYPE max = 0;
-        const int patternOffset = k * kPartialsPaddedStateCount;
-        for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
-            for (int i = 0; i < kStateCount; i++) {
-                if(destP[offset] > max)
-                    max = destP[offset];
-                offset++;
+    for (int l = 0; l < kCategoryCount; l++) {
+        const REALTYPE* partials = destP + l * kPartialsCategoryStride;
+        if (kPartialsPatternStride == kStateCount) { // patterns are contiguous within a category
+            const int end = endPattern * kStateCount;
+            #pragma omp simd reduction(|:outside)
+            for (int u = startPattern * kStateCount; u < end; u++)
+                outside |= (partials[u] >= upper) | ((partials[u] < lower) & (partials[u] > 0));
+        } else {
+            for (int k = startPattern; k < endPattern; k++) {
+                const REALTYPE* pattern = partials + k * kPartialsPatternStride;
+                #pragma omp simd reduction(|:outside)
+                for (int i = 0; i < kStateCount; i++)
+                    outside |= (pattern[i] >= upper) | ((pattern[i] < lower) & (pattern[i] > 0));
             }
         }
+        if (outside)
+            return true;
+    }
 
-        if (max == 0)
-            max = 1.0;
+    return false;
+}
 
-        REALTYPE oneOverMax = REALTYPE(1.0) / max;
-        for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
-            for (int i = 0; i < kStateCount; i++)
-                destP[offset++] *= oneOverMax;
-        }
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::hasScaleFactors(const REALTYPE* scaleFactors,
+                                                        int startPattern,
+                                                        int endPattern) {
+    int scaled = 0;
+    #pragma omp simd reduction(|:scaled)
+    for (int k = startPattern; k < endPattern; k++)
+        scaled |= (scaleFactors[k] != REALTYPE(1.0));
+    return scaled != 0;
+}
 
-        if (kFlags & BEAGLE_FLAG_SCALERS_LOG) {
-            REALTYPE logMax = log(max);
-            scaleFactors[k] = logMax;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += logMax;
+/*
+ * Dynamic scaling: partials were computed relative to readScaleFactors (or unscaled when NULL).
+ * Blocks left in range keep those factors; otherwise the block is rescaled and the cumulative
+ * factors receive only the change. Factors are raw, so unscaled patterns hold one.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::dynamicRescalePartialsRange(REALTYPE* destP,
+                                                                    const REALTYPE* readScaleFactors,
+                                                                    REALTYPE* writeScaleFactors,
+                                                                    REALTYPE* cumulativeScaleFactors,
+                                                                    int startPattern,
+                                                                    int endPattern) {
+    if (exceedsScalingExponent(destP, startPattern, endPattern)) {
+        rescalePartialsRange(destP, gDynamicScaleTmp, cumulativeScaleFactors, startPattern, endPattern);
+        if (readScaleFactors != NULL) {
+            for (int k = startPattern; k < endPattern; k++)
+                writeScaleFactors[k] = readScaleFactors[k] * gDynamicScaleTmp[k];
         } else {
-            scaleFactors[k] = max;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += log(max);
+            memcpy(writeScaleFactors + startPattern, gDynamicScaleTmp + startPattern,
+                   sizeof(REALTYPE) * (endPattern - startPattern));
         }
+    } else if (readScaleFactors == NULL) {
+        memcpy(writeScaleFactors + startPattern, ones, sizeof(REALTYPE) * (endPattern - startPattern));
+    } else if (readScaleFactors != writeScaleFactors) {
+        memcpy(writeScaleFactors + startPattern, readScaleFactors + startPattern,
+               sizeof(REALTYPE) * (endPattern - startPattern));
     }
 }
 
@@ -4108,9 +5982,9 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::autoRescalePartials(REALTYPE* destP,
 
     for (int k = 0; k < kPatternCount; k++) {
         REALTYPE max = 0;
-        const int patternOffset = k * kPartialsPaddedStateCount;
+        const int patternOffset = k * kPartialsPatternStride;
         for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
+            int offset = l * kPartialsCategoryStride + patternOffset;
             for (int i = 0; i < kStateCount; i++) {
                 if(destP[offset] > max)
                     max = destP[offset];
@@ -4124,7 +5998,7 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::autoRescalePartials(REALTYPE* destP,
 
         if (expMax != 0) {
             for (int l = 0; l < kCategoryCount; l++) {
-                int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
+                int offset = l * kPartialsCategoryStride + patternOffset;
                 for (int i = 0; i < kStateCount; i++)
                     destP[offset++] *= pow(2.0, -expMax);
             }
@@ -4190,8 +6064,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::reorderPatternsByPartition() {
             for (int l=0; l < kCategoryCount; l++) {
                 for (int i=0; i < kPatternCount; i++) {
                     for (int j=0; j < kStateCount; j++) {
-                        int sortIndex = l*kStateCount*kPatternCount + gPatternsNewOrder[i]*kStateCount + j;
-                        int pIndex = l*kStateCount*kPatternCount + i*kStateCount + j;
+                        int sortIndex = l*kPartialsCategoryStride + gPatternsNewOrder[i]*kPartialsPatternStride + j;
+                        int pIndex = l*kPartialsCategoryStride + i*kPartialsPatternStride + j;
                         sortedPartials[sortIndex] = unsortedPartials[pIndex];
                     }
                 }
@@ -4213,12 +6087,263 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::reorderPatternsByPartition() {
     free(sortedPartials);
     free(sortedTips);
 
+    for (int i = 0; i < kBufferCount; i++)
+        resetMissingTags(i);
+
     kPatternsReordered = true;
 
     return BEAGLE_SUCCESS;
 }
 
 
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::invalidateMatrices(const int* matrixIndices,
+                                                           int count) {
+    if ((!kSparseMatricesEnabled && !kMatrixMemoEnabled) || matrixIndices == NULL)
+        return;
+    for (int i = 0; i < count; i++) {
+        if (matrixIndices[i] >= 0 && matrixIndices[i] < kMatrixCount) {
+            if (kSparseMatricesEnabled)
+                gSparseMatrixStates[matrixIndices[i]] = BEAGLE_CPU_SPARSE_UNKNOWN;
+            if (kMatrixMemoEnabled)
+                dropMatrixMemoEntry(matrixIndices[i]);
+        }
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::dropMatrixMemoEntry(int matrixIndex) {
+    const int eigenIndex = gMatrixMemoKeys[matrixIndex].first;
+    if (eigenIndex < 0)
+        return;
+    typename std::map<double, MatrixMemoEntry>::iterator entry =
+            gMatrixMemo[eigenIndex].find(gMatrixMemoKeys[matrixIndex].second);
+    for (int d = 0; d < 3; d++) {
+        if (entry->second.matrixIndices[d] >= 0)
+            gMatrixMemoKeys[entry->second.matrixIndices[d]].first = -1;
+    }
+    gMatrixMemo[eigenIndex].erase(entry);
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::clearMatrixMemo(int eigenIndex) {
+    if (!kMatrixMemoEnabled)
+        return;
+    for (int i = 0; i < kMatrixCount; i++) {
+        if (eigenIndex < 0 || gMatrixMemoKeys[i].first == eigenIndex)
+            gMatrixMemoKeys[i].first = -1;
+    }
+    for (int e = 0; e < kEigenDecompCount; e++) {
+        if (eigenIndex < 0 || e == eigenIndex)
+            gMatrixMemo[e].clear();
+    }
+}
+
+/*
+ * Chooses a dense or sparse representation for every matrix applied to a partials
+ * child in operations. Done before threads are dispatched, as concurrent operations
+ * may share matrices.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::prepareSparseMatrices(const int* operations,
+                                                              int count,
+                                                              bool byPartition) {
+    if (!kSparseMatricesEnabled)
+        return;
+
+    const int numOps = (byPartition ? BEAGLE_PARTITION_OP_COUNT : BEAGLE_OP_COUNT);
+
+    for (int op = 0; op < count; op++) {
+        for (int c = 0; c < 2; c++) {
+            const int childIndex = operations[op * numOps + 3 + 2 * c];
+            const int matrixIndex = operations[op * numOps + 4 + 2 * c];
+            if (gTipStates[childIndex] == NULL &&
+                gSparseMatrixStates[matrixIndex] == BEAGLE_CPU_SPARSE_UNKNOWN)
+                analyzeSparseMatrix(matrixIndex);
+        }
+    }
+}
+
+/*
+ * Builds compressed sparse rows for each category of a transition matrix, dropping
+ * entries below BEAGLE_CPU_SPARSE_THRESHOLD, if the remaining fill is low enough.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::analyzeSparseMatrix(int matrixIndex) {
+    const REALTYPE* matrix = gTransitionMatrices[matrixIndex];
+
+    int nonZeros = 0;
+    for (int l = 0; l < kCategoryCount; l++) {
+        for (int i = 0; i < kStateCount; i++) {
+            const REALTYPE* row = matrix + l * kMatrixSize + i * kTransPaddedStateCount;
+            for (int j = 0; j < kStateCount; j++) {
+                if (std::abs(row[j]) > BEAGLE_CPU_SPARSE_THRESHOLD)
+                    nonZeros++;
+            }
+        }
+    }
+
+    if (nonZeros > BEAGLE_CPU_SPARSE_MAX_FILL * kStateCount * kStateCount * kCategoryCount) {
+        gSparseMatrixStates[matrixIndex] = BEAGLE_CPU_SPARSE_DENSE;
+        return;
+    }
+
+    if (gSparseRowOffsets[matrixIndex] == NULL) {
+        gSparseRowOffsets[matrixIndex] = (int*) malloc(sizeof(int) * kCategoryCount * (kStateCount + 1));
+        if (gSparseRowOffsets[matrixIndex] == NULL)
+            throw std::bad_alloc();
+    }
+    if (nonZeros > gSparseCapacities[matrixIndex]) {
+        free(gSparseColumns[matrixIndex]);
+        free(gSparseValues[matrixIndex]);
+        gSparseColumns[matrixIndex] = (int*) malloc(sizeof(int) * nonZeros);
+        gSparseValues[matrixIndex] = (REALTYPE*) malloc(sizeof(REALTYPE) * nonZeros);
+        if (gSparseColumns[matrixIndex] == NULL || gSparseValues[matrixIndex] == NULL)
+            throw std::bad_alloc();
+        gSparseCapacities[matrixIndex] = nonZeros;
+    }
+
+    int* offsets = gSparseRowOffsets[matrixIndex];
+    int* columns = gSparseColumns[matrixIndex];
+    REALTYPE* values = gSparseValues[matrixIndex];
+    int e = 0;
+    for (int l = 0; l < kCategoryCount; l++) {
+        for (int i = 0; i < kStateCount; i++) {
+            const REALTYPE* row = matrix + l * kMatrixSize + i * kTransPaddedStateCount;
+            *(offsets++) = e;
+            for (int j = 0; j < kStateCount; j++) {
+                if (std::abs(row[j]) > BEAGLE_CPU_SPARSE_THRESHOLD) {
+                    columns[e] = j;
+                    values[e] = row[j];
+                    e++;
+                }
+            }
+        }
+        *(offsets++) = e;
+    }
+
+    gSparseMatrixStates[matrixIndex] = BEAGLE_CPU_SPARSE_SPARSE;
+}
+
+/*
+ * Multiplies the sparse form of one category of a matrix into the partials of a range
+ * of patterns, four patterns at a time so each non-zero is loaded once per block.
+ * Writes the products to destP, or multiplies destP by them if accumulate is set.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcSparseMatrixPartials(REALTYPE* destP,
+                                                                 const int* offsets,
+                                                                 const int* columns,
+                                                                 const REALTYPE* values,
+                                                                 const REALTYPE* partials,
+                                                                 int category,
+                                                                 bool accumulate,
+                                                                 int startPattern,
+                                                                 int endPattern) {
+    const int stride = kPartialsPatternStride;
+    int k = startPattern;
+    for (; k + 4 <= endPattern; k += 4) {
+        const int v = category * kPartialsCategoryStride + k * stride;
+        const REALTYPE* p = partials + v;
+        REALTYPE* destPtr = destP + v;
+        for (int i = 0; i < kStateCount; i++) {
+            REALTYPE sum0 = 0.0, sum1 = 0.0, sum2 = 0.0, sum3 = 0.0;
+            for (int e = offsets[i]; e < offsets[i + 1]; e++) {
+                const REALTYPE value = values[e];
+                const int j = columns[e];
+                sum0 += value * p[j];
+                sum1 += value * p[j + stride];
+                sum2 += value * p[j + 2 * stride];
+                sum3 += value * p[j + 3 * stride];
+            }
+            if (accumulate) {
+                destPtr[i] *= sum0;
+                destPtr[i + stride] *= sum1;
+                destPtr[i + 2 * stride] *= sum2;
+                destPtr[i + 3 * stride] *= sum3;
+            } else {
+                destPtr[i] = sum0;
+                destPtr[i + stride] = sum1;
+                destPtr[i + 2 * stride] = sum2;
+                destPtr[i + 3 * stride] = sum3;
+            }
+        }
+    }
+    for (; k < endPattern; k++) {
+        const int v = category * kPartialsCategoryStride + k * stride;
+        const REALTYPE* p = partials + v;
+        REALTYPE* destPtr = destP + v;
+        for (int i = 0; i < kStateCount; i++) {
+            REALTYPE sum = 0.0;
+            for (int e = offsets[i]; e < offsets[i + 1]; e++)
+                sum += values[e] * p[columns[e]];
+            if (accumulate)
+                destPtr[i] *= sum;
+            else
+                destPtr[i] = sum;
+        }
+    }
+}
+
+/*
+ * Calculates partial likelihoods at a node using the sparse form of the matrices of
+ * partials children; a child with states (non-NULL states) uses its dense matrix.
+ * Divides by scaleFactors if not NULL.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsSparse(REALTYPE* destP,
+                                                           const int* states1,
+                                                           const REALTYPE* partials1,
+                                                           const REALTYPE* matrices1,
+                                                           int matrixIndex1,
+                                                           const int* states2,
+                                                           const REALTYPE* partials2,
+                                                           const REALTYPE* matrices2,
+                                                           int matrixIndex2,
+                                                           const REALTYPE* scaleFactors,
+                                                           int startPattern,
+                                                           int endPattern) {
+    // with a single partials child, it goes first so the states child is applied as a multiplier
+    if (states1 == NULL && states2 != NULL) {
+        calcPartialsSparse(destP, states2, partials2, matrices2, matrixIndex2,
+                           states1, partials1, matrices1, matrixIndex1,
+                           scaleFactors, startPattern, endPattern);
+        return;
+    }
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        const int matrixOffset = l * kMatrixSize;
+
+        if (states1 == NULL) {
+            calcSparseMatrixPartials(destP, gSparseRowOffsets[matrixIndex1] + l * (kStateCount + 1),
+                                     gSparseColumns[matrixIndex1], gSparseValues[matrixIndex1],
+                                     partials1, l, false, startPattern, endPattern);
+        } else {
+            for (int k = startPattern; k < endPattern; k++) {
+                REALTYPE* destPtr = destP + l * kPartialsCategoryStride + k * kPartialsPatternStride;
+                const REALTYPE* matrixPtr = matrices1 + matrixOffset + states1[k];
+                for (int i = 0; i < kStateCount; i++)
+                    destPtr[i] = matrixPtr[i * kTransPaddedStateCount];
+            }
+        }
+
+        calcSparseMatrixPartials(destP, gSparseRowOffsets[matrixIndex2] + l * (kStateCount + 1),
+                                 gSparseColumns[matrixIndex2], gSparseValues[matrixIndex2],
+                                 partials2, l, true, startPattern, endPattern);
+
+        for (int k = startPattern; k < endPattern; k++) {
+            REALTYPE* destPtr = destP + l * kPartialsCategoryStride + k * kPartialsPatternStride;
+            if (scaleFactors != NULL) {
+                const REALTYPE oneOverScaleFactor = REALTYPE(1.0) / scaleFactors[k];
+                for (int i = 0; i < kStateCount; i++)
+                    destPtr[i] *= oneOverScaleFactor;
+            }
+            for (int pad = 0; pad < P_PAD; pad++)
+                destPtr[kStateCount + pad] = 0.0;
+        }
+    }
+}
+
 /*
  * Calculates partial likelihoods at a node when both children have states.
  */
@@ -4231,9 +6356,8 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
                                                          int startPattern,
                                                          int endPattern) {
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        int v = l*kPartialsCategoryStride + kPartialsPatternStride*startPattern;
         for (int k = startPattern; k < endPattern; k++) {
             const int state1 = states1[k];
             const int state2 = states2[k];
@@ -4254,6 +6378,7 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
                     v++;
                 }
             }
+            v += kPartialsPatternStride - kPartialsPaddedStateCount;
         }
     }
 }
@@ -4268,9 +6393,8 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALTYPE* d
                                                                      int startPattern,
                                                                      int endPattern) {
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-    int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+    int v = l*kPartialsCategoryStride + kPartialsPatternStride*startPattern;
         for (int k = startPattern; k < endPattern; k++) {
             const int state1 = child1States[k];
             const int state2 = child2States[k];
@@ -4289,6 +6413,7 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALTYPE* d
                     v++;
                 }
             }
+            v += kPartialsPatternStride - kPartialsPaddedStateCount;
         }
     }
 }
@@ -4313,9 +6438,8 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP,
 
     int stateCountModFour = (kStateCount / 4) * 4;
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        int v = l*kPartialsCategoryStride + kPartialsPatternStride*startPattern;
         int matrixOffset = l*kMatrixSize;
         const REALTYPE* partials2Ptr = &partials2[v];
         REALTYPE* destPtr = &destP[v];
@@ -4347,7 +6471,8 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP,
                     *(destPtr++) = 0.0;
                 }
             }
-            partials2Ptr += kPartialsPaddedStateCount;
+            destPtr += kPartialsPatternStride - kPartialsPaddedStateCount;
+            partials2Ptr += kPartialsPatternStride;
         }
     }
 }
@@ -4369,9 +6494,8 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartialsFixedScaling(REALTYPE*
 
     int stateCountModFour = (kStateCount / 4) * 4;
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        int v = l*kPartialsCategoryStride + kPartialsPatternStride*startPattern;
         int matrixOffset = l*kMatrixSize;
         const REALTYPE* partials2Ptr = &partials2[v];
         REALTYPE* destPtr = &destP[v];
@@ -4404,7 +6528,8 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartialsFixedScaling(REALTYPE*
                     *(destPtr++) = 0.0;
                 }
             }
-            partials2Ptr += kPartialsPaddedStateCount;
+            destPtr += kPartialsPatternStride - kPartialsPaddedStateCount;
+            partials2Ptr += kPartialsPatternStride;
         }
     }
 }
@@ -4428,7 +6553,7 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPreStatesPartialsFixedScaling(REALTY
 //
 //#pragma omp parallel for num_threads(kCategoryCount)
 //    for (int l = 0; l < kCategoryCount; l++) {
-//        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+//        int v = l*kPartialsCategoryStride + kPartialsPatternStride*startPattern;
 //        int matrixOffset = l*kMatrixSize;
 //        const REALTYPE* partials2Ptr = &partials2[v];
 //        REALTYPE* destPtr = &destP[v];
@@ -4473,6 +6598,12 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartials(REALTYPE* destP,
                                                              const REALTYPE* matrices2,
                                                              int startPattern,
                                                              int endPattern) {
+    if (kStateCount >= BEAGLE_CPU_BLOCKED_MIN_STATE_COUNT) {
+        calcPartialsPartialsBlocked(destP, partials1, matrices1, partials2, matrices2, NULL,
+                                    startPattern, endPattern);
+        return;
+    }
+
     int matrixIncr = kStateCount;
 
     // increment for the extra column at the end
@@ -4480,9 +6611,8 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartials(REALTYPE* destP,
 
     int stateCountModFour = (kStateCount / 4) * 4;
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        int v = l*kPartialsCategoryStride + kPartialsPatternStride*startPattern;
         int matrixOffset = l*kMatrixSize;
         const REALTYPE* partials1Ptr = &partials1[v];
         const REALTYPE* partials2Ptr = &partials2[v];
@@ -4516,9 +6646,9 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartials(REALTYPE* destP,
 
                 *(destPtr++) = (sum1A + sum1B) * (sum2A + sum2B);
             }
-            destPtr += P_PAD;
-            partials1Ptr += kPartialsPaddedStateCount;
-            partials2Ptr += kPartialsPaddedStateCount;
+            destPtr += kPartialsPatternStride - kStateCount;
+            partials1Ptr += kPartialsPatternStride;
+            partials2Ptr += kPartialsPatternStride;
         }
     }
 }
@@ -4541,12 +6671,16 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPrePartialsPartials(REALTYPE* destP,
 
     int stateCountModFour = (kStateCount / 4) * 4;
     REALTYPE* tmpdestPtr = destP;
-    //clean up the partial first, set every entry to 0
-    std::fill(tmpdestPtr, tmpdestPtr + kPartialsSize, 0);
+    //clean up the partial first, set every entry in the pattern range to 0
+    for (int l = 0; l < kCategoryCount; l++) {
+        for (int k = startPattern; k < endPattern; k++) {
+            tmpdestPtr = destP + l*kPartialsCategoryStride + k*kPartialsPatternStride;
+            std::fill(tmpdestPtr, tmpdestPtr + kPartialsPaddedStateCount, 0);
+        }
+    }
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        int v = l*kPartialsCategoryStride + kPartialsPatternStride*startPattern;
         int matrixOffset = l*kMatrixSize;
         const REALTYPE* partials1Ptr = &partials1[v];
         const REALTYPE* partials2Ptr = &partials2[v];
@@ -4591,9 +6725,9 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPrePartialsPartials(REALTYPE* destP,
                     *(tmpdestPtr++) += matrices1Ptr[j] * MjPj;
                 }
             }
-            destPtr +=kPartialsPaddedStateCount;
-            partials1Ptr += kPartialsPaddedStateCount;
-            partials2Ptr += kPartialsPaddedStateCount;
+            destPtr += kPartialsPatternStride;
+            partials1Ptr += kPartialsPatternStride;
+            partials2Ptr += kPartialsPatternStride;
         }
     }
 
@@ -4617,12 +6751,16 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPrePartialsStates(REALTYPE* destP,
 
     int stateCountModFour = (kStateCount / 4) * 4;
     REALTYPE* tmpdestPtr = destP;
-    //clean up the partial first, set every entry to 0
-    std::fill(tmpdestPtr, tmpdestPtr + kPartialsSize, 0);
+    //clean up the partial first, set every entry in the pattern range to 0
+    for (int l = 0; l < kCategoryCount; l++) {
+        for (int k = startPattern; k < endPattern; k++) {
+            tmpdestPtr = destP + l*kPartialsCategoryStride + k*kPartialsPatternStride;
+            std::fill(tmpdestPtr, tmpdestPtr + kPartialsPaddedStateCount, 0);
+        }
+    }
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        int v = l*kPartialsCategoryStride + kPartialsPatternStride*startPattern;
         int matrixOffset = l*kMatrixSize;
         const REALTYPE* partials1Ptr = &partials1[v];
 
@@ -4654,8 +6792,8 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPrePartialsStates(REALTYPE* destP,
 
                 w += matrixIncr;
             }
-            destPtr +=kPartialsPaddedStateCount;
-            partials1Ptr += kPartialsPaddedStateCount;
+            destPtr += kPartialsPatternStride;
+            partials1Ptr += kPartialsPatternStride;
         }
     }
 
@@ -4671,6 +6809,12 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsFixedScaling(REALTYP
                                                                          int startPattern,
                                                                          int endPattern) {
 
+    if (kStateCount >= BEAGLE_CPU_BLOCKED_MIN_STATE_COUNT) {
+        calcPartialsPartialsBlocked(destP, partials1, matrices1, partials2, matrices2, scaleFactors,
+                                    startPattern, endPattern);
+        return;
+    }
+
     int matrixIncr = kStateCount;
 
     // increment for the extra column at the end
@@ -4678,9 +6822,8 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsFixedScaling(REALTYP
 
     int stateCountModFour = (kStateCount / 4) * 4;
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+        int v = l*kPartialsCategoryStride + kPartialsPatternStride*startPattern;
         int matrixOffset = l*kMatrixSize;
         const REALTYPE* partials1Ptr = &partials1[v];
         const REALTYPE* partials2Ptr = &partials2[v];
@@ -4714,9 +6857,135 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsFixedScaling(REALTYP
 
                 *(destPtr++) = (sum1A + sum1B) * (sum2A + sum2B) * oneOverScaleFactor;
             }
-            destPtr += P_PAD;
-            partials1Ptr += kPartialsPaddedStateCount;
-            partials2Ptr += kPartialsPaddedStateCount;
+            destPtr += kPartialsPatternStride - kStateCount;
+            partials1Ptr += kPartialsPatternStride;
+            partials2Ptr += kPartialsPatternStride;
+        }
+    }
+}
+
+/*
+ * Calculates partial likelihoods at a node when both children have partials, for large state
+ * counts. Each category's patterns are treated as a (patterns x states) matrix multiplied by the
+ * transposed transition matrix, in register blocks of BEAGLE_CPU_BLOCK_PATTERN_COUNT patterns by
+ * BEAGLE_CPU_BLOCK_STATE_COUNT destination states. Optionally divides by fixed scale factors.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsBlocked(REALTYPE* destP,
+                                                                    const REALTYPE* partials1,
+                                                                    const REALTYPE* matrices1,
+                                                                    const REALTYPE* partials2,
+                                                                    const REALTYPE* matrices2,
+                                                                    const REALTYPE* scaleFactors,
+                                                                    int startPattern,
+                                                                    int endPattern) {
+    const int matrixIncr = kStateCount + T_PAD;
+    const int paddedStateCount = kBlockedPaddedStateCount;
+    const int transposedSize = kStateCount * paddedStateCount;
+
+    const int slot = getBlockedMatricesSlot(startPattern);
+    REALTYPE* slotMatrices = gBlockedMatrices + (size_t) slot * 2 * kCategoryCount * transposedSize;
+    const REALTYPE** sources = &gBlockedMatricesSources[slot * 2];
+
+    // ranges of one operation split around missing-data runs reuse the first range's transposes
+    if (!gBlockedMatricesRetained[slot] || sources[0] != matrices1 || sources[1] != matrices2) {
+        for (int l = 0; l < kCategoryCount; l++) {
+            const REALTYPE* matrix1 = matrices1 + l*kMatrixSize;
+            const REALTYPE* matrix2 = matrices2 + l*kMatrixSize;
+            REALTYPE* matrix1T = slotMatrices + l * 2 * transposedSize;
+            REALTYPE* matrix2T = matrix1T + transposedSize;
+            for (int i = 0; i < kStateCount; i++) {
+                for (int j = 0; j < kStateCount; j++) {
+                    matrix1T[j*paddedStateCount + i] = matrix1[i*matrixIncr + j];
+                    matrix2T[j*paddedStateCount + i] = matrix2[i*matrixIncr + j];
+                }
+            }
+        }
+        sources[0] = (gBlockedMatricesRetained[slot] ? matrices1 : NULL);
+        sources[1] = (gBlockedMatricesRetained[slot] ? matrices2 : NULL);
+    }
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        const REALTYPE* matrix1T = slotMatrices + l * 2 * transposedSize;
+        const REALTYPE* matrix2T = matrix1T + transposedSize;
+
+        int v = l*kPartialsCategoryStride;
+        int k = startPattern;
+        for (; k + BEAGLE_CPU_BLOCK_PATTERN_COUNT <= endPattern; k += BEAGLE_CPU_BLOCK_PATTERN_COUNT) {
+            const int u = v + k*kPartialsPatternStride;
+            calcPartialsPartialsBlock<BEAGLE_CPU_BLOCK_PATTERN_COUNT>(&destP[u], &partials1[u], matrix1T,
+                                                                      &partials2[u], matrix2T, paddedStateCount,
+                                                                      (scaleFactors == NULL ? NULL : &scaleFactors[k]));
+        }
+        for (; k < endPattern; k++) {
+            const int u = v + k*kPartialsPatternStride;
+            calcPartialsPartialsBlock<1>(&destP[u], &partials1[u], matrix1T,
+                                         &partials2[u], matrix2T, paddedStateCount,
+                                         (scaleFactors == NULL ? NULL : &scaleFactors[k]));
+        }
+    }
+}
+
+/*
+ * Register-blocked micro-kernel: BLOCK_PATTERNS consecutive patterns against each block of
+ * BEAGLE_CPU_BLOCK_STATE_COUNT destination states, with the Hadamard product of the two
+ * children fused into the store.
+ */
+BEAGLE_CPU_TEMPLATE
+template <int BLOCK_PATTERNS>
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsBlock(REALTYPE* destP,
+                                                                  const REALTYPE* partials1,
+                                                                  const REALTYPE* matrix1T,
+                                                                  const REALTYPE* partials2,
+                                                                  const REALTYPE* matrix2T,
+                                                                  int paddedStateCount,
+                                                                  const REALTYPE* scaleFactors) {
+    const int BLOCK_STATES = BEAGLE_CPU_BLOCK_STATE_COUNT;
+
+    REALTYPE oneOverScaleFactors[BLOCK_PATTERNS];
+    for (int r = 0; r < BLOCK_PATTERNS; r++)
+        oneOverScaleFactors[r] = (scaleFactors == NULL ? REALTYPE(1.0) : REALTYPE(1.0) / scaleFactors[r]);
+
+    for (int i = 0; i < paddedStateCount; i += BLOCK_STATES) {
+        REALTYPE sums1[BLOCK_PATTERNS][BLOCK_STATES];
+        REALTYPE sums2[BLOCK_PATTERNS][BLOCK_STATES];
+        for (int r = 0; r < BLOCK_PATTERNS; r++) {
+            for (int c = 0; c < BLOCK_STATES; c++) {
+                sums1[r][c] = 0.0;
+                sums2[r][c] = 0.0;
+            }
+        }
+
+        for (int j = 0; j < kStateCount; j++) {
+            const REALTYPE* m1 = &matrix1T[j*paddedStateCount + i];
+            for (int r = 0; r < BLOCK_PATTERNS; r++) {
+                const REALTYPE p1 = partials1[r*kPartialsPatternStride + j];
+                for (int c = 0; c < BLOCK_STATES; c++)
+                    sums1[r][c] += m1[c] * p1;
+            }
+        }
+
+        for (int j = 0; j < kStateCount; j++) {
+            const REALTYPE* m2 = &matrix2T[j*paddedStateCount + i];
+            for (int r = 0; r < BLOCK_PATTERNS; r++) {
+                const REALTYPE p2 = partials2[r*kPartialsPatternStride + j];
+                for (int c = 0; c < BLOCK_STATES; c++)
+                    sums2[r][c] += m2[c] * p2;
+            }
+        }
+
+        const int width = (kStateCount - i < BLOCK_STATES ? kStateCount - i : BLOCK_STATES);
+        for (int r = 0; r < BLOCK_PATTERNS; r++) {
+            REALTYPE* destPtr = &destP[r*kPartialsPatternStride + i];
+            for (int c = 0; c < width; c++)
+                destPtr[c] = sums1[r][c] * sums2[r][c] * oneOverScaleFactors[r];
+        }
+    }
+
+    if (P_PAD) {
+        for (int r = 0; r < BLOCK_PATTERNS; r++) {
+            for (int pad = kStateCount; pad < kPartialsPaddedStateCount; pad++)
+                destP[r*kPartialsPatternStride + pad] = 0.0;
         }
     }
 }
@@ -4729,10 +6998,9 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsAutoScaling(REALTYPE
                                                                const REALTYPE* matrices2,
                                                                int* activateScaling) {
 
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-        int u = l*kPartialsPaddedStateCount*kPatternCount;
-        int v = l*kPartialsPaddedStateCount*kPatternCount;
+        int u = l*kPartialsCategoryStride;
+        int v = l*kPartialsCategoryStride;
         for (int k = 0; k < kPatternCount; k++) {
             int w = l * kMatrixSize;
             for (int i = 0; i < kStateCount; i++) {
@@ -4757,8 +7025,8 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsAutoScaling(REALTYPE
 
                 u++;
             }
-            u += P_PAD;
-            v += kPartialsPaddedStateCount;
+            u += kPartialsPatternStride - kStateCount;
+            v += kPartialsPatternStride;
         }
     }
 }
@@ -4800,6 +7068,39 @@ void* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::mallocAligned(size_t size) {
     return ptr;
 }
 
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::stopPartitionThreads()
+{
+    if (!kThreadingEnabled)
+        return;
+
+    // Send stop signal to all threads and join them...
+    for (int i = 0; i < kNumThreads; i++) {
+        threadData* td = &gThreads[i];
+        std::unique_lock<std::mutex> l(td->m);
+        td->stop = true;
+        td->cv.notify_one();
+    }
+
+    // Join all the threads (OpenMP instances run their queues without worker threads)
+    for (int i = 0; i < kNumThreads; i++) {
+        threadData* td = &gThreads[i];
+        if (td->t.joinable())
+            td->t.join();
+    }
+
+    delete[] gThreads;
+    delete[] gFutures;
+
+    for (int i=0; i<kNumThreads; i++) {
+        free(gThreadOperations[i]);
+    }
+    free(gThreadOperations);
+    free(gThreadOpCounts);
+
+    kThreadingEnabled = false;
+}
+
 BEAGLE_CPU_TEMPLATE
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::threadWaiting(threadData* tData)
 {
@@ -4827,6 +7128,164 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::threadWaiting(threadData* tData)
     }
 }
 
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::enqueueThreadTask(int threadIndex,
+                                                          std::packaged_task<void()>& threadTask)
+{
+    gFutures[threadIndex] = threadTask.get_future();
+    threadData* td = &gThreads[threadIndex];
+
+    std::unique_lock<std::mutex> l(td->m);
+    td->jobs.push(std::move(threadTask));
+    l.unlock();
+
+    // OpenMP instances have no worker threads; their queues are run in waitThreadTasks
+    if (!(kFlags & BEAGLE_FLAG_THREADING_OPENMP))
+        td->cv.notify_one();
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::waitThreadTasks(int threadCount)
+{
+#ifdef _OPENMP
+    if (kFlags & BEAGLE_FLAG_THREADING_OPENMP) {
+        // A single parallel region per call; all queued work for a pattern block runs on one thread
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(kOpenMPThreadCount)
+        for (int i = 0; i < threadCount; i++) {
+            std::queue<std::packaged_task<void()>>& jobs = gThreads[i].jobs;
+            while (!jobs.empty()) {
+                jobs.front()();
+                jobs.pop();
+            }
+        }
+        return;
+    }
+#endif
+
+    for (int i = 0; i < threadCount; i++) {
+        gFutures[i].wait();
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setOpenMPPatternBlocks(int threadCount)
+{
+#ifdef _OPENMP
+    kOpenMPThreadCount = threadCount;
+
+    // keep partitions set explicitly through setPatternPartitions
+    if (kPartitionsInitialised && !kAutoPartitioningEnabled)
+        return;
+
+    int blockCount = kPatternCount / BEAGLE_CPU_OPENMP_MIN_BLOCK_PATTERN_COUNT;
+    if (blockCount > threadCount)
+        blockCount = threadCount;
+
+    if (kAutoPartitioningEnabled) {
+        free(gAutoPartitionOperations);
+        if (kAutoRootPartitioningEnabled) {
+            free(gAutoPartitionIndices);
+            free(gAutoPartitionOutSumLogLikelihoods);
+        }
+        kAutoPartitioningEnabled = false;
+        kAutoRootPartitioningEnabled = false;
+
+        if (blockCount < 2) {
+            // too few threads or patterns for blocks; drop those of an earlier thread count
+            stopPartitionThreads();
+            free(gPatternPartitions);
+            free(gPatternPartitionsStartPatterns);
+            kPartitionCount = 1;
+            kMaxPartitionCount = kPartitionCount;
+            kPartitionsInitialised = false;
+        }
+    }
+
+    if (blockCount < 2)
+        return;
+
+    int blockSize = (kPatternCount + blockCount - 1) / blockCount;
+    blockSize = ((blockSize + BEAGLE_CPU_OPENMP_BLOCK_ALIGNMENT - 1) / BEAGLE_CPU_OPENMP_BLOCK_ALIGNMENT) *
+                BEAGLE_CPU_OPENMP_BLOCK_ALIGNMENT;
+    blockCount = (kPatternCount + blockSize - 1) / blockSize;
+
+    int* patternPartitions = (int*) malloc(sizeof(int) * kPatternCount);
+    if (patternPartitions == NULL)
+        throw std::bad_alloc();
+    for (int i = 0; i < kPatternCount; i++) {
+        patternPartitions[i] = i / blockSize;
+    }
+    setPatternPartitions(blockCount, patternPartitions);
+    free(patternPartitions);
+
+    gAutoPartitionOperations = (int*) malloc(sizeof(int) * kBufferCount * kPartitionCount * BEAGLE_PARTITION_OP_COUNT);
+    gAutoPartitionIndices = (int*) malloc(sizeof(int) * kPartitionCount);
+    gAutoPartitionOutSumLogLikelihoods = (double*) malloc(sizeof(double) * kPartitionCount);
+    if (gAutoPartitionOperations == NULL || gAutoPartitionIndices == NULL || gAutoPartitionOutSumLogLikelihoods == NULL)
+        throw std::bad_alloc();
+    for (int i = 0; i < kPartitionCount; i++) {
+        gAutoPartitionIndices[i] = i;
+    }
+
+    kAutoPartitioningEnabled = true;
+    kAutoRootPartitioningEnabled = true;
+#endif
+}
+
+/*
+ * Slots of transposed matrices for calcPartialsPartialsBlocked, allocated up front so that the
+ * kernel does not allocate; the padding columns stay zero.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::allocateBlockedMatrices(int slotCount)
+{
+    const size_t slotSize = (size_t) 2 * kCategoryCount * kStateCount * kBlockedPaddedStateCount;
+    free(gBlockedMatrices);
+    gBlockedMatrices = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * slotSize * slotCount);
+    if (gBlockedMatrices == NULL)
+        throw std::bad_alloc();
+    std::fill(gBlockedMatrices, gBlockedMatrices + slotSize * slotCount, REALTYPE(0.0));
+    gBlockedMatricesSources.assign(2 * slotCount, (const REALTYPE*) NULL);
+    gBlockedMatricesRetained.assign(slotCount, 0);
+    kBlockedMatricesSlotCount = slotCount;
+}
+
+/*
+ * The slot of the pattern partition holding startPattern. Each partition runs on one thread at a
+ * time, and a range passed to the kernels never spans partitions when they run concurrently.
+ */
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getBlockedMatricesSlot(int startPattern)
+{
+    int slot = 0;
+    if (kPartitionsInitialised && kPartitionCount > 1) {
+        slot = (int) (std::upper_bound(gPatternPartitionsStartPatterns + 1,
+                                       gPatternPartitionsStartPatterns + kPartitionCount,
+                                       startPattern) - (gPatternPartitionsStartPatterns + 1));
+    }
+    return slot;
+}
+
+/*
+ * Keeps the transposes of the slots covering [startPattern, endPattern) while one operation runs,
+ * since its matrices cannot change in between; released slots transpose on every call.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::retainBlockedMatrices(int startPattern,
+                                                              int endPattern,
+                                                              bool retain)
+{
+    if (gBlockedMatrices == NULL || startPattern >= endPattern)
+        return;
+    const int firstSlot = getBlockedMatricesSlot(startPattern);
+    const int lastSlot = getBlockedMatricesSlot(endPattern - 1);
+    for (int slot = firstSlot; slot <= lastSlot; slot++) {
+        gBlockedMatricesRetained[slot] = (retain ? 1 : 0);
+        gBlockedMatricesSources[slot * 2] = NULL;
+        gBlockedMatricesSources[slot * 2 + 1] = NULL;
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // BeagleCPUImplFactory public methods
 BEAGLE_CPU_FACTORY_TEMPLATE
@@ -4882,7 +7341,7 @@ BEAGLE_CPU_FACTORY_TEMPLATE
 const long BeagleCPUImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getFlags() {
     long flags = BEAGLE_FLAG_COMPUTATION_SYNCH |
                  BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_DYNAMIC |
-                 BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+                 BEAGLE_CPU_THREADING_FLAGS |
                  BEAGLE_FLAG_PROCESSOR_CPU |
                  BEAGLE_FLAG_VECTOR_NONE |
                  BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
@@ -0,0 +1,250 @@
+/*
+ *  BeagleCPUMixedImpl.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#ifndef __BeagleCPUMixedImpl__
+#define __BeagleCPUMixedImpl__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include "libhmsbeagle/CPU/BeagleCPUImpl.h"
+
+#include <vector>
+
+// Mixed precision is requested by requiring both precision flags
+#define BEAGLE_CPU_MIXED_PRECISION_FLAGS (BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_DOUBLE)
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * Mixed-precision CPU implementation. Partials and transition matrices are stored and
+ * propagated in REALTYPE (float), while scale factors, log integration at the root and
+ * edges and pattern-weighted sums are carried in double precision.
+ *
+ * The REALTYPE scale buffers of the base class are kept as a mirror of the double
+ * buffers so that kernels reading fixed scale factors continue to work unchanged.
+ */
+BEAGLE_CPU_TEMPLATE
+class BeagleCPUMixedImpl : public BeagleCPUImpl<BEAGLE_CPU_GENERIC> {
+
+protected:
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kFlags;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kTipCount;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kPatternCount;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kPaddedPatternCount;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kPartialsLayout;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kPartialsPatternStride;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kPartialsCategoryStride;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kStateCount;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kTransPaddedStateCount;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kPartialsPaddedStateCount;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kCategoryCount;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kEigenDecompCount;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kScaleBufferCount;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kMatrixSize;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kPatternsReordered;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gPartials;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gTransitionMatrices;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gScaleBuffers;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gPatternWeights;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gPatternsNewOrder;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gPatternPartitionsStartPatterns;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::outLogLikelihoodsTmp;
+
+    double** gScaleBuffersDouble;
+    double** gCategoryWeightsDouble;
+    double** gStateFrequenciesDouble;
+    double* outLogLikelihoodsDouble;
+
+    bool kDoubleSiteLikelihoods; // outLogLikelihoodsDouble holds the latest site likelihoods
+
+public:
+    BeagleCPUMixedImpl();
+
+    virtual ~BeagleCPUMixedImpl();
+
+    int createInstance(int tipCount,
+                       int partialsBufferCount,
+                       int compactBufferCount,
+                       int stateCount,
+                       int patternCount,
+                       int eigenDecompositionCount,
+                       int matrixCount,
+                       int categoryCount,
+                       int scaleBufferCount,
+                       int resourceNumber,
+                       int pluginResourceNumber,
+                       long preferenceFlags,
+                       long requirementFlags);
+
+    int setStateFrequencies(int stateFrequenciesIndex,
+                            const double* inStateFrequencies);
+
+    int setCategoryWeights(int categoryWeightsIndex,
+                           const double* inCategoryWeights);
+
+    int resetScaleFactors(int cumulativeScalingIndex);
+
+    int resetScaleFactorsByPartition(int cumulativeScalingIndex,
+                                     int partitionIndex);
+
+    int copyScaleFactors(int destScalingIndex,
+                         int srcScalingIndex);
+
+    int getScaleFactors(int srcScalingIndex,
+                        double* scaleFactors);
+
+    int calculateRootLogLikelihoods(const int* bufferIndices,
+                                    const int* categoryWeightsIndices,
+                                    const int* stateFrequenciesIndices,
+                                    const int* cumulativeScaleIndices,
+                                    int count,
+                                    double* outSumLogLikelihood);
+
+    int calculateRootLogLikelihoodsByPartition(const int* bufferIndices,
+                                               const int* categoryWeightsIndices,
+                                               const int* stateFrequenciesIndices,
+                                               const int* cumulativeScaleIndices,
+                                               const int* partitionIndices,
+                                               int partitionCount,
+                                               int count,
+                                               double* outSumLogLikelihoodByPartition,
+                                               double* outSumLogLikelihood);
+
+    int calculateEdgeLogLikelihoods(const int* parentBufferIndices,
+                                    const int* childBufferIndices,
+                                    const int* probabilityIndices,
+                                    const int* firstDerivativeIndices,
+                                    const int* secondDerivativeIndices,
+                                    const int* categoryWeightsIndices,
+                                    const int* stateFrequenciesIndices,
+                                    const int* cumulativeScaleIndices,
+                                    int count,
+                                    double* outSumLogLikelihood,
+                                    double* outSumFirstDerivative,
+                                    double* outSumSecondDerivative);
+
+    int calculateEdgeLogLikelihoodsByPartition(const int* parentBufferIndices,
+                                               const int* childBufferIndices,
+                                               const int* probabilityIndices,
+                                               const int* firstDerivativeIndices,
+                                               const int* secondDerivativeIndices,
+                                               const int* categoryWeightsIndices,
+                                               const int* stateFrequenciesIndices,
+                                               const int* cumulativeScaleIndices,
+                                               const int* partitionIndices,
+                                               int partitionCount,
+                                               int count,
+                                               double* outSumLogLikelihoodByPartition,
+                                               double* outSumLogLikelihood,
+                                               double* outSumFirstDerivativeByPartition,
+                                               double* outSumFirstDerivative,
+                                               double* outSumSecondDerivativeByPartition,
+                                               double* outSumSecondDerivative);
+
+    int getLogLikelihood(double* outSumLogLikelihood);
+
+    int getSiteLogLikelihoods(double* outLogLikelihoods);
+
+    virtual const char* getName();
+
+    virtual const long getFlags();
+
+protected:
+    virtual bool writeExtendedState(FILE* file);
+
+    virtual bool readExtendedState(FILE* file);
+
+    virtual int calcRootLogLikelihoods(const int bufferIndex,
+                                       const int categoryWeightsIndex,
+                                       const int stateFrequenciesIndex,
+                                       const int scalingFactorsIndex,
+                                       double* outSumLogLikelihood);
+
+    virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
+                                       const int childBufferIndex,
+                                       const int probabilityIndex,
+                                       const int categoryWeightsIndex,
+                                       const int stateFrequenciesIndex,
+                                       const int scalingFactorsIndex,
+                                       double* outSumLogLikelihood);
+
+    virtual void calcEdgeLogLikelihoodsDerivativesRange(const int parentBufferIndex,
+                                                        const int childBufferIndex,
+                                                        const int probabilityIndex,
+                                                        const int firstDerivativeIndex,
+                                                        const int secondDerivativeIndex,
+                                                        const int categoryWeightsIndex,
+                                                        const int stateFrequenciesIndex,
+                                                        const int scalingFactorsIndex,
+                                                        int startPattern,
+                                                        int endPattern,
+                                                        double* outSums);
+
+    virtual void rescalePartialsRange(REALTYPE *destP,
+                                      REALTYPE *scaleFactors,
+                                      REALTYPE *cumulativeScaleFactors,
+                                      int startPattern,
+                                      int endPattern);
+
+    virtual void sumScaleFactorsRange(const int* scalingIndices,
+                                      int count,
+                                      int cumulativeScalingIndex,
+                                      double sign,
+                                      int startPattern,
+                                      int endPattern);
+
+private:
+
+    int findScaleBufferIndex(const REALTYPE* scaleBuffer);
+
+    void mirrorScaleBuffer(int scalingIndex,
+                           int startPattern,
+                           int endPattern);
+
+    int sumSiteLogLikelihoods(int scalingFactorsIndex,
+                              double* outSumLogLikelihood);
+};
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+class BeagleCPUMixedImplFactory : public BeagleImplFactory {
+public:
+    virtual BeagleImpl* createImpl(int tipCount,
+                                   int partialsBufferCount,
+                                   int compactBufferCount,
+                                   int stateCount,
+                                   int patternCount,
+                                   int eigenBufferCount,
+                                   int matrixBufferCount,
+                                   int categoryCount,
+                                   int scaleBufferCount,
+                                   int resourceNumber,
+                                   int pluginResourceNumber,
+                                   long preferenceFlags,
+                                   long requirementFlags,
+                                   int* errorCode);
+
+    virtual const char* getName();
+    virtual const long getFlags();
+};
+
+}	// namespace cpu
+}	// namespace beagle
+
+// now include the file containing template function implementations
+#include "libhmsbeagle/CPU/BeagleCPUMixedImpl.hpp"
+
+#endif // __BeagleCPUMixedImpl__
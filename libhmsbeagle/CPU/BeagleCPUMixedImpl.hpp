@@ -0,0 +1,727 @@
+/*
+ *  BeagleCPUMixedImpl.hpp
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#ifndef BEAGLE_CPU_MIXED_IMPL_HPP
+#define BEAGLE_CPU_MIXED_IMPL_HPP
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+
+#include "libhmsbeagle/beagle.h"
+#include "libhmsbeagle/CPU/BeagleCPUImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUMixedImpl.h"
+
+namespace beagle {
+namespace cpu {
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+inline const char* getBeagleCPUMixedName(){ return "CPU-Mixed-Unknown"; };
+
+template<>
+inline const char* getBeagleCPUMixedName<float>(){ return "CPU-Mixed"; };
+
+BEAGLE_CPU_TEMPLATE
+BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::BeagleCPUMixedImpl() :
+    gScaleBuffersDouble(NULL),
+    gCategoryWeightsDouble(NULL),
+    gStateFrequenciesDouble(NULL),
+    outLogLikelihoodsDouble(NULL),
+    kDoubleSiteLikelihoods(false) {
+}
+
+BEAGLE_CPU_TEMPLATE
+BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUMixedImpl() {
+    if (gScaleBuffersDouble != NULL) {
+        for (int i = 0; i < kScaleBufferCount; i++)
+            free(gScaleBuffersDouble[i]);
+        free(gScaleBuffersDouble);
+    }
+    if (gCategoryWeightsDouble != NULL) {
+        for (int i = 0; i < kEigenDecompCount; i++) {
+            free(gCategoryWeightsDouble[i]);
+            free(gStateFrequenciesDouble[i]);
+        }
+        free(gCategoryWeightsDouble);
+        free(gStateFrequenciesDouble);
+    }
+    free(outLogLikelihoodsDouble);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
+                                                           int partialsBufferCount,
+                                                           int compactBufferCount,
+                                                           int stateCount,
+                                                           int patternCount,
+                                                           int eigenDecompositionCount,
+                                                           int matrixCount,
+                                                           int categoryCount,
+                                                           int scaleBufferCount,
+                                                           int resourceNumber,
+                                                           int pluginResourceNumber,
+                                                           long preferenceFlags,
+                                                           long requirementFlags) {
+
+    // Auto and dynamic scaling keep their own scaler representations
+    if ((preferenceFlags | requirementFlags) & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_DYNAMIC))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    int returnCode = BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(tipCount, partialsBufferCount,
+                            compactBufferCount, stateCount, patternCount, eigenDecompositionCount,
+                            matrixCount, categoryCount, scaleBufferCount, resourceNumber,
+                            pluginResourceNumber,
+                            preferenceFlags & ~(BEAGLE_FLAG_THREADING_CPP | BEAGLE_FLAG_THREADING_OPENMP),
+                            requirementFlags);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    gScaleBuffersDouble = (double**) calloc(sizeof(double*), kScaleBufferCount);
+    if (gScaleBuffersDouble == NULL)
+        throw std::bad_alloc();
+    for (int i = 0; i < kScaleBufferCount; i++) {
+        gScaleBuffersDouble[i] = (double*) calloc(sizeof(double), kPaddedPatternCount);
+        if (gScaleBuffersDouble[i] == NULL)
+            throw std::bad_alloc();
+    }
+
+    gCategoryWeightsDouble = (double**) calloc(sizeof(double*), kEigenDecompCount);
+    gStateFrequenciesDouble = (double**) calloc(sizeof(double*), kEigenDecompCount);
+    if (gCategoryWeightsDouble == NULL || gStateFrequenciesDouble == NULL)
+        throw std::bad_alloc();
+
+    outLogLikelihoodsDouble = (double*) malloc(sizeof(double) * kPatternCount);
+    if (outLogLikelihoodsDouble == NULL)
+        throw std::bad_alloc();
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::setStateFrequencies(int stateFrequenciesIndex,
+                                                                const double* inStateFrequencies) {
+    int returnCode = BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setStateFrequencies(stateFrequenciesIndex,
+                                                                           inStateFrequencies);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    if (gStateFrequenciesDouble[stateFrequenciesIndex] == NULL) {
+        gStateFrequenciesDouble[stateFrequenciesIndex] = (double*) malloc(sizeof(double) * kStateCount);
+        if (gStateFrequenciesDouble[stateFrequenciesIndex] == NULL)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    memcpy(gStateFrequenciesDouble[stateFrequenciesIndex], inStateFrequencies, sizeof(double) * kStateCount);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::setCategoryWeights(int categoryWeightsIndex,
+                                                               const double* inCategoryWeights) {
+    int returnCode = BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCategoryWeights(categoryWeightsIndex,
+                                                                          inCategoryWeights);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    if (gCategoryWeightsDouble[categoryWeightsIndex] == NULL) {
+        gCategoryWeightsDouble[categoryWeightsIndex] = (double*) malloc(sizeof(double) * kCategoryCount);
+        if (gCategoryWeightsDouble[categoryWeightsIndex] == NULL)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    memcpy(gCategoryWeightsDouble[categoryWeightsIndex], inCategoryWeights, sizeof(double) * kCategoryCount);
+
+    return BEAGLE_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// State files carry the double-precision buffers after those of the base class
+
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::writeExtendedState(FILE* file) {
+    bool ok = true;
+    for (int i = 0; ok && i < kScaleBufferCount; i++)
+        ok = writeStateBlock(file, gScaleBuffersDouble[i], sizeof(double) * kPaddedPatternCount);
+
+    std::vector<char> present(kEigenDecompCount);
+    for (int i = 0; i < kEigenDecompCount; i++)
+        present[i] = (gCategoryWeightsDouble[i] != NULL) | ((gStateFrequenciesDouble[i] != NULL) << 1);
+    if (ok)
+        ok = writeStateBlock(file, &present[0], kEigenDecompCount);
+    for (int i = 0; ok && i < kEigenDecompCount; i++) {
+        if (gCategoryWeightsDouble[i] != NULL)
+            ok = writeStateBlock(file, gCategoryWeightsDouble[i], sizeof(double) * kCategoryCount);
+        if (ok && gStateFrequenciesDouble[i] != NULL)
+            ok = writeStateBlock(file, gStateFrequenciesDouble[i], sizeof(double) * kStateCount);
+    }
+
+    // site results of the last likelihood calculation
+    char doubleSiteLikelihoods = (kDoubleSiteLikelihoods ? 1 : 0);
+    if (ok)
+        ok = writeStateBlock(file, &doubleSiteLikelihoods, 1) &&
+             writeStateBlock(file, outLogLikelihoodsDouble, sizeof(double) * kPatternCount);
+    return ok;
+}
+
+/*
+ * The base class has restored weights and frequencies through setCategoryWeights and
+ * setStateFrequencies, from REALTYPE copies; their double buffers are overwritten here.
+ */
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::readExtendedState(FILE* file) {
+    bool ok = true;
+    for (int i = 0; ok && i < kScaleBufferCount; i++) {
+        ok = readStateBlock(file, gScaleBuffersDouble[i], sizeof(double) * kPaddedPatternCount);
+        mirrorScaleBuffer(i, 0, kPaddedPatternCount);
+    }
+
+    std::vector<char> present(kEigenDecompCount);
+    if (ok)
+        ok = readStateBlock(file, &present[0], kEigenDecompCount);
+    for (int i = 0; ok && i < kEigenDecompCount; i++) {
+        if (present[i] & 1)
+            ok = gCategoryWeightsDouble[i] != NULL &&
+                 readStateBlock(file, gCategoryWeightsDouble[i], sizeof(double) * kCategoryCount);
+        if (ok && (present[i] & 2))
+            ok = gStateFrequenciesDouble[i] != NULL &&
+                 readStateBlock(file, gStateFrequenciesDouble[i], sizeof(double) * kStateCount);
+    }
+
+    char doubleSiteLikelihoods = 0;
+    if (ok)
+        ok = readStateBlock(file, &doubleSiteLikelihoods, 1) &&
+             readStateBlock(file, outLogLikelihoodsDouble, sizeof(double) * kPatternCount);
+    kDoubleSiteLikelihoods = (ok && doubleSiteLikelihoods != 0);
+    return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Scale factors are held in double precision and mirrored to REALTYPE
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::findScaleBufferIndex(const REALTYPE* scaleBuffer) {
+    for (int i = 0; i < kScaleBufferCount; i++) {
+        if (gScaleBuffers[i] == scaleBuffer)
+            return i;
+    }
+    return BEAGLE_OP_NONE;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::mirrorScaleBuffer(int scalingIndex,
+                                                               int startPattern,
+                                                               int endPattern) {
+    const double* source = gScaleBuffersDouble[scalingIndex];
+    REALTYPE* destination = gScaleBuffers[scalingIndex];
+    for (int k = startPattern; k < endPattern; k++)
+        destination[k] = (REALTYPE) source[k];
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::sumScaleFactorsRange(const int* scalingIndices,
+                                                                  int count,
+                                                                  int cumulativeScalingIndex,
+                                                                  double sign,
+                                                                  int startPattern,
+                                                                  int endPattern) {
+    double* cumulativeScaleBuffer = gScaleBuffersDouble[cumulativeScalingIndex];
+    if (kFlags & BEAGLE_FLAG_SCALERS_LOG) {
+        for (int i = 0; i < count; i++) {
+            const double* scaleBuffer = gScaleBuffersDouble[scalingIndices[i]];
+            for (int k = startPattern; k < endPattern; k++)
+                cumulativeScaleBuffer[k] += sign * scaleBuffer[k];
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            const double* scaleBuffer = gScaleBuffersDouble[scalingIndices[i]];
+            for (int k = startPattern; k < endPattern; k++)
+                cumulativeScaleBuffer[k] += sign * log(scaleBuffer[k]);
+        }
+    }
+    mirrorScaleBuffer(cumulativeScalingIndex, startPattern, endPattern);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::resetScaleFactors(int cumulativeScalingIndex) {
+    memset(gScaleBuffersDouble[cumulativeScalingIndex], 0, sizeof(double) * kPaddedPatternCount);
+    memset(gScaleBuffers[cumulativeScalingIndex], 0, sizeof(REALTYPE) * kPaddedPatternCount);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::resetScaleFactorsByPartition(int cumulativeScalingIndex,
+                                                                         int partitionIndex) {
+    int startPattern = gPatternPartitionsStartPatterns[partitionIndex];
+    int endPattern = gPatternPartitionsStartPatterns[partitionIndex + 1];
+
+    memset(&gScaleBuffersDouble[cumulativeScalingIndex][startPattern], 0,
+           sizeof(double) * (endPattern - startPattern));
+    memset(&gScaleBuffers[cumulativeScalingIndex][startPattern], 0,
+           sizeof(REALTYPE) * (endPattern - startPattern));
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::copyScaleFactors(int destScalingIndex,
+                                                             int srcScalingIndex) {
+    memcpy(gScaleBuffersDouble[destScalingIndex], gScaleBuffersDouble[srcScalingIndex],
+           sizeof(double) * kPatternCount);
+    memcpy(gScaleBuffers[destScalingIndex], gScaleBuffers[srcScalingIndex],
+           sizeof(REALTYPE) * kPatternCount);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::getScaleFactors(int srcScalingIndex,
+                                                            double* scaleFactors) {
+    if (srcScalingIndex < 0 || srcScalingIndex >= kScaleBufferCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    memcpy(scaleFactors, gScaleBuffersDouble[srcScalingIndex], sizeof(double) * kPatternCount);
+
+    return BEAGLE_SUCCESS;
+}
+
+/*
+ * Re-scales the partial likelihoods such that the largest is one; the factors are
+ * recorded (and accumulated) in double precision.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::rescalePartialsRange(REALTYPE* destP,
+                                                                  REALTYPE* scaleFactors,
+                                                                  REALTYPE* cumulativeScaleFactors,
+                                                                  int startPattern,
+                                                                  int endPattern) {
+    const int scalingIndex = findScaleBufferIndex(scaleFactors);
+    const int cumulativeIndex = (cumulativeScaleFactors == NULL ?
+                                 BEAGLE_OP_NONE : findScaleBufferIndex(cumulativeScaleFactors));
+    assert(scalingIndex != BEAGLE_OP_NONE);
+
+    double* scaleFactorsDouble = gScaleBuffersDouble[scalingIndex];
+    double* cumulativeScaleFactorsDouble = (cumulativeIndex == BEAGLE_OP_NONE ?
+                                            NULL : gScaleBuffersDouble[cumulativeIndex]);
+
+    const bool logScalers = (kFlags & BEAGLE_FLAG_SCALERS_LOG);
+
+    for (int k = startPattern; k < endPattern; k++) {
+        REALTYPE max = 0;
+        const int patternOffset = k * kPartialsPatternStride;
+        for (int l = 0; l < kCategoryCount; l++) {
+            int offset = l * kPartialsCategoryStride + patternOffset;
+            for (int i = 0; i < kStateCount; i++) {
+                if (destP[offset] > max)
+                    max = destP[offset];
+                offset++;
+            }
+        }
+
+        if (max == 0)
+            max = 1.0;
+
+        REALTYPE oneOverMax = REALTYPE(1.0) / max;
+        for (int l = 0; l < kCategoryCount; l++) {
+            int offset = l * kPartialsCategoryStride + patternOffset;
+            for (int i = 0; i < kStateCount; i++)
+                destP[offset++] *= oneOverMax;
+        }
+
+        const double logMax = log((double) max);
+        scaleFactorsDouble[k] = (logScalers ? logMax : (double) max);
+        scaleFactors[k] = (REALTYPE) scaleFactorsDouble[k];
+        if (cumulativeScaleFactorsDouble != NULL) {
+            cumulativeScaleFactorsDouble[k] += logMax;
+            cumulativeScaleFactors[k] = (REALTYPE) cumulativeScaleFactorsDouble[k];
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Likelihood integration in double precision
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::calculateRootLogLikelihoods(const int* bufferIndices,
+                                                                        const int* categoryWeightsIndices,
+                                                                        const int* stateFrequenciesIndices,
+                                                                        const int* cumulativeScaleIndices,
+                                                                        int count,
+                                                                        double* outSumLogLikelihood) {
+    kDoubleSiteLikelihoods = false;
+    return BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateRootLogLikelihoods(bufferIndices,
+                            categoryWeightsIndices, stateFrequenciesIndices, cumulativeScaleIndices,
+                            count, outSumLogLikelihood);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::calculateRootLogLikelihoodsByPartition(const int* bufferIndices,
+                                                                                   const int* categoryWeightsIndices,
+                                                                                   const int* stateFrequenciesIndices,
+                                                                                   const int* cumulativeScaleIndices,
+                                                                                   const int* partitionIndices,
+                                                                                   int partitionCount,
+                                                                                   int count,
+                                                                                   double* outSumLogLikelihoodByPartition,
+                                                                                   double* outSumLogLikelihood) {
+    kDoubleSiteLikelihoods = false;
+    return BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateRootLogLikelihoodsByPartition(bufferIndices,
+                            categoryWeightsIndices, stateFrequenciesIndices, cumulativeScaleIndices,
+                            partitionIndices, partitionCount, count, outSumLogLikelihoodByPartition,
+                            outSumLogLikelihood);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::calculateEdgeLogLikelihoods(const int* parentBufferIndices,
+                                                                        const int* childBufferIndices,
+                                                                        const int* probabilityIndices,
+                                                                        const int* firstDerivativeIndices,
+                                                                        const int* secondDerivativeIndices,
+                                                                        const int* categoryWeightsIndices,
+                                                                        const int* stateFrequenciesIndices,
+                                                                        const int* cumulativeScaleIndices,
+                                                                        int count,
+                                                                        double* outSumLogLikelihood,
+                                                                        double* outSumFirstDerivative,
+                                                                        double* outSumSecondDerivative) {
+    kDoubleSiteLikelihoods = false;
+    return BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateEdgeLogLikelihoods(parentBufferIndices,
+                            childBufferIndices, probabilityIndices, firstDerivativeIndices,
+                            secondDerivativeIndices, categoryWeightsIndices, stateFrequenciesIndices,
+                            cumulativeScaleIndices, count, outSumLogLikelihood, outSumFirstDerivative,
+                            outSumSecondDerivative);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::calculateEdgeLogLikelihoodsByPartition(
+                                                    const int* parentBufferIndices,
+                                                    const int* childBufferIndices,
+                                                    const int* probabilityIndices,
+                                                    const int* firstDerivativeIndices,
+                                                    const int* secondDerivativeIndices,
+                                                    const int* categoryWeightsIndices,
+                                                    const int* stateFrequenciesIndices,
+                                                    const int* cumulativeScaleIndices,
+                                                    const int* partitionIndices,
+                                                    int partitionCount,
+                                                    int count,
+                                                    double* outSumLogLikelihoodByPartition,
+                                                    double* outSumLogLikelihood,
+                                                    double* outSumFirstDerivativeByPartition,
+                                                    double* outSumFirstDerivative,
+                                                    double* outSumSecondDerivativeByPartition,
+                                                    double* outSumSecondDerivative) {
+    kDoubleSiteLikelihoods = false;
+    return BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateEdgeLogLikelihoodsByPartition(parentBufferIndices,
+                            childBufferIndices, probabilityIndices, firstDerivativeIndices,
+                            secondDerivativeIndices, categoryWeightsIndices, stateFrequenciesIndices,
+                            cumulativeScaleIndices, partitionIndices, partitionCount, count,
+                            outSumLogLikelihoodByPartition, outSumLogLikelihood,
+                            outSumFirstDerivativeByPartition, outSumFirstDerivative,
+                            outSumSecondDerivativeByPartition, outSumSecondDerivative);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::sumSiteLogLikelihoods(int scalingFactorsIndex,
+                                                                  double* outSumLogLikelihood) {
+    if (scalingFactorsIndex >= 0) {
+        const double* cumulativeScaleFactors = gScaleBuffersDouble[scalingFactorsIndex];
+        for (int k = 0; k < kPatternCount; k++)
+            outLogLikelihoodsDouble[k] += cumulativeScaleFactors[k];
+    }
+
+    *outSumLogLikelihood = 0.0;
+    for (int k = 0; k < kPatternCount; k++) {
+        *outSumLogLikelihood += outLogLikelihoodsDouble[k] * gPatternWeights[k];
+        outLogLikelihoodsTmp[k] = (REALTYPE) outLogLikelihoodsDouble[k];
+    }
+    kDoubleSiteLikelihoods = true;
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        return BEAGLE_ERROR_FLOATING_POINT;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoods(const int bufferIndex,
+                                                                   const int categoryWeightsIndex,
+                                                                   const int stateFrequenciesIndex,
+                                                                   const int scalingFactorsIndex,
+                                                                   double* outSumLogLikelihood) {
+
+    const REALTYPE* rootPartials = gPartials[bufferIndex];
+    const double* wt = gCategoryWeightsDouble[categoryWeightsIndex];
+    const double* freqs = gStateFrequenciesDouble[stateFrequenciesIndex];
+
+    for (int k = 0; k < kPatternCount; k++) {
+        double sum = 0.0;
+        for (int l = 0; l < kCategoryCount; l++) {
+            const REALTYPE* partials = rootPartials +
+                    l * kPartialsCategoryStride + k * kPartialsPatternStride;
+            double sumOverI = 0.0;
+            for (int i = 0; i < kStateCount; i++)
+                sumOverI += freqs[i] * (double) partials[i];
+            sum += wt[l] * sumOverI;
+        }
+        outLogLikelihoodsDouble[k] = log(sum);
+    }
+
+    return sumSiteLogLikelihoods(scalingFactorsIndex, outSumLogLikelihood);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int parIndex,
+                                                                   const int childIndex,
+                                                                   const int probIndex,
+                                                                   const int categoryWeightsIndex,
+                                                                   const int stateFrequenciesIndex,
+                                                                   const int scalingFactorsIndex,
+                                                                   double* outSumLogLikelihood) {
+
+    assert(parIndex >= kTipCount);
+
+    const REALTYPE* partialsParent = gPartials[parIndex];
+    const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
+    const double* wt = gCategoryWeightsDouble[categoryWeightsIndex];
+    const double* freqs = gStateFrequenciesDouble[stateFrequenciesIndex];
+
+    const int* statesChild = (childIndex < kTipCount ? gTipStates[childIndex] : NULL);
+    const REALTYPE* partialsChild = gPartials[childIndex];
+
+    for (int k = 0; k < kPatternCount; k++) {
+        double sum = 0.0;
+        for (int l = 0; l < kCategoryCount; l++) {
+            const int v = l * kPartialsCategoryStride + k * kPartialsPatternStride;
+            int w = l * kMatrixSize;
+            double sumOverI = 0.0;
+            if (statesChild != NULL) { // Integrate against a state at the child
+                const int stateChild = statesChild[k];
+                for (int i = 0; i < kStateCount; i++) {
+                    sumOverI += freqs[i] * (double) partialsParent[v + i] *
+                                (double) transMatrix[w + stateChild];
+                    w += kTransPaddedStateCount;
+                }
+            } else { // Integrate against a partial at the child
+                for (int i = 0; i < kStateCount; i++) {
+                    double sumOverJ = 0.0;
+                    for (int j = 0; j < kStateCount; j++)
+                        sumOverJ += (double) transMatrix[w + j] * (double) partialsChild[v + j];
+                    sumOverI += freqs[i] * (double) partialsParent[v + i] * sumOverJ;
+                    w += kTransPaddedStateCount;
+                }
+            }
+            sum += wt[l] * sumOverI;
+        }
+        outLogLikelihoodsDouble[k] = log(sum);
+    }
+
+    return sumSiteLogLikelihoods(scalingFactorsIndex, outSumLogLikelihood);
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsDerivativesRange(const int parIndex,
+                                                                                   const int childIndex,
+                                                                                   const int probIndex,
+                                                                                   const int firstDerivativeIndex,
+                                                                                   const int secondDerivativeIndex,
+                                                                                   const int categoryWeightsIndex,
+                                                                                   const int stateFrequenciesIndex,
+                                                                                   const int scalingFactorsIndex,
+                                                                                   int startPattern,
+                                                                                   int endPattern,
+                                                                                   double* outSums) {
+
+    const REALTYPE* partialsParent = gPartials[parIndex];
+    const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
+    const REALTYPE* firstDerivMatrix = (firstDerivativeIndex == BEAGLE_OP_NONE ?
+                                        transMatrix : gTransitionMatrices[firstDerivativeIndex]);
+    const REALTYPE* secondDerivMatrix = (secondDerivativeIndex == BEAGLE_OP_NONE ?
+                                         transMatrix : gTransitionMatrices[secondDerivativeIndex]);
+    const double* wt = gCategoryWeightsDouble[categoryWeightsIndex];
+    const double* freqs = gStateFrequenciesDouble[stateFrequenciesIndex];
+    const int* statesChild = (childIndex < kTipCount ? gTipStates[childIndex] : NULL);
+    const REALTYPE* partialsChild = gPartials[childIndex];
+    const double* scalingFactors = (scalingFactorsIndex == BEAGLE_OP_NONE ?
+                                    NULL : gScaleBuffersDouble[scalingFactorsIndex]);
+
+    double sumLogLikelihood = 0.0;
+    double sumFirstDerivative = 0.0;
+    double sumSecondDerivative = 0.0;
+
+    for (int k = startPattern; k < endPattern; k++) {
+        double sum = 0.0;
+        double sumD1 = 0.0;
+        double sumD2 = 0.0;
+        for (int l = 0; l < kCategoryCount; l++) {
+            const int v = l * kPartialsCategoryStride + k * kPartialsPatternStride;
+            int w = l * kMatrixSize;
+            double sumOverI = 0.0;
+            double sumOverID1 = 0.0;
+            double sumOverID2 = 0.0;
+            for (int i = 0; i < kStateCount; i++) {
+                double sumOverJ, sumOverJD1, sumOverJD2;
+                if (statesChild != NULL) { // Integrate against a state at the child
+                    const int stateChild = statesChild[k];
+                    sumOverJ = (double) transMatrix[w + stateChild];
+                    sumOverJD1 = (double) firstDerivMatrix[w + stateChild];
+                    sumOverJD2 = (double) secondDerivMatrix[w + stateChild];
+                } else { // Integrate against a partial at the child
+                    sumOverJ = sumOverJD1 = sumOverJD2 = 0.0;
+                    for (int j = 0; j < kStateCount; j++) {
+                        const double partial = (double) partialsChild[v + j];
+                        sumOverJ += (double) transMatrix[w + j] * partial;
+                        sumOverJD1 += (double) firstDerivMatrix[w + j] * partial;
+                        sumOverJD2 += (double) secondDerivMatrix[w + j] * partial;
+                    }
+                }
+                const double parent = freqs[i] * (double) partialsParent[v + i];
+                sumOverI += parent * sumOverJ;
+                sumOverID1 += parent * sumOverJD1;
+                sumOverID2 += parent * sumOverJD2;
+                w += kTransPaddedStateCount;
+            }
+            sum += wt[l] * sumOverI;
+            sumD1 += wt[l] * sumOverID1;
+            sumD2 += wt[l] * sumOverID2;
+        }
+
+        double logLikelihood = log(sum);
+        if (scalingFactors != NULL)
+            logLikelihood += scalingFactors[k];
+        const double firstDerivative = sumD1 / sum;
+        sumLogLikelihood += logLikelihood * gPatternWeights[k];
+        sumFirstDerivative += firstDerivative * gPatternWeights[k];
+        sumSecondDerivative += (sumD2 / sum - firstDerivative * firstDerivative) * gPatternWeights[k];
+    }
+
+    outSums[0] = sumLogLikelihood;
+    outSums[1] = sumFirstDerivative;
+    outSums[2] = sumSecondDerivative;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::getLogLikelihood(double* outSumLogLikelihood) {
+    if (!kDoubleSiteLikelihoods)
+        return BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getLogLikelihood(outSumLogLikelihood);
+
+    *outSumLogLikelihood = 0.0;
+    for (int k = 0; k < kPatternCount; k++)
+        *outSumLogLikelihood += outLogLikelihoodsDouble[k] * gPatternWeights[k];
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        return BEAGLE_ERROR_FLOATING_POINT;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::getSiteLogLikelihoods(double* outLogLikelihoods) {
+    if (!kDoubleSiteLikelihoods)
+        return BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getSiteLogLikelihoods(outLogLikelihoods);
+
+    if (kPatternsReordered) {
+        for (int i = 0; i < kPatternCount; i++)
+            outLogLikelihoods[i] = outLogLikelihoodsDouble[gPatternsNewOrder[i]];
+    } else {
+        memcpy(outLogLikelihoods, outLogLikelihoodsDouble, sizeof(double) * kPatternCount);
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+const char* BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::getName() {
+    return getBeagleCPUMixedName<BEAGLE_CPU_FACTORY_GENERIC>();
+}
+
+BEAGLE_CPU_TEMPLATE
+const long BeagleCPUMixedImpl<BEAGLE_CPU_GENERIC>::getFlags() {
+    return BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getFlags() | BEAGLE_CPU_MIXED_PRECISION_FLAGS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// BeagleImplFactory public methods
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+BeagleImpl* BeagleCPUMixedImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(int tipCount,
+                                             int partialsBufferCount,
+                                             int compactBufferCount,
+                                             int stateCount,
+                                             int patternCount,
+                                             int eigenBufferCount,
+                                             int matrixBufferCount,
+                                             int categoryCount,
+                                             int scaleBufferCount,
+                                             int resourceNumber,
+                                             int pluginResourceNumber,
+                                             long preferenceFlags,
+                                             long requirementFlags,
+                                             int* errorCode) {
+
+    // Only hand out a mixed-precision instance when it is explicitly requested
+    if ((requirementFlags & BEAGLE_CPU_MIXED_PRECISION_FLAGS) != BEAGLE_CPU_MIXED_PRECISION_FLAGS)
+        return NULL;
+
+    BeagleImpl* impl = new BeagleCPUMixedImpl<REALTYPE, T_PAD_DEFAULT, P_PAD_DEFAULT>();
+
+    try {
+        if (impl->createInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                                 patternCount, eigenBufferCount, matrixBufferCount,
+                                 categoryCount,scaleBufferCount, resourceNumber,
+                                 pluginResourceNumber,
+                                 preferenceFlags, requirementFlags) == 0)
+            return impl;
+    }
+    catch(...) {
+        if (DEBUGGING_OUTPUT)
+            std::cerr << "exception in initialize\n";
+        delete impl;
+        throw;
+    }
+
+    delete impl;
+
+    return NULL;
+}
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+const char* BeagleCPUMixedImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
+    return getBeagleCPUMixedName<BEAGLE_CPU_FACTORY_GENERIC>();
+}
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+const long BeagleCPUMixedImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getFlags() {
+    return BEAGLE_FLAG_COMPUTATION_SYNCH |
+           BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS |
+           BEAGLE_FLAG_THREADING_NONE |
+           BEAGLE_FLAG_PROCESSOR_CPU |
+           BEAGLE_CPU_MIXED_PRECISION_FLAGS |
+           BEAGLE_FLAG_VECTOR_NONE |
+           BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
+           BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL |
+           BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
+           BEAGLE_FLAG_PREORDER_TRANSPOSE_AUTO |
+           BEAGLE_FLAG_FRAMEWORK_CPU;
+}
+
+}	// namespace cpu
+}	// namespace beagle
+
+#endif // BEAGLE_CPU_MIXED_IMPL_HPP
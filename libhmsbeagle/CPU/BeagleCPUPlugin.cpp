@@ -7,6 +7,8 @@
 
 #include "libhmsbeagle/CPU/BeagleCPUPlugin.h"
 #include "libhmsbeagle/CPU/BeagleCPU4StateImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUFixedStateImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUMixedImpl.h"
 #include "libhmsbeagle/CPU/BeagleCPUImpl.h"
 #include <iostream>
 
@@ -25,7 +27,7 @@ Plugin("CPU", "CPU")
         resource.description = (char*) "";
         resource.supportFlags = BEAGLE_FLAG_COMPUTATION_SYNCH |
                                          BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_DYNAMIC |
-                                         BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+                                         BEAGLE_CPU_THREADING_FLAGS |
                                          BEAGLE_FLAG_PROCESSOR_CPU |
                                          BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_DOUBLE |
                                          BEAGLE_FLAG_VECTOR_NONE |
@@ -41,8 +43,11 @@ Plugin("CPU", "CPU")
 	// list with compatible factories
 	beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateImplFactory<double>());
 	beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateImplFactory<float>());
+	beagleFactories.push_back(new beagle::cpu::BeagleCPUFixedStateImplFactory<double>());
+	beagleFactories.push_back(new beagle::cpu::BeagleCPUFixedStateImplFactory<float>());
 	beagleFactories.push_back(new beagle::cpu::BeagleCPUImplFactory<double>());
 	beagleFactories.push_back(new beagle::cpu::BeagleCPUImplFactory<float>());
+	beagleFactories.push_back(new beagle::cpu::BeagleCPUMixedImplFactory<float>());
 }
 
 }	// namespace cpu
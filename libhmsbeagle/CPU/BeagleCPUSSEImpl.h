@@ -68,6 +68,9 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::gTransitionMatrices;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::kPatternCount;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::kPaddedPatternCount;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::kPartialsLayout;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::kPartialsPatternStride;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::kPartialsCategoryStride;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::kExtraPatterns;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::kStateCount;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::gTipStates;
@@ -142,6 +145,9 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::gTransitionMatrices;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::kPatternCount;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::kPaddedPatternCount;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::kPartialsLayout;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::kPartialsPatternStride;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::kPartialsCategoryStride;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::kExtraPatterns;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::kStateCount;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::gTipStates;
@@ -211,10 +211,16 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcPartialsPartials(double* __res
                                                                    const double* __restrict matrices2,
                                                                    int startPattern,
                                                                    int endPattern) {
+    if (kStateCount >= BEAGLE_CPU_BLOCKED_MIN_STATE_COUNT) {
+        BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::calcPartialsPartialsBlocked(destP, partials1, matrices1,
+                                                                          partials2, matrices2, NULL,
+                                                                          startPattern, endPattern);
+        return;
+    }
+
     int stateCountMinusOne = kPartialsPaddedStateCount - 1;
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-    	int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+    	int v = l*kPartialsCategoryStride + kPartialsPatternStride*startPattern;
     	double* destPu = destP + v;
         for (int k = startPattern; k < endPattern; k++) {
             int w = l * kMatrixSize;
@@ -285,7 +291,8 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcPartialsPartials(double* __res
                     *(destPu++) = 0.0;
                 }
             }
-            v += kPartialsPaddedStateCount;
+            destPu += kPartialsPatternStride - kPartialsPaddedStateCount;
+            v += kPartialsPatternStride;
         }
     }
 }
@@ -300,10 +307,16 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcPartialsPartialsFixedScaling(d
                                                                                int startPattern,
                                                                                int endPattern) {
 
+    if (kStateCount >= BEAGLE_CPU_BLOCKED_MIN_STATE_COUNT) {
+        BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::calcPartialsPartialsBlocked(destP, partials1, matrices1,
+                                                                          partials2, matrices2, scaleFactors,
+                                                                          startPattern, endPattern);
+        return;
+    }
+
     int stateCountMinusOne = kPartialsPaddedStateCount - 1;
-#pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
-      int v = l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
+      int v = l*kPartialsCategoryStride + kPartialsPatternStride*startPattern;
       double* destPu = destP + v;
         for (int k = startPattern; k < endPattern; k++) {
             int w = l * kMatrixSize;
@@ -343,7 +356,8 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcPartialsPartialsFixedScaling(d
                     *(destPu++) = 0.0;
                 }
             }
-            v += kPartialsPaddedStateCount;
+            destPu += kPartialsPatternStride - kPartialsPaddedStateCount;
+            v += kPartialsPatternStride;
         }
     }
 }
@@ -634,7 +648,7 @@ template <>
 const long BeagleCPUSSEImplFactory<double>::getFlags() {
     return BEAGLE_FLAG_COMPUTATION_SYNCH |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+           BEAGLE_CPU_THREADING_FLAGS |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_SSE |
            BEAGLE_FLAG_PRECISION_DOUBLE |
@@ -649,7 +663,7 @@ template <>
 const long BeagleCPUSSEImplFactory<float>::getFlags() {
     return BEAGLE_FLAG_COMPUTATION_SYNCH |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+           BEAGLE_CPU_THREADING_FLAGS |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_SSE |
            BEAGLE_FLAG_PRECISION_SINGLE |
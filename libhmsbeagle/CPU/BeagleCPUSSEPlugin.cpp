@@ -7,6 +7,7 @@
 
 #include "libhmsbeagle/CPU/BeagleCPUSSEPlugin.h"
 #include "libhmsbeagle/CPU/BeagleCPU4StateSSEImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUFixedStateImpl.h"
 #include "libhmsbeagle/CPU/BeagleCPUSSEImpl.h"
 #include <iostream>
 
@@ -32,7 +33,7 @@ Plugin("CPU-SSE", "CPU-SSE")
         resource.description = (char*) "";
         resource.supportFlags = BEAGLE_FLAG_COMPUTATION_SYNCH |
                                          BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-                                         BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+                                         BEAGLE_CPU_THREADING_FLAGS |
                                          BEAGLE_FLAG_PROCESSOR_CPU |
                                          BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_DOUBLE |
                                          BEAGLE_FLAG_VECTOR_NONE |
@@ -50,6 +51,8 @@ Plugin("CPU-SSE", "CPU-SSE")
 
 	beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateSSEImplFactory<double>());
 // 	beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateSSEImplFactory<float>()); // TODO Not yet written
+	// ahead of the generic SSE kernels, which would otherwise take the state counts it specialises
+	beagleFactories.push_back(new beagle::cpu::BeagleCPUFixedStateImplFactory<double>());
 	beagleFactories.push_back(new beagle::cpu::BeagleCPUSSEImplFactory<double>()); // TODO In process of writing (disabled until it works for all input)
 // 	beagleFactories.push_back(new beagle::cpu::BeagleCPUSSEImplFactory<float>()); // TODO Not yet written
 }
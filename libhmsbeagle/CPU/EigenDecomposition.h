@@ -15,10 +15,15 @@
 #include <cmath>
 #include <cassert>
 #include <vector>
+#include <algorithm>
+
+#include "libhmsbeagle/CPU/InstanceState.h"
 
 #define BEAGLE_CPU_EIGEN_GENERIC	REALTYPE, T_PAD
 #define BEAGLE_CPU_EIGEN_TEMPLATE	template <typename REALTYPE, int T_PAD>
 
+#define BEAGLE_CPU_EIGEN_BATCH_MATRIX_COUNT     32  // (edge, category) matrices computed together from each eigen system entry
+
 namespace beagle {
 namespace cpu {
 
@@ -84,6 +89,41 @@ public:
                                  REALTYPE** transitionMatrices,
                                  int count) = 0;
 
+    // calculate transition probability matrices for edges [startEdge, endEdge) of lists in
+    // which each edge has its own eigen decomposition and category rates; edges sharing an
+    // eigen decomposition should be adjacent
+    virtual void updateTransitionMatricesWithMultipleModels(const int* eigenIndices,
+                                 const int* categoryRateIndices,
+                                 const int* probabilityIndices,
+                                 const int* firstDerivativeIndices,
+                                 const int* secondDerivativeIndices,
+                                 const double* edgeLengths,
+                                 const double* const* categoryRates,
+                                 REALTYPE** transitionMatrices,
+                                 int startEdge,
+                                 int endEdge) {
+        for (int u = startEdge; u < endEdge; u++) {
+            updateTransitionMatrices(eigenIndices[u],
+                                     &probabilityIndices[u],
+                                     (firstDerivativeIndices != NULL ? &firstDerivativeIndices[u] : NULL),
+                                     (secondDerivativeIndices != NULL ? &secondDerivativeIndices[u] : NULL),
+                                     &edgeLengths[u],
+                                     categoryRates[categoryRateIndices[u]],
+                                     transitionMatrices,
+                                     1);
+        }
+    }
+
+    // true if updateTransitionMatricesWithMultipleModels may run concurrently on disjoint
+    // ranges of edges
+    virtual bool supportsConcurrentUpdates() {
+        return false;
+    }
+
+    // writes or reads every decomposition as blocks of an instance state file
+    virtual bool writeState(FILE* file) = 0;
+
+    virtual bool readState(FILE* file) = 0;
 
 };
 
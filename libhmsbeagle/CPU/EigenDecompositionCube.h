@@ -57,6 +57,23 @@ public:
                                  const double* edgeLengths,
                                  REALTYPE** transitionMatrices,
                                  int count);
+
+    virtual void updateTransitionMatricesWithMultipleModels(const int* eigenIndices,
+                                 const int* categoryRateIndices,
+                                 const int* probabilityIndices,
+                                 const int* firstDerivativeIndices,
+                                 const int* secondDerivativeIndices,
+                                 const double* edgeLengths,
+                                 const double* const* categoryRates,
+                                 REALTYPE** transitionMatrices,
+                                 int startEdge,
+                                 int endEdge);
+
+    virtual bool supportsConcurrentUpdates();
+
+    virtual bool writeState(FILE* file);
+
+    virtual bool readState(FILE* file);
 };
 
 }
@@ -322,6 +322,121 @@ void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrices(
 }
 
 
+/*
+ * Edges sharing an eigen system are taken BEAGLE_CPU_EIGEN_BATCH_MATRIX_COUNT (edge, category)
+ * matrices at a time, so that each C-cube entry is loaded once for all of them and the inner
+ * loop runs across matrices. Sums over k are accumulated in the same order and from the same
+ * exponentials as updateTransitionMatrices; scratch space is local, so ranges of edges may be
+ * updated concurrently.
+ */
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatricesWithMultipleModels(
+                                                      const int* eigenIndices,
+                                                      const int* categoryRateIndices,
+                                                      const int* probabilityIndices,
+                                                      const int* firstDerivativeIndices,
+                                                      const int* secondDerivativeIndices,
+                                                      const double* edgeLengths,
+                                                      const double* const* categoryRates,
+                                                      REALTYPE** transitionMatrices,
+                                                      int startEdge,
+                                                      int endEdge) {
+    if (firstDerivativeIndices == NULL)
+        secondDerivativeIndices = NULL;
+    const int derivativeCount = (firstDerivativeIndices != NULL) + (secondDerivativeIndices != NULL);
+
+    const int rowStride = kStateCount + T_PAD;
+    const int categoryStride = kStateCount * rowStride;
+    const int batchEdgeCount = std::max(1, BEAGLE_CPU_EIGEN_BATCH_MATRIX_COUNT / kCategoryCount);
+    const int batchSize = batchEdgeCount * kCategoryCount;
+
+    // exponentials and their derivatives are laid out [k][matrix]
+    std::vector<REALTYPE> exponentials((size_t) (1 + derivativeCount) * kStateCount * batchSize);
+    std::vector<REALTYPE> sums((size_t) (1 + derivativeCount) * batchSize);
+    REALTYPE* expTable = &exponentials[0];
+    REALTYPE* d1Table = expTable + kStateCount * batchSize;
+    REALTYPE* d2Table = d1Table + kStateCount * batchSize;
+
+    for (int start = startEdge; start < endEdge; ) {
+        const int eigenIndex = eigenIndices[start];
+        int end = start + 1;
+        while (end < endEdge && end - start < batchEdgeCount && eigenIndices[end] == eigenIndex)
+            end++;
+        const int matrixCount = (end - start) * kCategoryCount;
+        const REALTYPE* eigenValues = gEigenValues[eigenIndex];
+
+        for (int u = start; u < end; u++) {
+            const double* rates = categoryRates[categoryRateIndices[u]];
+            for (int l = 0; l < kCategoryCount; l++) {
+                const int m = (u - start) * kCategoryCount + l;
+                for (int k = 0; k < kStateCount; k++) {
+                    if (derivativeCount == 0) {
+                        expTable[k * batchSize + m] = exp(eigenValues[k] * ((REALTYPE)edgeLengths[u] * rates[l]));
+                    } else {
+                        REALTYPE scaledEigenValue = eigenValues[k] * ((REALTYPE)rates[l]);
+                        REALTYPE ex = exp(scaledEigenValue * ((REALTYPE)edgeLengths[u]));
+                        expTable[k * batchSize + m] = ex;
+                        d1Table[k * batchSize + m] = scaledEigenValue * ex;
+                        if (derivativeCount == 2)
+                            d2Table[k * batchSize + m] = scaledEigenValue * (scaledEigenValue * ex);
+                    }
+                }
+            }
+        }
+
+        const REALTYPE* cMatrix = gCMatrices[eigenIndex];
+        for (int i = 0; i < kStateCount; i++) {
+            for (int j = 0; j < kStateCount; j++) {
+                const REALTYPE* c = cMatrix + (i * kStateCount + j) * kStateCount;
+                std::fill(sums.begin(), sums.end(), (REALTYPE) 0);
+                for (int d = 0; d <= derivativeCount; d++) {
+                    REALTYPE* __restrict sum = &sums[(size_t) d * batchSize];
+                    const REALTYPE* table = expTable + (size_t) d * kStateCount * batchSize;
+                    for (int k = 0; k < kStateCount; k++) {
+                        const REALTYPE ck = c[k];
+                        const REALTYPE* __restrict row = table + k * batchSize;
+                        for (int m = 0; m < matrixCount; m++)
+                            sum[m] += ck * row[m];
+                    }
+                }
+                const int offset = i * rowStride + j;
+                for (int m = 0; m < matrixCount; m++) {
+                    const int u = start + m / kCategoryCount;
+                    const int l = m % kCategoryCount;
+                    const REALTYPE p = sums[m];
+                    transitionMatrices[probabilityIndices[u]][l * categoryStride + offset] = (p > 0 ? p : 0);
+                    if (derivativeCount > 0)
+                        transitionMatrices[firstDerivativeIndices[u]][l * categoryStride + offset] = sums[batchSize + m];
+                    if (derivativeCount > 1)
+                        transitionMatrices[secondDerivativeIndices[u]][l * categoryStride + offset] = sums[2 * batchSize + m];
+                }
+            }
+        }
+
+        if (T_PAD != 0) {
+            for (int u = start; u < end; u++) {
+                for (int l = 0; l < kCategoryCount; l++) {
+                    for (int i = 0; i < kStateCount; i++) {
+                        const int offset = l * categoryStride + i * rowStride + kStateCount;
+                        transitionMatrices[probabilityIndices[u]][offset] = 1.0;
+                        if (derivativeCount > 0)
+                            transitionMatrices[firstDerivativeIndices[u]][offset] = 0.0;
+                        if (derivativeCount > 1)
+                            transitionMatrices[secondDerivativeIndices[u]][offset] = 0.0;
+                    }
+                }
+            }
+        }
+
+        start = end;
+    }
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+bool EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::supportsConcurrentUpdates() {
+    return true;
+}
+
 BEAGLE_CPU_EIGEN_TEMPLATE
 void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatricesWithModelCategories(int* eigenIndices,
                                                       const int* probabilityIndices,
@@ -473,6 +588,26 @@ if (T_PAD != 0) {
 }
 
 
+BEAGLE_CPU_EIGEN_TEMPLATE
+bool EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::writeState(FILE* file) {
+    for (int i = 0; i < kEigenDecompCount; i++) {
+        if (!writeStateBlock(file, gEigenValues[i], sizeof(REALTYPE) * kStateCount) ||
+            !writeStateBlock(file, gCMatrices[i], sizeof(REALTYPE) * kStateCount * kStateCount * kStateCount))
+            return false;
+    }
+    return true;
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+bool EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::readState(FILE* file) {
+    for (int i = 0; i < kEigenDecompCount; i++) {
+        if (!readStateBlock(file, gEigenValues[i], sizeof(REALTYPE) * kStateCount) ||
+            !readStateBlock(file, gCMatrices[i], sizeof(REALTYPE) * kStateCount * kStateCount * kStateCount))
+            return false;
+    }
+    return true;
+}
+
 } // cpu
 } // beagle
 
@@ -29,6 +29,11 @@ protected:
     bool isComplex;
     int kEigenValuesSize;
 
+    void exponentiate(int eigenIndex,
+                      REALTYPE distance,
+                      REALTYPE* scratch,
+                      REALTYPE* transitionMat);
+
 public:
 	EigenDecompositionSquare(int decompositionCount,
 						     int stateCount,
@@ -58,6 +63,23 @@ public:
                                  const double* edgeLengths,
                                  REALTYPE** transitionMatrices,
                                  int count);
+
+    virtual void updateTransitionMatricesWithMultipleModels(const int* eigenIndices,
+                                 const int* categoryRateIndices,
+                                 const int* probabilityIndices,
+                                 const int* firstDerivativeIndices,
+                                 const int* secondDerivativeIndices,
+                                 const double* edgeLengths,
+                                 const double* const* categoryRates,
+                                 REALTYPE** transitionMatrices,
+                                 int startEdge,
+                                 int endEdge);
+
+    virtual bool supportsConcurrentUpdates();
+
+    virtual bool writeState(FILE* file);
+
+    virtual bool readState(FILE* file);
 };
 
 }
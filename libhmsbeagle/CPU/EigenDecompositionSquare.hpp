@@ -116,75 +116,182 @@ void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrice
                                                         REALTYPE** transitionMatrices,
                                                         int count) {
 
-	const REALTYPE* Ievc = gIMatrices[eigenIndex];
-	const REALTYPE* Evec = gEMatrices[eigenIndex];
-	const REALTYPE* Eval = gEigenValues[eigenIndex];
-	const REALTYPE* EvalImag = Eval + kStateCount;
     for (int u = 0; u < count; u++) {
         REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
         const double edgeLength = edgeLengths[u];
-        int n = 0;
         for (int l = 0; l < kCategoryCount; l++) {
 			const REALTYPE distance = categoryRates[l] * edgeLength;
-        	for(int i=0; i<kStateCount; i++) {
-        		if (!isComplex || EvalImag[i] == 0) {
-        			const REALTYPE tmp = exp(Eval[i] * distance);
-        			for(int j=0; j<kStateCount; j++) {
-        				matrixTmp[i*kStateCount+j] = Ievc[i*kStateCount+j] * tmp;
-        			}
-        		} else {
-        			// 2 x 2 conjugate block
-        			int i2 = i + 1;
-        			const REALTYPE b = EvalImag[i];
-        			const REALTYPE expat = exp(Eval[i] * distance);
-        			const REALTYPE expatcosbt = expat * cos(b * distance);
-        			const REALTYPE expatsinbt = expat * sin(b * distance);
-        			for(int j=0; j<kStateCount; j++) {
-        				matrixTmp[ i*kStateCount+j] = expatcosbt * Ievc[ i*kStateCount+j] +
-        						                      expatsinbt * Ievc[i2*kStateCount+j];
-        				matrixTmp[i2*kStateCount+j] = expatcosbt * Ievc[i2*kStateCount+j] -
-												      expatsinbt * Ievc[ i*kStateCount+j];
-        			}
-        			i++; // processed two conjugate rows
-        		}
-        	}
+            exponentiate(eigenIndex, distance, matrixTmp,
+                         transitionMat + l * kStateCount * (kStateCount + T_PAD));
+        }
+
+        if (DEBUGGING_OUTPUT) {
+        	int kMatrixSize = kStateCount * kStateCount;
+            fprintf(stderr,"transitionMat index=%d brlen=%.5f\n", probabilityIndices[u], edgeLengths[u]);
+            for ( int w = 0; w < (20 > kMatrixSize ? 20 : kMatrixSize); ++w)
+                fprintf(stderr,"transitionMat[%d] = %.5f\n", w, transitionMat[w]);
+        }
+    }
+}
+
+/*
+ * One category of a transition matrix, E exp(D distance) I, using scratch space of
+ * kStateCount^2 entries.
+ */
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::exponentiate(int eigenIndex,
+                                                                      REALTYPE distance,
+                                                                      REALTYPE* scratch,
+                                                                      REALTYPE* transitionMat) {
+	const REALTYPE* Ievc = gIMatrices[eigenIndex];
+	const REALTYPE* Evec = gEMatrices[eigenIndex];
+	const REALTYPE* Eval = gEigenValues[eigenIndex];
+	const REALTYPE* EvalImag = Eval + kStateCount;
+
+    for(int i=0; i<kStateCount; i++) {
+        if (!isComplex || EvalImag[i] == 0) {
+            const REALTYPE tmp = exp(Eval[i] * distance);
+            for(int j=0; j<kStateCount; j++) {
+                scratch[i*kStateCount+j] = Ievc[i*kStateCount+j] * tmp;
+            }
+        } else {
+            // 2 x 2 conjugate block
+            int i2 = i + 1;
+            const REALTYPE b = EvalImag[i];
+            const REALTYPE expat = exp(Eval[i] * distance);
+            const REALTYPE expatcosbt = expat * cos(b * distance);
+            const REALTYPE expatsinbt = expat * sin(b * distance);
+            for(int j=0; j<kStateCount; j++) {
+                scratch[ i*kStateCount+j] = expatcosbt * Ievc[ i*kStateCount+j] +
+                                            expatsinbt * Ievc[i2*kStateCount+j];
+                scratch[i2*kStateCount+j] = expatcosbt * Ievc[i2*kStateCount+j] -
+                                            expatsinbt * Ievc[ i*kStateCount+j];
+            }
+            i++; // processed two conjugate rows
+        }
+    }
 
 #ifdef DEBUG_COMPLEX
-           	fprintf(stderr,"[");
-            	for(int i=0; i<16; i++)
-            		fprintf(stderr," %7.5e,",matrixTmp[i]);
-            	fprintf(stderr,"] -- complex debug\n");
-            	exit(0);
+   	fprintf(stderr,"[");
+    	for(int i=0; i<16; i++)
+    		fprintf(stderr," %7.5e,",scratch[i]);
+    	fprintf(stderr,"] -- complex debug\n");
+    	exit(0);
 #endif
 
+    int n = 0;
+    for (int i = 0; i < kStateCount; i++) {
+        for (int j = 0; j < kStateCount; j++) {
+            REALTYPE sum = 0.0;
+            for (int k = 0; k < kStateCount; k++)
+                sum += Evec[i*kStateCount+k] * scratch[k*kStateCount+j];
+            if (sum > 0)
+                transitionMat[n] = sum;
+            else
+                transitionMat[n] = 0;
+            n++;
+        }
+if (T_PAD != 0) {
+        transitionMat[n] = 1.0;
+        n += T_PAD;
+}
+    }
+}
 
-            for (int i = 0; i < kStateCount; i++) {
-                for (int j = 0; j < kStateCount; j++) {
-                    REALTYPE sum = 0.0;
-                    for (int k = 0; k < kStateCount; k++)
-                        sum += Evec[i*kStateCount+k] * matrixTmp[k*kStateCount+j];
-                    if (sum > 0)
-                        transitionMat[n] = sum;
-                    else
-                        transitionMat[n] = 0;
-                    n++;
+/*
+ * Real eigen systems are applied to BEAGLE_CPU_EIGEN_BATCH_MATRIX_COUNT (edge, category)
+ * matrices at a time: each entry of E and row of I is loaded once for all of them, with rows
+ * accumulated in the same order as updateTransitionMatrices. Complex systems are exponentiated
+ * one matrix at a time. Derivatives are not computed, as in updateTransitionMatrices.
+ */
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatricesWithMultipleModels(
+                                                        const int* eigenIndices,
+                                                        const int* categoryRateIndices,
+                                                        const int* probabilityIndices,
+                                                        const int* firstDerivativeIndices,
+                                                        const int* secondDerivativeIndices,
+                                                        const double* edgeLengths,
+                                                        const double* const* categoryRates,
+                                                        REALTYPE** transitionMatrices,
+                                                        int startEdge,
+                                                        int endEdge) {
+    const int categoryStride = kStateCount * (kStateCount + T_PAD);
+    const int batchEdgeCount = std::max(1, BEAGLE_CPU_EIGEN_BATCH_MATRIX_COUNT / kCategoryCount);
+    const int batchSize = batchEdgeCount * kCategoryCount;
+
+    std::vector<REALTYPE> exponentials((size_t) batchSize * kStateCount);
+    std::vector<REALTYPE> rows((size_t) batchSize * kStateCount);
+
+    for (int start = startEdge; start < endEdge; ) {
+        const int eigenIndex = eigenIndices[start];
+        int end = start + 1;
+        while (end < endEdge && end - start < batchEdgeCount && eigenIndices[end] == eigenIndex)
+            end++;
+
+        if (isComplex) {
+            for (int u = start; u < end; u++) {
+                const double* rates = categoryRates[categoryRateIndices[u]];
+                for (int l = 0; l < kCategoryCount; l++) {
+                    const REALTYPE distance = rates[l] * edgeLengths[u];
+                    exponentiate(eigenIndex, distance, &rows[0],
+                                 transitionMatrices[probabilityIndices[u]] + l * categoryStride);
+                }
+            }
+            start = end;
+            continue;
+        }
+
+        const int matrixCount = (end - start) * kCategoryCount;
+        const REALTYPE* Ievc = gIMatrices[eigenIndex];
+        const REALTYPE* Evec = gEMatrices[eigenIndex];
+        const REALTYPE* Eval = gEigenValues[eigenIndex];
+
+        for (int u = start; u < end; u++) {
+            const double* rates = categoryRates[categoryRateIndices[u]];
+            for (int l = 0; l < kCategoryCount; l++) {
+                const REALTYPE distance = rates[l] * edgeLengths[u];
+                REALTYPE* exponential = &exponentials[(size_t) ((u - start) * kCategoryCount + l) * kStateCount];
+                for (int k = 0; k < kStateCount; k++)
+                    exponential[k] = exp(Eval[k] * distance);
+            }
+        }
+
+        for (int i = 0; i < kStateCount; i++) {
+            std::fill(rows.begin(), rows.begin() + (size_t) matrixCount * kStateCount, (REALTYPE) 0);
+            for (int k = 0; k < kStateCount; k++) {
+                const REALTYPE e = Evec[i * kStateCount + k];
+                const REALTYPE* __restrict inverseRow = Ievc + k * kStateCount;
+                for (int m = 0; m < matrixCount; m++) {
+                    const REALTYPE exponential = exponentials[(size_t) m * kStateCount + k];
+                    REALTYPE* __restrict row = &rows[(size_t) m * kStateCount];
+                    for (int j = 0; j < kStateCount; j++)
+                        row[j] += e * (inverseRow[j] * exponential);
                 }
+            }
+            for (int m = 0; m < matrixCount; m++) {
+                const int u = start + m / kCategoryCount;
+                const int l = m % kCategoryCount;
+                REALTYPE* transitionRow = transitionMatrices[probabilityIndices[u]] + l * categoryStride +
+                                          i * (kStateCount + T_PAD);
+                const REALTYPE* row = &rows[(size_t) m * kStateCount];
+                for (int j = 0; j < kStateCount; j++)
+                    transitionRow[j] = (row[j] > 0 ? row[j] : 0);
 if (T_PAD != 0) {
-                transitionMat[n] = 1.0;
-                n += T_PAD;
+                transitionRow[kStateCount] = 1.0;
 }
             }
         }
 
-        if (DEBUGGING_OUTPUT) {
-        	int kMatrixSize = kStateCount * kStateCount;
-            fprintf(stderr,"transitionMat index=%d brlen=%.5f\n", probabilityIndices[u], edgeLengths[u]);
-            for ( int w = 0; w < (20 > kMatrixSize ? 20 : kMatrixSize); ++w)
-                fprintf(stderr,"transitionMat[%d] = %.5f\n", w, transitionMat[w]);
-        }
+        start = end;
     }
 }
 
+BEAGLE_CPU_EIGEN_TEMPLATE
+bool EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::supportsConcurrentUpdates() {
+    return true;
+}
+
 BEAGLE_CPU_EIGEN_TEMPLATE
 void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatricesWithModelCategories(int* eigenIndices,
                                                         const int* probabilityIndices,
@@ -263,6 +370,28 @@ if (T_PAD != 0) {
     }
 }
 
+BEAGLE_CPU_EIGEN_TEMPLATE
+bool EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::writeState(FILE* file) {
+    for (int i = 0; i < kEigenDecompCount; i++) {
+        if (!writeStateBlock(file, gEigenValues[i], sizeof(REALTYPE) * kEigenValuesSize) ||
+            !writeStateBlock(file, gEMatrices[i], sizeof(REALTYPE) * kStateCount * kStateCount) ||
+            !writeStateBlock(file, gIMatrices[i], sizeof(REALTYPE) * kStateCount * kStateCount))
+            return false;
+    }
+    return true;
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+bool EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::readState(FILE* file) {
+    for (int i = 0; i < kEigenDecompCount; i++) {
+        if (!readStateBlock(file, gEigenValues[i], sizeof(REALTYPE) * kEigenValuesSize) ||
+            !readStateBlock(file, gEMatrices[i], sizeof(REALTYPE) * kStateCount * kStateCount) ||
+            !readStateBlock(file, gIMatrices[i], sizeof(REALTYPE) * kStateCount * kStateCount))
+            return false;
+    }
+    return true;
+}
+
 }
 }
 
@@ -0,0 +1,109 @@
+/*
+ * EigenDecompositionUniformization.h
+ *
+ * Transition probabilities by uniformization of a sparse rate matrix, for eigen
+ * buffers set through setRateMatrix; other buffers are forwarded to the wrapped
+ * eigen decomposition.
+ */
+
+#ifndef EIGENDECOMPOSITIONUNIFORMIZATION_H_
+#define EIGENDECOMPOSITIONUNIFORMIZATION_H_
+
+#include "libhmsbeagle/CPU/EigenDecomposition.h"
+
+#define BEAGLE_CPU_UNIFORMIZATION_EPSILON   1E-15   // bound on the truncated Poisson tail
+
+namespace beagle {
+namespace cpu {
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+class EigenDecompositionUniformization : public EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC> {
+
+	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::kStateCount;
+	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::kEigenDecompCount;
+	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::kCategoryCount;
+
+protected:
+    EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>* gEigenDecomposition; // owned
+
+    // Q in compressed sparse rows, NULL for buffers holding an eigen decomposition
+    int** gRowOffsets;
+    int** gColumnIndices;
+    double** gRates;
+    double* gUniformizationRates; // max_i -Q_ii
+
+    double* gPowerTmp;      // B^k, B = I + Q / lambda
+    double* gProductTmp;
+    double* gMatrixTmp;     // P(t) and its derivatives
+    double* gFirstDerivTmp;
+    double* gSecondDerivTmp;
+
+public:
+	EigenDecompositionUniformization(EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>* eigenDecomposition,
+	                                 int decompositionCount,
+	                                 int stateCount,
+	                                 int categoryCount,
+	                                 long flags);
+
+	virtual ~EigenDecompositionUniformization();
+
+    // sets a dense, row-major rate matrix for eigenIndex; only its non-zeros are kept
+    void setRateMatrix(int eigenIndex,
+                       const double* inRateMatrix);
+
+    virtual void setEigenDecomposition(int eigenIndex,
+                              const double* inEigenVectors,
+                              const double* inInverseEigenVectors,
+                              const double* inEigenValues);
+
+    virtual void updateTransitionMatrices(int eigenIndex,
+                                 const int* probabilityIndices,
+                                 const int* firstDerivativeIndices,
+                                 const int* secondDerivativeIndices,
+                                 const double* edgeLengths,
+                                 const double* categoryRates,
+                                 REALTYPE** transitionMatrices,
+                                 int count);
+
+    virtual void updateTransitionMatricesWithModelCategories(int* eigenIndices,
+                                 const int* probabilityIndices,
+                                 const int* firstDerivativeIndices,
+                                 const int* secondDerivativeIndices,
+                                 const double* edgeLengths,
+                                 REALTYPE** transitionMatrices,
+                                 int count);
+
+    virtual bool writeState(FILE* file);
+
+    virtual bool readState(FILE* file);
+
+    // reads a state written without uniformization, dropping every rate matrix
+    bool readDecompositionState(FILE* file);
+
+private:
+    void freeRateMatrix(int eigenIndex);
+
+    // out = Q * in, both dense row-major
+    void multiplyRateMatrix(int eigenIndex,
+                            const double* in,
+                            double* out);
+
+    // gMatrixTmp = exp(Q * distance), with rate * Q * P and (rate * Q)^2 * P if requested
+    void computeExponential(int eigenIndex,
+                            double distance,
+                            double rate,
+                            bool firstDerivative,
+                            bool secondDerivative);
+
+    void copyMatrix(REALTYPE* outMatrix,
+                    const double* inMatrix,
+                    REALTYPE padValue);
+};
+
+}
+}
+
+// Include the template implementation
+#include "libhmsbeagle/CPU/EigenDecompositionUniformization.hpp"
+
+#endif /* EIGENDECOMPOSITIONUNIFORMIZATION_H_ */
@@ -0,0 +1,356 @@
+/*
+ * EigenDecompositionUniformization.hpp
+ *
+ * P(t) = sum_k Poisson(k; lambda t) B^k with B = I + Q / lambda. Each term costs one
+ * dense-by-sparse product, so time is O(n nnz(Q)) per term and memory O(n^2).
+ */
+#ifndef _EigenDecompositionUniformization_hpp_
+#define _EigenDecompositionUniformization_hpp_
+
+#include "libhmsbeagle/CPU/EigenDecompositionUniformization.h"
+
+namespace beagle {
+namespace cpu {
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+EigenDecompositionUniformization<BEAGLE_CPU_EIGEN_GENERIC>::EigenDecompositionUniformization(
+                                                     EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>* eigenDecomposition,
+                                                     int decompositionCount,
+                                                     int stateCount,
+                                                     int categoryCount,
+                                                     long flags)
+    : EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>(decompositionCount, stateCount, categoryCount, flags) {
+
+    gEigenDecomposition = eigenDecomposition;
+
+    gRowOffsets = (int**) calloc(kEigenDecompCount, sizeof(int*));
+    gColumnIndices = (int**) calloc(kEigenDecompCount, sizeof(int*));
+    gRates = (double**) calloc(kEigenDecompCount, sizeof(double*));
+    gUniformizationRates = (double*) calloc(kEigenDecompCount, sizeof(double));
+    if (gRowOffsets == NULL || gColumnIndices == NULL || gRates == NULL || gUniformizationRates == NULL)
+        throw std::bad_alloc();
+
+    const size_t matrixSize = (size_t) kStateCount * kStateCount;
+    gPowerTmp = (double*) malloc(sizeof(double) * matrixSize);
+    gProductTmp = (double*) malloc(sizeof(double) * matrixSize);
+    gMatrixTmp = (double*) malloc(sizeof(double) * matrixSize);
+    gFirstDerivTmp = (double*) malloc(sizeof(double) * matrixSize);
+    gSecondDerivTmp = (double*) malloc(sizeof(double) * matrixSize);
+    if (gPowerTmp == NULL || gProductTmp == NULL || gMatrixTmp == NULL ||
+        gFirstDerivTmp == NULL || gSecondDerivTmp == NULL)
+        throw std::bad_alloc();
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+EigenDecompositionUniformization<BEAGLE_CPU_EIGEN_GENERIC>::~EigenDecompositionUniformization() {
+
+    for (int i = 0; i < kEigenDecompCount; i++)
+        freeRateMatrix(i);
+    free(gRowOffsets);
+    free(gColumnIndices);
+    free(gRates);
+    free(gUniformizationRates);
+    free(gPowerTmp);
+    free(gProductTmp);
+    free(gMatrixTmp);
+    free(gFirstDerivTmp);
+    free(gSecondDerivTmp);
+
+    delete gEigenDecomposition;
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionUniformization<BEAGLE_CPU_EIGEN_GENERIC>::freeRateMatrix(int eigenIndex) {
+    free(gRowOffsets[eigenIndex]);
+    free(gColumnIndices[eigenIndex]);
+    free(gRates[eigenIndex]);
+    gRowOffsets[eigenIndex] = NULL;
+    gColumnIndices[eigenIndex] = NULL;
+    gRates[eigenIndex] = NULL;
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionUniformization<BEAGLE_CPU_EIGEN_GENERIC>::setRateMatrix(int eigenIndex,
+                                                                               const double* inRateMatrix) {
+    freeRateMatrix(eigenIndex);
+
+    const size_t matrixSize = (size_t) kStateCount * kStateCount;
+    int nonZeroCount = 0;
+    for (size_t i = 0; i < matrixSize; i++) {
+        if (inRateMatrix[i] != 0.0)
+            nonZeroCount++;
+    }
+
+    gRowOffsets[eigenIndex] = (int*) malloc(sizeof(int) * (kStateCount + 1));
+    gColumnIndices[eigenIndex] = (int*) malloc(sizeof(int) * (nonZeroCount + 1));
+    gRates[eigenIndex] = (double*) malloc(sizeof(double) * (nonZeroCount + 1));
+    if (gRowOffsets[eigenIndex] == NULL || gColumnIndices[eigenIndex] == NULL || gRates[eigenIndex] == NULL)
+        throw std::bad_alloc();
+
+    int* rowOffsets = gRowOffsets[eigenIndex];
+    int* columnIndices = gColumnIndices[eigenIndex];
+    double* rates = gRates[eigenIndex];
+    double lambda = 0.0;
+    int p = 0;
+    for (int i = 0; i < kStateCount; i++) {
+        rowOffsets[i] = p;
+        for (int j = 0; j < kStateCount; j++) {
+            const double q = inRateMatrix[(size_t) i * kStateCount + j];
+            if (q != 0.0) {
+                columnIndices[p] = j;
+                rates[p] = q;
+                p++;
+            }
+            if (i == j && -q > lambda)
+                lambda = -q;
+        }
+    }
+    rowOffsets[kStateCount] = p;
+    gUniformizationRates[eigenIndex] = lambda;
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionUniformization<BEAGLE_CPU_EIGEN_GENERIC>::setEigenDecomposition(int eigenIndex,
+                                                                  const double* inEigenVectors,
+                                                                  const double* inInverseEigenVectors,
+                                                                  const double* inEigenValues) {
+    freeRateMatrix(eigenIndex);
+    gEigenDecomposition->setEigenDecomposition(eigenIndex, inEigenVectors, inInverseEigenVectors, inEigenValues);
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionUniformization<BEAGLE_CPU_EIGEN_GENERIC>::multiplyRateMatrix(int eigenIndex,
+                                                                                    const double* in,
+                                                                                    double* out) {
+    // out = in * Q, one sparse row of Q per non-zero of in; Q commutes with every power of B
+    const int* rowOffsets = gRowOffsets[eigenIndex];
+    const int* columnIndices = gColumnIndices[eigenIndex];
+    const double* rates = gRates[eigenIndex];
+    for (int i = 0; i < kStateCount; i++) {
+        const double* inRow = in + (size_t) i * kStateCount;
+        double* outRow = out + (size_t) i * kStateCount;
+        for (int j = 0; j < kStateCount; j++)
+            outRow[j] = 0.0;
+        for (int j = 0; j < kStateCount; j++) {
+            const double v = inRow[j];
+            if (v != 0.0) {
+                for (int p = rowOffsets[j]; p < rowOffsets[j + 1]; p++)
+                    outRow[columnIndices[p]] += v * rates[p];
+            }
+        }
+    }
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionUniformization<BEAGLE_CPU_EIGEN_GENERIC>::computeExponential(int eigenIndex,
+                                                                                    double distance,
+                                                                                    double rate,
+                                                                                    bool firstDerivative,
+                                                                                    bool secondDerivative) {
+    const size_t matrixSize = (size_t) kStateCount * kStateCount;
+    const double lambda = gUniformizationRates[eigenIndex];
+    const double x = lambda * distance;
+
+    for (size_t i = 0; i < matrixSize; i++) {
+        gPowerTmp[i] = 0.0;
+        gMatrixTmp[i] = 0.0;
+    }
+    for (int i = 0; i < kStateCount; i++)
+        gPowerTmp[(size_t) i * kStateCount + i] = 1.0;
+
+    if (x > 0.0) {
+        // Poisson weights in log space, so that exp(-x) does not underflow for long branches
+        const double logX = log(x);
+        const int maxTerms = (int) (x + 20.0 * sqrt(x) + 100.0);
+        double logWeight = -x;
+        for (int k = 0; ; k++) {
+            const double weight = exp(logWeight);
+            if (weight > 0.0) {
+                for (size_t i = 0; i < matrixSize; i++)
+                    gMatrixTmp[i] += weight * gPowerTmp[i];
+            }
+
+            // past the mode the tail is bounded by a geometric series
+            const double ratio = x / (k + 1);
+            if (k >= maxTerms || (ratio < 1.0 && weight * ratio / (1.0 - ratio) < BEAGLE_CPU_UNIFORMIZATION_EPSILON))
+                break;
+
+            multiplyRateMatrix(eigenIndex, gPowerTmp, gProductTmp);
+            for (size_t i = 0; i < matrixSize; i++)
+                gPowerTmp[i] += gProductTmp[i] / lambda;
+
+            logWeight += logX - log((double) (k + 1));
+        }
+    } else {
+        for (int i = 0; i < kStateCount; i++)
+            gMatrixTmp[(size_t) i * kStateCount + i] = 1.0;
+    }
+
+    if (firstDerivative || secondDerivative) {
+        multiplyRateMatrix(eigenIndex, gMatrixTmp, gFirstDerivTmp);
+        for (size_t i = 0; i < matrixSize; i++)
+            gFirstDerivTmp[i] *= rate;
+    }
+    if (secondDerivative) {
+        multiplyRateMatrix(eigenIndex, gFirstDerivTmp, gSecondDerivTmp);
+        for (size_t i = 0; i < matrixSize; i++)
+            gSecondDerivTmp[i] *= rate;
+    }
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionUniformization<BEAGLE_CPU_EIGEN_GENERIC>::copyMatrix(REALTYPE* outMatrix,
+                                                                            const double* inMatrix,
+                                                                            REALTYPE padValue) {
+    int n = 0;
+    for (int i = 0; i < kStateCount; i++) {
+        for (int j = 0; j < kStateCount; j++) {
+            outMatrix[n] = (REALTYPE) inMatrix[(size_t) i * kStateCount + j];
+            n++;
+        }
+        if (T_PAD != 0) {
+            outMatrix[n] = padValue;
+            n += T_PAD;
+        }
+    }
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionUniformization<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrices(int eigenIndex,
+                                                              const int* probabilityIndices,
+                                                              const int* firstDerivativeIndices,
+                                                              const int* secondDerivativeIndices,
+                                                              const double* edgeLengths,
+                                                              const double* categoryRates,
+                                                              REALTYPE** transitionMatrices,
+                                                              int count) {
+    if (gRowOffsets[eigenIndex] == NULL) {
+        gEigenDecomposition->updateTransitionMatrices(eigenIndex, probabilityIndices, firstDerivativeIndices,
+                                                      secondDerivativeIndices, edgeLengths, categoryRates,
+                                                      transitionMatrices, count);
+        return;
+    }
+
+    const int categoryMatrixSize = kStateCount * (kStateCount + T_PAD);
+    for (int u = 0; u < count; u++) {
+        for (int l = 0; l < kCategoryCount; l++) {
+            computeExponential(eigenIndex, edgeLengths[u] * categoryRates[l], categoryRates[l],
+                               firstDerivativeIndices != NULL, secondDerivativeIndices != NULL);
+            const int offset = l * categoryMatrixSize;
+            if (probabilityIndices != NULL)
+                copyMatrix(transitionMatrices[probabilityIndices[u]] + offset, gMatrixTmp, 1.0);
+            if (firstDerivativeIndices != NULL)
+                copyMatrix(transitionMatrices[firstDerivativeIndices[u]] + offset, gFirstDerivTmp, 0.0);
+            if (secondDerivativeIndices != NULL)
+                copyMatrix(transitionMatrices[secondDerivativeIndices[u]] + offset, gSecondDerivTmp, 0.0);
+        }
+    }
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionUniformization<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatricesWithModelCategories(int* eigenIndices,
+                                                              const int* probabilityIndices,
+                                                              const int* firstDerivativeIndices,
+                                                              const int* secondDerivativeIndices,
+                                                              const double* edgeLengths,
+                                                              REALTYPE** transitionMatrices,
+                                                              int count) {
+    bool allUniformized = true;
+    for (int l = 0; l < kCategoryCount; l++) {
+        if (gRowOffsets[eigenIndices[l]] == NULL)
+            allUniformized = false;
+    }
+
+    // eigen categories are filled first, then uniformized ones are overwritten
+    if (!allUniformized)
+        gEigenDecomposition->updateTransitionMatricesWithModelCategories(eigenIndices, probabilityIndices,
+                                                                         firstDerivativeIndices,
+                                                                         secondDerivativeIndices, edgeLengths,
+                                                                         transitionMatrices, count);
+
+    const int categoryMatrixSize = kStateCount * (kStateCount + T_PAD);
+    for (int u = 0; u < count; u++) {
+        for (int l = 0; l < kCategoryCount; l++) {
+            if (gRowOffsets[eigenIndices[l]] == NULL)
+                continue;
+            computeExponential(eigenIndices[l], edgeLengths[u], 1.0,
+                               firstDerivativeIndices != NULL, secondDerivativeIndices != NULL);
+            const int offset = l * categoryMatrixSize;
+            if (probabilityIndices != NULL)
+                copyMatrix(transitionMatrices[probabilityIndices[u]] + offset, gMatrixTmp, 1.0);
+            if (firstDerivativeIndices != NULL)
+                copyMatrix(transitionMatrices[firstDerivativeIndices[u]] + offset, gFirstDerivTmp, 0.0);
+            if (secondDerivativeIndices != NULL)
+                copyMatrix(transitionMatrices[secondDerivativeIndices[u]] + offset, gSecondDerivTmp, 0.0);
+        }
+    }
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+bool EigenDecompositionUniformization<BEAGLE_CPU_EIGEN_GENERIC>::writeState(FILE* file) {
+    if (!gEigenDecomposition->writeState(file))
+        return false;
+
+    // the number of non-zeros of each rate matrix, -1 for eigen decompositions
+    std::vector<int> nonZeroCounts(kEigenDecompCount, -1);
+    for (int i = 0; i < kEigenDecompCount; i++) {
+        if (gRowOffsets[i] != NULL)
+            nonZeroCounts[i] = gRowOffsets[i][kStateCount];
+    }
+    if (!writeStateBlock(file, &nonZeroCounts[0], sizeof(int) * kEigenDecompCount) ||
+        !writeStateBlock(file, gUniformizationRates, sizeof(double) * kEigenDecompCount))
+        return false;
+
+    for (int i = 0; i < kEigenDecompCount; i++) {
+        if (nonZeroCounts[i] >= 0 &&
+            (!writeStateBlock(file, gRowOffsets[i], sizeof(int) * (kStateCount + 1)) ||
+             !writeStateBlock(file, gColumnIndices[i], sizeof(int) * nonZeroCounts[i]) ||
+             !writeStateBlock(file, gRates[i], sizeof(double) * nonZeroCounts[i])))
+            return false;
+    }
+    return true;
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+bool EigenDecompositionUniformization<BEAGLE_CPU_EIGEN_GENERIC>::readState(FILE* file) {
+    if (!gEigenDecomposition->readState(file))
+        return false;
+
+    std::vector<int> nonZeroCounts(kEigenDecompCount);
+    if (!readStateBlock(file, &nonZeroCounts[0], sizeof(int) * kEigenDecompCount) ||
+        !readStateBlock(file, gUniformizationRates, sizeof(double) * kEigenDecompCount))
+        return false;
+
+    for (int i = 0; i < kEigenDecompCount; i++) {
+        freeRateMatrix(i);
+        const int nonZeroCount = nonZeroCounts[i];
+        if (nonZeroCount < 0)
+            continue;
+        if (nonZeroCount > kStateCount * kStateCount)
+            return false;
+
+        gRowOffsets[i] = (int*) malloc(sizeof(int) * (kStateCount + 1));
+        gColumnIndices[i] = (int*) malloc(sizeof(int) * (nonZeroCount + 1));
+        gRates[i] = (double*) malloc(sizeof(double) * (nonZeroCount + 1));
+        if (gRowOffsets[i] == NULL || gColumnIndices[i] == NULL || gRates[i] == NULL)
+            throw std::bad_alloc();
+
+        if (!readStateBlock(file, gRowOffsets[i], sizeof(int) * (kStateCount + 1)) ||
+            !readStateBlock(file, gColumnIndices[i], sizeof(int) * nonZeroCount) ||
+            !readStateBlock(file, gRates[i], sizeof(double) * nonZeroCount))
+            return false;
+    }
+    return true;
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+bool EigenDecompositionUniformization<BEAGLE_CPU_EIGEN_GENERIC>::readDecompositionState(FILE* file) {
+    for (int i = 0; i < kEigenDecompCount; i++)
+        freeRateMatrix(i);
+    return gEigenDecomposition->readState(file);
+}
+
+}
+}
+
+#endif // _EigenDecompositionUniformization_hpp_
@@ -0,0 +1,74 @@
+/*
+ * InstanceState.h
+ *
+ * Block I/O for instance state files written by beagleSaveInstanceState. Every block is
+ * padded to BEAGLE_CPU_STATE_ALIGNMENT bytes so that each array in the file starts at an
+ * aligned offset and can be read into its buffer with a single fread.
+ */
+
+#ifndef INSTANCESTATE_H_
+#define INSTANCESTATE_H_
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#define BEAGLE_CPU_STATE_MAGIC      "BGLSTATE"
+#define BEAGLE_CPU_STATE_VERSION    1
+#define BEAGLE_CPU_STATE_ALIGNMENT  64
+
+namespace beagle {
+namespace cpu {
+
+// first block of a state file; a state is only restored into an instance with equal dimensions
+struct InstanceStateHeader {
+    char magic[8];
+    int version;
+    int realTypeSize;
+    int tipCount;
+    int bufferCount;
+    int stateCount;
+    int patternCount;
+    int paddedPatternCount;
+    int partialsPaddedStateCount;
+    int partialsLayout;
+    int eigenDecompCount;
+    int matrixCount;
+    int matrixSize;
+    int categoryCount;
+    int scaleBufferCount;
+    long long flags;
+    int uniformization;     // 1 if rate matrices were set for uniformization
+    int partitionCount;     // 0 if patterns are not partitioned
+};
+
+inline bool writeStateBlock(FILE* file,
+                            const void* data,
+                            size_t size) {
+    static const char padding[BEAGLE_CPU_STATE_ALIGNMENT] = { 0 };
+    if (size > 0 && fwrite(data, 1, size, file) != size)
+        return false;
+    const size_t remainder = size % BEAGLE_CPU_STATE_ALIGNMENT;
+    if (remainder != 0) {
+        const size_t padSize = BEAGLE_CPU_STATE_ALIGNMENT - remainder;
+        if (fwrite(padding, 1, padSize, file) != padSize)
+            return false;
+    }
+    return true;
+}
+
+inline bool readStateBlock(FILE* file,
+                           void* data,
+                           size_t size) {
+    if (size > 0 && fread(data, 1, size, file) != size)
+        return false;
+    const size_t remainder = size % BEAGLE_CPU_STATE_ALIGNMENT;
+    if (remainder != 0 && fseek(file, (long) (BEAGLE_CPU_STATE_ALIGNMENT - remainder), SEEK_CUR) != 0)
+        return false;
+    return true;
+}
+
+}
+}
+
+#endif /* INSTANCESTATE_H_ */
@@ -234,6 +234,8 @@ public:
 
     int setCPUThreadCount(int threadCount);
 
+    int setPartialsLayout(int layout);
+
     int setTipStates(int tipIndex,
                      const int* inStates);
 
@@ -256,6 +258,9 @@ public:
                               const double* inInverseEigenVectors,
                               const double* inEigenValues);
 
+    int setUniformizationRateMatrix(int eigenIndex,
+                                    const double* inRateMatrix);
+
     int setStateFrequencies(int stateFrequenciesIndex,
                             const double* inStateFrequencies);
 
@@ -440,6 +445,19 @@ public:
                                                double* outSumSecondDerivativeByPartition,
                                                double* outSumSecondDerivative);
 
+    int calculateEdgeLogLikelihoodsPerEdge(const int* parentBufferIndices,
+                                           const int* childBufferIndices,
+                                           const int* probabilityIndices,
+                                           const int* firstDerivativeIndices,
+                                           const int* secondDerivativeIndices,
+                                           const int* categoryWeightsIndices,
+                                           const int* stateFrequenciesIndices,
+                                           const int* cumulativeScaleIndices,
+                                           int count,
+                                           double* outLogLikelihoods,
+                                           double* outFirstDerivatives,
+                                           double* outSecondDerivatives);
+
 	int calculateCrossProducts(const int *postBufferIndices,
 							   const int *preBufferIndices,
 							   const int *categoryRatesIndices,
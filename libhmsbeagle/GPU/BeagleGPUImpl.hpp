@@ -886,6 +886,13 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setCPUThreadCount(int threadCount) {
     return BEAGLE_SUCCESS;
 }
 
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setPartialsLayout(int layout) {
+    if (layout == BEAGLE_PARTIALS_LAYOUT_CATEGORY_MAJOR)
+        return BEAGLE_SUCCESS;
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
 BEAGLE_GPU_TEMPLATE
 int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setTipStates(int tipIndex,
                                 const int* inStates) {
@@ -1141,6 +1148,12 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setEigenDecomposition(int eigenIndex,
     return BEAGLE_SUCCESS;
 }
 
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setUniformizationRateMatrix(int eigenIndex,
+                                                                   const double* inRateMatrix) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
 BEAGLE_GPU_TEMPLATE
 int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setStateFrequencies(int stateFrequenciesIndex,
                                        const double* inStateFrequencies) {
@@ -4219,6 +4232,42 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateEdgeLogLikelihoodsByPartition(
     return returnCode;
 }
 
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateEdgeLogLikelihoodsPerEdge(const int* parentBufferIndices,
+                                                                       const int* childBufferIndices,
+                                                                       const int* probabilityIndices,
+                                                                       const int* firstDerivativeIndices,
+                                                                       const int* secondDerivativeIndices,
+                                                                       const int* categoryWeightsIndices,
+                                                                       const int* stateFrequenciesIndices,
+                                                                       const int* cumulativeScaleIndices,
+                                                                       int count,
+                                                                       double* outLogLikelihoods,
+                                                                       double* outFirstDerivatives,
+                                                                       double* outSecondDerivatives) {
+    // Evaluate the edges one at a time
+    const bool firstDerivatives = (firstDerivativeIndices != NULL && outFirstDerivatives != NULL);
+    const bool secondDerivatives = (firstDerivatives && secondDerivativeIndices != NULL && outSecondDerivatives != NULL);
+    const int noScaling = BEAGLE_OP_NONE;
+    double unusedDerivative;
+
+    for (int i = 0; i < count; i++) {
+        int returnCode = calculateEdgeLogLikelihoods(&parentBufferIndices[i], &childBufferIndices[i],
+                                                     &probabilityIndices[i],
+                                                     (firstDerivatives ? &firstDerivativeIndices[i] : NULL),
+                                                     (secondDerivatives ? &secondDerivativeIndices[i] : NULL),
+                                                     &categoryWeightsIndices[i], &stateFrequenciesIndices[i],
+                                                     (cumulativeScaleIndices == NULL ? &noScaling : &cumulativeScaleIndices[i]),
+                                                     1, &outLogLikelihoods[i],
+                                                     (firstDerivatives ? &outFirstDerivatives[i] : &unusedDerivative),
+                                                     (secondDerivatives ? &outSecondDerivatives[i] : &unusedDerivative));
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
 BEAGLE_GPU_TEMPLATE
 int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::getLogLikelihood(double* outSumLogLikelihood) {
 
@@ -7,11 +7,70 @@
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
+#include <map>
+#include <mutex>
+#include <vector>
 #include <jni.h>
 
 #include "libhmsbeagle/beagle.h"
 #include "libhmsbeagle/JNI/beagle_BeagleJNIWrapper.h"
 
+/*
+ * Direct java.nio buffers registered with an instance and referenced by handle, so
+ * repeated calls reach native memory without copies or further JNI lookups.
+ */
+struct DirectBuffer {
+    jobject reference;  // global reference keeping the buffer alive
+    void* address;
+    jlong capacity;     // in elements
+    jint elementSize;
+};
+
+struct InstanceSizes {
+    jint stateCount;
+    jint patternCount;
+    jint categoryCount;
+};
+
+struct InstanceBuffers : InstanceSizes {
+    std::vector<DirectBuffer> buffers;
+};
+
+static std::map<jint, InstanceBuffers> instanceBuffers;
+static std::mutex instanceBuffersMutex;
+
+/* Returns the address of a registered buffer holding at least minElements, or NULL. */
+static void* getDirectBuffer(jint instance, jint handle, jint elementSize, jlong minElements) {
+    std::lock_guard<std::mutex> lock(instanceBuffersMutex);
+    std::map<jint, InstanceBuffers>::iterator it = instanceBuffers.find(instance);
+    if (it == instanceBuffers.end() || handle < 0 || handle >= (jint) it->second.buffers.size())
+        return NULL;
+    const DirectBuffer& buffer = it->second.buffers[handle];
+    if (buffer.elementSize != elementSize || buffer.capacity < minElements)
+        return NULL;
+    return buffer.address;
+}
+
+/* Copies the sizes out under the lock, as finalize may erase the entry once it is released. */
+static bool getInstanceSizes(jint instance, InstanceSizes* outSizes) {
+    std::lock_guard<std::mutex> lock(instanceBuffersMutex);
+    std::map<jint, InstanceBuffers>::iterator it = instanceBuffers.find(instance);
+    if (it == instanceBuffers.end())
+        return false;
+    *outSizes = it->second;
+    return true;
+}
+
+static void releaseDirectBuffers(JNIEnv *env, jint instance) {
+    std::lock_guard<std::mutex> lock(instanceBuffersMutex);
+    std::map<jint, InstanceBuffers>::iterator it = instanceBuffers.find(instance);
+    if (it == instanceBuffers.end())
+        return;
+    for (size_t i = 0; i < it->second.buffers.size(); i++)
+        env->DeleteGlobalRef(it->second.buffers[i].reference);
+    it->second.buffers.clear();
+}
+
 /*
  * Class:     beagle_BeagleJNIWrapper
  * Method:    getVersion
@@ -292,6 +351,13 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_createInstance
 
 		env->CallVoidMethod(outInstanceDetails, setResourceNumberMethodID, instanceDetails.resourceNumber);
 		env->CallVoidMethod(outInstanceDetails, setFlagsMethodID, instanceDetails.flags);
+
+		std::lock_guard<std::mutex> lock(instanceBuffersMutex);
+		InstanceBuffers& sizes = instanceBuffers[instance];
+		sizes.stateCount = stateCount;
+		sizes.patternCount = patternCount;
+		sizes.categoryCount = categoryCount;
+		sizes.buffers.clear();
 	}
 
 	return instance;
@@ -305,6 +371,11 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_createInstance
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_finalize
   (JNIEnv *env, jobject obj, jint instance)
 {
+    releaseDirectBuffers(env, instance);
+    {
+        std::lock_guard<std::mutex> lock(instanceBuffersMutex);
+        instanceBuffers.erase(instance);
+    }
 	jint errCode = (jint)beagleFinalizeInstance(instance);
     return errCode;
 }
@@ -329,11 +400,11 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setCPUThreadCount
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setPatternWeights
 (JNIEnv *env, jobject obj, jint instance, jdoubleArray inPatternWeights)
 {
-    jdouble *patternWeights = env->GetDoubleArrayElements(inPatternWeights, NULL);
+    jdouble *patternWeights = (jdouble *) env->GetPrimitiveArrayCritical(inPatternWeights, NULL);
 
 	jint errCode = (jint)beagleSetPatternWeights(instance, (double *)patternWeights);
 
-    env->ReleaseDoubleArrayElements(inPatternWeights, patternWeights, JNI_ABORT);
+    env->ReleasePrimitiveArrayCritical(inPatternWeights, patternWeights, JNI_ABORT);
     return errCode;
 }
 
@@ -362,11 +433,11 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setPatternPartitions
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setTipStates
 (JNIEnv *env, jobject obj, jint instance, jint tipIndex, jintArray inTipStates)
 {
-    jint *tipStates = env->GetIntArrayElements(inTipStates, NULL);
+    jint *tipStates = (jint *) env->GetPrimitiveArrayCritical(inTipStates, NULL);
 
 	jint errCode = (jint)beagleSetTipStates(instance, tipIndex, (int *)tipStates);
 
-    env->ReleaseIntArrayElements(inTipStates, tipStates, JNI_ABORT);
+    env->ReleasePrimitiveArrayCritical(inTipStates, tipStates, JNI_ABORT);
     return errCode;
 }
 
@@ -397,11 +468,11 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getTipStates
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setTipPartials
 (JNIEnv *env, jobject obj, jint instance, jint tipIndex, jdoubleArray inPartials)
 {
-    jdouble *partials = env->GetDoubleArrayElements(inPartials, NULL);
+    jdouble *partials = (jdouble *) env->GetPrimitiveArrayCritical(inPartials, NULL);
 
 	jint errCode = (jint)beagleSetTipPartials(instance, tipIndex, (double *)partials);
 
-    env->ReleaseDoubleArrayElements(inPartials, partials, JNI_ABORT);
+    env->ReleasePrimitiveArrayCritical(inPartials, partials, JNI_ABORT);
     return errCode;
 }
 
@@ -432,11 +503,11 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setRootPrePartials
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setPartials
   (JNIEnv *env, jobject obj, jint instance, jint bufferIndex, jdoubleArray inPartials)
 {
-    jdouble *partials = env->GetDoubleArrayElements(inPartials, NULL);
+    jdouble *partials = (jdouble *) env->GetPrimitiveArrayCritical(inPartials, NULL);
 
 	jint errCode = (jint)beagleSetPartials(instance, bufferIndex, (double *)partials);
 
-    env->ReleaseDoubleArrayElements(inPartials, partials, JNI_ABORT);
+    env->ReleasePrimitiveArrayCritical(inPartials, partials, JNI_ABORT);
     return errCode;
 }
 
@@ -448,12 +519,12 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setPartials
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getPartials
 (JNIEnv *env, jobject obj, jint instance, jint bufferIndex, jint scaleIndex, jdoubleArray outPartials)
 {
-    jdouble *partials = env->GetDoubleArrayElements(outPartials, NULL);
+    jdouble *partials = (jdouble *) env->GetPrimitiveArrayCritical(outPartials, NULL);
 
     jint errCode = beagleGetPartials(instance, bufferIndex, scaleIndex, (double *)partials);
 
     // not using JNI_ABORT flag here because we want the values to be copied back...
-    env->ReleaseDoubleArrayElements(outPartials, partials, 0);
+    env->ReleasePrimitiveArrayCritical(outPartials, partials, 0);
     return errCode;
 }
 
@@ -712,11 +783,11 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setCategoryRatesWithIndex
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setTransitionMatrix
   (JNIEnv *env, jobject obj, jint instance, jint matrixIndex, jdoubleArray inMatrix, jdouble paddedValue)
 {
-    jdouble *matrix = env->GetDoubleArrayElements(inMatrix, NULL);
+    jdouble *matrix = (jdouble *) env->GetPrimitiveArrayCritical(inMatrix, NULL);
 
 	jint errCode = (jint)beagleSetTransitionMatrix(instance, matrixIndex, (double *)matrix, paddedValue);
 
-    env->ReleaseDoubleArrayElements(inMatrix, matrix, JNI_ABORT);
+    env->ReleasePrimitiveArrayCritical(inMatrix, matrix, JNI_ABORT);
 
     return errCode;
 }
@@ -729,11 +800,11 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setTransitionMatrix
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setDifferentialMatrix
   (JNIEnv *env, jobject obj, jint instance, jint matrixIndex, jdoubleArray inMatrix)
 {
-    jdouble *matrix = env->GetDoubleArrayElements(inMatrix, NULL);
+    jdouble *matrix = (jdouble *) env->GetPrimitiveArrayCritical(inMatrix, NULL);
 
 	jint errCode = (jint)beagleSetDifferentialMatrix(instance, matrixIndex, (double *)matrix);
 
-    env->ReleaseDoubleArrayElements(inMatrix, matrix, JNI_ABORT);
+    env->ReleasePrimitiveArrayCritical(inMatrix, matrix, JNI_ABORT);
 
     return errCode;
 }
@@ -741,11 +812,11 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setDifferentialMatrix
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getTransitionMatrix
   (JNIEnv *env, jobject obj, jint instance, jint matrixIndex, jdoubleArray outMatrix)
 {
-	jdouble *matrix = env->GetDoubleArrayElements(outMatrix, NULL);
+	jdouble *matrix = (jdouble *) env->GetPrimitiveArrayCritical(outMatrix, NULL);
 
 	jint errCode = (jint)beagleGetTransitionMatrix(instance, matrixIndex, (double *)matrix);
 
-	env->ReleaseDoubleArrayElements(outMatrix, matrix, 0);
+	env->ReleasePrimitiveArrayCritical(outMatrix, matrix, 0);
 
 	return errCode;
 }
@@ -913,11 +984,13 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_updatePrePartialsByPartition
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_updatePartials
   (JNIEnv *env, jobject obj, jint instance, jintArray inOperations, jint operationCount, jint cumulativeScalingIndex)
 {
-    jint *operations = env->GetIntArrayElements(inOperations, NULL);
+    // operation lists are short: copy them into a per-thread buffer rather than
+    // pinning the array or having the JVM allocate a copy for the whole update
+    static thread_local std::vector<jint> operations;
+    operations.resize(operationCount * BEAGLE_OP_COUNT);
+    env->GetIntArrayRegion(inOperations, 0, operationCount * BEAGLE_OP_COUNT, operations.data());
 
-	jint errCode = (jint)beagleUpdatePartials(instance, (BeagleOperation*)operations, operationCount, cumulativeScalingIndex);
-
-    env->ReleaseIntArrayElements(inOperations, operations, JNI_ABORT);
+	jint errCode = (jint)beagleUpdatePartials(instance, (BeagleOperation*)operations.data(), operationCount, cumulativeScalingIndex);
 
     return errCode;
 }
@@ -930,11 +1003,11 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_updatePartials
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_updatePartialsByPartition
   (JNIEnv *env, jobject obj, jint instance, jintArray inOperations, jint operationCount)
 {
-    jint *operations = env->GetIntArrayElements(inOperations, NULL);
+    static thread_local std::vector<jint> operations;
+    operations.resize(operationCount * BEAGLE_PARTITION_OP_COUNT);
+    env->GetIntArrayRegion(inOperations, 0, operationCount * BEAGLE_PARTITION_OP_COUNT, operations.data());
 
-    jint errCode = (jint)beagleUpdatePartialsByPartition(instance, (BeagleOperationByPartition*)operations, operationCount);
-
-    env->ReleaseIntArrayElements(inOperations, operations, JNI_ABORT);
+    jint errCode = (jint)beagleUpdatePartialsByPartition(instance, (BeagleOperationByPartition*)operations.data(), operationCount);
 
     return errCode;
 }
@@ -1195,12 +1268,184 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_calculateEdgeLogLikelihoods
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getSiteLogLikelihoods
 (JNIEnv *env, jobject obj, jint instance, jdoubleArray outSiteLogLikelihoods) {
 
-	jdouble *siteLogLikelihoods = env->GetDoubleArrayElements(outSiteLogLikelihoods, NULL);
+	jdouble *siteLogLikelihoods = (jdouble *) env->GetPrimitiveArrayCritical(outSiteLogLikelihoods, NULL);
 
 	jint errCode = (jint)beagleGetSiteLogLikelihoods(instance, (double *)siteLogLikelihoods);
 
     // not using JNI_ABORT flag here because we want the values to be copied back...
-    env->ReleaseDoubleArrayElements(outSiteLogLikelihoods, siteLogLikelihoods, 0);
+    env->ReleasePrimitiveArrayCritical(outSiteLogLikelihoods, siteLogLikelihoods, 0);
+    return errCode;
+}
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    registerDirectBuffer
+ * Signature: (ILjava/nio/Buffer;I)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_registerDirectBuffer
+  (JNIEnv *env, jobject obj, jint instance, jobject buffer, jint elementSize)
+{
+    void* address = env->GetDirectBufferAddress(buffer);
+    jlong capacity = env->GetDirectBufferCapacity(buffer);
+    if (address == NULL || capacity < 0)
+        return BEAGLE_ERROR_GENERAL;
+
+    std::lock_guard<std::mutex> lock(instanceBuffersMutex);
+    std::map<jint, InstanceBuffers>::iterator it = instanceBuffers.find(instance);
+    if (it == instanceBuffers.end())
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+
+    DirectBuffer directBuffer;
+    directBuffer.reference = env->NewGlobalRef(buffer);
+    directBuffer.address = address;
+    directBuffer.capacity = capacity;
+    directBuffer.elementSize = elementSize;
+    it->second.buffers.push_back(directBuffer);
+    return (jint) it->second.buffers.size() - 1;
+}
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    unregisterDirectBuffers
+ * Signature: (I)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_unregisterDirectBuffers
+  (JNIEnv *env, jobject obj, jint instance)
+{
+    releaseDirectBuffers(env, instance);
+    return BEAGLE_SUCCESS;
+}
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    setTipStatesDirect
+ * Signature: (III)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setTipStatesDirect
+  (JNIEnv *env, jobject obj, jint instance, jint tipIndex, jint handle)
+{
+    InstanceSizes sizes;
+    if (!getInstanceSizes(instance, &sizes))
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int* states = (int*) getDirectBuffer(instance, handle, sizeof(jint), sizes.patternCount);
+    if (states == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    return (jint)beagleSetTipStates(instance, tipIndex, states);
+}
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    setTipPartialsDirect
+ * Signature: (III)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setTipPartialsDirect
+  (JNIEnv *env, jobject obj, jint instance, jint tipIndex, jint handle)
+{
+    InstanceSizes sizes;
+    if (!getInstanceSizes(instance, &sizes))
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    double* partials = (double*) getDirectBuffer(instance, handle, sizeof(jdouble),
+                                                 (jlong) sizes.stateCount * sizes.patternCount);
+    if (partials == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    return (jint)beagleSetTipPartials(instance, tipIndex, partials);
+}
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    setPartialsDirect
+ * Signature: (III)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setPartialsDirect
+  (JNIEnv *env, jobject obj, jint instance, jint bufferIndex, jint handle)
+{
+    InstanceSizes sizes;
+    if (!getInstanceSizes(instance, &sizes))
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    double* partials = (double*) getDirectBuffer(instance, handle, sizeof(jdouble),
+                                                 (jlong) sizes.stateCount * sizes.patternCount * sizes.categoryCount);
+    if (partials == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    return (jint)beagleSetPartials(instance, bufferIndex, partials);
+}
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    getPartialsDirect
+ * Signature: (IIII)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getPartialsDirect
+  (JNIEnv *env, jobject obj, jint instance, jint bufferIndex, jint scaleIndex, jint handle)
+{
+    InstanceSizes sizes;
+    if (!getInstanceSizes(instance, &sizes))
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    double* partials = (double*) getDirectBuffer(instance, handle, sizeof(jdouble),
+                                                 (jlong) sizes.stateCount * sizes.patternCount * sizes.categoryCount);
+    if (partials == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    return (jint)beagleGetPartials(instance, bufferIndex, scaleIndex, partials);
+}
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    updatePartialsDirect
+ * Signature: (IIII)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_updatePartialsDirect
+  (JNIEnv *env, jobject obj, jint instance, jint handle, jint operationCount, jint cumulativeScalingIndex)
+{
+    int* operations = (int*) getDirectBuffer(instance, handle, sizeof(jint),
+                                             (jlong) operationCount * BEAGLE_OP_COUNT);
+    if (operations == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    return (jint)beagleUpdatePartials(instance, (BeagleOperation*)operations, operationCount, cumulativeScalingIndex);
+}
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    getSiteLogLikelihoodsDirect
+ * Signature: (II)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getSiteLogLikelihoodsDirect
+  (JNIEnv *env, jobject obj, jint instance, jint handle)
+{
+    InstanceSizes sizes;
+    if (!getInstanceSizes(instance, &sizes))
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    double* siteLogLikelihoods = (double*) getDirectBuffer(instance, handle, sizeof(jdouble), sizes.patternCount);
+    if (siteLogLikelihoods == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    return (jint)beagleGetSiteLogLikelihoods(instance, siteLogLikelihoods);
+}
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    evaluate
+ * Signature: (I[II[DI[D)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_evaluate
+  (JNIEnv *env, jobject obj, jint instance, jintArray inCommands, jint commandLength,
+   jdoubleArray inValues, jint valueCount, jdoubleArray outResults)
+{
+    if (env->GetArrayLength(inCommands) < commandLength ||
+        (valueCount > 0 && (inValues == NULL || env->GetArrayLength(inValues) < valueCount)) ||
+        env->GetArrayLength(outResults) < 3)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    jint *commands = env->GetIntArrayElements(inCommands, NULL);
+    jdouble *values = (inValues != NULL ? env->GetDoubleArrayElements(inValues, NULL) : NULL);
+    jdouble *results = env->GetDoubleArrayElements(outResults, NULL);
+
+    jint errCode = (jint)beagleEvaluate(instance, (int *)commands, commandLength, (double *)values,
+                                        valueCount, (double *)&results[0], (double *)&results[1],
+                                        (double *)&results[2]);
+
+    env->ReleaseDoubleArrayElements(outResults, results, 0);
+    if (values != NULL)
+        env->ReleaseDoubleArrayElements(inValues, values, JNI_ABORT);
+    env->ReleaseIntArrayElements(inCommands, commands, JNI_ABORT);
+
     return errCode;
 }
 
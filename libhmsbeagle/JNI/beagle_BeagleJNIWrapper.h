@@ -383,6 +383,78 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_calculateCrossProductDiffere
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_calculateEdgeDerivative
   (JNIEnv *, jobject, jint, jintArray, jintArray, jint, jintArray, jintArray, jint, jint, jint, jintArray, jint, jdoubleArray, jdoubleArray);
 
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    registerDirectBuffer
+ * Signature: (ILjava/nio/Buffer;I)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_registerDirectBuffer
+  (JNIEnv *, jobject, jint, jobject, jint);
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    unregisterDirectBuffers
+ * Signature: (I)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_unregisterDirectBuffers
+  (JNIEnv *, jobject, jint);
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    setTipStatesDirect
+ * Signature: (III)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setTipStatesDirect
+  (JNIEnv *, jobject, jint, jint, jint);
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    setTipPartialsDirect
+ * Signature: (III)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setTipPartialsDirect
+  (JNIEnv *, jobject, jint, jint, jint);
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    setPartialsDirect
+ * Signature: (III)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setPartialsDirect
+  (JNIEnv *, jobject, jint, jint, jint);
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    getPartialsDirect
+ * Signature: (IIII)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getPartialsDirect
+  (JNIEnv *, jobject, jint, jint, jint, jint);
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    updatePartialsDirect
+ * Signature: (IIII)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_updatePartialsDirect
+  (JNIEnv *, jobject, jint, jint, jint, jint);
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    getSiteLogLikelihoodsDirect
+ * Signature: (II)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getSiteLogLikelihoodsDirect
+  (JNIEnv *, jobject, jint, jint);
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    evaluate
+ * Signature: (I[II[DI[D)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_evaluate
+  (JNIEnv *, jobject, jint, jintArray, jint, jdoubleArray, jint, jdoubleArray);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,162 @@
+/*
+ *  RateMatrixCache.cpp
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+#include "libhmsbeagle/RateMatrixCache.h"
+#include "libhmsbeagle/benchmark/linalg.h"
+
+namespace beagle {
+
+RateMatrixCache::RateMatrixCache(int stateCount,
+                                 int eigenBufferCount,
+                                 long flags) {
+    kStateCount = stateCount;
+    kFlags = flags;
+    nextId = 0;
+    currentIds.assign(eigenBufferCount, -1);
+}
+
+void RateMatrixCache::invalidate(int eigenIndex) {
+    if (eigenIndex >= 0 && eigenIndex < (int) currentIds.size())
+        currentIds[eigenIndex] = -1;
+}
+
+void RateMatrixCache::invalidateAll() {
+    std::fill(currentIds.begin(), currentIds.end(), -1L);
+}
+
+int RateMatrixCache::setRateMatrix(BeagleImpl* impl,
+                                   int eigenIndex,
+                                   const double* inRateMatrix,
+                                   const double* inStateFrequencies) {
+    if (eigenIndex < 0 || eigenIndex >= (int) currentIds.size())
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    const int matrixSize = kStateCount * kStateCount;
+
+    // FNV-1a over the bytes of Q
+    unsigned long long hash = 14695981039346656037ULL;
+    const unsigned char* bytes = (const unsigned char*) inRateMatrix;
+    for (size_t i = 0; i < sizeof(double) * matrixSize; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    std::list<Entry>::iterator it = entries.begin();
+    for (; it != entries.end(); ++it) {
+        if (it->hash == hash &&
+            memcmp(&it->rateMatrix[0], inRateMatrix, sizeof(double) * matrixSize) == 0)
+            break;
+    }
+
+    if (it != entries.end()) {
+        entries.splice(entries.begin(), entries, it);
+    } else {
+        Entry entry;
+        entry.hash = hash;
+        entry.rateMatrix.assign(inRateMatrix, inRateMatrix + matrixSize);
+        int returnCode = decompose(inRateMatrix, entry);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+        entry.id = nextId++;
+        entries.push_front(entry);
+        if (entries.size() > BEAGLE_RATE_MATRIX_CACHE_SIZE)
+            entries.pop_back();
+    }
+
+    Entry& entry = entries.front();
+
+    if (currentIds[eigenIndex] != entry.id) {
+        int returnCode = impl->setEigenDecomposition(eigenIndex,
+                                                     &entry.eigenVectors[0],
+                                                     &entry.inverseEigenVectors[0],
+                                                     &entry.eigenValues[0]);
+        if (returnCode != BEAGLE_SUCCESS) {
+            currentIds[eigenIndex] = -1;
+            return returnCode;
+        }
+        currentIds[eigenIndex] = entry.id;
+    }
+
+    if (inStateFrequencies != NULL)
+        return impl->setStateFrequencies(eigenIndex, inStateFrequencies);
+
+    return BEAGLE_SUCCESS;
+}
+
+int RateMatrixCache::decompose(const double* inRateMatrix,
+                               Entry& entry) {
+    const int n = kStateCount;
+    const bool isComplex = (kFlags & BEAGLE_FLAG_EIGEN_COMPLEX) != 0;
+
+    double** qmat = New2DArray<double>(n, n);
+    double** eigvecs = New2DArray<double>(n, n);
+    double** teigvecs = New2DArray<double>(n, n);
+    double** inveigvecs = New2DArray<double>(n, n);
+    double* eigvalsimag = new double[n];
+    int* iwork = new int[n];
+    double* work = new double[n];
+
+    entry.eigenValues.assign(isComplex ? 2 * n : n, 0.0);
+
+    memcpy(*qmat, inRateMatrix, sizeof(double) * n * n);
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    int rc = EigenRealGeneral(n, qmat, &entry.eigenValues[0], eigvalsimag, eigvecs, iwork, work);
+    if (rc == RC_COMPLEX_EVAL && isComplex)
+        rc = 0;
+    if (rc != 0)
+        returnCode = BEAGLE_ERROR_GENERAL;
+
+    if (returnCode == BEAGLE_SUCCESS) {
+        memcpy(*teigvecs, *eigvecs, sizeof(double) * n * n);
+        if (InvertMatrix(teigvecs, n, work, iwork, inveigvecs) != 0)
+            returnCode = BEAGLE_ERROR_FLOATING_POINT;
+    }
+
+    if (returnCode == BEAGLE_SUCCESS) {
+        if (isComplex)
+            memcpy(&entry.eigenValues[n], eigvalsimag, sizeof(double) * n);
+
+        entry.eigenVectors.assign(*eigvecs, *eigvecs + n * n);
+        entry.inverseEigenVectors.resize(n * n);
+        const bool transposed = (kFlags & BEAGLE_FLAG_INVEVEC_TRANSPOSED) != 0;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                if (transposed)
+                    entry.inverseEigenVectors[j * n + i] = inveigvecs[i][j];
+                else
+                    entry.inverseEigenVectors[i * n + j] = inveigvecs[i][j];
+            }
+        }
+    }
+
+    Delete2DArray(qmat);
+    Delete2DArray(eigvecs);
+    Delete2DArray(teigvecs);
+    Delete2DArray(inveigvecs);
+    delete[] eigvalsimag;
+    delete[] iwork;
+    delete[] work;
+
+    return returnCode;
+}
+
+}   // end namespace beagle
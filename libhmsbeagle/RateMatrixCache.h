@@ -0,0 +1,70 @@
+/*
+ *  RateMatrixCache.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#ifndef __beagle_rate_matrix_cache__
+#define __beagle_rate_matrix_cache__
+
+#include <list>
+#include <vector>
+
+#include "libhmsbeagle/BeagleImpl.h"
+
+#define BEAGLE_RATE_MATRIX_CACHE_SIZE   8   // decompositions kept per instance
+
+namespace beagle {
+
+/*
+ * Eigen-decomposes infinitesimal rate matrices for beagleSetRateMatrix and keeps the most
+ * recently used decompositions, keyed by a hash of Q, so that repeated or reverted models
+ * skip the decomposition. An eigen buffer that already holds the requested Q is not
+ * re-uploaded at all.
+ */
+class RateMatrixCache {
+public:
+    RateMatrixCache(int stateCount,
+                    int eigenBufferCount,
+                    long flags);
+
+    int setRateMatrix(BeagleImpl* impl,
+                      int eigenIndex,
+                      const double* inRateMatrix,
+                      const double* inStateFrequencies);
+
+    // called when an eigen buffer is set by other means
+    void invalidate(int eigenIndex);
+
+    void invalidateAll();
+
+private:
+    struct Entry {
+        unsigned long long hash;
+        long id;
+        std::vector<double> rateMatrix;
+        std::vector<double> eigenVectors;
+        std::vector<double> inverseEigenVectors;
+        std::vector<double> eigenValues;
+    };
+
+    int decompose(const double* inRateMatrix,
+                  Entry& entry);
+
+    int kStateCount;
+    long kFlags;
+    long nextId;
+    std::list<Entry> entries;       // most recently used first
+    std::vector<long> currentIds;   // entry held by each eigen buffer, -1 if unknown
+};
+
+}   // end namespace beagle
+
+#endif // __beagle_rate_matrix_cache__
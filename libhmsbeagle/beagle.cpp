@@ -30,15 +30,18 @@
 #include <exception>    // for exception, bad_exception
 #include <stdexcept>    // for std exception hierarchy
 #include <list>
+#include <string>
 #include <utility>
 #include <vector>
 #include <iostream>
 
 #include "libhmsbeagle/beagle.h"
 #include "libhmsbeagle/BeagleImpl.h"
+#include "libhmsbeagle/RateMatrixCache.h"
 #include "libhmsbeagle/benchmark/BeagleBenchmark.h"
 
 #include "libhmsbeagle/plugin/Plugin.h"
+#include "libhmsbeagle/plugin/PluginManifest.h"
 #include "beagle.h"
 
 #define BEAGLE_VERSION  PACKAGE_VERSION  " (PRE-RELEASE)"
@@ -85,6 +88,9 @@ int debugPatternCount;
 //@CHANGED make this a std::vector<BeagleImpl *> and use at to reference.
 std::vector<beagle::BeagleImpl*> *instances = NULL;
 
+// per-instance decomposition caches for beagleSetRateMatrix, indexed as instances
+std::vector<beagle::RateMatrixCache*> *rateMatrixCaches = NULL;
+
 /// returns an initialized instance or NULL if the index refers to an invalid instance
 namespace beagle {
 BeagleImpl* getBeagleInstance(int instanceIndex);
@@ -123,85 +129,121 @@ std::map<int, int> ResourceMap;
 int loaded = 0; // Indicates is the initial library constructors have been run
                 // This patches a bug with JVM under Linux that calls the finalizer twice
 
+/** The plugins searched for implementations, in trial order; plugins whose devices come from a
+ *  driver are enumerated on every start rather than described from the manifest */
+const struct {
+    const char* name;
+    bool cached;
+} beaglePlugins[] = {
+    { "hmsbeagle-cpu-sse",       true },
+    { "hmsbeagle-cpu",           true },
+    { "hmsbeagle-cuda",          false },
+    { "hmsbeagle-opencl",        false },
+    { "hmsbeagle-opencl-altera", false },
+    { "hmsbeagle-cpu-avx",       true },
+    { "hmsbeagle-cpu-openmp",    true }
+};
+
+/** Plugins selected by beagleSelectPlugins, overriding BEAGLE_PLUGINS */
+std::string* pluginSelection = NULL;
+
 /** The list of plugins that provide implementations of likelihood calculators */
-std::list<beagle::plugin::Plugin*>* plugins;
+std::list<beagle::plugin::PluginDescription>* plugins;
+
+/** True if a plugin is named in a comma or space separated selection, with or without its
+ *  "hmsbeagle-" prefix; an empty selection selects every plugin */
+bool isPluginSelected(const char* pluginName, const char* selection) {
+    if (selection == NULL || selection[0] == '\0')
+        return true;
+    const char* shortName = pluginName + strlen("hmsbeagle-");
+    std::string s(selection);
+    size_t start = 0;
+    while (start < s.size()) {
+        size_t end = s.find_first_of(", ", start);
+        if (end == std::string::npos)
+            end = s.size();
+        std::string token = s.substr(start, end - start);
+        if (token == pluginName || token == shortName)
+            return true;
+        start = end + 1;
+    }
+    return false;
+}
 
+/*
+ * Plugins with a current entry in the manifest are described from it and only loaded when one
+ * of their factories is chosen by beagleCreateInstance; the others are loaded now and, if they
+ * may be cached, their descriptions written back to the manifest.
+ */
 void beagleLoadPlugins(void) {
     if(plugins==NULL){
-        plugins = new std::list<beagle::plugin::Plugin*>();
+        plugins = new std::list<beagle::plugin::PluginDescription>();
     }
 
     beagle::plugin::PluginManager& pm = beagle::plugin::PluginManager::instance();
+    beagle::plugin::PluginManifest manifest;
 
-    try{
-#ifdef BEAGLE_DEBUG_LOAD
-        std::cerr << "Loading hmsbeagle-cpu-sse" << std::endl;
-#endif
-        beagle::plugin::Plugin* sseplug = pm.findPlugin("hmsbeagle-cpu-sse");
-        plugins->push_back(sseplug);
-    }catch(beagle::plugin::SharedLibraryException sle){
-#ifdef BEAGLE_DEBUG_LOAD
-        std::cerr << "Unable to load hmsbeagle-cpu-sse: " << sle.getError() << std::endl;
-#endif
-    }
+    const char* selection = (pluginSelection != NULL ? pluginSelection->c_str() : getenv("BEAGLE_PLUGINS"));
+    std::vector<beagle::plugin::PluginDescription*> unavailable;
 
-    try{
-        beagle::plugin::Plugin* cpuplug = pm.findPlugin("hmsbeagle-cpu");
-        plugins->push_back(cpuplug);
-    }catch(beagle::plugin::SharedLibraryException sle){
-        // this one should always work
-        std::cerr << "Unable to load CPU plugin!\n";
-        std::cerr << "Please check for proper libhmsbeagle installation.\n";
-    }
+    for (size_t i = 0; i < sizeof(beaglePlugins) / sizeof(beaglePlugins[0]); i++) {
+        const char* name = beaglePlugins[i].name;
+        const bool mayCache = beaglePlugins[i].cached;
+        if (!isPluginSelected(name, selection))
+            continue;
 
-    try{
-#ifdef BEAGLE_DEBUG_LOAD
-        std::cerr << "Loading hmsbeagle-cuda" << std::endl;
-#endif
-        beagle::plugin::Plugin* cudaplug = pm.findPlugin("hmsbeagle-cuda");
-        plugins->push_back(cudaplug);
-    }catch(beagle::plugin::SharedLibraryException sle) {
-#ifdef BEAGLE_DEBUG_LOAD
-        std::cerr << "Unable to load hmsbeagle-cuda: " << sle.getError() << std::endl;
-#endif
-    }
+        const beagle::plugin::PluginDescription* cached = (mayCache ? manifest.find(name) : NULL);
+        if (cached != NULL) {
+            plugins->push_back(*cached);
+            continue;
+        }
 
-    try{
+        try{
 #ifdef BEAGLE_DEBUG_LOAD
-        std::cerr << "Loading hmsbeagle-opencl" << std::endl;
+            std::cerr << "Loading " << name << std::endl;
 #endif
-        beagle::plugin::Plugin* openclplug = pm.findPlugin("hmsbeagle-opencl");
-        plugins->push_back(openclplug);
-    }catch(beagle::plugin::SharedLibraryException sle) {
+            beagle::plugin::Plugin* plugin = pm.findPlugin(name);
+            plugins->push_back(beagle::plugin::describePlugin(name, plugin));
+        }catch(beagle::plugin::SharedLibraryException sle){
 #ifdef BEAGLE_DEBUG_LOAD
-        std::cerr << "Unable to load hmsbeagle-opencl: " << sle.getError() << std::endl;
+            std::cerr << "Unable to load " << name << ": " << sle.getError() << std::endl;
 #endif
+            if (strcmp(name, "hmsbeagle-cpu") == 0) {
+                // this one should always work
+                std::cerr << "Unable to load CPU plugin!\n";
+                std::cerr << "Please check for proper libhmsbeagle installation.\n";
+            }
+            plugins->push_back(beagle::plugin::PluginDescription(name));
+            if (mayCache)
+                unavailable.push_back(&plugins->back());
+            continue;
+        }
+        if (mayCache)
+            manifest.update(plugins->back());
     }
 
-    try{
-        beagle::plugin::Plugin* openclalteraplug = pm.findPlugin("hmsbeagle-opencl-altera");
-        plugins->push_back(openclalteraplug);
-    }catch(beagle::plugin::SharedLibraryException sle){}
-
-    try{
-        beagle::plugin::Plugin* avxplug = pm.findPlugin("hmsbeagle-cpu-avx");
-        plugins->push_back(avxplug);
-    }catch(beagle::plugin::SharedLibraryException sle){}
+    // plugins that failed to load are recorded once the others' directories are known, and
+    // only if their library is missing there
+    for (size_t i = 0; i < unavailable.size(); i++) {
+        if (beagle::plugin::locateUnavailablePlugin(unavailable[i], *plugins))
+            manifest.update(*unavailable[i]);
+    }
 
-    try{
-        beagle::plugin::Plugin* openmpplug = pm.findPlugin("hmsbeagle-cpu-openmp");
-        plugins->push_back(openmpplug);
-    }catch(beagle::plugin::SharedLibraryException sle){}
+    manifest.write();
 }
 
 std::list<beagle::BeagleImplFactory*>* beagleGetFactoryList(void) {
     if (implFactory == NULL) {
         implFactory = new std::list<beagle::BeagleImplFactory*>;
         // Set-up a list of implementation factories in trial-order
-        std::list<beagle::plugin::Plugin*>::iterator plugin_iter = plugins->begin();
+        std::list<beagle::plugin::PluginDescription>::iterator plugin_iter = plugins->begin();
         for(; plugin_iter != plugins->end(); plugin_iter++ ){
-            std::list<beagle::BeagleImplFactory*> factories = (*plugin_iter)->getBeagleFactories();
-            implFactory->insert(implFactory->end(), factories.begin(), factories.end());
+            std::list<beagle::plugin::PluginDescription::Factory>::iterator f_iter = plugin_iter->factories.begin();
+            for(; f_iter != plugin_iter->factories.end(); f_iter++)
+                implFactory->push_back(new beagle::plugin::LazyPluginFactory(plugin_iter->pluginName,
+                                                                            plugin_iter->libraryPath,
+                                                                            f_iter->name,
+                                                                            f_iter->flags));
         }
     }
     return implFactory;
@@ -227,9 +269,12 @@ void beagle_library_finalize(void) {
         delete plugins;
     }
     // Destroy implFactory.
-    // The contained factory pointers will be deleted by the plugins themselves
+    // The factories of the plugins themselves will be deleted by the plugins
     if (implFactory && loaded) {
         try {
+        for (std::list<beagle::BeagleImplFactory*>::iterator it = implFactory->begin();
+             it != implFactory->end(); ++it)
+            delete *it;
         delete implFactory;
         } catch (...) {
 
@@ -253,6 +298,12 @@ void beagle_library_finalize(void) {
     if (instances && loaded) {
         delete instances;
     }
+
+    if (rateMatrixCaches && loaded) {
+        for (size_t i = 0; i < rateMatrixCaches->size(); i++)
+            delete (*rateMatrixCaches)[i];
+        delete rateMatrixCaches;
+    }
     loaded = 0;
 }
 
@@ -293,6 +344,16 @@ const char* beagleGetCitation() {
     return BEAGLE_CITATION;
 }
 
+int beagleSelectPlugins(const char* pluginNames) {
+    if (plugins != NULL)
+        return BEAGLE_ERROR_GENERAL;
+
+    delete pluginSelection;
+    pluginSelection = (pluginNames != NULL ? new std::string(pluginNames) : NULL);
+
+    return BEAGLE_SUCCESS;
+}
+
 BeagleResourceList* beagleGetResourceList() {
     // plugins must be loaded before resources
     if (plugins==NULL)
@@ -302,9 +363,9 @@ BeagleResourceList* beagleGetResourceList() {
         // count the total resources across plugins
         rsrcList = (BeagleResourceList*) malloc(sizeof(BeagleResourceList));
         rsrcList->length = 0;
-        std::list<beagle::plugin::Plugin*>::iterator plugin_iter = plugins->begin();
+        std::list<beagle::plugin::PluginDescription>::iterator plugin_iter = plugins->begin();
         for(; plugin_iter != plugins->end(); plugin_iter++ ){
-            rsrcList->length += (*plugin_iter)->getBeagleResources().size();
+            rsrcList->length += plugin_iter->resources.size();
         }
 
         // allocate space for a complete list of resources
@@ -313,13 +374,13 @@ BeagleResourceList* beagleGetResourceList() {
         // copy in resource lists from each plugin
         int rI=0;
         for(plugin_iter = plugins->begin(); plugin_iter != plugins->end(); plugin_iter++ ){
-            std::list<BeagleResource> rList = (*plugin_iter)->getBeagleResources();
-            std::list<BeagleResource>::iterator r_iter = rList.begin();
+            std::list<beagle::plugin::PluginDescription::Resource>& rList = plugin_iter->resources;
+            std::list<beagle::plugin::PluginDescription::Resource>::iterator r_iter = rList.begin();
             int prev_rI = rI;
             for(; r_iter != rList.end(); r_iter++){
                 bool rsrcExists = false;
                 for(int i=0; i<prev_rI; i++){
-                    if (strcmp(rsrcList->list[i].name, r_iter->name) == 0) {
+                    if (strcmp(rsrcList->list[i].name, r_iter->name.c_str()) == 0) {
                         if (!rsrcExists) {
                             rsrcExists = true;
                             rsrcList->length--;
@@ -330,7 +391,11 @@ BeagleResourceList* beagleGetResourceList() {
 
                 if (!rsrcExists) {
                     ResourceMap.insert(std::pair<int, int>(rI, (rI - prev_rI)));
-                    rsrcList->list[rI++] = *r_iter;
+                    BeagleResource& resource = rsrcList->list[rI++];
+                    resource.name = (char*) r_iter->name.c_str();
+                    resource.description = (char*) r_iter->description.c_str();
+                    resource.supportFlags = r_iter->supportFlags;
+                    resource.requiredFlags = r_iter->requiredFlags;
                 }
             }
         }
@@ -648,6 +713,9 @@ int beagleCreateInstance(int tipCount,
         if (instances == NULL)
             instances = new std::vector<beagle::BeagleImpl*>;
 
+        if (rateMatrixCaches == NULL)
+            rateMatrixCaches = new std::vector<beagle::RateMatrixCache*>;
+
         if (rsrcList == NULL)
             beagleGetResourceList();
 
@@ -714,7 +782,15 @@ int beagleCreateInstance(int tipCount,
             int instance = instances->size();
             instances->push_back(bestBeagle);
 
+            BeagleInstanceDetails instanceDetails;
+            bestBeagle->getInstanceDetails(&instanceDetails);
+            rateMatrixCaches->resize(instances->size(), NULL);
+            (*rateMatrixCaches)[instance] = new beagle::RateMatrixCache(stateCount,
+                                                                        eigenBufferCount,
+                                                                        instanceDetails.flags);
+
             int returnValue = bestBeagle->getInstanceDetails(returnInfo);
+
             if (returnValue == BEAGLE_SUCCESS) {
                 returnInfo->resourceName = rsrcList->list[returnInfo->resourceNumber].name;
                 // TODO: move implDescription to inside the implementation
@@ -749,6 +825,8 @@ int beagleFinalizeInstance(int instance) {
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         delete beagleInstance;
         (*instances)[instance] = NULL;
+        delete (*rateMatrixCaches)[instance];
+        (*rateMatrixCaches)[instance] = NULL;
         return BEAGLE_SUCCESS;
     }
     catch (std::bad_alloc &) {
@@ -773,6 +851,17 @@ int beagleSetCPUThreadCount(int instance,
     return returnValue;
 }
 
+int beagleSetPartialsLayout(int instance,
+                            int layout) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->setPartialsLayout(layout);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
 int beagleSetTipStates(int instance,
                  int tipIndex,
                  const int* inStates) {
@@ -899,6 +988,7 @@ int beagleSetEigenDecomposition(int instance,
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        (*rateMatrixCaches)[instance]->invalidate(eigenIndex);
         int returnValue = beagleInstance->setEigenDecomposition(eigenIndex, inEigenVectors,
                                                      inInverseEigenVectors, inEigenValues);
         DEBUG_END_TIME();
@@ -915,6 +1005,55 @@ int beagleSetEigenDecomposition(int instance,
     }
 }
 
+int beagleSetRateMatrix(int instance,
+                        int eigenIndex,
+                        const double* inRateMatrix,
+                        const double* inStateFrequencies) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = (*rateMatrixCaches)[instance]->setRateMatrix(beagleInstance, eigenIndex,
+                                                                       inRateMatrix, inStateFrequencies);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetUniformizationRateMatrix(int instance,
+                                      int eigenIndex,
+                                      const double* inRateMatrix) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        (*rateMatrixCaches)[instance]->invalidate(eigenIndex);
+        int returnValue = beagleInstance->setUniformizationRateMatrix(eigenIndex, inRateMatrix);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
 int beagleSetStateFrequencies(int instance,
                               int stateFrequenciesIndex,
                               const double* inStateFrequencies) {
@@ -1088,6 +1227,39 @@ int beagleConvolveTransitionMatrices(int instance,
     }
 }
 
+int beagleUpdateEpochTransitionMatrices(int instance,
+                                        const int* segmentCounts,
+                                        const int* eigenIndices,
+                                        const int* categoryRateIndices,
+                                        const double* segmentLengths,
+                                        const int* probabilityIndices,
+                                        const int* firstDerivativeIndices,
+                                        const int* secondDerivativeIndices,
+                                        int count) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->updateEpochTransitionMatrices(segmentCounts, eigenIndices,
+                                                                        categoryRateIndices, segmentLengths,
+                                                                        probabilityIndices,
+                                                                        firstDerivativeIndices,
+                                                                        secondDerivativeIndices, count);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
 int beagleAddTransitionMatrices(int instance,
                                 const int* firstIndices,
                                 const int* secondIndices,
@@ -1153,6 +1325,39 @@ int beagleUpdateTransitionMatrices(int instance,
 //    }
 }
 
+int beagleSetTransitionMatrixMemo(int instance,
+                                  int enabled) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setTransitionMatrixMemo(enabled != 0);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleGetTransitionMatrixMemoCounts(int instance,
+                                        long* outHitCount,
+                                        long* outMissCount) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    if (outHitCount == NULL || outMissCount == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    int returnValue = beagleInstance->getTransitionMatrixMemoCounts(outHitCount, outMissCount);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
 int beagleUpdateTransitionMatricesWithModelCategories(int instance,
                              int* eigenIndices,
                              const int* probabilityIndices,
@@ -1702,6 +1907,39 @@ int beagleCalculateEdgeLogLikelihoodsByPartition(int instance,
 //    }
 }
 
+int beagleCalculateEdgeLogLikelihoodsPerEdge(int instance,
+                                             const int* parentBufferIndices,
+                                             const int* childBufferIndices,
+                                             const int* probabilityIndices,
+                                             const int* firstDerivativeIndices,
+                                             const int* secondDerivativeIndices,
+                                             const int* categoryWeightsIndices,
+                                             const int* stateFrequenciesIndices,
+                                             const int* cumulativeScaleIndices,
+                                             int count,
+                                             double* outLogLikelihoods,
+                                             double* outFirstDerivatives,
+                                             double* outSecondDerivatives) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->calculateEdgeLogLikelihoodsPerEdge(parentBufferIndices,
+                                                                         childBufferIndices,
+                                                                         probabilityIndices,
+                                                                         firstDerivativeIndices,
+                                                                         secondDerivativeIndices,
+                                                                         categoryWeightsIndices,
+                                                                         stateFrequenciesIndices,
+                                                                         cumulativeScaleIndices,
+                                                                         count,
+                                                                         outLogLikelihoods,
+                                                                         outFirstDerivatives,
+                                                                         outSecondDerivatives);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
 int beagleGetLogLikelihood(int instance,
                             double* outSumLogLikelihood) {
     DEBUG_START_TIME();
@@ -1791,6 +2029,70 @@ int beagleGetSiteDerivatives(int instance,
     return returnValue;
 }
 
+int beagleEvaluate(int instance,
+                   const int* commands,
+                   int commandLength,
+                   const double* values,
+                   int valueCount,
+                   double* outSumLogLikelihood,
+                   double* outSumFirstDerivative,
+                   double* outSumSecondDerivative) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->evaluate(commands, commandLength, values, valueCount,
+                                               outSumLogLikelihood, outSumFirstDerivative,
+                                               outSumSecondDerivative);
+    DEBUG_END_TIME();
+
+    return returnValue;
+}
+
+int beagleSaveInstanceState(int instance,
+                            const char* fileName) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        if (fileName == NULL)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        int returnValue = beagleInstance->saveState(fileName);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleRestoreInstanceState(int instance,
+                               const char* fileName) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        if (fileName == NULL)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        // the restored eigen buffers no longer hold what the cache last set
+        (*rateMatrixCaches)[instance]->invalidateAll();
+        int returnValue = beagleInstance->restoreState(fileName);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
 int beagleCalculateEdgeDerivatives(int instance,
                                    const int *postBufferIndices,
                                    const int *preBufferIndices,
@@ -1853,6 +2155,84 @@ int beagleCalculateCrossProductDerivative(int instance,
     return returnValue;
 }
 
+int beagleCalculateEdgeGradients(int instance,
+                                 const BeagleOperation* postorderOperations,
+                                 int postorderCount,
+                                 const BeagleOperation* preorderOperations,
+                                 int preorderCount,
+                                 const int* postBufferIndices,
+                                 const int* preBufferIndices,
+                                 const int* differentialMatrixIndices,
+                                 const int* secondDifferentialMatrixIndices,
+                                 const int* categoryWeightsIndices,
+                                 const int* categoryRatesIndices,
+                                 int count,
+                                 double* outGradient,
+                                 double* outDiagonalHessian) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->calculateEdgeGradients((const int*) postorderOperations,
+                                                                 postorderCount,
+                                                                 (const int*) preorderOperations,
+                                                                 preorderCount,
+                                                                 postBufferIndices, preBufferIndices,
+                                                                 differentialMatrixIndices,
+                                                                 secondDifferentialMatrixIndices,
+                                                                 categoryWeightsIndices,
+                                                                 categoryRatesIndices, count,
+                                                                 outGradient, outDiagonalHessian);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleCalculateParameterGradients(int instance,
+                                      const int* postBufferIndices,
+                                      const int* preBufferIndices,
+                                      const int* categoryRatesIndices,
+                                      const int* categoryWeightsIndices,
+                                      const double* edgeLengths,
+                                      int count,
+                                      const int* differentialMatrixIndices,
+                                      int parameterCount,
+                                      double* outGradients) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->calculateParameterGradients(postBufferIndices, preBufferIndices,
+                                                                      categoryRatesIndices,
+                                                                      categoryWeightsIndices,
+                                                                      edgeLengths, count,
+                                                                      differentialMatrixIndices,
+                                                                      parameterCount, outGradients);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
 int beagleCalculateEdgeDerivative(int instance, const int *postBufferIndices, const int *preBufferIndices,
                                   const int rootBufferIndex,
                                   const int *firstDerivativeIndices, const int *secondDerivativeIndices,
@@ -128,6 +128,10 @@ enum BeagleReturnCodes {
  *
  * This enumerates all possible hardware and implementation capability flags.
  * Each capability is a bit in a 'long'
+ *
+ * Requiring both BEAGLE_FLAG_PRECISION_SINGLE and BEAGLE_FLAG_PRECISION_DOUBLE selects
+ * a mixed-precision implementation where available: partials are held in single
+ * precision while scale factors and likelihood integration use double precision.
  */
 enum BeagleFlags {
     BEAGLE_FLAG_PRECISION_SINGLE    = 1 << 0,    /**< Single precision computation */
@@ -204,6 +208,43 @@ enum BeagleOpCodes {
     BEAGLE_OP_NONE               = -1 /**< Specify no use for indexed buffer */
 };
 
+/**
+ * @anchor BEAGLE_PARTIALS_LAYOUTS
+ *
+ * @brief Memory layouts of partials buffers
+ *
+ * This enumerates the partials buffer layouts selectable with beagleSetPartialsLayout.
+ */
+enum BeaglePartialsLayouts {
+    BEAGLE_PARTIALS_LAYOUT_CATEGORY_MAJOR = 0, /**< [category][pattern][state], the default */
+    BEAGLE_PARTIALS_LAYOUT_PATTERN_MAJOR  = 1  /**< [pattern][category][state], keeps all rate categories of a pattern adjacent */
+};
+
+/**
+ * @anchor BEAGLE_COMMAND_CODES
+ *
+ * @brief Command codes for beagleEvaluate
+ *
+ * Each command in a beagleEvaluate command stream is its code followed by the integers listed
+ * here. A derivativeOrder of 0, 1 or 2 selects how many of the probability, first and second
+ * derivative index lists follow.
+ */
+enum BeagleCommandCodes {
+    BEAGLE_COMMAND_UPDATE_TRANSITION_MATRICES = 1, /**< eigenIndex, count, derivativeOrder, probabilityIndices[count],
+                                                    *   [firstDerivativeIndices[count]], [secondDerivativeIndices[count]];
+                                                    *   takes count edge lengths from the values stream */
+    BEAGLE_COMMAND_UPDATE_PARTIALS            = 2, /**< count, cumulativeScaleIndex, count * BEAGLE_OP_COUNT operation integers */
+    BEAGLE_COMMAND_RESET_SCALE_FACTORS        = 3, /**< cumulativeScaleIndex */
+    BEAGLE_COMMAND_ACCUMULATE_SCALE_FACTORS   = 4, /**< count, cumulativeScaleIndex, scaleIndices[count] */
+    BEAGLE_COMMAND_ROOT_LOG_LIKELIHOODS       = 5, /**< count, bufferIndices[count], categoryWeightsIndices[count],
+                                                    *   stateFrequenciesIndices[count], cumulativeScaleIndices[count] */
+    BEAGLE_COMMAND_EDGE_LOG_LIKELIHOODS       = 6  /**< count, derivativeOrder, parentBufferIndices[count],
+                                                    *   childBufferIndices[count], probabilityIndices[count],
+                                                    *   [firstDerivativeIndices[count]], [secondDerivativeIndices[count]],
+                                                    *   categoryWeightsIndices[count], stateFrequenciesIndices[count],
+                                                    *   cumulativeScaleIndices[count] */
+};
+
 /**
  * @brief Information about a specific instance
  */
@@ -299,6 +340,25 @@ BEAGLE_DLLEXPORT const char* beagleGetCitation(void);
  */
 BEAGLE_DLLEXPORT BeagleResourceList* beagleGetResourceList(void);
 
+/**
+ * @brief Restrict the plugins the library loads
+ *
+ * This function selects which plugins are searched for resources and implementations, for
+ * example "cpu,cpu-sse" to skip probing GPU runtimes. It overrides the BEAGLE_PLUGINS
+ * environment variable, which takes the same form, and must be called before the first
+ * beagleGetResourceList or beagleCreateInstance call.
+ *
+ * If BEAGLE_PLUGIN_MANIFEST names a file, or is "default" for one cached per host, CPU plugins
+ * are described from that manifest and only loaded and initialised once one of their
+ * implementations is chosen for an instance. GPU plugins are always loaded.
+ *
+ * @param pluginNames   Comma or space separated plugin names, with or without the
+ *                       "hmsbeagle-" prefix; NULL or an empty string selects all plugins (input)
+ *
+ * @return error code; BEAGLE_ERROR_GENERAL if plugins have already been loaded
+ */
+BEAGLE_DLLEXPORT int beagleSelectPlugins(const char* pluginNames);
+
 /**
  * @brief Get a benchmarked list of hardware resources for the given
  * analysis parameters
@@ -421,6 +481,13 @@ BEAGLE_DLLEXPORT int beagleFinalize(void);
  * If BEAGLE_FLAG_THREADING_CPP is set and this function is not called BEAGLE will use
  * a heuristic to set an appropriate number of threads.
  *
+ * With BEAGLE_FLAG_THREADING_OPENMP (available when the CPU plugins are built with OpenMP)
+ * patterns are split into contiguous blocks, one per thread, and each likelihood call runs
+ * in a single OpenMP parallel region. If this function is not called the OpenMP default
+ * thread count (e.g., OMP_NUM_THREADS) is used. Lowering the thread count until there are
+ * too few patterns for two blocks runs unthreaded. BEAGLE_FLAG_SCALING_AUTO cannot be split
+ * into blocks; such instances do not report BEAGLE_FLAG_THREADING_OPENMP and run unthreaded.
+ *
  * @param instance             Instance number (input)
  * @param threadCount          Number of threads (input)
  *
@@ -429,6 +496,24 @@ BEAGLE_DLLEXPORT int beagleFinalize(void);
 BEAGLE_DLLEXPORT int beagleSetCPUThreadCount(int instance,
                                              int threadCount);
 
+/**
+ * @brief Set the internal memory layout of partials buffers
+ *
+ * This function selects how a native CPU implementation stores partials buffers
+ * (see BeaglePartialsLayouts). The pattern-major layout keeps the rate categories of each
+ * pattern adjacent, which improves locality when many rate categories are used. Existing
+ * buffer contents are converted. Partials passed to or returned from BEAGLE are always
+ * category-major, so the choice is not visible to clients. GPU implementations support
+ * only BEAGLE_PARTIALS_LAYOUT_CATEGORY_MAJOR.
+ *
+ * @param instance             Instance number (input)
+ * @param layout               Partials layout, one of BEAGLE_PARTIALS_LAYOUT_* (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetPartialsLayout(int instance,
+                                             int layout);
+
 /**
  * @brief Set the compact state representation for tip node
  *
@@ -537,6 +622,48 @@ BEAGLE_DLLEXPORT int beagleSetEigenDecomposition(int instance,
                                 const double* inInverseEigenVectors,
                                 const double* inEigenValues);
 
+/**
+ * @brief Set an eigen-decomposition buffer from an infinitesimal rate matrix
+ *
+ * This function eigen-decomposes a rate matrix and copies the decomposition into an instance
+ * buffer, as beagleSetEigenDecomposition would. The most recently used decompositions are cached
+ * per instance, so setting a rate matrix seen recently (e.g., after a rejected proposal) skips the
+ * decomposition, and re-setting the matrix a buffer already holds costs nothing. Complex eigenvalues
+ * require BEAGLE_FLAG_EIGEN_COMPLEX.
+ *
+ * @param instance              Instance number (input)
+ * @param eigenIndex            Index of eigen-decomposition buffer (input)
+ * @param inRateMatrix          Flattened rate matrix (stateCount x stateCount), row-major (input)
+ * @param inStateFrequencies    Equilibrium state frequencies (stateCount) copied into state
+ *                               frequencies buffer eigenIndex (input, NULL implies not set)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetRateMatrix(int instance,
+                                         int eigenIndex,
+                                         const double* inRateMatrix,
+                                         const double* inStateFrequencies);
+
+/**
+ * @brief Compute transition matrices for an eigen-decomposition buffer by uniformization
+ *
+ * This function stores the non-zero entries of an infinitesimal rate matrix in an eigen-decomposition
+ * buffer. beagleUpdateTransitionMatrices then computes exp(Q r t) for this buffer by uniformization,
+ * in O(stateCount^2) memory and O(stateCount * nnz(Q)) time per series term, instead of from an
+ * eigen-decomposition. This makes very large, sparse state spaces feasible. A later
+ * beagleSetEigenDecomposition or beagleSetRateMatrix on the buffer restores eigen-decomposition
+ * behaviour. Not all implementations support this function.
+ *
+ * @param instance              Instance number (input)
+ * @param eigenIndex            Index of eigen-decomposition buffer (input)
+ * @param inRateMatrix          Flattened rate matrix (stateCount x stateCount), row-major (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetUniformizationRateMatrix(int instance,
+                                                       int eigenIndex,
+                                                       const double* inRateMatrix);
+
 /**
  * @brief Set a state frequency buffer
  *
@@ -701,6 +828,45 @@ BEAGLE_DLLEXPORT int beagleTransposeTransitionMatrices(int instance,
                                                        const int* resultIndices,
                                                        int matrixCount);
 
+/**
+ * @brief Calculate epoch-model transition probability matrices
+ *
+ * This function sets the transition probability matrix of each of count branches to the
+ * product, in order, of the matrices of its segments, each segment having its own eigen
+ * decomposition, category rates and length. It replaces a beagleUpdateTransitionMatrices call
+ * per segment followed by repeated beagleConvolveTransitionMatrices calls, and needs no matrix
+ * buffers for the segments.
+ *
+ * Derivatives are with respect to the branch length, with each segment taking a fixed share of
+ * it (a segment of length d in a branch of total length t contributes d / t).
+ *
+ * @param instance                  Instance number (input)
+ * @param segmentCounts             List of numbers of segments of each branch, at least one (input)
+ * @param eigenIndices              List of eigen-decomposition buffer indices of all segments,
+ *                                   branch by branch (input)
+ * @param categoryRateIndices       List of category rate buffer indices of all segments
+ *                                   (input, NULL implies buffer 0)
+ * @param segmentLengths            List of lengths of all segments (input)
+ * @param probabilityIndices        List of indices of transition probability matrices to update
+ *                                   (input)
+ * @param firstDerivativeIndices    List of indices of first derivative matrices to update
+ *                                   (input, NULL implies no calculation)
+ * @param secondDerivativeIndices   List of indices of second derivative matrices to update
+ *                                   (input, NULL implies no calculation; requires first derivatives)
+ * @param count                     Number of branches (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleUpdateEpochTransitionMatrices(int instance,
+                                                         const int* segmentCounts,
+                                                         const int* eigenIndices,
+                                                         const int* categoryRateIndices,
+                                                         const double* segmentLengths,
+                                                         const int* probabilityIndices,
+                                                         const int* firstDerivativeIndices,
+                                                         const int* secondDerivativeIndices,
+                                                         int count);
+
 /**
  * @brief Calculate a list of transition probability matrices
  *
@@ -728,6 +894,42 @@ BEAGLE_DLLEXPORT int beagleUpdateTransitionMatrices(int instance,
                                    const double* edgeLengths,
                                    int count);
 
+/**
+ * @brief Enable or disable memoisation of transition probability matrices
+ *
+ * With memoisation enabled, beagleUpdateTransitionMatrices remembers which buffers hold the
+ * matrices (and derivatives) computed for each eigen-decomposition buffer and edge length. A
+ * later request for the same eigen-decomposition and edge length copies those buffers, or does
+ * nothing when the requested buffers already hold them, instead of recomputing. Entries are
+ * dropped when their buffers are overwritten by any call, the entries of an eigen-decomposition
+ * when it is set again, and all entries when the category rates are set. Enabling or disabling
+ * memoisation clears the table and the counts of beagleGetTransitionMatrixMemoCounts.
+ *
+ * @param instance      Instance number (input)
+ * @param enabled       Non-zero to memoise transition matrices, zero to stop (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetTransitionMatrixMemo(int instance,
+                                                   int enabled);
+
+/**
+ * @brief Get the hit and miss counts of transition matrix memoisation
+ *
+ * This function reports how many of the edges passed to beagleUpdateTransitionMatrices since
+ * memoisation was last enabled were met from memoised buffers (hits) and how many were
+ * computed (misses).
+ *
+ * @param instance      Instance number (input)
+ * @param outHitCount   Pointer to destination for the number of hits (output)
+ * @param outMissCount  Pointer to destination for the number of misses (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleGetTransitionMatrixMemoCounts(int instance,
+                                                         long* outHitCount,
+                                                         long* outMissCount);
+
 /**
  * @brief Calculate a list of transition probability matrices with
  *         each category using a different eigen decompsition
@@ -1235,6 +1437,100 @@ BEAGLE_DLLEXPORT int beagleCalculateCrossProductDerivative(int instance,
                                                   double *outSumDerivatives,
                                                   double *outSumSquaredDerivatives);
 
+/**
+ * @brief Calculate the gradient of the log likelihood with respect to all branch lengths
+ *
+ * This function optionally updates the post-order and then the pre-order partials, and then
+ * returns for each of count edges the derivative of the log likelihood with respect to its
+ * length, and optionally the second derivative (the diagonal of the Hessian). It replaces a
+ * beagleUpdatePartials, beagleUpdatePrePartials and beagleCalculateEdgeDerivatives sequence,
+ * with each edge having its own category weights and rates.
+ *
+ * The pre-order partials of an edge include its transition probability matrix, so that the
+ * differential matrix of an edge is the (transposed) infinitesimal rate matrix Q and the second
+ * differential matrix is Q * Q. If categoryRatesIndices is given, the matrices are scaled by
+ * the category rate r (and r * r for the second) of each category; otherwise each category of
+ * the matrices is taken to be scaled already.
+ *
+ * @param instance                          Instance number (input)
+ * @param postorderOperations               BeagleOperation list of the post-order traversal
+ *                                           (input, NULL if the partials are current)
+ * @param postorderCount                    Number of post-order operations (input)
+ * @param preorderOperations                BeagleOperation list of the pre-order traversal
+ *                                           (input, NULL if the pre-order partials are current)
+ * @param preorderCount                     Number of pre-order operations (input)
+ * @param postBufferIndices                 List of indices of post-order partials or tip states
+ *                                           below each edge (input)
+ * @param preBufferIndices                  List of indices of pre-order partials of each edge (input)
+ * @param differentialMatrixIndices         List of indices of differential matrices of each edge (input)
+ * @param secondDifferentialMatrixIndices   List of indices of second differential matrices of each
+ *                                           edge (input, NULL implies no second derivatives)
+ * @param categoryWeightsIndices            List of category weights indices of each edge (input)
+ * @param categoryRatesIndices              List of category rates indices of each edge (input, NULL
+ *                                           implies the matrices are scaled by the category rates)
+ * @param count                             Number of edges (input)
+ * @param outGradient                       Pointer to destination for the count first derivatives
+ *                                           (output)
+ * @param outDiagonalHessian                Pointer to destination for the count second derivatives
+ *                                           (output, required with secondDifferentialMatrixIndices)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateEdgeGradients(int instance,
+                                                  const BeagleOperation* postorderOperations,
+                                                  int postorderCount,
+                                                  const BeagleOperation* preorderOperations,
+                                                  int preorderCount,
+                                                  const int* postBufferIndices,
+                                                  const int* preBufferIndices,
+                                                  const int* differentialMatrixIndices,
+                                                  const int* secondDifferentialMatrixIndices,
+                                                  const int* categoryWeightsIndices,
+                                                  const int* categoryRatesIndices,
+                                                  int count,
+                                                  double* outGradient,
+                                                  double* outDiagonalHessian);
+
+/**
+ * @brief Calculate the gradient of the log likelihood with respect to rate-matrix parameters
+ *
+ * This function accumulates, for each category c, the cross products
+ *   C_c = sum_edges sum_patterns w_p / L_p * pi_c * r_c * t * pre_c (x) post_c
+ * of the pre-order and post-order partials below each edge of length t, and returns for each
+ * parameter theta the contraction sum_c sum_ij C_c[i][j] * dQ_c/dtheta[i][j]. The derivative
+ * dQ/dtheta of the unscaled rate matrix, one per category, is set into a matrix buffer with
+ * beagleSetDifferentialMatrix. As with beagleCalculateCrossProductDerivative, the gradient is
+ * exact for parameters whose dQ/dtheta commutes with Q and a first-order approximation otherwise.
+ *
+ * The pre-order and post-order partials must be current, as after beagleCalculateEdgeGradients.
+ *
+ * @param instance                  Instance number (input)
+ * @param postBufferIndices         List of indices of post-order partials or tip states below each
+ *                                   edge (input)
+ * @param preBufferIndices          List of indices of pre-order partials of each edge (input)
+ * @param categoryRatesIndices      List of category rates indices of each edge (input, NULL implies
+ *                                   buffer 0)
+ * @param categoryWeightsIndices    List of category weights indices of each edge (input)
+ * @param edgeLengths               List of edge lengths (input)
+ * @param count                     Number of edges (input)
+ * @param differentialMatrixIndices List of indices of the differential matrices of each parameter
+ *                                   (input)
+ * @param parameterCount            Number of parameters (input)
+ * @param outGradients              Pointer to destination for the parameterCount derivatives (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateParameterGradients(int instance,
+                                                       const int* postBufferIndices,
+                                                       const int* preBufferIndices,
+                                                       const int* categoryRatesIndices,
+                                                       const int* categoryWeightsIndices,
+                                                       const double* edgeLengths,
+                                                       int count,
+                                                       const int* differentialMatrixIndices,
+                                                       int parameterCount,
+                                                       double* outGradients);
+
 /**
  * @brief Calculate site log likelihoods and derivatives along an edge
  *
@@ -1332,6 +1628,46 @@ BEAGLE_DLLEXPORT int beagleCalculateEdgeLogLikelihoodsByPartition(
                                                     double* outSumSecondDerivative);
 
 
+/**
+ * @brief Calculate log likelihoods and derivatives along many edges in one call
+ *
+ * This function integrates each (parent, child, transition matrix) triple independently,
+ * returning one log likelihood and, optionally, first and second derivatives per edge.
+ * This differs from beagleCalculateEdgeLogLikelihoods, where count > 1 sums site likelihoods
+ * across a mixture of buffers. Edges and blocks of patterns are evaluated in parallel on
+ * threaded CPU instances. Site log likelihoods are not retained.
+ *
+ * @param instance                  Instance number (input)
+ * @param parentBufferIndices       List of indices of parent partialsBuffers (input)
+ * @param childBufferIndices        List of indices of child partialsBuffers or compactBuffers (input)
+ * @param probabilityIndices        List of indices of transition probability matrices (input)
+ * @param firstDerivativeIndices    List of indices of first derivative matrices, or NULL (input)
+ * @param secondDerivativeIndices   List of indices of second derivative matrices, or NULL (input)
+ * @param categoryWeightsIndices    List of indices of category weights, one per edge (input)
+ * @param stateFrequenciesIndices   List of indices of state frequencies, one per edge (input)
+ * @param cumulativeScaleIndices    List of scaleBuffers containing accumulated factors, one per
+ *                                   edge, or NULL (input)
+ * @param count                     Number of edges (input)
+ * @param outLogLikelihoods         Destination for the log likelihood of each edge (output)
+ * @param outFirstDerivatives       Destination for the first derivative of each edge, or NULL (output)
+ * @param outSecondDerivatives      Destination for the second derivative of each edge, or NULL (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateEdgeLogLikelihoodsPerEdge(int instance,
+                                                             const int* parentBufferIndices,
+                                                             const int* childBufferIndices,
+                                                             const int* probabilityIndices,
+                                                             const int* firstDerivativeIndices,
+                                                             const int* secondDerivativeIndices,
+                                                             const int* categoryWeightsIndices,
+                                                             const int* stateFrequenciesIndices,
+                                                             const int* cumulativeScaleIndices,
+                                                             int count,
+                                                             double* outLogLikelihoods,
+                                                             double* outFirstDerivatives,
+                                                             double* outSecondDerivatives);
+
 /**
  * @brief Returns log likelihood sum and subsequent to an asynchronous integration call.
  *
@@ -1398,6 +1734,71 @@ BEAGLE_DLLEXPORT int beagleGetSiteDerivatives(int instance,
                                     double* outFirstDerivatives,
                                     double* outSecondDerivatives);
 
+/**
+ * @brief Run a whole likelihood evaluation in one call
+ *
+ * This function executes a stream of commands (see @ref BEAGLE_COMMAND_CODES) that would
+ * otherwise be separate beagleUpdateTransitionMatrices, beagleUpdatePartials,
+ * beagleResetScaleFactors, beagleAccumulateScaleFactors, beagleCalculateRootLogLikelihoods and
+ * beagleCalculateEdgeLogLikelihoods calls. The stream is validated before anything runs, and
+ * implementations may merge or reorder commands as long as the results are unchanged.
+ *
+ * The log likelihood is that of the last root or edge command; derivatives are those of the last
+ * edge command with a derivativeOrder of 1 or 2. Outputs not produced by the stream are left
+ * unchanged.
+ *
+ * @param instance                  Instance number (input)
+ * @param commands                  Command stream (input)
+ * @param commandLength             Number of integers in commands (input)
+ * @param values                    Edge lengths consumed in order by transition matrix commands (input)
+ * @param valueCount                Number of doubles in values (input)
+ * @param outSumLogLikelihood       Pointer to destination for resulting log likelihood (output)
+ * @param outSumFirstDerivative     Pointer to destination for resulting first derivative (output)
+ * @param outSumSecondDerivative    Pointer to destination for resulting second derivative (output)
+ *
+ * @return error code; BEAGLE_ERROR_OUT_OF_RANGE if the stream is malformed
+ */
+BEAGLE_DLLEXPORT int beagleEvaluate(int instance,
+                                    const int* commands,
+                                    int commandLength,
+                                    const double* values,
+                                    int valueCount,
+                                    double* outSumLogLikelihood,
+                                    double* outSumFirstDerivative,
+                                    double* outSumSecondDerivative);
+
+/**
+ * @brief Save the state of an instance to a file
+ *
+ * This function writes tip states and partials, partials buffers, scale buffers, transition
+ * matrices, eigen decompositions, category rates and weights, state frequencies, pattern
+ * weights and the site results of the last likelihood calculation as one versioned binary file,
+ * so that a later process can continue from the same point without recomputing them.
+ *
+ * @param instance      Instance number (input)
+ * @param fileName      Path of the file to write (input)
+ *
+ * @return error code; BEAGLE_ERROR_NO_IMPLEMENTATION if the implementation cannot save its state
+ */
+BEAGLE_DLLEXPORT int beagleSaveInstanceState(int instance,
+                                             const char* fileName);
+
+/**
+ * @brief Restore the state of an instance from a file
+ *
+ * This function reads a file written by beagleSaveInstanceState into an instance created with
+ * the same dimensions, flags and implementation as the saved one. The contents of the instance
+ * are undefined if the restore fails after the file header has been accepted.
+ *
+ * @param instance      Instance number (input)
+ * @param fileName      Path of the file to read (input)
+ *
+ * @return error code; BEAGLE_ERROR_OUT_OF_RANGE if the file was saved from a different kind of
+ * instance
+ */
+BEAGLE_DLLEXPORT int beagleRestoreInstanceState(int instance,
+                                                const char* fileName);
+
 /* using C calling conventions so that C programs can successfully link the beagle library
  * (closing brace)
  */
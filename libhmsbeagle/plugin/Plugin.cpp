@@ -8,6 +8,9 @@
 
 #include "libhmsbeagle/plugin/Plugin.h"
 #include <string>
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
 using namespace std;
 
 namespace beagle {
@@ -37,9 +40,21 @@ Plugin* PluginManager::findPlugin(const char* name) noexcept(false)
     delete pi;
     throw SharedLibraryException("plugin_init error");
     }
+#ifndef _WIN32
+    Dl_info info;
+    if (dladdr((void*) pif, &info) && info.dli_fname)
+        pi->m_library_name = info.dli_fname;
+#endif
     m_plugin_map[name]=pi;
     return pi->m_plugin;
 }
 
+std::string PluginManager::findPluginPath(const char* name)
+{
+    if (m_plugin_map.count(name) == 0)
+        return std::string();
+    return m_plugin_map[name]->m_library_name;
+}
+
 }	// namespace plugin
 }	// namespace beagle
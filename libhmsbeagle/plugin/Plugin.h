@@ -57,6 +57,9 @@ class BEAGLE_DLLEXPORT PluginManager
 
       Plugin* findPlugin(const char* name) noexcept(false);
 
+      // File the plugin was loaded from, or an empty string if it is not loaded or unknown
+      std::string findPluginPath(const char* name);
+
     private:
         struct PluginInfo {
         SharedLibrary* m_library;
@@ -0,0 +1,423 @@
+/*
+ *  PluginManifest.cpp
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+#include "libhmsbeagle/platform.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include "libhmsbeagle/plugin/Plugin.h"
+#include "libhmsbeagle/plugin/PluginManifest.h"
+
+#define BEAGLE_PLUGIN_MANIFEST_HEADER   "beagle-plugin-manifest-2"
+
+namespace beagle {
+namespace plugin {
+
+namespace {
+
+long long modificationTime(const std::string& path) {
+#ifndef _WIN32
+    struct stat info;
+    if (!path.empty() && stat(path.c_str(), &info) == 0)
+        return (long long) info.st_mtime;
+#endif
+    return -1;
+}
+
+// resolves symbolic links so that one library is recorded under one name
+std::string canonicalPath(const std::string& path) {
+#ifndef _WIN32
+    char resolved[PATH_MAX];
+    if (!path.empty() && realpath(path.c_str(), resolved) != NULL)
+        return std::string(resolved);
+#endif
+    return path;
+}
+
+std::string directoryOf(const std::string& path) {
+    size_t slash = path.rfind('/');
+    return (slash == std::string::npos ? std::string(".") : path.substr(0, slash));
+}
+
+// the library name UnixSharedLibrary opens for a plugin
+std::string libraryFileName(const std::string& pluginName) {
+    std::string name = "lib" + pluginName;
+#ifdef DLS_MACOS
+    name += "." PLUGIN_VERSION ".so";
+#elif defined(__OpenBSD__) || defined(__NetBSD__)
+    name += ".so." PLUGIN_VERSION ".0";
+#else
+    name += ".so." PLUGIN_VERSION ".0.0";
+#endif
+    return name;
+}
+
+// tabs and line breaks separate manifest fields
+std::string field(const char* text) {
+    std::string s(text != NULL ? text : "");
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '\t' || s[i] == '\n' || s[i] == '\r')
+            s[i] = ' ';
+    }
+    return s;
+}
+
+std::vector<std::string> splitFields(const std::string& line) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (true) {
+        size_t tab = line.find('\t', start);
+        fields.push_back(line.substr(start, tab == std::string::npos ? std::string::npos : tab - start));
+        if (tab == std::string::npos)
+            break;
+        start = tab + 1;
+    }
+    return fields;
+}
+
+// variables that change which plugin libraries the dynamic linker finds or which devices
+// the plugins report
+const char* keyVariables[] = {
+    "LD_LIBRARY_PATH",
+    "DYLD_LIBRARY_PATH",
+    "DYLD_FALLBACK_LIBRARY_PATH",
+    "CUDA_VISIBLE_DEVICES",
+    "GPU_DEVICE_ORDINAL",
+    "ROCR_VISIBLE_DEVICES"
+};
+
+// the file libhmsbeagle itself was loaded from, and the values of keyVariables
+std::string manifestKey() {
+    std::string library;
+#ifndef _WIN32
+    Dl_info info;
+    if (dladdr((void*) &manifestKey, &info) && info.dli_fname)
+        library = canonicalPath(info.dli_fname);
+#endif
+    std::string key = "library\t" + field(library.c_str()) + "\n";
+    for (size_t i = 0; i < sizeof(keyVariables) / sizeof(keyVariables[0]); i++)
+        key += std::string("environment\t") + keyVariables[i] + "\t" + field(getenv(keyVariables[i])) + "\n";
+    return key;
+}
+
+// FNV-1a, to name the default manifest of each key
+std::string keyHash(const std::string& key) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < key.size(); i++) {
+        hash ^= (unsigned char) key[i];
+        hash *= 1099511628211ULL;
+    }
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx", hash);
+    return text;
+}
+
+// default manifests are per host so that a home directory shared across nodes with different
+// hardware does not mix their resources, and per key so that installs do not replace each
+// other's manifest
+std::string defaultPath(const std::string& key) {
+    const char* env = getenv("BEAGLE_PLUGIN_MANIFEST");
+    if (env == NULL || env[0] == '\0' || strcmp(env, "none") == 0)
+        return std::string();
+#ifdef _WIN32
+    return std::string();
+#else
+    if (strcmp(env, "default") != 0)
+        return std::string(env);
+
+    std::string directory;
+    const char* cache = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (cache != NULL && cache[0] != '\0')
+        directory = cache;
+    else if (home != NULL && home[0] != '\0')
+        directory = std::string(home) + "/.cache";
+    else
+        return std::string();
+
+    char host[256];
+    if (gethostname(host, sizeof(host)) != 0)
+        return std::string();
+    host[sizeof(host) - 1] = '\0';
+
+    return directory + "/beagle/plugins-" PLUGIN_VERSION "-" + field(host) + "-" + keyHash(key);
+#endif
+}
+
+} // namespace
+
+PluginDescription describePlugin(const char* pluginName,
+                                 const Plugin* plugin) {
+    PluginDescription description(pluginName);
+    description.available = true;
+    description.libraryPath = canonicalPath(PluginManager::instance().findPluginPath(pluginName));
+    description.libraryTime = modificationTime(description.libraryPath);
+
+    const std::list<BeagleResource>& resources = plugin->getBeagleResources();
+    for (std::list<BeagleResource>::const_iterator it = resources.begin(); it != resources.end(); ++it) {
+        PluginDescription::Resource resource;
+        resource.name = field(it->name);
+        resource.description = field(it->description);
+        resource.supportFlags = it->supportFlags;
+        resource.requiredFlags = it->requiredFlags;
+        description.resources.push_back(resource);
+    }
+
+    const std::list<BeagleImplFactory*>& factories = plugin->getBeagleFactories();
+    for (std::list<BeagleImplFactory*>::const_iterator it = factories.begin(); it != factories.end(); ++it) {
+        PluginDescription::Factory factory;
+        factory.name = field((*it)->getName());
+        factory.flags = (*it)->getFlags();
+        description.factories.push_back(factory);
+    }
+
+    return description;
+}
+
+bool locateUnavailablePlugin(PluginDescription* description,
+                             const std::list<PluginDescription>& plugins) {
+    const std::string fileName = libraryFileName(description->pluginName);
+    description->libraryPath.clear();
+    description->libraryTime = -1;
+    for (std::list<PluginDescription>::const_iterator it = plugins.begin(); it != plugins.end(); ++it) {
+        if (!it->available || it->libraryPath.empty())
+            continue;
+        const std::string candidate = directoryOf(it->libraryPath) + "/" + fileName;
+        if (modificationTime(candidate) != -1)
+            return false;
+        if (description->libraryPath.empty())
+            description->libraryPath = candidate;
+    }
+    return !description->libraryPath.empty();
+}
+
+LazyPluginFactory::LazyPluginFactory(const std::string& pluginName,
+                                     const std::string& libraryPath,
+                                     const std::string& factoryName,
+                                     long flags)
+    : kPluginName(pluginName), kLibraryPath(libraryPath), kFactoryName(factoryName), kFlags(flags),
+      factory(NULL) {
+}
+
+BeagleImplFactory* LazyPluginFactory::findFactory() {
+    if (factory != NULL)
+        return factory;
+
+    PluginManager& pm = PluginManager::instance();
+    try {
+        Plugin* plugin = pm.findPlugin(kPluginName.c_str());
+        const std::list<BeagleImplFactory*>& factories = plugin->getBeagleFactories();
+        for (std::list<BeagleImplFactory*>::const_iterator it = factories.begin();
+             it != factories.end(); ++it) {
+            if ((*it)->getFlags() == kFlags && field((*it)->getName()) == kFactoryName) {
+                factory = *it;
+                break;
+            }
+        }
+    } catch (SharedLibraryException&) {
+    }
+
+    if (factory == NULL || canonicalPath(pm.findPluginPath(kPluginName.c_str())) != kLibraryPath) {
+        // the search path now finds another library than the one described, or none at all
+        PluginManifest manifest;
+        manifest.remove(kPluginName);
+        manifest.write();
+    }
+    return factory;
+}
+
+BeagleImpl* LazyPluginFactory::createImpl(int tipCount,
+                                          int partialsBufferCount,
+                                          int compactBufferCount,
+                                          int stateCount,
+                                          int patternCount,
+                                          int eigenBufferCount,
+                                          int matrixBufferCount,
+                                          int categoryCount,
+                                          int scaleBufferCount,
+                                          int resourceNumber,
+                                          int pluginResourceNumber,
+                                          long preferenceFlags,
+                                          long requirementFlags,
+                                          int* errorCode) {
+    if (findFactory() == NULL) {
+        *errorCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
+        return NULL;
+    }
+    return factory->createImpl(tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                               patternCount, eigenBufferCount, matrixBufferCount, categoryCount,
+                               scaleBufferCount, resourceNumber, pluginResourceNumber,
+                               preferenceFlags, requirementFlags, errorCode);
+}
+
+const char* LazyPluginFactory::getName() {
+    return kFactoryName.c_str();
+}
+
+const long LazyPluginFactory::getFlags() {
+    return kFlags;
+}
+
+PluginManifest::PluginManifest()
+    : key(manifestKey()), path(defaultPath(key)), modified(false) {
+    if (isEnabled())
+        read();
+}
+
+bool PluginManifest::isEnabled() const {
+    return !path.empty();
+}
+
+/*
+ * Reads entries written by write(); a file from another version or key, or with any line that
+ * does not parse, is ignored as a whole.
+ */
+void PluginManifest::read() {
+    std::ifstream in(path.c_str());
+    if (!in)
+        return;
+
+    std::string line;
+    if (!std::getline(in, line) || line != BEAGLE_PLUGIN_MANIFEST_HEADER "\t" PACKAGE_VERSION)
+        return;
+
+    const size_t keyLines = std::count(key.begin(), key.end(), '\n');
+    std::string fileKey;
+    for (size_t i = 0; i < keyLines && std::getline(in, line); i++)
+        fileKey += line + "\n";
+    if (fileKey != key)
+        return;
+
+    std::map<std::string, PluginDescription> parsed;
+    PluginDescription* current = NULL;
+    while (std::getline(in, line)) {
+        std::vector<std::string> f = splitFields(line);
+        if (f[0] == "plugin" && f.size() == 5) {
+            current = &parsed[f[1]];
+            current->pluginName = f[1];
+            current->available = (f[2] == "1");
+            current->libraryTime = atoll(f[3].c_str());
+            current->libraryPath = f[4];
+        } else if (f[0] == "resource" && f.size() == 5 && current != NULL) {
+            PluginDescription::Resource resource;
+            resource.supportFlags = atol(f[1].c_str());
+            resource.requiredFlags = atol(f[2].c_str());
+            resource.name = f[3];
+            resource.description = f[4];
+            current->resources.push_back(resource);
+        } else if (f[0] == "factory" && f.size() == 3 && current != NULL) {
+            PluginDescription::Factory factory;
+            factory.flags = atol(f[1].c_str());
+            factory.name = f[2];
+            current->factories.push_back(factory);
+        } else {
+            return;
+        }
+    }
+
+    entries.swap(parsed);
+}
+
+// an available plugin's library must be unchanged, an unavailable one's still missing
+bool PluginManifest::isCurrent(const PluginDescription& description) const {
+    if (description.libraryPath.empty())
+        return false;
+    const long long time = modificationTime(description.libraryPath);
+    return (description.available ? time != -1 && time == description.libraryTime : time == -1);
+}
+
+const PluginDescription* PluginManifest::find(const std::string& pluginName) const {
+    std::map<std::string, PluginDescription>::const_iterator it = entries.find(pluginName);
+    if (it == entries.end() || !isCurrent(it->second))
+        return NULL;
+    return &it->second;
+}
+
+void PluginManifest::update(const PluginDescription& description) {
+    entries[description.pluginName] = description;
+    modified = true;
+}
+
+void PluginManifest::remove(const std::string& pluginName) {
+    if (entries.erase(pluginName) > 0)
+        modified = true;
+}
+
+void PluginManifest::write() {
+    if (!isEnabled() || !modified)
+        return;
+#ifndef _WIN32
+    // create the cache directories if needed
+    for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1))
+        mkdir(path.substr(0, slash).c_str(), 0755);
+
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%ld", (long) getpid());
+    const std::string temporaryPath = path + suffix;
+#else
+    const std::string temporaryPath = path + ".tmp";
+#endif
+
+    {
+        std::ofstream out(temporaryPath.c_str());
+        if (!out)
+            return;
+
+        out << BEAGLE_PLUGIN_MANIFEST_HEADER "\t" PACKAGE_VERSION "\n" << key;
+        for (std::map<std::string, PluginDescription>::const_iterator it = entries.begin();
+             it != entries.end(); ++it) {
+            const PluginDescription& d = it->second;
+            out << "plugin\t" << d.pluginName << "\t" << (d.available ? 1 : 0) << "\t"
+                << d.libraryTime << "\t" << d.libraryPath << "\n";
+            for (std::list<PluginDescription::Resource>::const_iterator r = d.resources.begin();
+                 r != d.resources.end(); ++r) {
+                out << "resource\t" << r->supportFlags << "\t" << r->requiredFlags << "\t"
+                    << r->name << "\t" << r->description << "\n";
+            }
+            for (std::list<PluginDescription::Factory>::const_iterator f = d.factories.begin();
+                 f != d.factories.end(); ++f) {
+                out << "factory\t" << f->flags << "\t" << f->name << "\n";
+            }
+        }
+        if (!out) {
+            out.close();
+            remove(temporaryPath.c_str());
+            return;
+        }
+    }
+
+    // replace the manifest in one step so that concurrent readers see either version
+    if (rename(temporaryPath.c_str(), path.c_str()) != 0)
+        remove(temporaryPath.c_str());
+
+    modified = false;
+}
+
+} // namespace plugin
+} // namespace beagle
@@ -0,0 +1,152 @@
+/*
+ *  PluginManifest.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+
+#ifndef __beagle_plugin_manifest__
+#define __beagle_plugin_manifest__
+
+#include <list>
+#include <map>
+#include <string>
+
+#include "libhmsbeagle/BeagleImpl.h"
+
+namespace beagle {
+namespace plugin {
+
+class Plugin;
+
+/*
+ * The resources and implementation factories of one plugin, either reported by its
+ * plugin_init or read back from a manifest.
+ */
+struct PluginDescription {
+    PluginDescription(const std::string& name = std::string())
+        : pluginName(name), available(false), libraryTime(-1) {}
+
+    struct Resource {
+        std::string name;
+        std::string description;
+        long supportFlags;
+        long requiredFlags;
+    };
+
+    struct Factory {
+        std::string name;
+        long flags;
+    };
+
+    std::string pluginName;
+    bool available;             // false if the plugin could not be loaded
+    std::string libraryPath;    // file the plugin was loaded from, or where the missing library of
+                                // a plugin that could not be loaded would lie; empty if unknown
+    long long libraryTime;      // modification time of libraryPath, -1 if it does not exist
+    std::list<Resource> resources;
+    std::list<Factory> factories;
+};
+
+// Describes a plugin loaded through the PluginManager.
+PluginDescription describePlugin(const char* pluginName,
+                                 const Plugin* plugin);
+
+/*
+ * Records where the library of a plugin that could not be loaded would lie beside the plugins
+ * that did. Returns false if a library of that name is there, in which case loading failed for
+ * another reason, such as a missing driver, and the plugin should be probed on every start.
+ */
+bool locateUnavailablePlugin(PluginDescription* description,
+                             const std::list<PluginDescription>& plugins);
+
+/*
+ * Stands in for a factory of a plugin that has not been loaded yet. The first createImpl loads
+ * the plugin by name, as beagleLoadPlugins would, and forwards to its factory of the same name
+ * and flags. If the library found is not the one the manifest recorded, the entry is dropped.
+ */
+class LazyPluginFactory : public BeagleImplFactory {
+public:
+    LazyPluginFactory(const std::string& pluginName,
+                      const std::string& libraryPath,
+                      const std::string& factoryName,
+                      long flags);
+
+    virtual BeagleImpl* createImpl(int tipCount,
+                                   int partialsBufferCount,
+                                   int compactBufferCount,
+                                   int stateCount,
+                                   int patternCount,
+                                   int eigenBufferCount,
+                                   int matrixBufferCount,
+                                   int categoryCount,
+                                   int scaleBufferCount,
+                                   int resourceNumber,
+                                   int pluginResourceNumber,
+                                   long preferenceFlags,
+                                   long requirementFlags,
+                                   int* errorCode);
+
+    virtual const char* getName();
+
+    virtual const long getFlags();
+
+private:
+    BeagleImplFactory* findFactory();
+
+    std::string kPluginName;
+    std::string kLibraryPath;
+    std::string kFactoryName;
+    long kFlags;
+    BeagleImplFactory* factory;
+};
+
+/*
+ * A text file caching the description of each plugin, so that later processes can list
+ * resources and rank implementations without loading any plugin. It is only used if
+ * BEAGLE_PLUGIN_MANIFEST names the file, or is "default" for beagle/plugins-<plugin version>-
+ * <host name>-<key hash> under $XDG_CACHE_HOME or $HOME/.cache; it is not supported on Windows.
+ *
+ * The file is keyed on the location of libhmsbeagle and on the variables that change which
+ * libraries or devices the plugins find, and is ignored when any of them differ. An entry is
+ * used while its library keeps the modification time it had when the entry was written, and
+ * an unavailable plugin is recorded only while its library is missing. Plugins that enumerate
+ * devices through a driver are not cached by the caller; removing the file rebuilds it.
+ */
+class PluginManifest {
+public:
+    PluginManifest();
+
+    bool isEnabled() const;
+
+    // the cached description of a plugin, or NULL if there is none or it is out of date
+    const PluginDescription* find(const std::string& pluginName) const;
+
+    void update(const PluginDescription& description);
+
+    void remove(const std::string& pluginName);
+
+    // writes the manifest back if any entry was updated; failures are ignored
+    void write();
+
+private:
+    void read();
+
+    bool isCurrent(const PluginDescription& description) const;
+
+    std::string key;            // header lines identifying the library and search environment
+    std::string path;
+    std::map<std::string, PluginDescription> entries;
+    bool modified;
+};
+
+} // namespace plugin
+} // namespace beagle
+
+#endif // __beagle_plugin_manifest__